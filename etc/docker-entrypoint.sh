@@ -31,6 +31,17 @@ fi
 
 ################################################################################
 
+# Private X server for display_backend x11, so the host's X server and
+# `xhost +` are not needed. Rendering uses Mesa (llvmpipe without a GPU).
+if [ "${XVFB:-0}" = '1' ]; then
+	Xvfb :99 -screen 0 1280x720x24 -nolisten tcp &
+	export DISPLAY=:99
+	for i in $(seq 50); do
+		[ -e /tmp/.X11-unix/X99 ] && break
+		sleep 0.1
+	done
+fi
+
 # Run from OBS's directory. Core dumps will be located there.
 echo "OBS_INSTALL_PATH: $OBS_INSTALL_PATH"
 cd ${OBS_INSTALL_PATH}/bin/64bit/
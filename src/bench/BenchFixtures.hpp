@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <jansson.h>
+#include "../lib/Settings.hpp"
+
+/**
+ * @file
+ * @brief Settings and shows shared by the benchmarks.
+ *
+ */
+
+// Settings of a 1080p30 program with a cut transition, encoded in software.
+inline Settings benchSettings() {
+	Settings settings;
+	settings.transition_type = "cut_transition";
+	settings.transition_delay_sec = 0;
+	settings.transition_duration_ms = 0;
+	settings.video_hw_decode = false;
+	settings.video_hw_encode = false;
+	settings.video_gpu_conversion = true;
+	settings.video_bitrate_kbps = 6000;
+	settings.video_keyint_sec = 2;
+	settings.video_rate_control = "CBR";
+	settings.video_width = 1920;
+	settings.video_height = 1080;
+	settings.video_fps_num = 30;
+	settings.video_fps_den = 1;
+	settings.audio_sample_rate = 48000;
+	settings.audio_bitrate_kbps = 160;
+	return settings;
+}
+
+// Builds the json of a show with the given number of RTMP sources, in the
+// format of etc/shows/*.json. If shared, half of the sources read one input,
+// otherwise each source has its own. The caller owns the reference.
+inline json_t* buildShowJson(int64_t sources, int64_t sources_per_scene, bool shared) {
+	json_t* json_show = json_object();
+	json_object_set_new(json_show, "name", json_string("bench"));
+
+	json_t* json_scenes = json_array();
+	for(int64_t i = 0; i < sources; i += sources_per_scene) {
+		json_t* json_scene = json_object();
+		json_object_set_new(json_scene, "name", json_string(("scene " + std::to_string(i / sources_per_scene)).c_str()));
+
+		json_t* json_sources = json_array();
+		for(int64_t j = i; j < sources && j < i + sources_per_scene; j++) {
+			std::string url = (shared && j % 2) ? "rtmp://localhost/shared" : "rtmp://localhost/source" + std::to_string(j);
+			json_t* json_source = json_object();
+			json_object_set_new(json_source, "name", json_string(("source " + std::to_string(j)).c_str()));
+			json_object_set_new(json_source, "type", json_string("RTMP"));
+			json_object_set_new(json_source, "url", json_string(url.c_str()));
+			json_array_append_new(json_sources, json_source);
+		}
+		json_object_set_new(json_scene, "sources", json_sources);
+		json_array_append_new(json_scenes, json_scene);
+	}
+	json_object_set_new(json_show, "scenes", json_scenes);
+	return json_show;
+}
@@ -0,0 +1,761 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "obs.h"
+#include <util/platform.h>
+#include "../lib/NativeDisplay.hpp"
+#include "ObsStub.hpp"
+
+/**
+ * @file
+ * @brief In-memory stand-in for the libobs functions used by Studio, Output,
+ * Show, Scene, Source, SourceRegistry and InputWatchdog.
+ *
+ * The benchmarks are linked with this file instead of libobs, so the studio
+ * can be exercised without a GPU, a display or the obs modules. Only the libobs
+ * headers are needed. Objects are plain structs with the bookkeeping libobs
+ * does on the control path (names, settings, scene items, references), but no
+ * rendering, decoding nor encoding. Only the output signals are emitted, on
+ * the calling thread.
+ *
+ */
+
+struct obs_data {
+	long refs;
+	std::map<std::string, std::string> strings;
+	std::map<std::string, long long> ints;
+	std::map<std::string, bool> bools;
+};
+
+struct signal_handler {
+	struct Connection {
+		std::string signal;
+		signal_callback_t callback;
+		void* data;
+	};
+	std::vector<Connection> connections;
+};
+
+struct obs_source {
+	long refs;
+	std::string id;
+	std::string name;
+	obs_data_t* settings;
+	signal_handler_t signals;
+	// Transitions only
+	obs_source_t* transition_target;
+	// Scenes only, a scene is a source in libobs
+	obs_scene_t* scene;
+};
+
+struct obs_scene_item {
+	obs_scene_t* scene;
+	obs_source_t* source;
+	enum obs_bounds_type bounds_type;
+	struct vec2 bounds;
+	uint32_t bounds_alignment;
+	bool visible;
+};
+
+struct obs_scene {
+	obs_source_t source;
+	std::vector<obs_sceneitem_t*> items;
+};
+
+struct video_output {
+	uint32_t total_frames;
+	uint32_t skipped_frames;
+};
+
+struct audio_output {
+};
+
+struct obs_encoder {
+	long refs;
+	std::string id;
+	std::string name;
+	obs_data_t* settings;
+	video_t* video;
+	audio_t* audio;
+};
+
+struct obs_service {
+	long refs;
+	obs_data_t* settings;
+};
+
+struct obs_output {
+	long refs;
+	std::string id;
+	std::string name;
+	obs_data_t* settings;
+	signal_handler_t signals;
+	bool active;
+	// ffmpeg_muxer only, numbers the segment files
+	int segment;
+};
+
+// Arguments of an emitted signal, pointed to by the stack of its calldata
+struct stub_calldata {
+	std::map<std::string, std::vector<uint8_t>> data;
+	std::map<std::string, std::string> strings;
+};
+
+static video_t stub_video = {};
+static audio_t stub_audio = {};
+static bool stub_initialized = false;
+static std::atomic<int64_t> stub_source_create_delay_us(0);
+
+// Started outputs, for ObsStubSplitFiles
+static std::mutex stub_outputs_mtx;
+static std::set<obs_output_t*> stub_active_outputs;
+
+///////////////////////////////////////
+// DATA                              //
+///////////////////////////////////////
+
+obs_data_t* obs_data_create() {
+	obs_data_t* data = new obs_data();
+	data->refs = 1;
+	return data;
+}
+
+void obs_data_release(obs_data_t* data) {
+	if(data && --data->refs == 0) {
+		delete data;
+	}
+}
+
+void obs_data_set_string(obs_data_t* data, const char* name, const char* val) {
+	data->strings[name] = val ? val : "";
+}
+
+void obs_data_set_int(obs_data_t* data, const char* name, long long val) {
+	data->ints[name] = val;
+}
+
+void obs_data_set_bool(obs_data_t* data, const char* name, bool val) {
+	data->bools[name] = val;
+}
+
+///////////////////////////////////////
+// SIGNALS                           //
+///////////////////////////////////////
+
+void signal_handler_connect(signal_handler_t* handler, const char* signal, signal_callback_t callback, void* data) {
+	handler->connections.push_back({signal, callback, data});
+}
+
+void signal_handler_disconnect(signal_handler_t* handler, const char* signal, signal_callback_t callback, void* data) {
+	for(auto it = handler->connections.begin(); it != handler->connections.end(); it++) {
+		if(it->signal == signal && it->callback == callback && it->data == data) {
+			handler->connections.erase(it);
+			return;
+		}
+	}
+}
+
+// Only the signals of the outputs are emitted, with a stub_calldata.
+bool calldata_get_data(const calldata_t* data, const char* name, void* out, size_t size) {
+	stub_calldata* args = data ? (stub_calldata*) data->stack : nullptr;
+	if(!args) {
+		return false;
+	}
+	auto it = args->data.find(name);
+	if(it == args->data.end() || it->second.size() != size) {
+		return false;
+	}
+	memcpy(out, it->second.data(), size);
+	return true;
+}
+
+bool calldata_get_string(const calldata_t* data, const char* name, const char** str) {
+	stub_calldata* args = data ? (stub_calldata*) data->stack : nullptr;
+	if(!args) {
+		return false;
+	}
+	auto it = args->strings.find(name);
+	if(it == args->strings.end()) {
+		return false;
+	}
+	*str = it->second.c_str();
+	return true;
+}
+
+static void stub_calldata_set_int(stub_calldata* args, const char* name, long long val) {
+	std::vector<uint8_t>& bytes = args->data[name];
+	bytes.resize(sizeof(val));
+	memcpy(bytes.data(), &val, sizeof(val));
+}
+
+// Calls the callbacks connected to signal, on the calling thread.
+static void stub_signal_emit(signal_handler_t* handler, const char* signal, stub_calldata* args) {
+	calldata_t cd = {};
+	cd.stack = (uint8_t*) args;
+	// A callback may disconnect
+	std::vector<signal_handler::Connection> connections = handler->connections;
+	for(signal_handler::Connection& connection : connections) {
+		if(connection.signal == signal) {
+			connection.callback(connection.data, &cd);
+		}
+	}
+}
+
+///////////////////////////////////////
+// SOURCES                           //
+///////////////////////////////////////
+
+obs_source_t* obs_source_create(const char* id, const char* name, obs_data_t* settings, obs_data_t* hotkey_data) {
+	// Stands for the time libobs takes to open an input
+	int64_t delay_us = stub_source_create_delay_us;
+	if(delay_us > 0 && !strcmp(id, "ffmpeg_source")) {
+		std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+	}
+
+	obs_source_t* source = new obs_source();
+	source->refs = 1;
+	source->id = id;
+	source->name = name;
+	source->settings = obs_data_create();
+	if(settings) {
+		source->settings->strings = settings->strings;
+		source->settings->ints = settings->ints;
+		source->settings->bools = settings->bools;
+	}
+	source->transition_target = nullptr;
+	source->scene = nullptr;
+	return source;
+}
+
+obs_source_t* obs_source_get_ref(obs_source_t* source) {
+	if(source) {
+		source->refs++;
+	}
+	return source;
+}
+
+void obs_source_update(obs_source_t* source, obs_data_t* settings) {
+	for(auto & it : settings->strings) {
+		source->settings->strings[it.first] = it.second;
+	}
+	for(auto & it : settings->ints) {
+		source->settings->ints[it.first] = it.second;
+	}
+	for(auto & it : settings->bools) {
+		source->settings->bools[it.first] = it.second;
+	}
+}
+
+void obs_source_release(obs_source_t* source) {
+	if(!source || --source->refs > 0) {
+		return;
+	}
+	if(source->transition_target) {
+		obs_source_release(source->transition_target);
+	}
+	obs_data_release(source->settings);
+	if(source->scene) {
+		// Embedded in the scene
+		for(obs_sceneitem_t* item : source->scene->items) {
+			obs_source_release(item->source);
+			delete item;
+		}
+		delete source->scene;
+		return;
+	}
+	delete source;
+}
+
+const char* obs_source_get_name(const obs_source_t* source) {
+	return source ? source->name.c_str() : nullptr;
+}
+
+const char* obs_source_get_id(const obs_source_t* source) {
+	return source ? source->id.c_str() : nullptr;
+}
+
+signal_handler_t* obs_source_get_signal_handler(const obs_source_t* source) {
+	return source ? const_cast<signal_handler_t*>(&source->signals) : nullptr;
+}
+
+bool obs_source_active(const obs_source_t* source) {
+	return false;
+}
+
+bool obs_source_showing(const obs_source_t* source) {
+	return false;
+}
+
+uint32_t obs_source_get_width(obs_source_t* source) {
+	return 0;
+}
+
+uint32_t obs_source_get_height(obs_source_t* source) {
+	return 0;
+}
+
+///////////////////////////////////////
+// TRANSITIONS                       //
+///////////////////////////////////////
+
+void obs_transition_set(obs_source_t* transition, obs_source_t* source) {
+	if(source) {
+		source->refs++;
+	}
+	if(transition->transition_target) {
+		obs_source_release(transition->transition_target);
+	}
+	transition->transition_target = source;
+}
+
+void obs_transition_clear(obs_source_t* transition) {
+	obs_transition_set(transition, nullptr);
+}
+
+// Switches at once: there is no render loop to run the transition.
+bool obs_transition_start(obs_source_t* transition, enum obs_transition_mode mode, uint32_t duration_ms, obs_source_t* dest) {
+	obs_transition_set(transition, dest);
+	return true;
+}
+
+///////////////////////////////////////
+// SCENES                            //
+///////////////////////////////////////
+
+obs_scene_t* obs_scene_create(const char* name) {
+	obs_scene_t* scene = new obs_scene();
+	scene->source.refs = 1;
+	scene->source.id = "scene";
+	scene->source.name = name;
+	scene->source.settings = obs_data_create();
+	scene->source.transition_target = nullptr;
+	scene->source.scene = scene;
+	return scene;
+}
+
+void obs_scene_release(obs_scene_t* scene) {
+	if(scene) {
+		obs_source_release(&scene->source);
+	}
+}
+
+obs_source_t* obs_scene_get_source(const obs_scene_t* scene) {
+	return scene ? const_cast<obs_source_t*>(&scene->source) : nullptr;
+}
+
+obs_sceneitem_t* obs_scene_add(obs_scene_t* scene, obs_source_t* source) {
+	if(!scene || !source) {
+		return nullptr;
+	}
+	obs_sceneitem_t* item = new obs_scene_item();
+	source->refs++;
+	item->scene = scene;
+	item->source = source;
+	item->bounds_type = OBS_BOUNDS_NONE;
+	item->bounds = {};
+	item->bounds_alignment = 0;
+	item->visible = true;
+	scene->items.push_back(item);
+	return item;
+}
+
+obs_sceneitem_t* obs_scene_find_source(obs_scene_t* scene, const char* name) {
+	for(obs_sceneitem_t* item : scene->items) {
+		if(item->source->name == name) {
+			return item;
+		}
+	}
+	return nullptr;
+}
+
+void obs_sceneitem_remove(obs_sceneitem_t* item) {
+	std::vector<obs_sceneitem_t*>& items = item->scene->items;
+	items.erase(std::find(items.begin(), items.end(), item));
+	obs_source_release(item->source);
+	delete item;
+}
+
+void obs_sceneitem_set_order(obs_sceneitem_t* item, enum obs_order_movement movement) {
+}
+
+int obs_sceneitem_get_order_position(obs_sceneitem_t* item) {
+	std::vector<obs_sceneitem_t*>& items = item->scene->items;
+	return std::find(items.begin(), items.end(), item) - items.begin();
+}
+
+void obs_sceneitem_set_order_position(obs_sceneitem_t* item, int position) {
+	std::vector<obs_sceneitem_t*>& items = item->scene->items;
+	items.erase(std::find(items.begin(), items.end(), item));
+	position = std::max(0, std::min(position, (int)items.size()));
+	items.insert(items.begin() + position, item);
+}
+
+void obs_sceneitem_set_bounds_type(obs_sceneitem_t* item, enum obs_bounds_type type) {
+	item->bounds_type = type;
+}
+
+void obs_sceneitem_set_bounds_alignment(obs_sceneitem_t* item, uint32_t alignment) {
+	item->bounds_alignment = alignment;
+}
+
+void obs_sceneitem_set_bounds(obs_sceneitem_t* item, const struct vec2* bounds) {
+	item->bounds = *bounds;
+}
+
+void obs_sceneitem_set_visible(obs_sceneitem_t* item, bool visible) {
+	item->visible = visible;
+}
+
+///////////////////////////////////////
+// MEDIA                             //
+///////////////////////////////////////
+
+// Inputs never play: the benchmarks don't start the input watchdog.
+void obs_source_add_audio_capture_callback(obs_source_t* source, obs_source_audio_capture_t callback, void* param) {
+}
+
+void obs_source_remove_audio_capture_callback(obs_source_t* source, obs_source_audio_capture_t callback, void* param) {
+}
+
+enum obs_media_state obs_source_media_get_state(obs_source_t* source) {
+	return OBS_MEDIA_STATE_NONE;
+}
+
+int64_t obs_source_media_get_time(obs_source_t* source) {
+	return 0;
+}
+
+void obs_source_media_restart(obs_source_t* source) {
+}
+
+///////////////////////////////////////
+// CORE                              //
+///////////////////////////////////////
+
+// No module is loaded: every source, encoder and output id is accepted.
+bool obs_startup(const char* locale, const char* module_config_path, profiler_name_store_t* store) {
+	stub_initialized = true;
+	return true;
+}
+
+bool obs_initialized(void) {
+	return stub_initialized;
+}
+
+void obs_shutdown(void) {
+	stub_initialized = false;
+}
+
+int obs_reset_video(struct obs_video_info* ovi) {
+	return OBS_VIDEO_SUCCESS;
+}
+
+bool obs_reset_audio(const struct obs_audio_info* oai) {
+	return true;
+}
+
+int obs_open_module(obs_module_t** module, const char* path, const char* data_path) {
+	*module = nullptr;
+	return MODULE_SUCCESS;
+}
+
+bool obs_init_module(obs_module_t* module) {
+	return true;
+}
+
+void obs_post_load_modules(void) {
+}
+
+video_t* obs_get_video(void) {
+	return &stub_video;
+}
+
+audio_t* obs_get_audio(void) {
+	return &stub_audio;
+}
+
+void obs_set_output_source(uint32_t channel, obs_source_t* source) {
+}
+
+// Nothing is rendered, the frame counters stay at 0.
+uint32_t obs_get_total_frames(void) {
+	return 0;
+}
+
+uint32_t obs_get_lagged_frames(void) {
+	return 0;
+}
+
+uint64_t obs_get_average_frame_time_ns(void) {
+	return 0;
+}
+
+uint32_t video_output_get_total_frames(const video_t* video) {
+	return video ? video->total_frames : 0;
+}
+
+uint32_t video_output_get_skipped_frames(const video_t* video) {
+	return video ? video->skipped_frames : 0;
+}
+
+bool NativeDisplaySupported(const std::string& backend) {
+	return true;
+}
+
+std::string NativeDisplayOpen(const std::string& backend) {
+	return "";
+}
+
+void NativeDisplayClose() {
+}
+
+int os_mkdirs(const char* path) {
+	std::error_code ec;
+	if(std::filesystem::is_directory(path, ec)) {
+		return MKDIR_EXISTS;
+	}
+	return std::filesystem::create_directories(path, ec) ? MKDIR_SUCCESS : MKDIR_ERROR;
+}
+
+// Numbered rather than dated, so that two files of the same second differ.
+char* os_generate_formatted_filename(const char* extension, bool space, const char* format) {
+	static std::atomic<int> counter(0);
+	std::string filename = "stub_"+ std::to_string(counter++) +"."+ extension;
+	return strdup(filename.c_str());
+}
+
+void bfree(void* ptr) {
+	free(ptr);
+}
+
+///////////////////////////////////////
+// ENCODERS                          //
+///////////////////////////////////////
+
+static obs_encoder_t* stub_encoder_create(const char* id, const char* name, obs_data_t* settings) {
+	obs_encoder_t* encoder = new obs_encoder();
+	encoder->refs = 1;
+	encoder->id = id;
+	encoder->name = name;
+	encoder->settings = obs_data_create();
+	if(settings) {
+		obs_encoder_update(encoder, settings);
+	}
+	encoder->video = nullptr;
+	encoder->audio = nullptr;
+	return encoder;
+}
+
+obs_encoder_t* obs_video_encoder_create(const char* id, const char* name, obs_data_t* settings, obs_data_t* hotkey_data) {
+	return stub_encoder_create(id, name, settings);
+}
+
+obs_encoder_t* obs_audio_encoder_create(const char* id, const char* name, obs_data_t* settings, size_t mixer_idx, obs_data_t* hotkey_data) {
+	return stub_encoder_create(id, name, settings);
+}
+
+void obs_encoder_release(obs_encoder_t* encoder) {
+	if(!encoder || --encoder->refs > 0) {
+		return;
+	}
+	obs_data_release(encoder->settings);
+	delete encoder;
+}
+
+void obs_encoder_update(obs_encoder_t* encoder, obs_data_t* settings) {
+	if(settings != encoder->settings) {
+		encoder->settings->strings.insert(settings->strings.begin(), settings->strings.end());
+		encoder->settings->ints.insert(settings->ints.begin(), settings->ints.end());
+		encoder->settings->bools.insert(settings->bools.begin(), settings->bools.end());
+	}
+}
+
+obs_data_t* obs_encoder_get_settings(const obs_encoder_t* encoder) {
+	encoder->settings->refs++;
+	return encoder->settings;
+}
+
+void obs_encoder_set_scaled_size(obs_encoder_t* encoder, uint32_t width, uint32_t height) {
+}
+
+void obs_encoder_set_video(obs_encoder_t* encoder, video_t* video) {
+	encoder->video = video;
+}
+
+void obs_encoder_set_audio(obs_encoder_t* encoder, audio_t* audio) {
+	encoder->audio = audio;
+}
+
+video_t* obs_encoder_video(const obs_encoder_t* encoder) {
+	return encoder ? encoder->video : nullptr;
+}
+
+bool obs_encoder_active(const obs_encoder_t* encoder) {
+	return false;
+}
+
+///////////////////////////////////////
+// OUTPUTS                           //
+///////////////////////////////////////
+
+obs_service_t* obs_service_create(const char* id, const char* name, obs_data_t* settings, obs_data_t* hotkey_data) {
+	obs_service_t* service = new obs_service();
+	service->refs = 1;
+	service->settings = obs_data_create();
+	return service;
+}
+
+void obs_service_release(obs_service_t* service) {
+	if(!service || --service->refs > 0) {
+		return;
+	}
+	obs_data_release(service->settings);
+	delete service;
+}
+
+obs_output_t* obs_output_create(const char* id, const char* name, obs_data_t* settings, obs_data_t* hotkey_data) {
+	obs_output_t* output = new obs_output();
+	output->refs = 1;
+	output->id = id;
+	output->name = name;
+	output->settings = obs_data_create();
+	if(settings) {
+		output->settings->strings = settings->strings;
+		output->settings->ints = settings->ints;
+		output->settings->bools = settings->bools;
+	}
+	output->active = false;
+	output->segment = 0;
+	return output;
+}
+
+void obs_output_release(obs_output_t* output) {
+	if(!output || --output->refs > 0) {
+		return;
+	}
+	std::unique_lock<std::mutex> lock(stub_outputs_mtx);
+	stub_active_outputs.erase(output);
+	lock.unlock();
+
+	obs_data_release(output->settings);
+	delete output;
+}
+
+// Writes a few bytes to path, standing in for the muxer.
+static bool stub_write_file(const std::string& path) {
+	std::ofstream file(path, std::ios::binary);
+	file << "stub segment";
+	return file.good();
+}
+
+// An rtmp_output is active at once, there is no server to connect to. An
+// ffmpeg_muxer creates its file.
+bool obs_output_start(obs_output_t* output) {
+	if(output->id == "ffmpeg_muxer" && !stub_write_file(output->settings->strings["path"])) {
+		return false;
+	}
+	output->active = true;
+	std::unique_lock<std::mutex> lock(stub_outputs_mtx);
+	stub_active_outputs.insert(output);
+	return true;
+}
+
+void obs_output_stop(obs_output_t* output) {
+	std::unique_lock<std::mutex> lock(stub_outputs_mtx);
+	stub_active_outputs.erase(output);
+	lock.unlock();
+
+	output->active = false;
+	stub_calldata args;
+	stub_calldata_set_int(&args, "code", OBS_OUTPUT_SUCCESS);
+	stub_signal_emit(&output->signals, "stop", &args);
+}
+
+void obs_output_force_stop(obs_output_t* output) {
+	obs_output_stop(output);
+}
+
+bool obs_output_active(const obs_output_t* output) {
+	return output->active;
+}
+
+void obs_output_set_video_encoder(obs_output_t* output, obs_encoder_t* encoder) {
+}
+
+void obs_output_set_audio_encoder(obs_output_t* output, obs_encoder_t* encoder, size_t idx) {
+}
+
+void obs_output_set_service(obs_output_t* output, obs_service_t* service) {
+}
+
+void obs_output_set_reconnect_settings(obs_output_t* output, int retry_count, int retry_sec) {
+}
+
+signal_handler_t* obs_output_get_signal_handler(const obs_output_t* output) {
+	return output ? const_cast<signal_handler_t*>(&output->signals) : nullptr;
+}
+
+const char* obs_output_get_last_error(obs_output_t* output) {
+	return nullptr;
+}
+
+uint64_t obs_output_get_total_bytes(const obs_output_t* output) {
+	return 0;
+}
+
+int obs_output_get_total_frames(const obs_output_t* output) {
+	return 0;
+}
+
+int obs_output_get_frames_dropped(const obs_output_t* output) {
+	return 0;
+}
+
+float obs_output_get_congestion(obs_output_t* output) {
+	return 0;
+}
+
+int obs_output_get_connect_time_ms(obs_output_t* output) {
+	return 0;
+}
+
+///////////////////////////////////////
+// TEST HOOKS                        //
+///////////////////////////////////////
+
+void ObsStubSetSourceCreateDelay(std::chrono::microseconds delay) {
+	stub_source_create_delay_us = delay.count();
+}
+
+int ObsStubSplitFiles() {
+	std::unique_lock<std::mutex> lock(stub_outputs_mtx);
+	std::vector<obs_output_t*> outputs(stub_active_outputs.begin(), stub_active_outputs.end());
+	lock.unlock();
+
+	int split = 0;
+	for(obs_output_t* output : outputs) {
+		if(output->id != "ffmpeg_muxer" || output->settings->ints["max_time_sec"] <= 0) {
+			continue;
+		}
+		std::string next_file = output->settings->strings["directory"] +"/stub_segment_"+ output->name +"_"+
+			std::to_string(++output->segment) +"."+ output->settings->strings["extension"];
+		if(!stub_write_file(next_file)) {
+			continue;
+		}
+
+		stub_calldata args;
+		args.strings["next_file"] = next_file;
+		stub_signal_emit(&output->signals, "file_changed", &args);
+		split++;
+	}
+	return split;
+}
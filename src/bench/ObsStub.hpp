@@ -0,0 +1,21 @@
+#pragma once
+
+#include <chrono>
+
+/**
+ * @file
+ * @brief Hooks of bench/ObsStub.cpp, standing in for what libobs does on its
+ * own threads.
+ *
+ */
+
+// Makes obs_source_create sleep for delay when opening an ffmpeg_source, as
+// libobs does while it connects to and probes the input. 0 by default.
+void ObsStubSetSourceCreateDelay(std::chrono::microseconds delay);
+
+// Starts a new segment in each started ffmpeg_muxer output with a
+// max_time_sec, as the muxer does once the segment duration is reached: the
+// next file is created and file_changed emitted.
+//
+// @return  the number of segments started.
+int ObsStubSplitFiles();
@@ -0,0 +1,325 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <jansson.h>
+#include "../lib/Studio.hpp"
+#include "BenchFixtures.hpp"
+#include "ObsStub.hpp"
+
+/**
+ * @file
+ * @brief Benchmarks of the Studio service, served by an in-process gRPC server
+ * on the libobs stub (bench/ObsStub.cpp).
+ *
+ * The calls go through gRPC as for a remote client, so they measure the
+ * snapshot reads, the worker pool and its back-pressure. Opening an input is
+ * made to take BENCH_SOURCE_OPEN_US, as libobs does while it connects, so that
+ * a scene switch holds the studio lock for a realistic time.
+ *
+ */
+
+#define BENCH_SCENES 4
+#define BENCH_SOURCE_OPEN_US 1000
+
+static Settings benchStudioSettings() {
+	Settings settings = benchSettings();
+	settings.server = "rtmp://localhost/live";
+	settings.key = "bench";
+	// No thread polls the stub inputs, which never play
+	settings.input_stall_ms = 0;
+	return settings;
+}
+
+// Number of threads of the process, from /proc/self/status.
+static int benchThreadCount() {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while(std::getline(status, line)) {
+		if(line.rfind("Threads:", 0) == 0) {
+			return std::stoi(line.substr(8));
+		}
+	}
+	return 0;
+}
+
+// Value below which the given fraction of the sorted samples are.
+static double benchPercentile(const std::vector<double>& sorted, double fraction) {
+	if(sorted.empty()) {
+		return 0;
+	}
+	return sorted[std::min(sorted.size() - 1, (size_t) (fraction * sorted.size()))];
+}
+
+// A started Studio with one show of BENCH_SCENES scenes, served in-process.
+// Each scene has its own inputs, so a switch opens all the inputs of the next
+// scene under the studio lock.
+class BenchStudio {
+public:
+	BenchStudio(int sources_per_scene, int worker_threads, int max_queued)
+		: dir(std::filesystem::temp_directory_path() / ("obs_headless_bench_"+ std::to_string(getpid()))) {
+		settings = benchStudioSettings();
+		settings.grpc_worker_threads = worker_threads;
+		settings.grpc_max_queued_requests = max_queued;
+		std::filesystem::remove_all(dir);
+		std::filesystem::create_directories(dir);
+
+		studio = new Studio(&settings);
+		grpc::Status s = studio->EngineInit();
+		if(!s.ok()) {
+			error = "EngineInit failed: "+ s.error_message();
+			return;
+		}
+
+		grpc::ServerBuilder builder;
+		builder.RegisterService(studio);
+		std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> interceptors;
+		interceptors.push_back(std::make_unique<MetricsInterceptorFactory>(studio->RpcMetrics()));
+		builder.experimental().SetInterceptorCreators(std::move(interceptors));
+		server = builder.BuildAndStart();
+		stub = proto::Studio::NewStub(server->InProcessChannel(grpc::ChannelArguments()));
+
+		std::string show_path = (dir / "show.json").string();
+		json_t* json_show = buildShowJson(BENCH_SCENES * sources_per_scene, sources_per_scene, false);
+		json_dump_file(json_show, show_path.c_str(), 0);
+		json_decref(json_show);
+
+		grpc::ClientContext load_ctx;
+		proto::ShowLoadRequest load_req;
+		proto::ShowLoadResponse load_rep;
+		load_req.set_show_path(show_path);
+		s = stub->ShowLoad(&load_ctx, load_req, &load_rep);
+		if(!s.ok()) {
+			error = "ShowLoad failed: "+ s.error_message();
+			return;
+		}
+		show_id = load_rep.show().id();
+		for(const proto::Scene& scene : load_rep.show().scenes()) {
+			scene_ids.push_back(scene.id());
+		}
+
+		grpc::ClientContext start_ctx;
+		google::protobuf::Empty empty;
+		s = stub->StudioStart(&start_ctx, empty, &empty);
+		if(!s.ok()) {
+			error = "StudioStart failed: "+ s.error_message();
+		}
+	}
+
+	~BenchStudio() {
+		if(server) {
+			server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+		}
+		delete studio;
+		std::filesystem::remove_all(dir);
+	}
+
+	// Switches the show to its scene number i modulo BENCH_SCENES.
+	grpc::Status SwitchScene(int i) {
+		grpc::ClientContext ctx;
+		proto::SceneSetAsCurrentRequest req;
+		proto::SceneSetAsCurrentResponse rep;
+		req.set_show_id(show_id);
+		req.set_scene_id(scene_ids[i % scene_ids.size()]);
+		return stub->SceneSetAsCurrent(&ctx, req, &rep);
+	}
+
+	Settings settings;
+	Studio* studio;
+	std::unique_ptr<grpc::Server> server;
+	std::unique_ptr<proto::Studio::Stub> stub;
+	std::filesystem::path dir;
+	std::string show_id;
+	std::vector<std::string> scene_ids;
+	// Set if the studio could not be set up
+	std::string error;
+};
+
+// Latency of StudioGet while another client switches scenes in a loop (Arg 1)
+// or not (Arg 0). The reads are served from the published snapshot, so their
+// p99 must stay the same while each switch holds the studio lock for
+// sources_per_scene * BENCH_SOURCE_OPEN_US.
+static void BM_StudioGetDuringSwitch(benchmark::State& state) {
+	ObsStubSetSourceCreateDelay(std::chrono::microseconds(BENCH_SOURCE_OPEN_US));
+	BenchStudio bench(10, 4, 64);
+	if(!bench.error.empty()) {
+		ObsStubSetSourceCreateDelay(std::chrono::microseconds(0));
+		state.SkipWithError(bench.error.c_str());
+		return;
+	}
+
+	std::atomic<bool> switching(state.range(0) != 0);
+	std::atomic<int64_t> switches(0);
+	std::thread switcher([&]() {
+		for(int i = 1; switching; i++) {
+			if(bench.SwitchScene(i).ok()) {
+				switches++;
+			}
+		}
+	});
+
+	std::vector<double> latencies_us;
+	proto::StudioGetRequest req;
+	for(auto _ : state) {
+		grpc::ClientContext ctx;
+		proto::StudioGetResponse rep;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		grpc::Status s = bench.stub->StudioGet(&ctx, req, &rep);
+		latencies_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		if(!s.ok()) {
+			state.SkipWithError(("StudioGet failed: "+ s.error_message()).c_str());
+			break;
+		}
+	}
+
+	switching = false;
+	switcher.join();
+	ObsStubSetSourceCreateDelay(std::chrono::microseconds(0));
+
+	std::sort(latencies_us.begin(), latencies_us.end());
+	state.counters["p50_us"] = benchPercentile(latencies_us, 0.50);
+	state.counters["p99_us"] = benchPercentile(latencies_us, 0.99);
+	state.counters["max_us"] = latencies_us.empty() ? 0 : latencies_us.back();
+	state.counters["switches"] = switches.load();
+}
+
+// Threads of the process while a burst of SceneSetAsCurrent calls, given as
+// argument, is sent at once with the callback API: the calls wait in the
+// bounded worker pool queue or are rejected with RESOURCE_EXHAUSTED, the
+// server does not start a thread per call. threads_peak stays close to
+// threads_idle whatever the burst size.
+static void BM_StudioBurstThreads(benchmark::State& state) {
+	ObsStubSetSourceCreateDelay(std::chrono::microseconds(BENCH_SOURCE_OPEN_US / 10));
+	BenchStudio bench(10, 4, 64);
+	if(!bench.error.empty()) {
+		ObsStubSetSourceCreateDelay(std::chrono::microseconds(0));
+		state.SkipWithError(bench.error.c_str());
+		return;
+	}
+	int64_t burst = state.range(0);
+	// Calls to the scene already active fail, which is expected here
+	int format = gTraceFormat;
+	gTraceFormat = TRACE_FORMAT_NONE;
+
+	// Let the threads started by the first calls settle
+	bench.SwitchScene(1);
+	int threads_idle = benchThreadCount();
+	std::atomic<int> threads_peak(threads_idle);
+	std::atomic<bool> sampling(true);
+	std::thread sampler([&]() {
+		while(sampling) {
+			int threads = benchThreadCount();
+			if(threads > threads_peak) {
+				threads_peak = threads;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	int64_t ok = 0;
+	int64_t rejected = 0;
+	for(auto _ : state) {
+		struct Call {
+			grpc::ClientContext ctx;
+			proto::SceneSetAsCurrentRequest req;
+			proto::SceneSetAsCurrentResponse rep;
+		};
+		std::vector<Call> calls(burst);
+		std::mutex mtx;
+		std::condition_variable cv;
+		int64_t pending = burst;
+
+		for(int64_t i = 0; i < burst; i++) {
+			Call& call = calls[i];
+			call.req.set_show_id(bench.show_id);
+			call.req.set_scene_id(bench.scene_ids[i % bench.scene_ids.size()]);
+			bench.stub->async()->SceneSetAsCurrent(&call.ctx, &call.req, &call.rep, [&](grpc::Status s) {
+				std::unique_lock<std::mutex> lock(mtx);
+				if(s.ok()) {
+					ok++;
+				} else if(s.error_code() == grpc::RESOURCE_EXHAUSTED) {
+					rejected++;
+				}
+				if(--pending == 0) {
+					cv.notify_one();
+				}
+			});
+		}
+
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [&] { return pending == 0; });
+	}
+
+	sampling = false;
+	sampler.join();
+	gTraceFormat = format;
+	ObsStubSetSourceCreateDelay(std::chrono::microseconds(0));
+
+	state.counters["threads_idle"] = threads_idle;
+	state.counters["threads_peak"] = threads_peak.load();
+	state.counters["ok"] = benchmark::Counter(ok, benchmark::Counter::kAvgIterations);
+	state.counters["rejected"] = benchmark::Counter(rejected, benchmark::Counter::kAvgIterations);
+}
+
+// Records into a temporary directory with max_segments given as argument,
+// while the muxer starts three times as many segments: only the last
+// max_segments files must be left in the directory. Fails otherwise.
+static void BM_StudioRecordSegments(benchmark::State& state) {
+	BenchStudio bench(2, 4, 64);
+	if(!bench.error.empty()) {
+		state.SkipWithError(bench.error.c_str());
+		return;
+	}
+	int64_t max_segments = state.range(0);
+	std::filesystem::path record_dir = bench.dir / "record";
+
+	int64_t files = 0;
+	for(auto _ : state) {
+		grpc::ClientContext start_ctx;
+		proto::RecordStartRequest req;
+		proto::RecordStartResponse rep;
+		req.set_directory(record_dir.string());
+		req.set_format("ts");
+		req.set_segment_duration_sec(2);
+		req.set_max_segments(max_segments);
+		grpc::Status s = bench.stub->RecordStart(&start_ctx, req, &rep);
+		if(!s.ok()) {
+			state.SkipWithError(("RecordStart failed: "+ s.error_message()).c_str());
+			break;
+		}
+
+		for(int64_t i = 0; i < 3 * max_segments; i++) {
+			ObsStubSplitFiles();
+		}
+
+		grpc::ClientContext stop_ctx;
+		google::protobuf::Empty empty;
+		s = bench.stub->RecordStop(&stop_ctx, empty, &empty);
+		if(!s.ok()) {
+			state.SkipWithError(("RecordStop failed: "+ s.error_message()).c_str());
+			break;
+		}
+
+		state.PauseTiming();
+		files = std::distance(std::filesystem::directory_iterator(record_dir), std::filesystem::directory_iterator());
+		std::filesystem::remove_all(record_dir);
+		state.ResumeTiming();
+		if(files != max_segments) {
+			state.SkipWithError(("Expected "+ std::to_string(max_segments) +" segments, found "+ std::to_string(files)).c_str());
+			break;
+		}
+	}
+	state.counters["segments_kept"] = files;
+}
+
+BENCHMARK(BM_StudioGetDuringSwitch)->Arg(0)->Arg(1)->Iterations(2000)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_StudioBurstThreads)->Arg(64)->Arg(512)->Iterations(20)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_StudioRecordSegments)->Arg(3)->Arg(10)->Unit(benchmark::kMillisecond);
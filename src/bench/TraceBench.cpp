@@ -0,0 +1,121 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <string>
+#include <benchmark/benchmark.h>
+#include "../lib/Trace.hpp"
+
+/**
+ * @file
+ * @brief Benchmarks of a trace call, formatting and queueing included.
+ *
+ * A call below APP_TRACE_LEVEL generates no code at all, so it is not
+ * benchmarked here.
+ *
+ */
+
+// Sends stdout, the TraceLogger writer included, to /dev/null while it exists,
+// so that the traced lines do not mix with the benchmark report.
+class BenchStdoutToDevNull {
+public:
+	BenchStdoutToDevNull() {
+		fflush(stdout);
+		saved = dup(STDOUT_FILENO);
+		int fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+	~BenchStdoutToDevNull() {
+		TraceLogger::Instance().Flush();
+		fflush(stdout);
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+	}
+
+private:
+	int saved;
+};
+
+// Stands for the accessors whose result is traced, e.g. Source::Id()
+static std::string benchTraceId(int64_t i) {
+	return "source_" + std::to_string(i);
+}
+
+// Enabled trace call with five fields, in the format given as argument
+// (TRACE_FORMAT_TEXT or TRACE_FORMAT_JSON). Lines the ring buffer has no room
+// for are dropped, which is part of what a burst of traces costs.
+static void BM_TraceEnabled(benchmark::State& state) {
+	int level = gTraceLevel;
+	int format = gTraceFormat;
+	gTraceLevel = TRACE_LEVEL_TRACE;
+	gTraceFormat = state.range(0);
+
+	uint64_t dropped = TraceLogger::Instance().Dropped();
+	{
+		BenchStdoutToDevNull devnull;
+		std::string show_id = "show_0";
+		int64_t i = 0;
+		for(auto _ : state) {
+			trace_error("Source changed", field_s(show_id), field_ns("source_id", benchTraceId(i)), field(i), field_nl("state", "playing\t\"live\""), field_n("volume", 0.5));
+			i++;
+		}
+	}
+	state.counters["dropped"] = TraceLogger::Instance().Dropped() - dropped;
+
+	gTraceLevel = level;
+	gTraceFormat = format;
+}
+
+// Lines per second written by the TraceLogger, in the format given as first
+// argument, for bursts of the number of lines given as second argument. Each
+// iteration waits for the writer to write the burst, and dropped lines are
+// not counted: items_per_second is the throughput of what reaches stdout.
+static void BM_TraceThroughput(benchmark::State& state) {
+	int level = gTraceLevel;
+	int format = gTraceFormat;
+	gTraceLevel = TRACE_LEVEL_TRACE;
+	gTraceFormat = state.range(0);
+	int64_t burst = state.range(1);
+
+	uint64_t dropped = TraceLogger::Instance().Dropped();
+	{
+		BenchStdoutToDevNull devnull;
+		std::string show_id = "show_0";
+		TraceRequestScope scope("bench-request");
+		int64_t i = 0;
+		for(auto _ : state) {
+			for(int64_t j = 0; j < burst; j++) {
+				trace_info("Source changed", field_s(show_id), field_ns("source_id", benchTraceId(i)), field(i), field_nl("url", "rtmp://host/live?key=\"a b\""));
+				i++;
+			}
+			TraceLogger::Instance().Flush();
+		}
+	}
+	dropped = TraceLogger::Instance().Dropped() - dropped;
+	state.SetItemsProcessed(state.iterations() * burst - dropped);
+	state.counters["dropped"] = dropped;
+
+	gTraceLevel = level;
+	gTraceFormat = format;
+}
+
+// Trace call below gTraceLevel: neither the message nor the fields are
+// evaluated.
+static void BM_TraceDisabled(benchmark::State& state) {
+	int level = gTraceLevel;
+	gTraceLevel = TRACE_LEVEL_ERROR;
+
+	std::string show_id = "show_0";
+	int64_t i = 0;
+	for(auto _ : state) {
+		trace_debug("Source changed", field_s(show_id), field_ns("source_id", benchTraceId(i)), field(i), field_nl("state", "playing"), field_n("volume", 0.5));
+		i++;
+		benchmark::ClobberMemory();
+	}
+
+	gTraceLevel = level;
+}
+
+BENCHMARK(BM_TraceEnabled)->Arg(TRACE_FORMAT_TEXT)->Arg(TRACE_FORMAT_JSON)->Unit(benchmark::kNanosecond);
+BENCHMARK(BM_TraceThroughput)->ArgsProduct({{TRACE_FORMAT_TEXT, TRACE_FORMAT_JSON}, {100, 4096}})->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_TraceDisabled)->Unit(benchmark::kNanosecond);
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <benchmark/benchmark.h>
+#include <jansson.h>
+#include "../lib/EventBus.hpp"
+#include "../lib/Show.hpp"
+#include "../lib/ShowCache.hpp"
+#include "../lib/SourceRegistry.hpp"
+#include "../lib/Trace.hpp"
+#include "BenchFixtures.hpp"
+
+/**
+ * @file
+ * @brief Benchmarks of the show tree, linked with bench/ObsStub.cpp instead of
+ * libobs so that they run headless, e.g. in CI.
+ *
+ * Each benchmark takes the total number of sources of the show as argument.
+ * The show has BENCH_SOURCES_PER_SCENE sources per scene, half of them sharing
+ * one input so that the SourceRegistry is exercised too. Run with
+ * --benchmark_format=json (or --benchmark_out=<file>) to track regressions.
+ *
+ */
+
+#define BENCH_SOURCES_PER_SCENE 10
+#define BENCH_EVENT_HISTORY_SIZE 1024
+
+int gTraceLevel = TRACE_LEVEL_ERROR;
+int gTraceFormat = TRACE_FORMAT_TEXT;
+
+// A loaded show and what it depends on.
+struct BenchShow {
+	Settings settings;
+	EventBus events;
+	SourceRegistry registry;
+	Show show;
+
+	BenchShow(int64_t sources)
+		: settings(benchSettings())
+		, events(BENCH_EVENT_HISTORY_SIZE)
+		, show("show_0", "bench", &settings, &events, &registry, nullptr) {
+		json_t* json_show = buildShowJson(sources, BENCH_SOURCES_PER_SCENE, true);
+		grpc::Status s = show.Load(json_show);
+		json_decref(json_show);
+		if(!s.ok()) {
+			throw std::string(s.error_message());
+		}
+	}
+};
+
+static void BM_ShowLoad(benchmark::State& state) {
+	Settings settings = benchSettings();
+	EventBus events(BENCH_EVENT_HISTORY_SIZE);
+	SourceRegistry registry;
+	json_t* json_show = buildShowJson(state.range(0), BENCH_SOURCES_PER_SCENE, true);
+
+	for(auto _ : state) {
+		Show show("show_0", "bench", &settings, &events, &registry, nullptr);
+		grpc::Status s = show.Load(json_show);
+		if(!s.ok()) {
+			state.SkipWithError(s.error_message().c_str());
+			break;
+		}
+	}
+
+	json_decref(json_show);
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Writes the json of a show to a temporary file, for the ShowCache benchmarks.
+static std::string writeShowFile(int64_t sources) {
+	std::string path = (std::filesystem::temp_directory_path() / ("obs_headless_bench_"+ std::to_string(sources) +".json")).string();
+	json_t* json_show = buildShowJson(sources, BENCH_SOURCES_PER_SCENE, true);
+	json_dump_file(json_show, path.c_str(), 0);
+	json_decref(json_show);
+	return path;
+}
+
+// Reads and validates a show file without a cache, like ShowLoad with
+// show_cache_dir unset.
+static void BM_ShowSpecParse(benchmark::State& state) {
+	std::string path = writeShowFile(state.range(0));
+	ShowCache cache("");
+
+	for(auto _ : state) {
+		ShowSpec spec;
+		bool cached;
+		grpc::Status s = cache.Load(path, &spec, &cached);
+		if(!s.ok()) {
+			state.SkipWithError(s.error_message().c_str());
+			break;
+		}
+	}
+
+	std::remove(path.c_str());
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Same file, read from the compiled show cache.
+static void BM_ShowCacheLoad(benchmark::State& state) {
+	std::string path = writeShowFile(state.range(0));
+	std::string dir = (std::filesystem::temp_directory_path() / "obs_headless_bench_cache").string();
+	ShowCache cache(dir);
+	ShowSpec spec;
+	bool cached;
+	cache.Load(path, &spec, &cached);
+
+	for(auto _ : state) {
+		ShowSpec spec;
+		grpc::Status s = cache.Load(path, &spec, &cached);
+		if(!s.ok() || !cached) {
+			state.SkipWithError("Show cache miss");
+			break;
+		}
+	}
+
+	std::remove(path.c_str());
+	std::filesystem::remove_all(dir);
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Switches back and forth between the first two scenes of a started show.
+static void BM_SceneSetAsCurrent(benchmark::State& state) {
+	BenchShow bench(std::max<int64_t>(state.range(0), 2 * BENCH_SOURCES_PER_SCENE));
+	std::string scene_ids[2] = {"scene_0", "scene_1"};
+	bench.show.Start();
+
+	size_t next = 1;
+	for(auto _ : state) {
+		grpc::Status s = bench.show.SwitchScene(scene_ids[next]);
+		if(!s.ok()) {
+			state.SkipWithError(s.error_message().c_str());
+			break;
+		}
+		next = 1 - next;
+	}
+
+	bench.show.Stop();
+	state.counters["switch_latency_us"] = bench.show.LastSwitchLatencyUs();
+}
+
+// Same work as the StudioGet snapshot: builds the proto tree of the show and
+// serializes the response.
+static void BM_StudioGetSerialize(benchmark::State& state) {
+	BenchShow bench(state.range(0));
+	size_t bytes = 0;
+
+	for(auto _ : state) {
+		proto::Show proto_show;
+		bench.show.UpdateProto(&proto_show);
+
+		proto::StudioGetResponse response;
+		response.mutable_studio()->set_active_show_id(bench.show.Id());
+		response.mutable_studio()->add_shows()->CopyFrom(proto_show);
+		std::string serialized;
+		response.SerializeToString(&serialized);
+		bytes = serialized.size();
+		benchmark::DoNotOptimize(serialized);
+	}
+
+	state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+// Reloads a started show whose file changed the url of one source, back and
+// forth, like a show_watch reload. The other sources are reused.
+static void BM_ShowReload(benchmark::State& state) {
+	BenchShow bench(state.range(0));
+	bench.show.Start();
+
+	ShowSpec specs[2];
+	json_t* json_show = buildShowJson(state.range(0), BENCH_SOURCES_PER_SCENE, true);
+	grpc::Status s = ParseShowSpec(json_show, &specs[0]);
+	json_decref(json_show);
+	if(!s.ok()) {
+		state.SkipWithError(s.error_message().c_str());
+		return;
+	}
+	specs[1] = specs[0];
+	specs[1].scenes[0].sources[0].url = "rtmp://localhost/changed";
+
+	proto::ShowReloadStats stats;
+	size_t next = 1;
+	for(auto _ : state) {
+		stats.Clear();
+		s = bench.show.Reload(specs[next], &stats);
+		if(!s.ok()) {
+			state.SkipWithError(s.error_message().c_str());
+			break;
+		}
+		next = 1 - next;
+	}
+
+	bench.show.Stop();
+	state.counters["sources_reused"] = stats.sources_reused();
+	state.counters["sources_added"] = stats.sources_added();
+}
+
+// Duplicates every scene of the show into a new show, like ShowDuplicate.
+static void BM_ShowDuplicate(benchmark::State& state) {
+	BenchShow bench(state.range(0));
+	SceneMap scenes = bench.show.Scenes();
+
+	for(auto _ : state) {
+		Show copy("show_1", "copy", &bench.settings, &bench.events, &bench.registry, nullptr);
+		for(auto & it : scenes) {
+			if(!copy.DuplicateSceneFromShow(&bench.show, it.first)) {
+				state.SkipWithError("DuplicateSceneFromShow failed");
+				break;
+			}
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Duplicates one scene within the show, like SceneDuplicate, then removes it.
+static void BM_SceneDuplicate(benchmark::State& state) {
+	BenchShow bench(state.range(0));
+
+	for(auto _ : state) {
+		Scene* scene = bench.show.DuplicateScene("scene_0");
+		if(!scene) {
+			state.SkipWithError("DuplicateScene failed");
+			break;
+		}
+		bench.show.RemoveScene(scene->Id());
+	}
+}
+
+BENCHMARK(BM_ShowLoad)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ShowSpecParse)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ShowCacheLoad)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SceneSetAsCurrent)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_StudioGetSerialize)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ShowReload)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ShowDuplicate)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SceneDuplicate)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
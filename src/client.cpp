@@ -5,6 +5,8 @@
 #include <algorithm>
 #include <grpc++/grpc++.h>
 #include "lib/proto/studio.grpc.pb.h"
+#include "lib/BatchBench.hpp"
+#include "lib/LoadGenerator.hpp"
 #include "lib/Trace.hpp"
 
 using grpc::Channel;
@@ -59,9 +61,17 @@ private:
 
 void switch_scene(StudioClient& client);
 void describe_state(StudioClient& client);
+int run_bench(int argc, char** argv);
+int run_batch_bench(int argc, char** argv);
 
 
 int main(int argc, char** argv) {
+	if(argc > 1 && string(argv[1]) == "bench") {
+		return run_bench(argc - 2, argv + 2);
+	}
+	if(argc > 1 && string(argv[1]) == "batch") {
+		return run_batch_bench(argc - 2, argv + 2);
+	}
 
 	try {
 		proto::StudioState studio_state;
@@ -129,6 +139,46 @@ int main(int argc, char** argv) {
 }
 
 
+// Load generator mode, see lib/LoadGenerator.hpp
+int run_bench(int argc, char** argv) {
+	LoadOptions options;
+	string err = ParseLoadOptions(argc, argv, &options);
+	if(!err.empty()) {
+		cerr << err << "\n" << LoadUsage();
+		return 1;
+	}
+	gTraceLevel = TRACE_LEVEL_INFO;
+	gTraceFormat = options.trace_format;
+
+	LoadGenerator generator(options);
+	err = generator.Run();
+	if(!err.empty()) {
+		trace_error("Bench failed", error(err));
+		return 1;
+	}
+	generator.Report();
+	return 0;
+}
+
+// Show building benchmark mode, see lib/BatchBench.hpp
+int run_batch_bench(int argc, char** argv) {
+	BatchBenchOptions options;
+	string err = ParseBatchBenchOptions(argc, argv, &options);
+	if(!err.empty()) {
+		cerr << err << "\n" << BatchBenchUsage();
+		return 1;
+	}
+	gTraceLevel = TRACE_LEVEL_INFO;
+	gTraceFormat = options.trace_format;
+
+	err = RunBatchBench(options);
+	if(!err.empty()) {
+		trace_error("Batch bench failed", error(err));
+		return 1;
+	}
+	return 0;
+}
+
 void describe_state(StudioClient& client) {
 	proto::StudioState studio_state = client.StudioGet();
 	trace_info("Listing studio state (* = active)");
@@ -139,7 +189,7 @@ void describe_state(StudioClient& client) {
 
 		for(auto scene : show.scenes()) {
 			string scene_pre = (scene.id() == show.active_scene_id()) ? "*" : "-";
-			trace_info("      " + scene_pre +" Scene", field_ns("id", scene.id()), field_ns("name", scene.name()));
+			trace_info("      " + scene_pre +" Scene", field_ns("id", scene.id()), field_ns("name", scene.name()), field_n("preloaded", scene.preloaded()));
 
 			std::vector<std::string> active_source_ids;
 			for(int i=0; i<scene.active_source_ids_size(); i++) {
@@ -175,7 +225,7 @@ void switch_scene(StudioClient& client) {
 
 proto::StudioState StudioClient::StudioGet() {
 	ClientContext context;
-	Empty request;
+	proto::StudioGetRequest request;
 	proto::StudioGetResponse response;
 
 	Status s = stub->StudioGet(&context, request, &response);
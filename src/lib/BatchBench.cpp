@@ -0,0 +1,222 @@
+#include "BatchBench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <grpc++/grpc++.h>
+#include "proto/studio.grpc.pb.h"
+#include "ClientOptions.hpp"
+#include "Trace.hpp"
+
+#define BATCH_BENCH_SHOW "batch_bench"
+
+std::string BatchBenchUsage() {
+	return "obs_headless_client batch [options]\n"
+		"  --target <host:port>      server address (localhost:50051)\n"
+		"  --scenes <n>              scenes of the built show (4)\n"
+		"  --sources <n>             sources per scene (50)\n"
+		"  --rounds <n>              builds with each path (5)\n"
+		"  --format <text|json>      report format (text)\n";
+}
+
+std::string ParseBatchBenchOptions(int argc, char** argv, BatchBenchOptions* options) {
+	std::string err = ParseClientOptions(argc, argv, &options->target, &options->trace_format, [options](const std::string& arg, const std::string& value, std::string* error) {
+		if(arg == "--scenes") {
+			options->scenes = std::stoi(value);
+		} else if(arg == "--sources") {
+			options->sources = std::stoi(value);
+		} else if(arg == "--rounds") {
+			options->rounds = std::stoi(value);
+		} else {
+			return false;
+		}
+		return true;
+	});
+	if(!err.empty()) {
+		return err;
+	}
+
+	if(options->scenes <= 0 || options->sources <= 0 || options->rounds <= 0) {
+		return "--scenes, --sources and --rounds must be positive";
+	}
+	return "";
+}
+
+// Timings of a path, in us
+struct BatchBenchPath {
+	const char* name;
+	uint64_t rpcs;
+	std::vector<int64_t> build_us;
+};
+
+static std::string failed(const char* method, const grpc::Status& s) {
+	return std::string(method) +" failed: "+ s.error_message();
+}
+
+static std::string createShow(proto::Studio::Stub* stub, std::string* show_id) {
+	grpc::ClientContext ctx;
+	proto::ShowCreateRequest req;
+	proto::ShowCreateResponse rep;
+	req.set_show_name(BATCH_BENCH_SHOW);
+	grpc::Status s = stub->ShowCreate(&ctx, req, &rep);
+	if(!s.ok()) {
+		return failed("ShowCreate", s);
+	}
+	*show_id = rep.show().id();
+	return "";
+}
+
+static std::string removeShow(proto::Studio::Stub* stub, const std::string& show_id) {
+	grpc::ClientContext ctx;
+	proto::ShowRemoveRequest req;
+	google::protobuf::Empty rep;
+	req.set_show_id(show_id);
+	grpc::Status s = stub->ShowRemove(&ctx, req, &rep);
+	return s.ok() ? "" : failed("ShowRemove", s);
+}
+
+static std::string sourceName(int scene, int source) {
+	return "source_"+ std::to_string(scene) +"_"+ std::to_string(source);
+}
+
+static std::string sourceUrl(int source) {
+	return "/tmp/batch_bench_"+ std::to_string(source) +".png";
+}
+
+// Low latency properties, set after each SourceAdd
+static proto::SourceProperties sourceProperties() {
+	proto::SourceProperties properties;
+	properties.set_buffering_mb(0);
+	properties.set_ffmpeg_options("fflags=nobuffer");
+	return properties;
+}
+
+static std::string buildWithRpcs(proto::Studio::Stub* stub, const BatchBenchOptions& options, const std::string& show_id, uint64_t* rpcs) {
+	for(int i = 0; i < options.scenes; i++) {
+		grpc::ClientContext scene_ctx;
+		proto::SceneAddRequest scene_req;
+		proto::SceneAddResponse scene_rep;
+		scene_req.set_show_id(show_id);
+		scene_req.set_scene_name("scene_"+ std::to_string(i));
+		grpc::Status s = stub->SceneAdd(&scene_ctx, scene_req, &scene_rep);
+		(*rpcs)++;
+		if(!s.ok()) {
+			return failed("SceneAdd", s);
+		}
+
+		for(int j = 0; j < options.sources; j++) {
+			grpc::ClientContext add_ctx;
+			proto::SourceAddRequest add_req;
+			proto::SourceAddResponse add_rep;
+			add_req.set_show_id(show_id);
+			add_req.set_scene_id(scene_rep.scene().id());
+			add_req.set_source_name(sourceName(i, j));
+			add_req.set_source_type("Image");
+			add_req.set_source_url(sourceUrl(j));
+			s = stub->SourceAdd(&add_ctx, add_req, &add_rep);
+			(*rpcs)++;
+			if(!s.ok()) {
+				return failed("SourceAdd", s);
+			}
+
+			grpc::ClientContext set_ctx;
+			proto::SourceSetPropertiesRequest set_req;
+			proto::SourceSetPropertiesResponse set_rep;
+			set_req.set_show_id(show_id);
+			set_req.set_scene_id(scene_rep.scene().id());
+			set_req.set_source_id(add_rep.source().id());
+			*set_req.mutable_properties() = sourceProperties();
+			s = stub->SourceSetProperties(&set_ctx, set_req, &set_rep);
+			(*rpcs)++;
+			if(!s.ok()) {
+				return failed("SourceSetProperties", s);
+			}
+		}
+	}
+	return "";
+}
+
+static std::string buildWithBatch(proto::Studio::Stub* stub, const BatchBenchOptions& options, const std::string& show_id, uint64_t* rpcs) {
+	proto::ApplyBatchRequest req;
+	proto::ApplyBatchResponse rep;
+
+	for(int i = 0; i < options.scenes; i++) {
+		// Referred to by the following operations as "$<index>"
+		std::string scene_ref = "$"+ std::to_string(req.operations_size());
+		proto::SceneAddRequest* scene_add = req.add_operations()->mutable_scene_add();
+		scene_add->set_show_id(show_id);
+		scene_add->set_scene_name("scene_"+ std::to_string(i));
+
+		for(int j = 0; j < options.sources; j++) {
+			std::string source_ref = "$"+ std::to_string(req.operations_size());
+			proto::SourceAddRequest* source_add = req.add_operations()->mutable_source_add();
+			source_add->set_show_id(show_id);
+			source_add->set_scene_id(scene_ref);
+			source_add->set_source_name(sourceName(i, j));
+			source_add->set_source_type("Image");
+			source_add->set_source_url(sourceUrl(j));
+
+			proto::SourceSetPropertiesRequest* set = req.add_operations()->mutable_source_set_properties();
+			set->set_show_id(show_id);
+			set->set_scene_id(scene_ref);
+			set->set_source_id(source_ref);
+			*set->mutable_properties() = sourceProperties();
+		}
+	}
+
+	grpc::ClientContext ctx;
+	grpc::Status s = stub->ApplyBatch(&ctx, req, &rep);
+	(*rpcs)++;
+	return s.ok() ? "" : failed("ApplyBatch", s);
+}
+
+static int64_t percentile(std::vector<int64_t> values, double p) {
+	std::sort(values.begin(), values.end());
+	size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+	return values[index];
+}
+
+std::string RunBatchBench(const BatchBenchOptions& options) {
+	std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(options.target, grpc::InsecureChannelCredentials());
+	std::unique_ptr<proto::Studio::Stub> stub = proto::Studio::NewStub(channel);
+
+	BatchBenchPath paths[2] = {{"rpc", 0, {}}, {"batch", 0, {}}};
+	for(int round = 0; round < options.rounds; round++) {
+		for(int p = 0; p < 2; p++) {
+			std::string show_id;
+			std::string err = createShow(stub.get(), &show_id);
+			if(!err.empty()) {
+				return err;
+			}
+
+			uint64_t rpcs = 0;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if(p == 0) {
+				err = buildWithRpcs(stub.get(), options, show_id, &rpcs);
+			} else {
+				err = buildWithBatch(stub.get(), options, show_id, &rpcs);
+			}
+			int64_t build_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+			std::string remove_err = removeShow(stub.get(), show_id);
+			if(!err.empty() || !remove_err.empty()) {
+				return err.empty() ? remove_err : err;
+			}
+			paths[p].rpcs = rpcs;
+			paths[p].build_us.push_back(build_us);
+		}
+	}
+
+	for(const BatchBenchPath& path : paths) {
+		trace_info("batch bench", field_nc("path", path.name),
+			field_n("scenes", options.scenes),
+			field_n("sources", options.scenes * options.sources),
+			field_n("rpcs", path.rpcs),
+			field_n("p50_us", percentile(path.build_us, 0.5)),
+			field_n("min_us", percentile(path.build_us, 0)),
+			field_n("max_us", percentile(path.build_us, 1)));
+	}
+	int64_t rpc_us = percentile(paths[0].build_us, 0.5);
+	int64_t batch_us = percentile(paths[1].build_us, 0.5);
+	trace_info("batch bench speedup", field_n("p50", batch_us > 0 ? (double) rpc_us / batch_us : 0));
+	return "";
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+/**
+ * @file
+ * @brief Show building benchmark of the `batch` mode of obs_headless_client.
+ *
+ * Each round creates an empty show and builds the same scenes and sources in
+ * it twice: once with one SceneAdd, SourceAdd and SourceSetProperties call
+ * per node, as a client would without batching, and once with a single
+ * ApplyBatch call. The show is removed after each build. Both builds are
+ * timed from the first call to the last response, so the gap includes the
+ * round trips, the studio lock acquisitions and the responses of the per-RPC
+ * path.
+ *
+ * The sources are images of a scene that is not started, so nothing is
+ * decoded and the server does the same work on both paths.
+ *
+ */
+
+struct BatchBenchOptions {
+	std::string target = "localhost:50051";
+	int scenes = 4;
+	// Per scene
+	int sources = 50;
+	int rounds = 5;
+	int trace_format = 1;
+};
+
+/**
+ * Parses the arguments following "batch".
+ *
+ * @return  an error message, empty on success.
+ */
+std::string ParseBatchBenchOptions(int argc, char** argv, BatchBenchOptions* options);
+
+// Usage of the batch mode.
+std::string BatchBenchUsage();
+
+/**
+ * Runs the rounds and traces the RPC count and build time percentiles of
+ * each path.
+ *
+ * @return  an error message, empty on success.
+ */
+std::string RunBatchBench(const BatchBenchOptions& options);
@@ -0,0 +1,40 @@
+#include "ClientOptions.hpp"
+#include "Trace.hpp"
+
+std::string ParseClientOptions(int argc, char** argv, std::string* target, int* trace_format, ClientOptionParser parse) {
+	for(int i = 0; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "--help" || arg == "-h") {
+			return "usage:";
+		}
+		if(i + 1 >= argc) {
+			return "missing value for "+ arg;
+		}
+		std::string value = argv[++i];
+
+		try {
+			if(arg == "--target") {
+				*target = value;
+			} else if(arg == "--format") {
+				if(value == "text") {
+					*trace_format = TRACE_FORMAT_TEXT;
+				} else if(value == "json") {
+					*trace_format = TRACE_FORMAT_JSON;
+				} else {
+					return "unknown format: "+ value;
+				}
+			} else {
+				std::string err;
+				if(!parse(arg, value, &err)) {
+					return "unknown option: "+ arg;
+				}
+				if(!err.empty()) {
+					return err;
+				}
+			}
+		} catch(...) {
+			return "invalid value for "+ arg +": "+ value;
+		}
+	}
+	return "";
+}
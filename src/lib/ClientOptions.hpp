@@ -0,0 +1,27 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+/**
+ * @file
+ * @brief Command line parsing shared by the modes of obs_headless_client.
+ *
+ */
+
+// Parses the value of a mode option. Returns false if arg is not an option
+// of the mode, and sets error if value is invalid. std::stoi and std::stod
+// may throw, which is reported as an invalid value.
+typedef std::function<bool(const std::string& arg, const std::string& value, std::string* error)> ClientOptionParser;
+
+/**
+ * Parses the "--option value" arguments following the mode. --help and -h,
+ * --target and --format (text or json) are common to all modes, the other
+ * options are passed to parse.
+ *
+ * @param   target        set by --target.
+ * @param   trace_format  set by --format, to TRACE_FORMAT_TEXT or
+ *                        TRACE_FORMAT_JSON.
+ * @return  an error message, "usage:" for --help, empty on success.
+ */
+std::string ParseClientOptions(int argc, char** argv, std::string* target, int* trace_format, ClientOptionParser parse);
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <ctime>
+#include "EventBus.hpp"
+
+// Events held by the calling thread, see Hold
+static thread_local EventBus* held_bus = nullptr;
+static thread_local std::vector<proto::StudioEvent> held_events;
+// Last event published by the calling thread, see LastPublished
+static thread_local EventBus* published_bus = nullptr;
+static thread_local uint64_t published_sequence = 0;
+
+EventBus::EventBus(size_t history_size)
+	: history_size(history_size)
+	, sequence(0) {
+}
+
+uint64_t EventBus::Publish(proto::StudioEvent event) {
+	if(held_bus == this) {
+		held_events.push_back(std::move(event));
+		return 0;
+	}
+
+	std::unique_lock<std::mutex> lock(mtx);
+	uint64_t event_sequence = append(event);
+	lock.unlock();
+
+	notify();
+	return event_sequence;
+}
+
+void EventBus::Hold() {
+	held_bus = this;
+	held_events.clear();
+}
+
+void EventBus::EndHold(bool publish) {
+	if(held_bus != this) {
+		return;
+	}
+	held_bus = nullptr;
+
+	std::vector<proto::StudioEvent> events;
+	events.swap(held_events);
+	if(!publish || events.empty()) {
+		return;
+	}
+
+	// In one go, so that no other event is interleaved
+	std::unique_lock<std::mutex> lock(mtx);
+	for(proto::StudioEvent& event : events) {
+		append(event);
+	}
+	lock.unlock();
+
+	notify();
+}
+
+uint64_t EventBus::append(proto::StudioEvent& event) {
+	uint64_t event_sequence = ++sequence;
+	event.set_sequence(event_sequence);
+	event.set_timestamp(std::time(nullptr));
+
+	history.push_back(std::move(event));
+	if(history.size() > history_size) {
+		history.pop_front();
+	}
+
+	published_bus = this;
+	published_sequence = event_sequence;
+	return event_sequence;
+}
+
+void EventBus::notify() {
+	// Notified without the lock, so that a listener removing itself (or
+	// another one) never waits for the publishing thread.
+	std::unique_lock<std::mutex> listeners_lock(listeners_mtx);
+	std::vector<std::shared_ptr<EventListener>> notified = listeners;
+	listeners_lock.unlock();
+
+	for(std::shared_ptr<EventListener>& listener : notified) {
+		listener->OnEvent();
+	}
+}
+
+bool EventBus::FetchEvents(uint64_t after, std::deque<proto::StudioEvent>& events, size_t max_events) {
+	std::unique_lock<std::mutex> lock(mtx);
+
+	if(sequence == after) {
+		// Nothing new
+		return true;
+	}
+	if(sequence < after) {
+		// `after` was never published, e.g. it comes from a previous run
+		return false;
+	}
+
+	// The oldest retained event must directly follow `after`.
+	if(history.empty() || history.front().sequence() > after + 1) {
+		return false;
+	}
+
+	// Sequence numbers are contiguous in history
+	size_t first = after + 1 - history.front().sequence();
+	for(size_t i = first; i < history.size() && max_events > 0; i++, max_events--) {
+		events.push_back(history[i]);
+	}
+	return true;
+}
+
+void EventBus::AddListener(std::shared_ptr<EventListener> listener) {
+	std::unique_lock<std::mutex> lock(listeners_mtx);
+	listeners.push_back(std::move(listener));
+}
+
+void EventBus::RemoveListener(EventListener* listener) {
+	std::unique_lock<std::mutex> lock(listeners_mtx);
+	listeners.erase(std::remove_if(listeners.begin(), listeners.end(), [listener](const std::shared_ptr<EventListener>& l) {
+		return l.get() == listener;
+	}), listeners.end());
+}
+
+uint64_t EventBus::LastPublished() {
+	return published_bus == this ? published_sequence : 0;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "proto/studio.pb.h"
+
+/**
+ * @file
+ * @brief In-process bus of studio events.
+ *
+ * Mutation paths (Studio, Show, Scene) publish proto::StudioEvent deltas, and
+ * WatchStudio streams read them back in order. The last `history_size`
+ * events are retained so that a watcher can resume from a sequence number.
+ *
+ * Watchers never block on the bus: they register an EventListener, which is
+ * notified after each Publish, and then fetch the new events from their own
+ * thread.
+ *
+ */
+
+class EventListener {
+public:
+	virtual ~EventListener() {}
+
+	// Called after an event is published, on the publishing thread, which may
+	// hold the studio lock. Must only schedule the fetch, never block nor
+	// call back into the bus or the studio.
+	virtual void OnEvent() = 0;
+};
+
+class EventBus {
+public:
+	/**
+	 * EventBus constructor.
+	 *
+	 * @param   history_size  number of events retained for resuming watchers.
+	 */
+	EventBus(size_t history_size);
+
+	/**
+	 * Stamps an event with the next sequence number and the current time,
+	 * retains it and notifies the listeners.
+	 *
+	 * @param   event  the event to publish, its sequence and timestamp are
+	 *                 overwritten.
+	 * @return         the sequence number of the event, 0 if it is held.
+	 */
+	uint64_t Publish(proto::StudioEvent event);
+
+	/**
+	 * Holds the events then published by the calling thread until EndHold,
+	 * which publishes them together, with contiguous sequence numbers, or
+	 * drops them (e.g. a rolled back batch). Events of other threads are not
+	 * held.
+	 */
+	void Hold();
+	void EndHold(bool publish);
+
+	/**
+	 * Fetches the retained events newer than `after`, without waiting.
+	 *
+	 * @param   after       sequence number of the last event the caller got.
+	 * @param   events      newer events are appended to it, in order.
+	 * @param   max_events  maximum number of events to append.
+	 * @return              false if events following `after` are not retained
+	 *                      anymore (the caller has to resync), true otherwise.
+	 */
+	bool FetchEvents(uint64_t after, std::deque<proto::StudioEvent>& events, size_t max_events);
+
+	/**
+	 * Registers a listener. It is notified of each following Publish. The
+	 * listeners are notified outside of the bus locks, so a listener may get
+	 * one more OnEvent after RemoveListener returned: the bus keeps a
+	 * reference on it until then.
+	 */
+	void AddListener(std::shared_ptr<EventListener> listener);
+	void RemoveListener(EventListener* listener);
+
+	// Returns the sequence number of the last event published by the calling
+	// thread (0 if none), held events included once EndHold published them.
+	uint64_t LastPublished();
+
+private:
+	// Stamps and retains an event. Must be called with mtx held.
+	uint64_t append(proto::StudioEvent& event);
+	void notify();
+
+	std::mutex mtx;
+	std::deque<proto::StudioEvent> history;
+	std::mutex listeners_mtx;
+	std::vector<std::shared_ptr<EventListener>> listeners;
+	size_t history_size;
+	uint64_t sequence;
+};
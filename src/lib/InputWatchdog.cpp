@@ -0,0 +1,309 @@
+#include <algorithm>
+#include "InputWatchdog.hpp"
+#include "Trace.hpp"
+
+static int64_t steadyNowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t elapsedMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+}
+
+InputWatchdog::InputWatchdog(int stall_ms, int check_ms, int backoff_min_ms, int backoff_max_ms, int rescue_hold_ms,
+	std::function<void(std::string name, bool stalled, bool failed_over, uint64_t outage_ms, uint64_t reconnects)> changed)
+	: stall(stall_ms)
+	, check_interval(check_ms)
+	, backoff_min(backoff_min_ms)
+	, backoff_max(backoff_max_ms)
+	, rescue_hold(rescue_hold_ms)
+	, changed(changed)
+	, stopping(false)
+	, rng(std::random_device()()) {
+}
+
+InputWatchdog::~InputWatchdog() {
+	Stop();
+	for(auto & it : inputs) {
+		trace_warn("Input still watched", field_ns("name", it.second->name));
+	}
+}
+
+void InputWatchdog::Start() {
+	std::unique_lock<std::mutex> lock(mtx);
+	if(thread.joinable()) {
+		return;
+	}
+	stopping = false;
+	thread = std::thread(&InputWatchdog::run, this);
+	trace_info("Input watchdog started",
+		field_n("stall_ms", stall.count()),
+		field_n("backoff_min_ms", backoff_min.count()),
+		field_n("backoff_max_ms", backoff_max.count()),
+		field_n("rescue_hold_ms", rescue_hold.count()));
+}
+
+void InputWatchdog::Stop() {
+	std::unique_lock<std::mutex> lock(mtx);
+	if(!thread.joinable()) {
+		return;
+	}
+	stopping = true;
+	lock.unlock();
+	cv.notify_all();
+	thread.join();
+}
+
+void InputWatchdog::Watch(obs_source_t* source, std::string name) {
+	std::unique_ptr<Input> input(new Input());
+	input->source = source;
+	input->name = name;
+	input->last_audio_ns = 0;
+	input->last_media_time = -1;
+	input->last_progress = std::chrono::steady_clock::now();
+	input->stalled = false;
+	input->attempt = 0;
+	input->stalls = 0;
+	input->reconnects = 0;
+	input->outage_ms = 0;
+	input->total_outage_ms = 0;
+	input->failed_over = false;
+	input->failovers = 0;
+	input->failover_ms = 0;
+	input->recovery_ms = 0;
+	input->opened_at = input->last_progress;
+	input->anchor_media_time = -1;
+	input->open_ms = 0;
+	input->delay_ms = 0;
+
+	std::unique_lock<std::mutex> lock(mtx);
+	obs_source_add_audio_capture_callback(source, audioCb, input.get());
+	trace_debug("Watch input", field_s(name));
+	inputs[source] = std::move(input);
+}
+
+void InputWatchdog::Unwatch(obs_source_t* source) {
+	std::unique_lock<std::mutex> lock(mtx);
+	auto it = inputs.find(source);
+	if(it == inputs.end()) {
+		return;
+	}
+
+	// libobs holds its callback lock while calling, so no call is running
+	// once removed
+	obs_source_remove_audio_capture_callback(source, audioCb, it->second.get());
+	trace_debug("Unwatch input", field_ns("name", it->second->name));
+	inputs.erase(it);
+}
+
+void InputWatchdog::AddRescue(obs_source_t* source, obs_sceneitem_t* item, obs_sceneitem_t* rescue_item) {
+	std::unique_lock<std::mutex> lock(mtx);
+	auto it = inputs.find(source);
+	if(it == inputs.end()) {
+		return;
+	}
+
+	Input* input = it->second.get();
+	Rescue rescue{item, rescue_item};
+	input->rescues.push_back(rescue);
+	trace_debug("Add rescue", field_ns("name", input->name), field_n("rescues", input->rescues.size()));
+
+	// Added to a scene while the input is down
+	if(input->failed_over) {
+		showRescue(rescue, true);
+	} else if(input->stalled) {
+		failover(input, std::chrono::steady_clock::now());
+	}
+}
+
+void InputWatchdog::RemoveRescue(obs_source_t* source, obs_sceneitem_t* item) {
+	std::unique_lock<std::mutex> lock(mtx);
+	auto it = inputs.find(source);
+	if(it == inputs.end()) {
+		return;
+	}
+
+	std::vector<Rescue>& rescues = it->second->rescues;
+	rescues.erase(std::remove_if(rescues.begin(), rescues.end(), [item](const Rescue& rescue) {
+		return rescue.item == item;
+	}), rescues.end());
+}
+
+bool InputWatchdog::Health(obs_source_t* source, InputHealth* health) {
+	std::unique_lock<std::mutex> lock(mtx);
+	auto it = inputs.find(source);
+	if(it == inputs.end()) {
+		return false;
+	}
+
+	const Input* input = it->second.get();
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	health->stalled = input->stalled;
+	health->idle_ms = elapsedMs(input->last_progress, now);
+	health->stalls = input->stalls;
+	health->reconnects = input->reconnects;
+	health->outage_ms = input->stalled ? health->idle_ms : input->outage_ms;
+	health->total_outage_ms = input->total_outage_ms + (input->stalled ? health->idle_ms : 0);
+	health->failed_over = input->failed_over;
+	health->failovers = input->failovers;
+	health->failover_ms = input->failover_ms;
+	health->recovery_ms = input->recovery_ms;
+	health->open_ms = input->open_ms;
+	health->delay_ms = input->delay_ms;
+	return true;
+}
+
+void InputWatchdog::audioCb(void* param, obs_source_t* source, const struct audio_data* audio, bool muted) {
+	Input* input = (Input*)param;
+	input->last_audio_ns.store(steadyNowNs(), std::memory_order_relaxed);
+}
+
+std::chrono::milliseconds InputWatchdog::backoff(int attempt) {
+	// Doubles from backoff_min, capped at backoff_max, then a random
+	// duration between half and all of it ("equal jitter")
+	std::chrono::milliseconds delay = backoff_min;
+	for(int i = 0; i < attempt && delay < backoff_max; i++) {
+		delay *= 2;
+	}
+	delay = std::min(delay, backoff_max);
+
+	std::uniform_int_distribution<int64_t> jitter(0, delay.count() / 2);
+	return std::chrono::milliseconds(delay.count() - delay.count() / 2 + jitter(rng));
+}
+
+void InputWatchdog::showRescue(const Rescue& rescue, bool show) {
+	// Show the top item first, so that no frame is rendered with neither
+	if(show) {
+		obs_sceneitem_set_visible(rescue.rescue_item, true);
+		obs_sceneitem_set_visible(rescue.item, false);
+	} else {
+		obs_sceneitem_set_visible(rescue.item, true);
+		obs_sceneitem_set_visible(rescue.rescue_item, false);
+	}
+}
+
+void InputWatchdog::failover(Input* input, std::chrono::steady_clock::time_point now) {
+	if(input->rescues.empty()) {
+		return;
+	}
+
+	for(const Rescue& rescue : input->rescues) {
+		showRescue(rescue, true);
+	}
+	input->failed_over = true;
+	input->failovers++;
+	input->failover_ms = elapsedMs(input->last_progress, now);
+	trace_info("Input failed over to its rescue", field_ns("name", input->name), field_n("rescues", input->rescues.size()), field_n("failover_ms", input->failover_ms));
+}
+
+void InputWatchdog::restore(Input* input, std::chrono::steady_clock::time_point now) {
+	for(const Rescue& rescue : input->rescues) {
+		showRescue(rescue, false);
+	}
+	input->failed_over = false;
+	input->recovery_ms = elapsedMs(input->recovered_at, now);
+	trace_info("Input restored from its rescue", field_ns("name", input->name), field_n("recovery_ms", input->recovery_ms));
+}
+
+void InputWatchdog::check(Input* input, std::chrono::steady_clock::time_point now, std::vector<Change>* changes) {
+	enum obs_media_state state = obs_source_media_get_state(input->source);
+	int64_t media_time = obs_source_media_get_time(input->source);
+	int64_t last_audio_ns = input->last_audio_ns.load(std::memory_order_relaxed);
+	std::chrono::steady_clock::time_point last_audio{std::chrono::nanoseconds(last_audio_ns)};
+
+	bool failed = state == OBS_MEDIA_STATE_ERROR || state == OBS_MEDIA_STATE_ENDED;
+	// A restart resets the media time, only count it moving forward
+	bool progress = !failed && ((media_time > input->last_media_time && input->last_media_time >= 0)
+		|| (last_audio_ns && last_audio > input->last_progress));
+	input->last_media_time = media_time;
+
+	// Audio may come first, the media time anchors the delay
+	if(progress && input->anchor_media_time < 0 && media_time > 0) {
+		input->open_ms = elapsedMs(input->opened_at, now);
+		input->anchor = now;
+		input->anchor_media_time = media_time;
+		trace_debug("Input opened", field_ns("name", input->name), field_n("open_ms", input->open_ms));
+	} else if(progress && input->anchor_media_time >= 0) {
+		int64_t behind = (int64_t)elapsedMs(input->anchor, now) - (media_time - input->anchor_media_time);
+		input->delay_ms = std::max<int64_t>(behind, 0);
+	}
+
+	if(progress) {
+		std::chrono::steady_clock::time_point stall_start = input->last_progress;
+		input->last_progress = now;
+		if(input->stalled) {
+			input->stalled = false;
+			input->attempt = 0;
+			input->outage_ms = elapsedMs(stall_start, now);
+			input->total_outage_ms += input->outage_ms;
+			input->recovered_at = now;
+			trace_info("Input recovered", field_ns("name", input->name), field_n("outage_ms", input->outage_ms), field_n("reconnects", input->reconnects));
+			if(input->failed_over && rescue_hold.count() == 0) {
+				restore(input, now);
+			}
+			changes->push_back(Change{input->name, false, input->failed_over, input->outage_ms, input->reconnects});
+		} else if(input->failed_over && now - input->recovered_at >= rescue_hold) {
+			restore(input, now);
+			changes->push_back(Change{input->name, false, false, input->outage_ms, input->reconnects});
+		}
+		return;
+	}
+
+	// Progress must be continuous for rescue_hold
+	if(input->failed_over && !input->stalled) {
+		input->recovered_at = now;
+	}
+
+	if(!input->stalled) {
+		if(!failed && now - input->last_progress < stall) {
+			return;
+		}
+		input->stalled = true;
+		input->stalls++;
+		input->next_reconnect = now;
+		trace_warn("Input stalled", field_ns("name", input->name), field_nc("media_state", failed ? "failed" : "no progress"), field_n("idle_ms", elapsedMs(input->last_progress, now)));
+		// Still failed over if it stalled again during the hold
+		if(!input->failed_over) {
+			failover(input, now);
+		}
+		changes->push_back(Change{input->name, true, input->failed_over, elapsedMs(input->last_progress, now), input->reconnects});
+	}
+
+	if(now < input->next_reconnect) {
+		return;
+	}
+
+	std::chrono::milliseconds delay = backoff(input->attempt);
+	input->attempt++;
+	input->reconnects++;
+	input->next_reconnect = now + delay;
+	input->opened_at = now;
+	input->anchor_media_time = -1;
+	trace_info("Reconnect input", field_ns("name", input->name), field_n("attempt", input->attempt), field_n("next_in_ms", delay.count()));
+	obs_source_media_restart(input->source);
+}
+
+void InputWatchdog::run() {
+	std::unique_lock<std::mutex> lock(mtx);
+
+	while(!stopping) {
+		cv.wait_for(lock, check_interval, [this]() { return stopping; });
+		if(stopping) {
+			break;
+		}
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::vector<Change> changes;
+		for(auto & it : inputs) {
+			check(it.second.get(), now, &changes);
+		}
+
+		// Without the lock, the callback may query Health
+		lock.unlock();
+		for(const Change& change : changes) {
+			changed(change.name, change.stalled, change.failed_over, change.outage_ms, change.reconnects);
+		}
+		lock.lock();
+	}
+}
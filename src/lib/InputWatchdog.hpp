@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "obs.h"
+
+/**
+ * @file
+ * @brief Stall detection and reconnection of the network inputs.
+ *
+ * ffmpeg_source reconnects when its input ends, but not when the input
+ * stalls with the connection still open: the program then shows a frozen
+ * frame. The watchdog samples each watched obs source every check_ms. An
+ * input makes progress when its media time advances or an audio packet is
+ * received (audio capture callback). Without progress for stall_ms, or
+ * in the error or ended media state, the input is stalled and restarted with
+ * obs_source_media_restart, then again after a backoff doubling from
+ * backoff_min_ms to backoff_max_ms, with jitter so that inputs of the same
+ * server do not reconnect in lockstep. The outage lasts from the last
+ * progress to the first progress after the stall.
+ *
+ * A scene item of an input may have a rescue item under it (a slate image or
+ * a backup input, see Source::SetRescue), hidden but kept loaded. The
+ * watchdog shows the rescue and hides the input in the same check that
+ * detects the stall, so the switch lands on the next rendered frame. The
+ * input is shown again once it made progress for rescue_hold_ms, so that a
+ * reconnect delivering a few frames before stalling again does not flap.
+ *
+ * The watchdog also measures the latency of each input, which depends on its
+ * properties (see proto::SourceProperties): the time to open it, from its
+ * creation or restart to its first progress, and its delay, how far playback
+ * fell behind the input since then (wall time elapsed minus media time
+ * elapsed).
+ *
+ */
+
+// Health of a watched input.
+struct InputHealth {
+	bool stalled;
+	// Since the last progress
+	uint64_t idle_ms;
+	uint64_t stalls;
+	uint64_t reconnects;
+	// Duration of the current outage if stalled, otherwise of the last one
+	uint64_t outage_ms;
+	uint64_t total_outage_ms;
+	// The rescue items are shown instead of the input
+	bool failed_over;
+	uint64_t failovers;
+	// Of the last failover, from the last progress of the input to the
+	// rescue being shown
+	uint64_t failover_ms;
+	// Of the last recovery, from the first progress of the input to it being
+	// shown again
+	uint64_t recovery_ms;
+	uint64_t open_ms;
+	uint64_t delay_ms;
+};
+
+class InputWatchdog {
+public:
+	/**
+	 * @param  changed  called from the watchdog thread when an input stalls,
+	 *                  recovers or is shown again after a failover, with its
+	 *                  name and the outage duration.
+	 */
+	InputWatchdog(int stall_ms, int check_ms, int backoff_min_ms, int backoff_max_ms, int rescue_hold_ms,
+		std::function<void(std::string name, bool stalled, bool failed_over, uint64_t outage_ms, uint64_t reconnects)> changed);
+
+	/**
+	 * InputWatchdog destructor, stops the watchdog thread. All inputs are
+	 * expected to be unwatched.
+	 */
+	~InputWatchdog();
+
+	void Start();
+	void Stop();
+
+	// Watches an obs source until Unwatch, which must be called before it
+	// is released.
+	void Watch(obs_source_t* source, std::string name);
+	void Unwatch(obs_source_t* source);
+
+	// Registers the rescue item of a scene item of a watched source, until
+	// RemoveRescue which must be called before either item is removed. Does
+	// nothing if the source is not watched.
+	void AddRescue(obs_source_t* source, obs_sceneitem_t* item, obs_sceneitem_t* rescue_item);
+	void RemoveRescue(obs_source_t* source, obs_sceneitem_t* item);
+
+	// Returns false if the source is not watched.
+	bool Health(obs_source_t* source, InputHealth* health);
+
+private:
+	struct Rescue {
+		obs_sceneitem_t* item;
+		obs_sceneitem_t* rescue_item;
+	};
+
+	struct Input {
+		obs_source_t* source;
+		std::string name;
+		// steady_clock time of the last audio packet, in ns. Written by the
+		// audio thread.
+		std::atomic<int64_t> last_audio_ns;
+		int64_t last_media_time;
+		std::chrono::steady_clock::time_point last_progress;
+		bool stalled;
+		int attempt;
+		std::chrono::steady_clock::time_point next_reconnect;
+		uint64_t stalls;
+		uint64_t reconnects;
+		uint64_t outage_ms;
+		uint64_t total_outage_ms;
+		std::vector<Rescue> rescues;
+		bool failed_over;
+		// First progress after the stall, restarted by a check without
+		// progress
+		std::chrono::steady_clock::time_point recovered_at;
+		uint64_t failovers;
+		uint64_t failover_ms;
+		uint64_t recovery_ms;
+		// Created or restarted, reset by the first progress
+		std::chrono::steady_clock::time_point opened_at;
+		// Time and media time of the first progress, -1 until then
+		std::chrono::steady_clock::time_point anchor;
+		int64_t anchor_media_time;
+		uint64_t open_ms;
+		uint64_t delay_ms;
+	};
+
+	// A stall or recovery to report once the lock is released.
+	struct Change {
+		std::string name;
+		bool stalled;
+		bool failed_over;
+		uint64_t outage_ms;
+		uint64_t reconnects;
+	};
+
+	static void audioCb(void* param, obs_source_t* source, const struct audio_data* audio, bool muted);
+	void run();
+	void check(Input* input, std::chrono::steady_clock::time_point now, std::vector<Change>* changes);
+	std::chrono::milliseconds backoff(int attempt);
+	void failover(Input* input, std::chrono::steady_clock::time_point now);
+	void restore(Input* input, std::chrono::steady_clock::time_point now);
+	static void showRescue(const Rescue& rescue, bool show);
+
+	std::chrono::milliseconds stall;
+	std::chrono::milliseconds check_interval;
+	std::chrono::milliseconds backoff_min;
+	std::chrono::milliseconds backoff_max;
+	std::chrono::milliseconds rescue_hold;
+	std::function<void(std::string name, bool stalled, bool failed_over, uint64_t outage_ms, uint64_t reconnects)> changed;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+	std::thread thread;
+	std::map<obs_source_t*, std::unique_ptr<Input>> inputs;
+	std::mt19937 rng;
+};
@@ -0,0 +1,519 @@
+#include "LoadGenerator.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <thread>
+#include "ClientOptions.hpp"
+#include "Trace.hpp"
+
+static const char* load_method_names[] = {
+	"StudioGet", "ShowGet", "SceneGet", "SceneGetCurrent", "SourceGet",
+	"SceneSetAsCurrent", "SourceSetProperties", "Health", "GetMetrics"
+};
+
+const char* LoadMethodName(LoadMethod method) {
+	if(method < 0 || method >= LoadMethodCount) {
+		return "invalid";
+	}
+	return load_method_names[method];
+}
+
+LoadMethod StringToLoadMethod(const std::string& name) {
+	for(int i = 0; i < LoadMethodCount; i++) {
+		if(name == load_method_names[i]) {
+			return (LoadMethod) i;
+		}
+	}
+	return LoadMethodCount;
+}
+
+///////////////////////////////////////
+// OPTIONS                           //
+///////////////////////////////////////
+
+std::string LoadUsage() {
+	return "obs_headless_client bench [options]\n"
+		"  --target <host:port>      server address (localhost:50051)\n"
+		"  --channels <n>            concurrent channels, one sender thread each (4)\n"
+		"  --qps <n>                 target calls per second over all channels (100)\n"
+		"  --duration <sec>          length of the run (10)\n"
+		"  --mix <method=weight,...> methods to call, e.g. StudioGet=45,SceneGet=45,SceneSetAsCurrent=5,SourceSetProperties=5\n"
+		"                            (StudioGet=50,SceneGet=50)\n"
+		"  --timeout <ms>            deadline of each call (5000)\n"
+		"  --max-in-flight <n>       calls in flight per channel above which calls are skipped (1000)\n"
+		"  --replay <file>           replay a trace file instead of the mix\n"
+		"  --speed <factor>          replay speed (1)\n"
+		"  --record <file>           write the calls to a trace file\n"
+		"  --format <text|json>      report format (text)\n";
+}
+
+static std::string parseMix(const std::string& mix, LoadOptions* options) {
+	std::fill(std::begin(options->weights), std::end(options->weights), 0);
+
+	std::istringstream in(mix);
+	std::string item;
+	while(std::getline(in, item, ',')) {
+		size_t eq = item.find('=');
+		std::string name = item.substr(0, eq);
+		LoadMethod method = StringToLoadMethod(name);
+		if(method == LoadMethodCount) {
+			return "unknown method in --mix: "+ name;
+		}
+		double weight = 1;
+		if(eq != std::string::npos) {
+			try {
+				weight = std::stod(item.substr(eq + 1));
+			} catch(...) {
+				return "invalid weight in --mix: "+ item;
+			}
+		}
+		if(weight < 0) {
+			return "negative weight in --mix: "+ item;
+		}
+		options->weights[method] = weight;
+	}
+
+	double total_weight = 0;
+	for(double weight : options->weights) {
+		total_weight += weight;
+	}
+	// Also rejects NaN and infinite weights, planMix draws in [0, total)
+	if(!(total_weight > 0) || std::isinf(total_weight)) {
+		return "the weights of --mix must add up to a positive number: "+ mix;
+	}
+	return "";
+}
+
+std::string ParseLoadOptions(int argc, char** argv, LoadOptions* options) {
+	options->weights[LoadStudioGet] = 50;
+	options->weights[LoadSceneGet] = 50;
+
+	std::string err = ParseClientOptions(argc, argv, &options->target, &options->trace_format, [options](const std::string& arg, const std::string& value, std::string* error) {
+		if(arg == "--channels") {
+			options->channels = std::stoi(value);
+		} else if(arg == "--qps") {
+			options->qps = std::stod(value);
+		} else if(arg == "--duration") {
+			options->duration_sec = std::stoi(value);
+		} else if(arg == "--timeout") {
+			options->timeout_ms = std::stoi(value);
+		} else if(arg == "--max-in-flight") {
+			options->max_in_flight = std::stoi(value);
+		} else if(arg == "--mix") {
+			*error = parseMix(value, options);
+		} else if(arg == "--replay") {
+			options->replay_path = value;
+		} else if(arg == "--speed") {
+			options->replay_speed = std::stod(value);
+		} else if(arg == "--record") {
+			options->record_path = value;
+		} else {
+			return false;
+		}
+		return true;
+	});
+	if(!err.empty()) {
+		return err;
+	}
+
+	if(options->channels <= 0 || options->qps <= 0 || options->duration_sec <= 0 || options->replay_speed <= 0) {
+		return "--channels, --qps, --duration and --speed must be positive";
+	}
+	return "";
+}
+
+///////////////////////////////////////
+// LOAD GENERATOR                    //
+///////////////////////////////////////
+
+LoadGenerator::MethodStats::MethodStats() {
+	for(std::atomic<uint64_t>& code : codes) {
+		code = 0;
+	}
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions& options)
+	: options(options)
+	, skipped(0)
+	, run_duration(0) {
+	for(int i = 0; i < options.channels; i++) {
+		// Separate subchannels, otherwise all channels share one connection
+		grpc::ChannelArguments args;
+		args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+		std::unique_ptr<Channel> channel = std::make_unique<Channel>();
+		channel->stub = proto::Studio::NewStub(grpc::CreateCustomChannel(options.target, grpc::InsecureChannelCredentials(), args));
+		channel->in_flight = 0;
+		channels.push_back(std::move(channel));
+	}
+}
+
+std::string LoadGenerator::Run() {
+	std::string err;
+	if(options.replay_path.empty()) {
+		err = loadTargets();
+		if(err.empty()) {
+			planMix();
+		}
+	} else {
+		err = loadReplay();
+	}
+	if(!err.empty()) {
+		return err;
+	}
+
+	if(!options.record_path.empty()) {
+		err = writeRecord();
+		if(!err.empty()) {
+			return err;
+		}
+	}
+
+	trace_info("Starting load", field_ns("target", options.target), field_n("channels", options.channels),
+		field_n("qps", options.qps), field_n("duration_sec", options.duration_sec), field_ns("replay", options.replay_path));
+
+	run_start = std::chrono::steady_clock::now();
+	std::vector<std::thread> senders;
+	for(std::unique_ptr<Channel>& channel : channels) {
+		senders.emplace_back(&LoadGenerator::runChannel, this, channel.get());
+	}
+	for(std::thread& sender : senders) {
+		sender.join();
+	}
+
+	// Calls in flight end at the latest at their deadline
+	for(std::unique_ptr<Channel>& channel : channels) {
+		while(channel->in_flight.load() > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	run_duration = std::chrono::steady_clock::now() - run_start;
+	return "";
+}
+
+std::string LoadGenerator::loadTargets() {
+	grpc::ClientContext context;
+	context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(options.timeout_ms));
+	proto::StudioGetRequest request;
+	proto::StudioGetResponse response;
+
+	grpc::Status s = channels[0]->stub->StudioGet(&context, request, &response);
+	if(!s.ok()) {
+		return "StudioGet failed: "+ s.error_message();
+	}
+
+	const proto::StudioState& studio = response.studio();
+	for(const proto::Show& show : studio.shows()) {
+		if(show.id() != studio.active_show_id()) {
+			continue;
+		}
+		show_id = show.id();
+		for(const proto::Scene& scene : show.scenes()) {
+			scene_ids.push_back(scene.id());
+			for(const proto::Source& source : scene.sources()) {
+				targets.push_back(Target{scene.id(), source.id(), source.type(), source.url(), scene.id() == show.active_scene_id()});
+			}
+		}
+	}
+
+	if(show_id.empty() || scene_ids.empty()) {
+		return "no active show with scenes to call";
+	}
+	trace_info("Targets", field_ns("show_id", show_id), field_n("scenes", scene_ids.size()), field_n("sources", targets.size()));
+	return "";
+}
+
+void LoadGenerator::planMix() {
+	double total_weight = 0;
+	for(double weight : options.weights) {
+		total_weight += weight;
+	}
+
+	std::vector<const Target*> inactive_targets;
+	for(const Target& target : targets) {
+		if(!target.active_scene) {
+			inactive_targets.push_back(&target);
+		}
+	}
+
+	// Each channel sends qps / channels calls per second, evenly spaced and
+	// shifted so that the channels interleave.
+	double interval_us = 1e6 * options.channels / options.qps;
+	int64_t calls_per_channel = options.qps * options.duration_sec / options.channels;
+
+	for(size_t c = 0; c < channels.size(); c++) {
+		std::mt19937_64 rng(c + 1);
+		std::uniform_real_distribution<double> pick_method(0, total_weight);
+
+		for(int64_t i = 0; i < calls_per_channel; i++) {
+			LoadCall call;
+			call.offset_us = (i + (double) c / channels.size()) * interval_us;
+
+			double r = pick_method(rng);
+			call.method = LoadMethodCount;
+			for(int m = 0; m < LoadMethodCount && call.method == LoadMethodCount; m++) {
+				if(r < options.weights[m]) {
+					call.method = (LoadMethod) m;
+				}
+				r -= options.weights[m];
+			}
+			if(call.method == LoadMethodCount) {
+				// Rounding, r was close to total_weight
+				continue;
+			}
+
+			call.show_id = show_id;
+			const Target* target = NULL;
+			if(call.method == LoadSourceSetProperties && !inactive_targets.empty()) {
+				// The active scene can't be modified
+				target = inactive_targets[rng() % inactive_targets.size()];
+			} else if(!targets.empty()) {
+				target = &targets[rng() % targets.size()];
+			}
+
+			if(call.method == LoadSceneSetAsCurrent) {
+				call.scene_id = scene_ids[rng() % scene_ids.size()];
+			} else if(target) {
+				call.scene_id = target->scene_id;
+				call.source_id = target->source_id;
+				// Same properties: the server does the whole update
+				call.source_type = target->source_type;
+				call.source_url = target->source_url;
+			}
+			channels[c]->calls.push_back(call);
+		}
+	}
+}
+
+std::string LoadGenerator::loadReplay() {
+	std::ifstream in(options.replay_path);
+	if(!in) {
+		return "can't open "+ options.replay_path;
+	}
+
+	std::string line;
+	size_t line_number = 0;
+	size_t c = 0;
+	while(std::getline(in, line)) {
+		line_number++;
+		if(line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		std::istringstream fields(line);
+		std::string method;
+		LoadCall call;
+		if(!(fields >> call.offset_us >> method)) {
+			return "invalid line "+ std::to_string(line_number) +" in "+ options.replay_path;
+		}
+		call.method = StringToLoadMethod(method);
+		if(call.method == LoadMethodCount) {
+			return "unknown method "+ method +" line "+ std::to_string(line_number);
+		}
+
+		std::string* ids[] = {&call.show_id, &call.scene_id, &call.source_id, &call.source_type, &call.source_url};
+		for(std::string* id : ids) {
+			if(fields >> *id && *id == "-") {
+				id->clear();
+			}
+		}
+
+		call.offset_us /= options.replay_speed;
+		channels[c]->calls.push_back(call);
+		c = (c + 1) % channels.size();
+	}
+
+	trace_info("Replay loaded", field_ns("path", options.replay_path), field_n("lines", line_number));
+	return "";
+}
+
+std::string LoadGenerator::writeRecord() {
+	std::vector<const LoadCall*> calls;
+	for(std::unique_ptr<Channel>& channel : channels) {
+		for(const LoadCall& call : channel->calls) {
+			calls.push_back(&call);
+		}
+	}
+	std::stable_sort(calls.begin(), calls.end(), [](const LoadCall* a, const LoadCall* b) {
+		return a->offset_us < b->offset_us;
+	});
+
+	std::ofstream out(options.record_path);
+	if(!out) {
+		return "can't write "+ options.record_path;
+	}
+	auto id = [](const std::string& value) { return value.empty() ? std::string("-") : value; };
+
+	out << "# offset_us method show_id scene_id source_id source_type source_url\n";
+	for(const LoadCall* call : calls) {
+		out << call->offset_us << " " << LoadMethodName(call->method) << " " << id(call->show_id) << " " << id(call->scene_id)
+			<< " " << id(call->source_id) << " " << id(call->source_type) << " " << id(call->source_url) << "\n";
+	}
+	return "";
+}
+
+void LoadGenerator::runChannel(Channel* channel) {
+	std::chrono::steady_clock::time_point end = run_start + std::chrono::seconds(options.duration_sec);
+
+	for(const LoadCall& call : channel->calls) {
+		std::chrono::steady_clock::time_point scheduled = run_start + std::chrono::microseconds(call.offset_us);
+		// A replayed trace is not cut by --duration
+		if(options.replay_path.empty() && scheduled >= end) {
+			break;
+		}
+		std::this_thread::sleep_until(scheduled);
+
+		if(channel->in_flight.load(std::memory_order_relaxed) >= options.max_in_flight) {
+			skipped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		send(channel, call, scheduled);
+	}
+}
+
+template<typename Req, typename Rep, typename Fn>
+void LoadGenerator::start(Channel* channel, LoadMethod method, const Req& req, std::chrono::steady_clock::time_point scheduled, Fn fn) {
+	// Owned by the callback, released when the call completes
+	struct Call {
+		grpc::ClientContext context;
+		Req request;
+		Rep response;
+	};
+	std::shared_ptr<Call> call = std::make_shared<Call>();
+	call->request = req;
+	call->context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(options.timeout_ms));
+
+	channel->in_flight.fetch_add(1, std::memory_order_relaxed);
+	fn(channel->stub->async(), &call->context, &call->request, &call->response, [this, channel, method, scheduled, call](grpc::Status s) {
+		done(channel, method, scheduled, s);
+	});
+}
+
+void LoadGenerator::send(Channel* channel, const LoadCall& call, std::chrono::steady_clock::time_point scheduled) {
+	switch(call.method) {
+	case LoadStudioGet: {
+		proto::StudioGetRequest req;
+		start<proto::StudioGetRequest, proto::StudioGetResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->StudioGet(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadShowGet: {
+		proto::ShowGetRequest req;
+		req.set_show_id(call.show_id);
+		start<proto::ShowGetRequest, proto::ShowGetResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->ShowGet(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadSceneGet: {
+		proto::SceneGetRequest req;
+		req.set_show_id(call.show_id);
+		req.set_scene_id(call.scene_id);
+		start<proto::SceneGetRequest, proto::SceneGetResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->SceneGet(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadSceneGetCurrent: {
+		proto::SceneGetCurrentRequest req;
+		req.set_show_id(call.show_id);
+		start<proto::SceneGetCurrentRequest, proto::SceneGetCurrentResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->SceneGetCurrent(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadSourceGet: {
+		proto::SourceGetRequest req;
+		req.set_show_id(call.show_id);
+		req.set_scene_id(call.scene_id);
+		req.set_source_id(call.source_id);
+		start<proto::SourceGetRequest, proto::SourceGetResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->SourceGet(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadSceneSetAsCurrent: {
+		proto::SceneSetAsCurrentRequest req;
+		req.set_show_id(call.show_id);
+		req.set_scene_id(call.scene_id);
+		start<proto::SceneSetAsCurrentRequest, proto::SceneSetAsCurrentResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->SceneSetAsCurrent(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadSourceSetProperties: {
+		proto::SourceSetPropertiesRequest req;
+		req.set_show_id(call.show_id);
+		req.set_scene_id(call.scene_id);
+		req.set_source_id(call.source_id);
+		req.set_source_type(call.source_type);
+		req.set_source_url(call.source_url);
+		start<proto::SourceSetPropertiesRequest, proto::SourceSetPropertiesResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->SourceSetProperties(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadHealth: {
+		google::protobuf::Empty req;
+		start<google::protobuf::Empty, proto::HealthResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->Health(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadGetMetrics: {
+		google::protobuf::Empty req;
+		start<google::protobuf::Empty, proto::MetricsResponse>(channel, call.method, req, scheduled,
+			[](auto stub, auto ctx, auto req, auto rep, auto cb) { stub->GetMetrics(ctx, req, rep, cb); });
+		break;
+	}
+	case LoadMethodCount:
+		break;
+	}
+}
+
+void LoadGenerator::done(Channel* channel, LoadMethod method, std::chrono::steady_clock::time_point scheduled, const grpc::Status& s) {
+	uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - scheduled).count();
+	stats[method].latency.Observe(us);
+	size_t code = s.error_code();
+	if(code < std::size(stats[method].codes)) {
+		stats[method].codes[code].fetch_add(1, std::memory_order_relaxed);
+	}
+	channel->in_flight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void LoadGenerator::Report() {
+	double seconds = std::chrono::duration<double>(run_duration).count();
+	uint64_t total = 0;
+	uint64_t total_errors = 0;
+
+	for(int m = 0; m < LoadMethodCount; m++) {
+		MethodStats& method = stats[m];
+		uint64_t count = method.latency.Count();
+		if(count == 0) {
+			continue;
+		}
+
+		uint64_t errors = count - method.codes[grpc::StatusCode::OK].load();
+		total += count;
+		total_errors += errors;
+
+		trace_info("bench", field_ns("method", LoadMethodName((LoadMethod) m)),
+			field_n("count", count),
+			field_n("qps", seconds > 0 ? count / seconds : 0),
+			field_n("error_rate", (double) errors / count),
+			field_n("p50_us", method.latency.Percentile(0.5)),
+			field_n("p90_us", method.latency.Percentile(0.9)),
+			field_n("p99_us", method.latency.Percentile(0.99)),
+			field_n("p999_us", method.latency.Percentile(0.999)),
+			field_n("max_us", method.latency.Percentile(1)));
+
+		for(size_t code = grpc::StatusCode::OK + 1; code < std::size(method.codes); code++) {
+			uint64_t n = method.codes[code].load();
+			if(n > 0) {
+				trace_info("bench errors", field_ns("method", LoadMethodName((LoadMethod) m)), field_nc("code", StatusCodeName(code)), field_n("count", n));
+			}
+		}
+	}
+
+	trace_info("bench total", field_n("count", total),
+		field_n("qps", seconds > 0 ? total / seconds : 0),
+		field_n("error_rate", total > 0 ? (double) total_errors / total : 0),
+		field_n("skipped", skipped.load()),
+		field_n("duration_sec", seconds));
+}
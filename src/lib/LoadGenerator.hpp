@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <grpc++/grpc++.h>
+#include "proto/studio.grpc.pb.h"
+#include "Metrics.hpp"
+
+/**
+ * @file
+ * @brief Load generator of the `bench` mode of obs_headless_client.
+ *
+ * Calls are sent open-loop: each channel has a sender thread which issues
+ * calls at their scheduled time with the callback API, without waiting for
+ * the previous ones to complete. Latency is measured from the scheduled time,
+ * so a server (or client) falling behind shows up in the percentiles instead
+ * of silently lowering the rate.
+ *
+ * Calls either follow a weighted mix of methods at a target QPS, or replay a
+ * trace file with one call per line:
+ *
+ *     # offset_us method [show_id [scene_id [source_id [source_type [source_url]]]]]
+ *     0 StudioGet
+ *     1500 SceneSetAsCurrent show_0 scene_1
+ *
+ * Missing or "-" ids are empty. The same format is written with --record, so
+ * a mix run can be replayed.
+ *
+ */
+
+// Methods the load generator can call.
+enum LoadMethod {
+	LoadStudioGet = 0,
+	LoadShowGet,
+	LoadSceneGet,
+	LoadSceneGetCurrent,
+	LoadSourceGet,
+	LoadSceneSetAsCurrent,
+	LoadSourceSetProperties,
+	LoadHealth,
+	LoadGetMetrics,
+	LoadMethodCount
+};
+
+const char* LoadMethodName(LoadMethod method);
+// Returns LoadMethodCount if unknown.
+LoadMethod StringToLoadMethod(const std::string& name);
+
+struct LoadOptions {
+	std::string target = "localhost:50051";
+	int channels = 4;
+	double qps = 100;
+	int duration_sec = 10;
+	int timeout_ms = 5000;
+	// Calls in flight per channel above which scheduled calls are skipped
+	int max_in_flight = 1000;
+	// Weights by method, e.g. from "StudioGet=45,SceneGet=45,SceneSetAsCurrent=10"
+	double weights[LoadMethodCount] = {};
+	// Trace file to replay instead of the mix, and its speed factor
+	std::string replay_path;
+	double replay_speed = 1;
+	// Trace file to write the sent calls to
+	std::string record_path;
+	int trace_format = 1;
+};
+
+/**
+ * Parses the arguments following "bench".
+ *
+ * @return  an error message, empty on success.
+ */
+std::string ParseLoadOptions(int argc, char** argv, LoadOptions* options);
+
+// Usage of the bench mode.
+std::string LoadUsage();
+
+// A call to send.
+struct LoadCall {
+	// From the start of the run
+	int64_t offset_us;
+	LoadMethod method;
+	std::string show_id;
+	std::string scene_id;
+	std::string source_id;
+	std::string source_type;
+	std::string source_url;
+};
+
+class LoadGenerator {
+public:
+	LoadGenerator(const LoadOptions& options);
+
+	/**
+	 * Reads the studio state to pick the call targets (or reads the replay
+	 * file), runs the load and waits for the calls in flight.
+	 *
+	 * @return  an error message, empty on success.
+	 */
+	std::string Run();
+
+	// Traces the latency percentiles, rate and status codes of each method.
+	void Report();
+
+private:
+	// Counters of a method
+	struct MethodStats {
+		LatencyHistogram latency;
+		std::atomic<uint64_t> codes[grpc::StatusCode::UNAUTHENTICATED + 1];
+		MethodStats();
+	};
+
+	struct Channel {
+		std::unique_ptr<proto::Studio::Stub> stub;
+		std::atomic<int64_t> in_flight;
+		std::vector<LoadCall> calls;
+	};
+
+	struct Target {
+		std::string scene_id;
+		std::string source_id;
+		std::string source_type;
+		std::string source_url;
+		bool active_scene;
+	};
+
+	std::string loadTargets();
+	std::string loadReplay();
+	void planMix();
+	void runChannel(Channel* channel);
+	void send(Channel* channel, const LoadCall& call, std::chrono::steady_clock::time_point scheduled);
+	template<typename Req, typename Rep, typename Fn>
+	void start(Channel* channel, LoadMethod method, const Req& req, std::chrono::steady_clock::time_point scheduled, Fn fn);
+	void done(Channel* channel, LoadMethod method, std::chrono::steady_clock::time_point scheduled, const grpc::Status& s);
+	std::string writeRecord();
+
+	LoadOptions options;
+	std::vector<std::unique_ptr<Channel>> channels;
+	MethodStats stats[LoadMethodCount];
+	// Scheduled calls not sent because max_in_flight was reached
+	std::atomic<uint64_t> skipped;
+
+	std::string show_id;
+	std::vector<std::string> scene_ids;
+	std::vector<Target> targets;
+
+	std::chrono::steady_clock::time_point run_start;
+	std::chrono::steady_clock::duration run_duration;
+};
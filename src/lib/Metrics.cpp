@@ -0,0 +1,484 @@
+#include "Metrics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <sstream>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <google/protobuf/descriptor.h>
+#include "Trace.hpp"
+
+static const uint64_t latency_bounds_us[] = METRICS_LATENCY_BOUNDS_US;
+
+static const char* status_code_names[] = {
+	"OK", "CANCELLED", "UNKNOWN", "INVALID_ARGUMENT", "DEADLINE_EXCEEDED",
+	"NOT_FOUND", "ALREADY_EXISTS", "PERMISSION_DENIED", "RESOURCE_EXHAUSTED",
+	"FAILED_PRECONDITION", "ABORTED", "OUT_OF_RANGE", "UNIMPLEMENTED",
+	"INTERNAL", "UNAVAILABLE", "DATA_LOSS", "UNAUTHENTICATED"
+};
+
+const char* StatusCodeName(int code) {
+	if(code < 0 || code >= (int) std::size(status_code_names)) {
+		return "UNKNOWN";
+	}
+	return status_code_names[code];
+}
+
+///////////////////////////////////////
+// HISTOGRAM                         //
+///////////////////////////////////////
+
+LatencyHistogram::LatencyHistogram()
+	: count(0)
+	, sum_us(0)
+	, max_us(0) {
+	for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		buckets[i] = 0;
+	}
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t us) {
+	if(us >= (1ULL << HISTOGRAM_MAX_BITS)) {
+		us = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+	}
+	if(us < (1ULL << HISTOGRAM_SUB_BITS)) {
+		return us;
+	}
+	int shift = 63 - __builtin_clzll(us) - HISTOGRAM_SUB_BITS;
+	// Mantissa in [2^SUB_BITS, 2^(SUB_BITS+1)), each octave has 2^SUB_BITS buckets
+	return ((shift + 1) << HISTOGRAM_SUB_BITS) + (us >> shift) - (1ULL << HISTOGRAM_SUB_BITS);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+	if(index < (1ULL << HISTOGRAM_SUB_BITS)) {
+		return index;
+	}
+	int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+	uint64_t mantissa = (index & ((1ULL << HISTOGRAM_SUB_BITS) - 1)) + (1ULL << HISTOGRAM_SUB_BITS);
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Observe(uint64_t us) {
+	buckets[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	sum_us.fetch_add(us, std::memory_order_relaxed);
+
+	uint64_t max = max_us.load(std::memory_order_relaxed);
+	while(us > max && !max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+	}
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) {
+	uint64_t total = count.load(std::memory_order_relaxed);
+	if(total == 0) {
+		return 0;
+	}
+	uint64_t rank = fraction * total;
+	if(rank < 1) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if(seen >= rank) {
+			return std::min(bucketUpperBound(i), max_us.load(std::memory_order_relaxed));
+		}
+	}
+	return max_us.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::UpdateProto(proto::Histogram* proto_histogram) {
+	proto_histogram->set_count(count.load(std::memory_order_relaxed));
+	proto_histogram->set_sum_us(sum_us.load(std::memory_order_relaxed));
+	proto_histogram->set_max_us(max_us.load(std::memory_order_relaxed));
+	proto_histogram->set_p50_us(Percentile(0.5));
+	proto_histogram->set_p90_us(Percentile(0.9));
+	proto_histogram->set_p99_us(Percentile(0.99));
+	proto_histogram->set_p999_us(Percentile(0.999));
+	for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		uint64_t n = buckets[i].load(std::memory_order_relaxed);
+		if(n > 0) {
+			proto_histogram->add_bounds_us(bucketUpperBound(i));
+			proto_histogram->add_counts(n);
+		}
+	}
+}
+
+RpcStats::RpcStats()
+	: in_flight(0) {
+	for(std::atomic<uint64_t>& code : codes) {
+		code = 0;
+	}
+}
+
+void RpcStats::UpdateProto(proto::RpcMetrics* proto_rpc) {
+	latency.UpdateProto(proto_rpc->mutable_latency());
+	queue_wait.UpdateProto(proto_rpc->mutable_queue_wait());
+	lock_wait.UpdateProto(proto_rpc->mutable_lock_wait());
+	work.UpdateProto(proto_rpc->mutable_work());
+	proto_rpc->set_in_flight(in_flight.load(std::memory_order_relaxed));
+	for(size_t i = 0; i < std::size(codes); i++) {
+		uint64_t n = codes[i].load(std::memory_order_relaxed);
+		if(n > 0) {
+			proto::StatusCount* proto_code = proto_rpc->add_codes();
+			proto_code->set_code(StatusCodeName(i));
+			proto_code->set_count(n);
+		}
+	}
+}
+
+///////////////////////////////////////
+// METRICS                           //
+///////////////////////////////////////
+
+Metrics::Metrics()
+	: stopped(false) {
+	const google::protobuf::ServiceDescriptor* service =
+		google::protobuf::DescriptorPool::generated_pool()->FindServiceByName(proto::Studio::service_full_name());
+	for(int i = 0; service && i < service->method_count(); i++) {
+		std::string method = "/" + service->full_name() + "/" + service->method(i)->name();
+		rpcs[method] = std::make_unique<RpcStats>();
+	}
+
+	sem_init(&dump_sem, 0, 0);
+	dump_thread = std::thread(&Metrics::runDump, this);
+}
+
+Metrics::~Metrics() {
+	stopped = true;
+	sem_post(&dump_sem);
+	dump_thread.join();
+	sem_destroy(&dump_sem);
+}
+
+RpcStats* Metrics::Rpc(std::string_view method) {
+	auto it = rpcs.find(method);
+	if(it == rpcs.end()) {
+		return &other_rpcs;
+	}
+	return it->second.get();
+}
+
+void Metrics::UpdateProto(proto::MetricsResponse* rep) {
+	for(auto & it : rpcs) {
+		proto::RpcMetrics* proto_rpc = rep->add_rpcs();
+		proto_rpc->set_method(it.first);
+		it.second->UpdateProto(proto_rpc);
+	}
+	proto::RpcMetrics* proto_rpc = rep->add_rpcs();
+	proto_rpc->set_method("other");
+	other_rpcs.UpdateProto(proto_rpc);
+}
+
+void Metrics::RequestDump() {
+	sem_post(&dump_sem);
+}
+
+void Metrics::runDump() {
+	while(true) {
+		while(sem_wait(&dump_sem) != 0) {
+			// EINTR
+		}
+		if(stopped) {
+			return;
+		}
+		dump();
+	}
+}
+
+void Metrics::dump() {
+	trace_info("RPC metrics (us)");
+	for(auto & it : rpcs) {
+		RpcStats* rpc = it.second.get();
+		if(rpc->latency.Count() == 0 && rpc->in_flight.load(std::memory_order_relaxed) == 0) {
+			continue;
+		}
+		uint64_t errors = 0;
+		for(size_t i = grpc::StatusCode::OK + 1; i < std::size(rpc->codes); i++) {
+			errors += rpc->codes[i].load(std::memory_order_relaxed);
+		}
+		trace_info("rpc", field_ns("method", it.first),
+			field_n("count", rpc->latency.Count()),
+			field_n("in_flight", rpc->in_flight.load(std::memory_order_relaxed)),
+			field_n("errors", errors),
+			field_n("p50", rpc->latency.Percentile(0.5)),
+			field_n("p99", rpc->latency.Percentile(0.99)),
+			field_n("max", rpc->latency.Percentile(1)),
+			field_n("queue_p99", rpc->queue_wait.Percentile(0.99)),
+			field_n("lock_wait_p50", rpc->lock_wait.Percentile(0.5)),
+			field_n("lock_wait_p99", rpc->lock_wait.Percentile(0.99)),
+			field_n("work_p50", rpc->work.Percentile(0.5)),
+			field_n("work_p99", rpc->work.Percentile(0.99)));
+	}
+}
+
+// Escapes a Prometheus label value.
+static std::string label(const std::string& value) {
+	std::string escaped;
+	for(char c : value) {
+		if(c == '\\' || c == '"') {
+			escaped += '\\';
+			escaped += c;
+		} else if(c == '\n') {
+			escaped += "\\n";
+		} else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+// Renders a histogram with the METRICS_LATENCY_BOUNDS_US buckets, in seconds.
+static void renderHistogram(std::ostringstream& out, const char* name, const std::string& method, const proto::Histogram& histogram) {
+	uint64_t cumulative = 0;
+	int i = 0;
+	for(uint64_t le : latency_bounds_us) {
+		while(i < histogram.bounds_us_size() && histogram.bounds_us(i) <= le) {
+			cumulative += histogram.counts(i);
+			i++;
+		}
+		out << name << "_bucket{method=\"" << method << "\",le=\"" << le / 1e6 << "\"} " << cumulative << "\n";
+	}
+	out << name << "_bucket{method=\"" << method << "\",le=\"+Inf\"} " << histogram.count() << "\n"
+		<< name << "_sum{method=\"" << method << "\"} " << histogram.sum_us() / 1e6 << "\n"
+		<< name << "_count{method=\"" << method << "\"} " << histogram.count() << "\n";
+}
+
+std::string Metrics::ToPrometheus(const proto::MetricsResponse& rep) {
+	std::ostringstream out;
+
+	const proto::VideoMetrics& video = rep.video();
+	out << "# TYPE obs_video_total_frames counter\n"
+		<< "obs_video_total_frames " << video.total_frames() << "\n"
+		<< "# TYPE obs_video_lagged_frames counter\n"
+		<< "obs_video_lagged_frames " << video.lagged_frames() << "\n"
+		<< "# TYPE obs_video_average_frame_time_seconds gauge\n"
+		<< "obs_video_average_frame_time_seconds " << video.average_frame_time_ns() / 1e9 << "\n"
+		<< "# TYPE obs_video_output_total_frames counter\n"
+		<< "obs_video_output_total_frames " << video.output_total_frames() << "\n"
+		<< "# TYPE obs_video_output_skipped_frames counter\n"
+		<< "obs_video_output_skipped_frames " << video.output_skipped_frames() << "\n";
+
+	out << "# TYPE obs_output_active gauge\n"
+		<< "# TYPE obs_output_bytes counter\n"
+		<< "# TYPE obs_output_frames counter\n"
+		<< "# TYPE obs_output_dropped_frames counter\n"
+		<< "# TYPE obs_output_congestion gauge\n"
+		<< "# TYPE obs_output_connect_time_seconds gauge\n";
+	for(const proto::OutputMetrics& output : rep.outputs()) {
+		std::string labels = "{id=\""+ label(output.id()) +"\",name=\""+ label(output.name()) +"\",rendition=\""+ label(output.rendition()) +"\"}";
+		out << "obs_output_active" << labels << " " << (output.active() ? 1 : 0) << "\n"
+			<< "obs_output_bytes" << labels << " " << output.total_bytes() << "\n"
+			<< "obs_output_frames" << labels << " " << output.total_frames() << "\n"
+			<< "obs_output_dropped_frames" << labels << " " << output.frames_dropped() << "\n"
+			<< "obs_output_congestion" << labels << " " << output.congestion() << "\n"
+			<< "obs_output_connect_time_seconds" << labels << " " << output.connect_time_ms() / 1e3 << "\n";
+	}
+
+	out << "# TYPE obs_source_references gauge\n"
+		<< "# TYPE obs_source_active gauge\n"
+		<< "# TYPE obs_source_showing gauge\n"
+		<< "# TYPE obs_source_width gauge\n"
+		<< "# TYPE obs_source_height gauge\n";
+	for(const proto::SourceMetrics& source : rep.sources()) {
+		std::string labels = "{name=\""+ label(source.name()) +"\",type=\""+ label(source.type()) +"\",media_state=\""+ label(source.media_state()) +"\"}";
+		out << "obs_source_references" << labels << " " << source.references() << "\n"
+			<< "obs_source_active" << labels << " " << (source.active() ? 1 : 0) << "\n"
+			<< "obs_source_showing" << labels << " " << (source.showing() ? 1 : 0) << "\n"
+			<< "obs_source_width" << labels << " " << source.width() << "\n"
+			<< "obs_source_height" << labels << " " << source.height() << "\n";
+	}
+
+	out << "# TYPE obs_source_stalled gauge\n"
+		<< "# TYPE obs_source_idle_seconds gauge\n"
+		<< "# TYPE obs_source_stalls counter\n"
+		<< "# TYPE obs_source_reconnects counter\n"
+		<< "# TYPE obs_source_outage_seconds counter\n"
+		<< "# TYPE obs_source_failed_over gauge\n"
+		<< "# TYPE obs_source_failovers counter\n"
+		<< "# TYPE obs_source_failover_seconds gauge\n"
+		<< "# TYPE obs_source_recovery_seconds gauge\n"
+		<< "# TYPE obs_source_open_seconds gauge\n"
+		<< "# TYPE obs_source_delay_seconds gauge\n";
+	for(const proto::SourceMetrics& source : rep.sources()) {
+		if(!source.watched()) {
+			continue;
+		}
+		std::string labels = "{name=\""+ label(source.name()) +"\"}";
+		out << "obs_source_stalled" << labels << " " << (source.stalled() ? 1 : 0) << "\n"
+			<< "obs_source_idle_seconds" << labels << " " << source.idle_ms() / 1e3 << "\n"
+			<< "obs_source_stalls" << labels << " " << source.stalls() << "\n"
+			<< "obs_source_reconnects" << labels << " " << source.reconnects() << "\n"
+			<< "obs_source_outage_seconds" << labels << " " << source.total_outage_ms() / 1e3 << "\n"
+			<< "obs_source_failed_over" << labels << " " << (source.failed_over() ? 1 : 0) << "\n"
+			<< "obs_source_failovers" << labels << " " << source.failovers() << "\n"
+			<< "obs_source_failover_seconds" << labels << " " << source.failover_ms() / 1e3 << "\n"
+			<< "obs_source_recovery_seconds" << labels << " " << source.recovery_ms() / 1e3 << "\n"
+			<< "obs_source_open_seconds" << labels << " " << source.open_ms() / 1e3 << "\n"
+			<< "obs_source_delay_seconds" << labels << " " << source.delay_ms() / 1e3 << "\n";
+	}
+
+	const proto::SourceRegistryStats& registry = rep.source_registry();
+	out << "# TYPE obs_source_registry_instances gauge\n"
+		<< "obs_source_registry_instances " << registry.instances() << "\n"
+		<< "# TYPE obs_source_registry_references gauge\n"
+		<< "obs_source_registry_references " << registry.references() << "\n"
+		<< "# TYPE obs_source_registry_saved gauge\n"
+		<< "obs_source_registry_saved " << registry.saved() << "\n";
+
+	out << "# TYPE grpc_server_handling_seconds histogram\n"
+		<< "# TYPE grpc_server_queue_wait_seconds histogram\n"
+		<< "# TYPE grpc_server_lock_wait_seconds histogram\n"
+		<< "# TYPE grpc_server_work_seconds histogram\n"
+		<< "# TYPE grpc_server_in_flight gauge\n"
+		<< "# TYPE grpc_server_handled_total counter\n";
+	for(const proto::RpcMetrics& rpc : rep.rpcs()) {
+		if(rpc.latency().count() == 0 && rpc.in_flight() == 0) {
+			continue;
+		}
+		std::string method = label(rpc.method());
+		renderHistogram(out, "grpc_server_handling_seconds", method, rpc.latency());
+		renderHistogram(out, "grpc_server_queue_wait_seconds", method, rpc.queue_wait());
+		renderHistogram(out, "grpc_server_lock_wait_seconds", method, rpc.lock_wait());
+		renderHistogram(out, "grpc_server_work_seconds", method, rpc.work());
+		out << "grpc_server_in_flight{method=\"" << method << "\"} " << rpc.in_flight() << "\n";
+		for(const proto::StatusCount& code : rpc.codes()) {
+			out << "grpc_server_handled_total{method=\"" << method << "\",code=\"" << code.code() << "\"} " << code.count() << "\n";
+		}
+	}
+
+	return out.str();
+}
+
+///////////////////////////////////////
+// INTERCEPTOR                       //
+///////////////////////////////////////
+
+class MetricsInterceptor : public grpc::experimental::Interceptor {
+public:
+	MetricsInterceptor(RpcStats* rpc)
+		: rpc(rpc)
+		, start(std::chrono::steady_clock::now()) {
+		rpc->in_flight.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	~MetricsInterceptor() {
+		rpc->in_flight.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void Intercept(grpc::experimental::InterceptorBatchMethods* methods) override {
+		if(methods->QueryInterceptionHookPoint(grpc::experimental::InterceptionHookPoints::PRE_SEND_STATUS)) {
+			uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			// Filled on this thread by the handler, see CallTiming
+			uint64_t waited = call_timing.queue_wait_us + call_timing.lock_wait_us;
+
+			rpc->latency.Observe(us);
+			rpc->queue_wait.Observe(call_timing.queue_wait_us);
+			rpc->lock_wait.Observe(call_timing.lock_wait_us);
+			rpc->work.Observe(us > waited ? us - waited : 0);
+
+			size_t code = methods->GetSendStatus().error_code();
+			if(code < std::size(rpc->codes)) {
+				rpc->codes[code].fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		methods->Proceed();
+	}
+
+private:
+	RpcStats* rpc;
+	std::chrono::steady_clock::time_point start;
+};
+
+grpc::experimental::Interceptor* MetricsInterceptorFactory::CreateServerInterceptor(grpc::experimental::ServerRpcInfo* info) {
+	return new MetricsInterceptor(metrics->Rpc(info->method() ? info->method() : ""));
+}
+
+///////////////////////////////////////
+// HTTP SERVER                       //
+///////////////////////////////////////
+
+MetricsHttpServer::MetricsHttpServer()
+	: fd(-1)
+	, stopped(true) {
+}
+
+MetricsHttpServer::~MetricsHttpServer() {
+	Stop();
+}
+
+bool MetricsHttpServer::Start(int port, std::function<std::string()> render_in) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0) {
+		return false;
+	}
+	int yes = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		close(fd);
+		fd = -1;
+		return false;
+	}
+
+	render = render_in;
+	stopped = false;
+	thread = std::thread(&MetricsHttpServer::run, this);
+	trace_info("Metrics endpoint listening", field(port));
+	return true;
+}
+
+void MetricsHttpServer::Stop() {
+	if(stopped.exchange(true)) {
+		return;
+	}
+	thread.join();
+	close(fd);
+	fd = -1;
+}
+
+void MetricsHttpServer::run() {
+	while(!stopped) {
+		// Wakes up regularly to check stopped
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if(poll(&pfd, 1, 200) <= 0) {
+			continue;
+		}
+
+		int client = accept(fd, NULL, NULL);
+		if(client < 0) {
+			continue;
+		}
+
+		// The request is not parsed: any path returns the metrics.
+		struct timeval timeout = { 1, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		char request[4096];
+		if(recv(client, request, sizeof(request), 0) > 0) {
+			std::string body = render();
+			std::string response = "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: "+ std::to_string(body.size()) +"\r\n"
+				"Connection: close\r\n\r\n"+ body;
+
+			size_t sent = 0;
+			while(sent < response.size()) {
+				ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+				if(n <= 0) {
+					break;
+				}
+				sent += n;
+			}
+		}
+		close(client);
+	}
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <semaphore.h>
+#include <grpcpp/support/server_interceptor.h>
+#include "proto/studio.grpc.pb.h"
+
+/**
+ * @file
+ * @brief Counters of the server, exposed by GetMetrics and in the Prometheus
+ * text format.
+ *
+ * The counters updated on the hot paths are relaxed atomics: recording a
+ * value never takes a lock. The libobs counters (frames, lagged frames,
+ * dropped frames, bytes) are not copied here, they are sampled when the
+ * metrics are read.
+ *
+ * Each call is split in queue time (waiting for a worker), lock wait (waiting
+ * for Studio::mtx, a TimedMutex) and work time (the rest), so that e.g. a
+ * slow SceneSetAsCurrent can be told apart from one stuck behind StudioStart.
+ *
+ */
+
+// Upper bounds of the Prometheus histogram buckets, in microseconds.
+#define METRICS_LATENCY_BOUNDS_US { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 }
+
+// Log-linear buckets: values below 2^HISTOGRAM_SUB_BITS are exact, above
+// each power of 2 is split in 2^HISTOGRAM_SUB_BITS buckets (about 6% error).
+// Values are clamped to 2^HISTOGRAM_MAX_BITS - 1 us (71 min).
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_MAX_BITS 32
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/**
+ * High dynamic range histogram of durations, in the spirit of HdrHistogram:
+ * a fixed array of log-linear buckets, so that percentiles stay precise from
+ * microseconds to minutes without any allocation.
+ */
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	// Records a duration, lock-free.
+	void Observe(uint64_t us);
+	// Number of values recorded.
+	uint64_t Count() { return count.load(std::memory_order_relaxed); }
+	// Upper bound of the bucket holding the given fraction (0 to 1) of the
+	// values, 0 if empty.
+	uint64_t Percentile(double fraction);
+	void UpdateProto(proto::Histogram* proto_histogram);
+
+private:
+	static size_t bucketIndex(uint64_t us);
+	static uint64_t bucketUpperBound(size_t index);
+
+	std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum_us;
+	std::atomic<uint64_t> max_us;
+};
+
+// Name of a grpc::StatusCode, e.g. "NOT_FOUND".
+const char* StatusCodeName(int code);
+
+// Counters of a gRPC method.
+struct RpcStats {
+	// From the start of the call to its status
+	LatencyHistogram latency;
+	// Time waiting for a worker thread, for the dispatched methods
+	LatencyHistogram queue_wait;
+	// Time waiting for Studio::mtx
+	LatencyHistogram lock_wait;
+	// latency - queue_wait - lock_wait
+	LatencyHistogram work;
+	std::atomic<int64_t> in_flight;
+	// Calls by grpc::StatusCode
+	std::atomic<uint64_t> codes[grpc::StatusCode::UNAUTHENTICATED + 1];
+
+	RpcStats();
+	void UpdateProto(proto::RpcMetrics* proto_rpc);
+};
+
+/**
+ * Timing of the call handled by the calling thread. Filled by the Studio
+ * dispatch and by TimedMutex, read by the interceptor when the call sends its
+ * status, which happens on the same thread (ServerUnaryReactor::Finish).
+ */
+struct CallTiming {
+	uint64_t queue_wait_us = 0;
+	uint64_t lock_wait_us = 0;
+};
+inline thread_local CallTiming call_timing;
+
+/**
+ * std::mutex adding the time spent waiting for it to call_timing. Locking an
+ * available mutex costs a try_lock, the clock is only read on contention.
+ */
+class TimedMutex {
+public:
+	void lock() {
+		if(mtx.try_lock()) {
+			return;
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		mtx.lock();
+		call_timing.lock_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+	bool try_lock() { return mtx.try_lock(); }
+	void unlock() { mtx.unlock(); }
+
+private:
+	std::mutex mtx;
+};
+
+class Metrics {
+public:
+	/**
+	 * Metrics constructor. Creates the counters of each method of the Studio
+	 * service, so that recording never modifies the map, and starts the dump
+	 * thread.
+	 */
+	Metrics();
+
+	/**
+	 * Metrics destructor. Stops the dump thread.
+	 */
+	~Metrics();
+
+	// Returns the counters of a method, given its full gRPC name, e.g.
+	// "/proto.Studio/StudioGet". Lock-free.
+	RpcStats* Rpc(std::string_view method);
+
+	// Adds the RPC counters to a GetMetrics response.
+	void UpdateProto(proto::MetricsResponse* rep);
+
+	/**
+	 * Asks the dump thread to trace the RPC counters. Async-signal-safe, so
+	 * it can be called from a SIGUSR1 handler.
+	 */
+	void RequestDump();
+
+	// Renders a GetMetrics response in the Prometheus text format.
+	static std::string ToPrometheus(const proto::MetricsResponse& rep);
+
+private:
+	void dump();
+	void runDump();
+
+	// Read-only after the constructor
+	std::map<std::string, std::unique_ptr<RpcStats>, std::less<>> rpcs;
+	// Calls of methods not in the Studio service (e.g. reflection)
+	RpcStats other_rpcs;
+
+	sem_t dump_sem;
+	std::atomic<bool> stopped;
+	std::thread dump_thread;
+};
+
+/**
+ * Times every call of the server into a Metrics. Registered on the
+ * ServerBuilder with experimental().SetInterceptorCreators().
+ */
+class MetricsInterceptorFactory : public grpc::experimental::ServerInterceptorFactoryInterface {
+public:
+	MetricsInterceptorFactory(Metrics* metrics) : metrics(metrics) {}
+	grpc::experimental::Interceptor* CreateServerInterceptor(grpc::experimental::ServerRpcInfo* info) override;
+
+private:
+	Metrics* metrics;
+};
+
+/**
+ * Minimal HTTP server answering any request with the metrics in the
+ * Prometheus text format. Listens on 127.0.0.1 only.
+ */
+class MetricsHttpServer {
+public:
+	MetricsHttpServer();
+
+	/**
+	 * MetricsHttpServer destructor. Calls Stop.
+	 */
+	~MetricsHttpServer();
+
+	/**
+	 * Starts listening.
+	 *
+	 * @param   port    local TCP port.
+	 * @param   render  returns the response body, called by the server
+	 *                  thread for each request.
+	 * @return          false if the port could not be bound.
+	 */
+	bool Start(int port, std::function<std::string()> render);
+
+	// Stops listening and joins the server thread.
+	void Stop();
+
+private:
+	void run();
+
+	int fd;
+	std::function<std::string()> render;
+	std::atomic<bool> stopped;
+	std::thread thread;
+};
@@ -0,0 +1,57 @@
+#include "NativeDisplay.hpp"
+#include <obs.h>
+#include <obs-nix-platform.h>
+#include <X11/Xlib.h>
+#ifdef ENABLE_QT
+#include <QGuiApplication>
+#include <qpa/qplatformnativeinterface.h>
+#endif
+
+// Display opened by the x11 backend, owned by this module.
+static Display* x11_display = nullptr;
+
+bool NativeDisplaySupported(const std::string& backend) {
+#ifdef ENABLE_QT
+	if(backend == "qt") {
+		return true;
+	}
+#endif
+	return backend == "x11";
+}
+
+std::string NativeDisplayOpen(const std::string& backend) {
+	void* display = nullptr;
+
+	if(backend == "x11") {
+		x11_display = XOpenDisplay(nullptr);
+		if(!x11_display) {
+			return "XOpenDisplay failed, check DISPLAY";
+		}
+		display = x11_display;
+	}
+#ifdef ENABLE_QT
+	else if(backend == "qt") {
+		// OBS 27+: we need to set the display manually. The OBS app does it
+		// using QT, so we do the same here.
+		QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
+		if(!native) {
+			return "no QGuiApplication";
+		}
+		display = native->nativeResourceForIntegration("display");
+	}
+#endif
+	else {
+		return "unsupported display backend: "+ backend;
+	}
+
+	obs_set_nix_platform(OBS_NIX_PLATFORM_X11_EGL);
+	obs_set_nix_platform_display(display);
+	return "";
+}
+
+void NativeDisplayClose() {
+	if(x11_display) {
+		XCloseDisplay(x11_display);
+		x11_display = nullptr;
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+
+/**
+ * @file
+ * @brief Native display handle given to libobs with
+ * obs_set_nix_platform_display.
+ *
+ * libobs-opengl needs an X11 display to create its EGL context, even though
+ * obs-headless only renders offscreen. Two backends provide it:
+ *
+ * - qt: the display of the QApplication created by the server, as the OBS app
+ *   does. Needs Qt (ENABLE_QT) and an X server.
+ * - x11: a display opened with Xlib from $DISPLAY, without Qt. Any X server
+ *   works, e.g. Xvfb with Mesa llvmpipe in a container without a GPU.
+ *
+ * Xlib macros (Status, None, ...) clash with gRPC, so they stay in
+ * NativeDisplay.cpp.
+ *
+ */
+
+// Returns true if the backend is known and compiled in.
+bool NativeDisplaySupported(const std::string& backend);
+
+/**
+ * Opens the display of a backend and sets it as the libobs platform display.
+ * Must be called before obs_startup.
+ *
+ * @param   backend  "qt" or "x11".
+ * @return           an error message, empty on success.
+ */
+std::string NativeDisplayOpen(const std::string& backend);
+
+// Closes the display opened by NativeDisplayOpen, after obs_shutdown.
+void NativeDisplayClose();
@@ -0,0 +1,352 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "Output.hpp"
+
+// Maximum time Stop waits for the obs output to stop.
+static const std::chrono::seconds OUTPUT_STOP_TIMEOUT(5);
+
+std::string OutputTypeToString(OutputType type) {
+	switch(type) {
+	case OutputRTMP:
+		return "RTMP";
+	case OutputFile:
+		return "File";
+	}
+	return "InvalidType";
+}
+
+OutputType StringToOutputType(std::string type) {
+	if(type == "RTMP") {
+		return OutputRTMP;
+	} else if(type == "File") {
+		return OutputFile;
+	}
+	return OutputInvalid;
+}
+
+Output::Output(std::string id, std::string name, OutputType type, std::string url, std::string key, std::string rendition, Settings* settings, EventBus* events)
+	: id(id)
+	, name(name)
+	, type(type)
+	, url(url)
+	, key(key)
+	, rendition(rendition)
+	, started(false)
+	, obs_output(nullptr)
+	, obs_service(nullptr)
+	, settings(settings)
+	, events(events)
+	, segment_sec(0)
+	, max_segments(0)
+	, active(false)
+	, reconnecting(false)
+	, segments_closed(false) {
+	trace_debug("Create Output", field_s(id), field_s(name), field_ns("type", OutputTypeToString(type)), field_s(url), field_s(rendition));
+}
+
+Output::~Output() {
+	if(obs_output) {
+		signal_handler_t *handler = obs_output_get_signal_handler(obs_output);
+		signal_handler_disconnect(handler, "stop", OutputStopCb, this);
+		signal_handler_disconnect(handler, "reconnect", OutputReconnectCb, this);
+		signal_handler_disconnect(handler, "reconnect_success", OutputReconnectSuccessCb, this);
+		signal_handler_disconnect(handler, "file_changed", OutputFileChangedCb, this);
+		obs_output_release(obs_output);
+	}
+	if(obs_service) {
+		obs_service_release(obs_service);
+	}
+
+	if(segment_cleaner.joinable()) {
+		// The segments expired before are deleted first
+		std::unique_lock<std::mutex> lock(segments_mtx);
+		segments_closed = true;
+		lock.unlock();
+		segments_cv.notify_one();
+		segment_cleaner.join();
+	}
+}
+
+grpc::Status Output::Start(obs_encoder_t* enc_v, obs_encoder_t* enc_a) {
+	grpc::Status s = grpc::Status::OK;
+
+	if(started) {
+		trace_error("Output already started", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Output already started");
+	}
+
+	if(!obs_output) {
+		s = create();
+		if(!s.ok()) {
+			return s;
+		}
+	}
+
+	// The encoders are shared with the other outputs
+	obs_output_set_video_encoder(obs_output, enc_v);
+	obs_output_set_audio_encoder(obs_output, enc_a, 0);
+	if(obs_service) {
+		obs_output_set_service(obs_output, obs_service);
+		obs_output_set_reconnect_settings(obs_output, settings->output_reconnect_max_retries, settings->output_reconnect_delay_sec);
+	}
+
+	if(obs_output_start(obs_output) != true) {
+		std::string output_error = obs_output_get_last_error(obs_output) ? obs_output_get_last_error(obs_output) : "";
+		trace_error("obs_output_start failed", field_s(id), error(output_error));
+		setState(false, false, output_error);
+		return grpc::Status(grpc::INTERNAL, "obs_output_start failed: "+ output_error);
+	}
+
+	started = true;
+	setState(true, false, "");
+	return grpc::Status::OK;
+}
+
+grpc::Status Output::Stop() {
+	if(!started) {
+		trace_error("Output already stopped", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Output already stopped");
+	}
+
+	// The obs output is reused by the next Start, wait until it is actually
+	// stopped.
+	obs_output_stop(obs_output);
+	std::chrono::steady_clock::time_point stop_deadline = std::chrono::steady_clock::now() + OUTPUT_STOP_TIMEOUT;
+	while(obs_output_active(obs_output) && std::chrono::steady_clock::now() < stop_deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	if(obs_output_active(obs_output)) {
+		trace_warn("Output still active, forcing stop", field_s(id));
+		obs_output_force_stop(obs_output);
+	}
+
+	started = false;
+	setState(false, false, "");
+	return grpc::Status::OK;
+}
+
+grpc::Status Output::UpdateProto(proto::Output* proto_output) {
+	proto_output->Clear();
+	proto_output->set_id(id);
+	proto_output->set_name(name);
+	proto_output->set_type(OutputTypeToString(type));
+	proto_output->set_url(url);
+	proto_output->set_started(started);
+	proto_output->set_rendition(rendition);
+
+	std::unique_lock<std::mutex> lock(state_mtx);
+	proto_output->set_active(active);
+	proto_output->set_reconnecting(reconnecting);
+	proto_output->set_last_error(last_error);
+	return grpc::Status::OK;
+}
+
+void Output::SetSegments(std::string directory, std::string extension, int segment_sec_in, int max_segments_in) {
+	segment_directory = directory;
+	segment_extension = extension;
+	segment_sec = segment_sec_in;
+	max_segments = max_segments_in;
+}
+
+uint64_t Output::TotalBytes() {
+	obs_output_t* output = obs_output;
+	return output ? obs_output_get_total_bytes(output) : 0;
+}
+
+int Output::FramesDropped() {
+	obs_output_t* output = obs_output;
+	return output ? obs_output_get_frames_dropped(output) : 0;
+}
+
+int Output::TotalFrames() {
+	obs_output_t* output = obs_output;
+	return output ? obs_output_get_total_frames(output) : 0;
+}
+
+float Output::Congestion() {
+	obs_output_t* output = obs_output;
+	return output ? obs_output_get_congestion(output) : 0;
+}
+
+int Output::ConnectTimeMs() {
+	obs_output_t* output = obs_output;
+	return output ? obs_output_get_connect_time_ms(output) : 0;
+}
+
+bool Output::Active() {
+	std::unique_lock<std::mutex> lock(state_mtx);
+	return active;
+}
+
+grpc::Status Output::create() {
+	std::string output_name = "obs_output_"+ id;
+
+	if(type == OutputRTMP) {
+		obs_data_t* rtmp_settings = obs_data_create();
+		if (!rtmp_settings) {
+			return grpc::Status(grpc::INTERNAL, "Couldn't create rtmp settings");
+		}
+		obs_data_set_string(rtmp_settings, "server", url.c_str());
+		obs_data_set_string(rtmp_settings, "key", key.c_str());
+
+		std::string service_name = "obs_service_"+ id;
+		obs_service = obs_service_create("rtmp_common", service_name.c_str(), rtmp_settings, nullptr);
+		obs_data_release(rtmp_settings);
+		if (!obs_service) {
+			trace_error("Couldn't create service", field_s(id));
+			return grpc::Status(grpc::INTERNAL, "Couldn't create service");
+		}
+
+		obs_output = obs_output_create("rtmp_output", output_name.c_str(), NULL, nullptr);
+	} else if(type == OutputFile) {
+		obs_data_t* file_settings = obs_data_create();
+		if (!file_settings) {
+			return grpc::Status(grpc::INTERNAL, "Couldn't create file settings");
+		}
+		obs_data_set_string(file_settings, "path", url.c_str());
+		if(segment_extension == "mp4") {
+			// Fragmented, so that a segment is readable while written
+			obs_data_set_string(file_settings, "muxer_settings", "movflags=frag_keyframe+empty_moov+default_base_moof");
+		}
+		if(segment_sec > 0) {
+			// The muxer names the following segments itself
+			obs_data_set_int(file_settings, "max_time_sec", segment_sec);
+			obs_data_set_string(file_settings, "directory", segment_directory.c_str());
+			obs_data_set_string(file_settings, "format", "%CCYY-%MM-%DD_%hh-%mm-%ss");
+			obs_data_set_string(file_settings, "extension", segment_extension.c_str());
+			obs_data_set_bool(file_settings, "allow_spaces", false);
+			obs_data_set_bool(file_settings, "allow_overwrite", false);
+		}
+
+		obs_output = obs_output_create("ffmpeg_muxer", output_name.c_str(), file_settings, nullptr);
+		obs_data_release(file_settings);
+	} else {
+		trace_error("Unsupported output type", field(type));
+	}
+
+	if (!obs_output) {
+		trace_error("Couldn't create output", field_s(id));
+		return grpc::Status(grpc::INTERNAL, "Couldn't create output");
+	}
+
+	signal_handler_t *handler = obs_output_get_signal_handler(obs_output);
+	signal_handler_connect(handler, "stop", OutputStopCb, this);
+	signal_handler_connect(handler, "reconnect", OutputReconnectCb, this);
+	signal_handler_connect(handler, "reconnect_success", OutputReconnectSuccessCb, this);
+	signal_handler_connect(handler, "file_changed", OutputFileChangedCb, this);
+
+	if(type == OutputFile) {
+		std::unique_lock<std::mutex> lock(segments_mtx);
+		segments.push_back(url);
+		lock.unlock();
+		if(segment_sec > 0 && max_segments > 0) {
+			segment_cleaner = std::thread(&Output::cleanSegments, this);
+		}
+	}
+
+	return grpc::Status::OK;
+}
+
+void Output::cleanSegments() {
+	std::unique_lock<std::mutex> lock(segments_mtx);
+	while(true) {
+		segments_cv.wait(lock, [this] { return segments_closed || !expired_segments.empty(); });
+		if(expired_segments.empty()) {
+			return;
+		}
+		std::string oldest = expired_segments.front();
+		expired_segments.pop_front();
+
+		lock.unlock();
+		if(std::remove(oldest.c_str()) != 0) {
+			trace_warn("Failed to delete segment", field_ns("id", id), field_s(oldest));
+		}
+		lock.lock();
+	}
+}
+
+void Output::setState(bool active_in, bool reconnecting_in, std::string last_error_in) {
+	std::unique_lock<std::mutex> lock(state_mtx);
+	active = active_in;
+	reconnecting = reconnecting_in;
+	last_error = last_error_in;
+	lock.unlock();
+
+	if(events) {
+		proto::StudioEvent event;
+		proto::OutputStateChanged* output_state = event.mutable_output_state_changed();
+		output_state->set_output_id(id);
+		output_state->set_started(active_in);
+		output_state->set_reconnecting(reconnecting_in);
+		output_state->set_error(last_error_in);
+		events->Publish(std::move(event));
+	}
+}
+
+void OutputStopCb(void *my_data, calldata_t *cd) {
+	Output* output = (Output*) my_data;
+	if(!output) {
+		trace_error("outputcb: output is null");
+		return;
+	}
+
+	long long code = calldata_int(cd, "code");
+	const char* last_error = calldata_string(cd, "last_error");
+	std::string output_error = last_error ? last_error : "";
+	if(code != OBS_OUTPUT_SUCCESS && output_error.empty()) {
+		output_error = "output stopped with code "+ std::to_string(code);
+	}
+
+	trace_info("outputcb: stop", field_ns("id", output->id), field(code), field_s(output_error));
+	output->setState(false, false, output_error);
+}
+
+void OutputReconnectCb(void *my_data, calldata_t *cd) {
+	Output* output = (Output*) my_data;
+	if(!output) {
+		trace_error("outputcb: output is null");
+		return;
+	}
+
+	trace_warn("outputcb: reconnecting", field_ns("id", output->id));
+	output->setState(false, true, "");
+}
+
+void OutputReconnectSuccessCb(void *my_data, calldata_t *cd) {
+	Output* output = (Output*) my_data;
+	if(!output) {
+		trace_error("outputcb: output is null");
+		return;
+	}
+
+	trace_info("outputcb: reconnected", field_ns("id", output->id));
+	output->setState(true, false, "");
+}
+
+void OutputFileChangedCb(void *my_data, calldata_t *cd) {
+	Output* output = (Output*) my_data;
+	if(!output) {
+		trace_error("outputcb: output is null");
+		return;
+	}
+
+	const char* next_file = calldata_string(cd, "next_file");
+	if(!next_file) {
+		return;
+	}
+	trace_debug("outputcb: next segment", field_ns("id", output->id), field_c(next_file));
+
+	std::unique_lock<std::mutex> lock(output->segments_mtx);
+	output->segments.push_back(next_file);
+	bool expired = false;
+	while(output->max_segments > 0 && output->segments.size() > (size_t) output->max_segments) {
+		output->expired_segments.push_back(output->segments.front());
+		output->segments.pop_front();
+		expired = true;
+	}
+	lock.unlock();
+	if(expired) {
+		output->segments_cv.notify_one();
+	}
+}
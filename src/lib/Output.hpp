@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <grpc++/grpc++.h>
+#include "proto/studio.grpc.pb.h"
+#include "obs.h"
+#include "EventBus.hpp"
+#include "Trace.hpp"
+#include "Settings.hpp"
+
+/**
+ * @file
+ * @brief Destination of the encoded program.
+ *
+ * All outputs share the Studio video and audio encoders, so adding an output
+ * does not add an encode. Each output has its own obs_output_t, and therefore
+ * its own connection and reconnect state.
+ *
+ */
+
+enum OutputType {
+	OutputInvalid = -1,
+	OutputRTMP = 0,
+	OutputFile
+};
+
+std::string OutputTypeToString(OutputType type);
+OutputType StringToOutputType(std::string type);
+
+
+class Output {
+public:
+	/**
+	 * Output constructor. The obs output is created by the first Start.
+	 *
+	 * @param   url  RTMP server url, or file path for a File output.
+	 * @param   key  RTMP stream key, unused for a File output.
+	 * @param   rendition  name of the rendition it sends, "main" by default.
+	 */
+	Output(std::string id, std::string name, OutputType type, std::string url, std::string key, std::string rendition, Settings* settings, EventBus* events);
+	~Output();
+
+	// Getters
+	std::string Id() { return id; }
+	std::string Name() { return name; }
+	OutputType Type() { return type; }
+	std::string Url() { return url; }
+	std::string Rendition() { return rendition; }
+	bool Started() { return started; }
+
+	// Methods
+	grpc::Status Start(obs_encoder_t* enc_v, obs_encoder_t* enc_a);
+	grpc::Status Stop();
+	grpc::Status UpdateProto(proto::Output* proto_output);
+	/**
+	 * Splits a File output into segments, the following ones being named
+	 * after the current date in the same directory. Must be called before the
+	 * first Start.
+	 *
+	 * @param   directory     directory of the segments.
+	 * @param   extension     extension of the segments, e.g. "mp4" or "ts".
+	 * @param   segment_sec   duration of a segment.
+	 * @param   max_segments  number of segments kept on disk, older ones are
+	 *                        deleted by a thread of the output. 0 to keep
+	 *                        all of them.
+	 */
+	void SetSegments(std::string directory, std::string extension, int segment_sec, int max_segments);
+
+	// Counters of the obs output, 0 before the first Start.
+	uint64_t TotalBytes();
+	int FramesDropped();
+	int TotalFrames();
+	float Congestion();
+	int ConnectTimeMs();
+	bool Active();
+
+private:
+	grpc::Status create();
+	// Deletes the expired segments until the output is destroyed.
+	void cleanSegments();
+	// Updates the live state and publishes an OutputStateChanged event.
+	void setState(bool active, bool reconnecting, std::string last_error);
+
+	friend void OutputStopCb(void *my_data, calldata_t *cd);
+	friend void OutputReconnectCb(void *my_data, calldata_t *cd);
+	friend void OutputReconnectSuccessCb(void *my_data, calldata_t *cd);
+	friend void OutputFileChangedCb(void *my_data, calldata_t *cd);
+
+	std::string id;
+	std::string name;
+	OutputType type;
+	std::string url;
+	std::string key;
+	std::string rendition;
+	// Start was called and Stop was not
+	bool started;
+	// Set by the first Start. Atomic because the counters are sampled by
+	// GetMetrics, which does not hold the studio lock.
+	std::atomic<obs_output_t*> obs_output;
+	obs_service_t* obs_service;
+	Settings* settings;
+	EventBus* events;
+
+	// Segmenting of a File output, disabled if segment_sec is 0
+	std::string segment_directory;
+	std::string segment_extension;
+	int segment_sec;
+	int max_segments;
+
+	// Live state, updated from the obs output signals
+	std::mutex state_mtx;
+	bool active;
+	bool reconnecting;
+	std::string last_error;
+
+	// Segments on disk, oldest first. Their deletion is left to
+	// segment_cleaner, so that file_changed, emitted on the packet path of
+	// the muxer, never waits for the disk.
+	std::mutex segments_mtx;
+	std::condition_variable segments_cv;
+	std::deque<std::string> segments;
+	std::deque<std::string> expired_segments;
+	bool segments_closed;
+	std::thread segment_cleaner;
+};
+
+void OutputStopCb(void *my_data, calldata_t *cd);
+void OutputReconnectCb(void *my_data, calldata_t *cd);
+void OutputReconnectSuccessCb(void *my_data, calldata_t *cd);
+void OutputFileChangedCb(void *my_data, calldata_t *cd);
+
+typedef std::map<std::string, Output*> OutputMap;
@@ -1,12 +1,17 @@
 #include <algorithm>
 #include "Scene.hpp"
 
-Scene::Scene(std::string id, std::string name, Settings* settings)
+Scene::Scene(std::string id, std::string name, std::string show_id, Settings* settings, EventBus* events, SourceRegistry* registry, InputWatchdog* watchdog)
 	: id(id)
 	, name(name)
+	, show_id(show_id)
 	, started(false)
+	, preloaded(false)
 	, obs_scene(nullptr)
 	, settings(settings)
+	, events(events)
+	, registry(registry)
+	, watchdog(watchdog)
 	, source_id_counter(0) {
 	trace_debug("Create Scene", field_s(id), field_s(name));
 }
@@ -27,15 +32,17 @@ Source* Scene::GetSource(std::string source_id) {
 }
 
 
-Source* Scene::AddSource(std::string source_name, SourceType type, std::string source_url, int width, int height) {
+Source* Scene::AddSource(std::string source_name, SourceType type, std::string source_url, int width, int height, SourceType rescue_type, std::string rescue_url, const proto::SourceProperties& properties) {
 	std::string source_id = "source_"+ std::to_string(source_id_counter);
 	source_id_counter++;
 
-	Source* source = new Source(source_id, source_name, type, source_url, width, height, settings);
+	Source* source = new Source(source_id, source_name, type, source_url, width, height, settings, registry, watchdog);
 	if(!source) {
 		trace_error("Failed to create a source", field_s(source_id));
 		return NULL;
 	}
+	source->SetRescue(rescue_type, rescue_url);
+	source->SetProperties(properties);
 
 	trace_debug("Add source", field_s(source_id));
 	sources[source_id] = source;
@@ -43,6 +50,15 @@ Source* Scene::AddSource(std::string source_name, SourceType type, std::string s
 	// TODO at the moment, all sources are always active. Add a way to switch
 	// sources on and off.
 	active_sources.push_back(source); // TODO need a setActive method
+
+	if(events) {
+		proto::StudioEvent event;
+		proto::SourceAdded* source_added = event.mutable_source_added();
+		source_added->set_show_id(show_id);
+		source_added->set_scene_id(id);
+		source->UpdateProto(source_added->mutable_source());
+		events->Publish(std::move(event));
+	}
 	return source;
 }
 
@@ -54,7 +70,7 @@ Source* Scene::DuplicateSourceFromScene(Scene* scene, std::string source_id) {
 	}
 
 	// TODO width & height
-	Source* new_source = AddSource(source->Name(), source->Type(), source->Url(), -1, -1);
+	Source* new_source = AddSource(source->Name(), source->Type(), source->Url(), -1, -1, source->RescueType(), source->RescueUrl(), source->Properties());
 	if(!new_source) {
 		trace_error("Failed to duplicate source");
 		return NULL;
@@ -84,9 +100,107 @@ grpc::Status Scene::RemoveSource(std::string source_id) {
 	delete it->second;
 	sources.erase(it);
 
+	if(events) {
+		proto::StudioEvent event;
+		proto::SourceRemoved* source_removed = event.mutable_source_removed();
+		source_removed->set_show_id(show_id);
+		source_removed->set_scene_id(id);
+		source_removed->set_source_id(source_id);
+		events->Publish(std::move(event));
+	}
+
+	return grpc::Status::OK;
+}
+
+grpc::Status Scene::DiscardSource(std::string source_id) {
+	SourceMap::iterator it = sources.find(source_id);
+	if(it == sources.end()) {
+		trace_error("Source not found", field_s(source_id));
+		return grpc::Status(grpc::NOT_FOUND, "Source not found id="+ source_id);
+	}
+
+	removeSource(it->second);
+	return grpc::Status::OK;
+}
+
+grpc::Status Scene::Reload(const std::vector<SourceSpec>& specs, proto::ShowReloadStats* stats) {
+	grpc::Status s;
+	std::vector<Source*> unmatched;
+	std::vector<const SourceSpec*> added;
+
+	for(auto & it : sources) {
+		unmatched.push_back(it.second);
+	}
+
+	for(const SourceSpec& spec : specs) {
+		auto it = std::find_if(unmatched.begin(), unmatched.end(), [&](Source* source) {
+			return source->Name() == spec.name
+				&& source->Type() == spec.type
+				&& source->Url() == spec.url
+				&& source->Width() == spec.width
+				&& source->Height() == spec.height
+				&& source->RescueType() == spec.rescue_type
+				&& source->RescueUrl() == spec.rescue_url
+				&& SourcePropertiesKey(source->Properties()) == SourcePropertiesKey(spec.properties);
+		});
+		if(it == unmatched.end()) {
+			added.push_back(&spec);
+			continue;
+		}
+		unmatched.erase(it);
+		stats->set_sources_reused(stats->sources_reused() + 1);
+	}
+
+	for(const SourceSpec* spec : added) {
+		Source* source = AddSource(spec->name, spec->type, spec->url, spec->width, spec->height, spec->rescue_type, spec->rescue_url, spec->properties);
+		if(!source) {
+			trace_error("Failed to add source", field_s(id), field_ns("source_name", spec->name));
+			return grpc::Status(grpc::INTERNAL, "Failed to add source name="+ spec->name);
+		}
+		if(started) {
+			s = source->Start(&obs_scene);
+			if(!s.ok()) {
+				trace_error("Source Start failed", field_s(source->Id()), error(s.error_message()));
+				return s;
+			}
+		}
+		stats->set_sources_added(stats->sources_added() + 1);
+	}
+
+	for(Source* source : unmatched) {
+		removeSource(source);
+		stats->set_sources_removed(stats->sources_removed() + 1);
+	}
+
 	return grpc::Status::OK;
 }
 
+void Scene::removeSource(Source* source) {
+	std::string source_id = source->Id();
+	trace_debug("Remove source", field_s(id), field_s(source_id));
+
+	if(started) {
+		// Also removes its scene items
+		grpc::Status s = source->Stop();
+		if(!s.ok()) {
+			trace_error("Source Stop failed", field_s(source_id), error(s.error_message()));
+		}
+	}
+
+	active_sources.erase(std::remove(active_sources.begin(), active_sources.end(), source), active_sources.end());
+	sources.erase(source_id);
+	delete source;
+
+	if(events) {
+		proto::StudioEvent event;
+		proto::SourceRemoved* source_removed = event.mutable_source_removed();
+		source_removed->set_show_id(show_id);
+		source_removed->set_scene_id(id);
+		source_removed->set_source_id(source_id);
+		events->Publish(std::move(event));
+	}
+}
+
 grpc::Status Scene::Start() {
 	grpc::Status s;
 	trace_debug("Start scene", field_s(id));
@@ -146,6 +260,7 @@ grpc::Status Scene::UpdateProto(proto::Scene* proto_scene) {
 	proto_scene->Clear();
 	proto_scene->set_id(id);
 	proto_scene->set_name(name);
+	proto_scene->set_preloaded(preloaded);
 
 	for (auto & s : active_sources) {
 		proto_scene->add_active_source_ids(s->Id());
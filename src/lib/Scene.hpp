@@ -1,11 +1,13 @@
 #pragma once
 
 #include <vector>
+#include "EventBus.hpp"
+#include "ShowSpec.hpp"
 #include "Source.hpp"
 
 class Scene {
 public:
-	Scene(std::string id, std::string name, Settings* settings);
+	Scene(std::string id, std::string name, std::string show_id, Settings* settings, EventBus* events, SourceRegistry* registry, InputWatchdog* watchdog);
 	~Scene();
 
 	// Getters
@@ -13,25 +15,48 @@ public:
 	std::string Name() { return name; }
 	SourceMap Sources() { return sources; }
 	obs_scene_t* GetScene() { return obs_scene; }
+	bool Started() { return started; }
+	bool Preloaded() { return preloaded; }
+
+	// Setters
+	void SetPreloaded(bool value) { preloaded = value; }
 
 	// Methods
 	Source* GetSource(std::string source_id);
-	Source* AddSource(std::string source_name, SourceType type, std::string source_url, int width, int height);
+	Source* AddSource(std::string source_name, SourceType type, std::string source_url, int width, int height, SourceType rescue_type, std::string rescue_url, const proto::SourceProperties& properties);
 	Source* DuplicateSourceFromScene(Scene* scene, std::string source_id);
 	Source* DuplicateSource(std::string source_id);
 	grpc::Status RemoveSource(std::string source_id);
+	// Removes a source even if active, stopping it if the scene is started.
+	// Rolls back an AddSource.
+	grpc::Status DiscardSource(std::string source_id);
+	/**
+	 * Applies the sources of a reloaded scene. Sources whose name, type, url,
+	 * size, rescue and properties did not change are kept, and keep running if the scene is
+	 * started. The others are removed, and the new ones added (and started)
+	 * before the old ones are removed.
+	 */
+	grpc::Status Reload(const std::vector<SourceSpec>& specs, proto::ShowReloadStats* stats);
 	grpc::Status Start();
 	grpc::Status Stop();
 	grpc::Status UpdateProto(proto::Scene* proto_scene);
 
 private:
+	// Stops a source if the scene is started, and deletes it.
+	void removeSource(Source* source);
+
 	std::string id;
 	std::string name;
+	std::string show_id;
 	bool started;
+	bool preloaded;
 	obs_scene_t* obs_scene;
 	SourceMap sources;
 	std::vector<Source*> active_sources;
 	Settings* settings;
+	EventBus* events;
+	SourceRegistry* registry;
+	InputWatchdog* watchdog;
 	uint64_t source_id_counter;
 };
 
@@ -1,6 +1,8 @@
 #include <fstream>
 #include <sstream>
 #include <ios>
+#include <iterator>
+#include "NativeDisplay.hpp"
 #include "Settings.hpp"
 #include "Trace.hpp"
 
@@ -54,6 +56,13 @@ Settings LoadConfig(const string& file) {
             iss >> s.video_fps_num;
         } else if(key == "video_fps_den") {
             iss >> s.video_fps_den;
+        } else if(key == "video_rendition") {
+            Rendition r;
+            iss >> r.name >> r.width >> r.height >> r.bitrate_kbps >> r.preset;
+            if(iss.fail()) {
+                throw invalid_argument("Invalid video rendition: " + line);
+            }
+            s.video_renditions.push_back(r);
         }
         
         else if(key == "audio_sample_rate") {
@@ -61,6 +70,73 @@ Settings LoadConfig(const string& file) {
         } else if(key == "audio_bitrate_kbps") {
             iss >> s.audio_bitrate_kbps;
         } 
+
+        else if(key == "grpc_worker_threads") {
+            iss >> s.grpc_worker_threads;
+        } else if(key == "grpc_max_queued_requests") {
+            iss >> s.grpc_max_queued_requests;
+        } else if(key == "output_reconnect_max_retries") {
+            iss >> s.output_reconnect_max_retries;
+        } else if(key == "output_reconnect_delay_sec") {
+            iss >> s.output_reconnect_delay_sec;
+        }
+
+        else if(key == "trace_level") {
+            string level;
+            iss >> level;
+            s.trace_level = -1;
+            for(size_t i = 0; i < std::size(trace_level_name); i++) {
+                if(level == trace_level_name[i]) {
+                    s.trace_level = i;
+                }
+            }
+            if(s.trace_level < 0) {
+                throw invalid_argument("Invalid trace level: " + level);
+            }
+        }
+        else if(key == "trace_format") {
+            string format;
+            iss >> format;
+            if(format == "text") {
+                s.trace_format = TRACE_FORMAT_TEXT;
+            } else if(format == "json") {
+                s.trace_format = TRACE_FORMAT_JSON;
+            } else if(format == "none") {
+                s.trace_format = TRACE_FORMAT_NONE;
+            } else {
+                throw invalid_argument("Invalid trace format: " + format);
+            }
+        }
+        else if(key == "metrics_port") {
+            iss >> s.metrics_port;
+        }
+        else if(key == "display_backend") {
+            iss >> s.display_backend;
+        }
+        else if(key == "show_load_threads") {
+            iss >> s.show_load_threads;
+        } else if(key == "show_cache_dir") {
+            iss >> s.show_cache_dir;
+        } else if(key == "show_watch") {
+            iss >> s.show_watch;
+        } else if(key == "show_watch_debounce_ms") {
+            iss >> s.show_watch_debounce_ms;
+        }
+        else if(key == "input_stall_ms") {
+            iss >> s.input_stall_ms;
+        } else if(key == "input_check_ms") {
+            iss >> s.input_check_ms;
+        } else if(key == "input_backoff_min_ms") {
+            iss >> s.input_backoff_min_ms;
+        } else if(key == "input_backoff_max_ms") {
+            iss >> s.input_backoff_max_ms;
+        } else if(key == "rescue_hold_ms") {
+            iss >> s.rescue_hold_ms;
+        } else if(key == "source_update_timeout_ms") {
+            iss >> s.source_update_timeout_ms;
+        } else if(key == "batch_max_operations") {
+            iss >> s.batch_max_operations;
+        }
     }
 
     if(s.server == "") {
@@ -76,6 +152,67 @@ Settings LoadConfig(const string& file) {
         throw invalid_argument("Invalid transition duration: " + to_string(s.transition_duration_ms));
     }
 
+    for(size_t i = 0; i < s.video_renditions.size(); i++) {
+        const Rendition& r = s.video_renditions[i];
+        if(r.name == "main") {
+            throw invalid_argument("Invalid video rendition name: main is reserved");
+        }
+        for(size_t j = 0; j < i; j++) {
+            if(s.video_renditions[j].name == r.name) {
+                throw invalid_argument("Duplicate video rendition: " + r.name);
+            }
+        }
+        if(r.width <= 0 || r.height <= 0 || r.bitrate_kbps <= 0) {
+            throw invalid_argument("Invalid video rendition size or bitrate: " + r.name);
+        }
+    }
+
+    if(s.grpc_worker_threads < 1 || s.grpc_worker_threads > 256) {
+        throw invalid_argument("Invalid grpc worker threads: " + to_string(s.grpc_worker_threads));
+    }
+    if(s.grpc_max_queued_requests < 0) {
+        throw invalid_argument("Invalid grpc max queued requests: " + to_string(s.grpc_max_queued_requests));
+    }
+    if(s.output_reconnect_max_retries < 0) {
+        throw invalid_argument("Invalid output reconnect max retries: " + to_string(s.output_reconnect_max_retries));
+    }
+    if(s.output_reconnect_delay_sec < 0) {
+        throw invalid_argument("Invalid output reconnect delay: " + to_string(s.output_reconnect_delay_sec));
+    }
+
+    if(s.metrics_port < 0 || s.metrics_port > 65535) {
+        throw invalid_argument("Invalid metrics port: " + to_string(s.metrics_port));
+    }
+
+    if(!NativeDisplaySupported(s.display_backend)) {
+        throw invalid_argument("Unsupported display backend: " + s.display_backend);
+    }
+
+    if(s.show_load_threads < 1 || s.show_load_threads > 256) {
+        throw invalid_argument("Invalid show load threads: " + to_string(s.show_load_threads));
+    }
+    if(s.show_watch_debounce_ms < 0) {
+        throw invalid_argument("Invalid show watch debounce: " + to_string(s.show_watch_debounce_ms));
+    }
+    if(s.input_stall_ms < 0) {
+        throw invalid_argument("Invalid input stall: " + to_string(s.input_stall_ms));
+    }
+    if(s.input_check_ms < 1) {
+        throw invalid_argument("Invalid input check interval: " + to_string(s.input_check_ms));
+    }
+    if(s.input_backoff_min_ms < 1 || s.input_backoff_max_ms < s.input_backoff_min_ms) {
+        throw invalid_argument("Invalid input backoff: " + to_string(s.input_backoff_min_ms) + " to " + to_string(s.input_backoff_max_ms));
+    }
+    if(s.rescue_hold_ms < 0) {
+        throw invalid_argument("Invalid rescue hold: " + to_string(s.rescue_hold_ms));
+    }
+    if(s.source_update_timeout_ms < 1) {
+        throw invalid_argument("Invalid source update timeout: " + to_string(s.source_update_timeout_ms));
+    }
+    if(s.batch_max_operations < 1) {
+        throw invalid_argument("Invalid batch max operations: " + to_string(s.batch_max_operations));
+    }
+
     // TODO more checks
 
     trace_debug("", field_s(s.server));
@@ -92,8 +229,30 @@ Settings LoadConfig(const string& file) {
     trace_debug("", field(s.video_height));
     trace_debug("", field(s.video_fps_num));
     trace_debug("", field(s.video_fps_den));
+    for(const Rendition& r : s.video_renditions) {
+        trace_debug("video rendition", field_ns("name", r.name), field_n("width", r.width), field_n("height", r.height), field_n("bitrate_kbps", r.bitrate_kbps), field_ns("preset", r.preset));
+    }
     trace_debug("", field(s.audio_sample_rate));
     trace_debug("", field(s.audio_bitrate_kbps));
+    trace_debug("", field(s.grpc_worker_threads));
+    trace_debug("", field(s.grpc_max_queued_requests));
+    trace_debug("", field(s.output_reconnect_max_retries));
+    trace_debug("", field(s.output_reconnect_delay_sec));
+    trace_debug("", field_nc("s.trace_level", trace_level_name[s.trace_level]));
+    trace_debug("", field(s.trace_format));
+    trace_debug("", field(s.metrics_port));
+    trace_debug("", field_s(s.display_backend));
+    trace_debug("", field(s.show_load_threads));
+    trace_debug("", field_s(s.show_cache_dir));
+    trace_debug("", field(s.show_watch));
+    trace_debug("", field(s.show_watch_debounce_ms));
+    trace_debug("", field(s.input_stall_ms));
+    trace_debug("", field(s.input_check_ms));
+    trace_debug("", field(s.input_backoff_min_ms));
+    trace_debug("", field(s.input_backoff_max_ms));
+    trace_debug("", field(s.rescue_hold_ms));
+    trace_debug("", field(s.source_update_timeout_ms));
+    trace_debug("", field(s.batch_max_operations));
 
 
     return s;
@@ -1,8 +1,19 @@
 #pragma once
 #include <string>
+#include <vector>
 
 using namespace std;
 
+// A rung of the video rendition ladder, encoded from the same composite as
+// the main video, scaled to width x height.
+struct Rendition {
+    string name;
+    int width;
+    int height;
+    int bitrate_kbps;
+    string preset;
+};
+
 struct Settings {
     string server;
     string key;
@@ -21,9 +32,63 @@ struct Settings {
     int video_height;
     int video_fps_num;
     int video_fps_den;
+    // Extra renditions, one "video_rendition <name> <width> <height>
+    // <bitrate_kbps> <preset>" line each. The main video is named "main".
+    vector<Rendition> video_renditions;
 
     int audio_sample_rate;
     int audio_bitrate_kbps;
+
+    // Threads running the blocking Studio handlers, and number of requests
+    // that can wait for one before RESOURCE_EXHAUSTED is returned.
+    int grpc_worker_threads = 4;
+    int grpc_max_queued_requests = 64;
+
+    // Reconnect attempts of each RTMP output, and delay between them.
+    int output_reconnect_max_retries = 20;
+    int output_reconnect_delay_sec = 10;
+
+    // Runtime trace level (trace, debug, info, warning or error). Levels
+    // below APP_TRACE_LEVEL are compiled out whatever this value.
+    int trace_level = 0;
+    // Trace format: text, json or none.
+    int trace_format = 1;
+
+    // Local port of the Prometheus metrics endpoint, 0 to disable it.
+    int metrics_port = 0;
+
+    // Where libobs gets its X display: "qt" (QApplication, needs ENABLE_QT)
+    // or "x11" (Xlib, e.g. Xvfb, without Qt). See NativeDisplay.hpp.
+    string display_backend = "qt";
+
+    // Threads parsing the files of the ShowLoadMany requests, shared by the
+    // concurrent requests. The worker running a request parses files too.
+    int show_load_threads = 4;
+    // Directory of the compiled show cache, empty to disable it. See
+    // ShowCache.hpp.
+    string show_cache_dir;
+    // Reload the loaded shows when their file changes, once no change was
+    // seen for show_watch_debounce_ms.
+    bool show_watch = false;
+    int show_watch_debounce_ms = 200;
+
+    // Input watchdog of the RTMP sources: an input without new frames for
+    // input_stall_ms (0 disables it), checked every input_check_ms, is
+    // reconnected with a backoff from input_backoff_min_ms to
+    // input_backoff_max_ms. See InputWatchdog.hpp.
+    int input_stall_ms = 5000;
+    int input_check_ms = 500;
+    int input_backoff_min_ms = 1000;
+    int input_backoff_max_ms = 30000;
+    // A source failed over to its rescue is shown again once its input made
+    // progress for rescue_hold_ms.
+    int rescue_hold_ms = 2000;
+    // A started source given a new input keeps the current one on air until
+    // the new one plays, for up to source_update_timeout_ms.
+    int source_update_timeout_ms = 10000;
+    // Maximum number of operations of an ApplyBatch call, which holds the
+    // studio lock for all of them.
+    int batch_max_operations = 1000;
 };
 
 Settings LoadConfig(const string& file);
\ No newline at end of file
@@ -1,13 +1,19 @@
+#include <algorithm>
+#include <chrono>
 #include "Show.hpp"
 
-Show::Show(std::string id, std::string name, Settings* settings)
+Show::Show(std::string id, std::string name, Settings* settings, EventBus* events, SourceRegistry* registry, InputWatchdog* watchdog)
 	: id(id)
 	, name(name)
 	, started(false)
 	, settings(settings)
+	, events(events)
+	, registry(registry)
+	, watchdog(watchdog)
 	, obs_transition(nullptr)
 	, active_scene(nullptr)
-	, scene_id_counter(0) {
+	, scene_id_counter(0)
+	, last_switch_latency_us(0) {
 	trace_debug("Create Show", field_s(id), field_s(name));
 }
 
@@ -19,119 +25,149 @@ Show::~Show() {
 }
 
 grpc::Status Show::Load(json_t* jsonShow) {
-	json_t* jsonShowName = json_object_get(jsonShow, "name");
-
-	if(!jsonShowName) {
-		trace_error("Show name not found in json", field_s(id));
-		return grpc::Status(grpc::INVALID_ARGUMENT, "Show name not found in config file");
+	ShowSpec spec;
+	grpc::Status s = ParseShowSpec(jsonShow, &spec);
+	if(!s.ok()) {
+		trace_error("Invalid show json", field_s(id));
+		return s;
 	}
+	return Load(spec);
+}
 
-	const char* strShowName = json_string_value(jsonShowName);
-	if(!strShowName) {
-		trace_error("Can't read show name", field_s(id));
-		return grpc::Status(grpc::INVALID_ARGUMENT, "Show name not found in config file");
-	}
-	name = std::string(strShowName);
+grpc::Status Show::Load(const ShowSpec& spec) {
+	name = spec.name;
 	trace_debug("Update show name", field_s(name));
 
-	json_t* jsonScenes = json_object_get(jsonShow, "scenes");
-	if(!jsonScenes) {
-		trace_error("Scenes not found in json", field_s(id));
-		return grpc::Status(grpc::INVALID_ARGUMENT, "Scenes not found in config file");
-	}
-
-	size_t sceneIdx;
-	json_t *jsonScene;
-
-	json_array_foreach(jsonScenes, sceneIdx, jsonScene) {
-		json_t* jsonSceneName = json_object_get(jsonScene, "name");
-		if(!jsonSceneName) {
-			trace_error("Scene name not found in json", field(sceneIdx));
-			return grpc::Status(grpc::INVALID_ARGUMENT, "Scene name not found in config file sceneIdx="+ std::to_string(sceneIdx));
-		}
-
-		const char* strSceneName = json_string_value(jsonSceneName);
-		if(!strSceneName) {
-			trace_error("Can't read scene name", field(sceneIdx));
-			return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read scene name sceneIdx="+ std::to_string(sceneIdx));
-		}
+	for(size_t sceneIdx = 0; sceneIdx < spec.scenes.size(); sceneIdx++) {
+		const SceneSpec& sceneSpec = spec.scenes[sceneIdx];
 
-		Scene* scene = AddScene(std::string(strSceneName));
+		Scene* scene = AddScene(sceneSpec.name);
 		if(!scene) {
-			trace_error("Failed to add scene", field(sceneIdx), field_c(strSceneName));
+			trace_error("Failed to add scene", field(sceneIdx), field_ns("scene_name", sceneSpec.name));
 			return grpc::Status(grpc::INVALID_ARGUMENT, "Failed to add scene sceneIdx="+ std::to_string(sceneIdx));
 		}
+		scene->SetPreloaded(sceneSpec.preload);
+		spec_preload[sceneSpec.name] = sceneSpec.preload;
+
+		for(size_t sourceIdx = 0; sourceIdx < sceneSpec.sources.size(); sourceIdx++) {
+			const SourceSpec& sourceSpec = sceneSpec.sources[sourceIdx];
 
-		json_t* jsonSources = json_object_get(jsonScene, "sources");
-		if(!jsonSources) {
-			trace_error("Sources not found in json", field(sceneIdx));
-			return grpc::Status(grpc::INVALID_ARGUMENT, "Sources not found in config file sceneIdx="+ std::to_string(sceneIdx));
+			Source* source = scene->AddSource(sourceSpec.name, sourceSpec.type, sourceSpec.url, sourceSpec.width, sourceSpec.height, sourceSpec.rescue_type, sourceSpec.rescue_url, sourceSpec.properties);
+			if(!source) {
+				trace_error("Failed to add source", field(sceneIdx), field(sourceIdx));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Failed to add source sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+			}
 		}
+	}
 
-		size_t sourceIdx;
-		json_t* jsonSource;
+	return grpc::Status::OK;
+}
 
-		json_array_foreach(jsonSources, sourceIdx, jsonSource) {
-			json_t* jsonSourceName = json_object_get(jsonSource, "name");
-			if(!jsonSourceName) {
-				trace_error("Source name not found in json", field(sceneIdx), field(sourceIdx));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Source name not found in config file sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
-			}
+grpc::Status Show::Reload(const ShowSpec& spec, proto::ShowReloadStats* stats) {
+	grpc::Status s;
 
-			const char* strSourceName = json_string_value(jsonSourceName);
-			if(!strSourceName) {
-				trace_error("Can't read source name", field(sceneIdx), field(sourceIdx));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read source name sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
-			}
+	if(spec.scenes.empty()) {
+		trace_error("Reloaded show has no scene", field_s(id));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Reloaded show has no scene");
+	}
 
-			json_t* jsonSourceUrl = json_object_get(jsonSource, "url");
-			if(!jsonSourceUrl) {
-				trace_error("Source url not found in json", field(sceneIdx), field(sourceIdx));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Source url not found in config file sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
-			}
+	// Steps already applied are kept when a later one fails
+	auto partial = [this](const grpc::Status& failed) {
+		trace_error("Show partially reloaded", field_s(id), error(failed.error_message()));
+		return grpc::Status(failed.error_code(), "Show partially reloaded: "+ failed.error_message());
+	};
 
-			const char* strSourceUrl = json_string_value(jsonSourceUrl);
-			if(!strSourceUrl) {
-				trace_error("Can't read source url", field(sceneIdx), field(sourceIdx));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read source url sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
-			}
+	name = spec.name;
 
-			json_t* jsonSourceType = json_object_get(jsonSource, "type");
-			if(!jsonSourceType) {
-				trace_error("Source type not found in json", field(sceneIdx), field(sourceIdx));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Source type not found in config file sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
-			}
+	std::vector<Scene*> unmatched;
+	for(auto & it : scenes) {
+		unmatched.push_back(it.second);
+	}
 
-			const char* strSourceType = json_string_value(jsonSourceType);
-			if(!strSourceType) {
-				trace_error("Can't read source type", field(sceneIdx), field(sourceIdx));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read source type sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+	std::vector<Scene*> kept;
+	for(const SceneSpec& sceneSpec : spec.scenes) {
+		auto it = std::find_if(unmatched.begin(), unmatched.end(), [&](Scene* scene) {
+			return scene->Name() == sceneSpec.name;
+		});
+
+		Scene* scene;
+		// Preload flag of the previous spec, false for a new scene
+		bool was_preload = false;
+		if(it == unmatched.end()) {
+			scene = AddScene(sceneSpec.name);
+			if(!scene) {
+				trace_error("Failed to add scene", field_s(id), field_ns("scene_name", sceneSpec.name));
+				return partial(grpc::Status(grpc::INTERNAL, "Failed to add scene name="+ sceneSpec.name));
 			}
+			stats->set_scenes_added(stats->scenes_added() + 1);
+		} else {
+			scene = *it;
+			unmatched.erase(it);
+			stats->set_scenes_reused(stats->scenes_reused() + 1);
+			auto previous = spec_preload.find(sceneSpec.name);
+			was_preload = previous != spec_preload.end() && previous->second;
+		}
+		kept.push_back(scene);
 
-			SourceType type = StringToSourceType(std::string(strSourceType));
-			if(type == InvalidType) {
-				trace_error("Unsupported source type", field_c(strSourceType));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Unsupported source type="+ std::string(strSourceType));
-			}
+		s = scene->Reload(sceneSpec.sources, stats);
+		if(!s.ok()) {
+			return partial(s);
+		}
 
-			int sourceWidth = -1;
-			json_t* jsonSourceWidth = json_object_get(jsonSource, "width");
-			if (jsonSourceWidth && json_is_integer(jsonSourceWidth)) {
-				sourceWidth = json_integer_value(jsonSourceWidth);
+		if(sceneSpec.preload != was_preload) {
+			s = sceneSpec.preload ? PreloadScene(scene->Id()) : UnloadScene(scene->Id());
+			if(!s.ok()) {
+				return partial(s);
 			}
+		}
+		spec_preload[sceneSpec.name] = sceneSpec.preload;
+	}
 
-			int sourceHeight = -1;
-			json_t* jsonSourceHeight = json_object_get(jsonSource, "height");
-			if (jsonSourceHeight && json_is_integer(jsonSourceHeight)) {
-				sourceHeight = json_integer_value(jsonSourceHeight);
+	// Move away from a removed active scene before removing it
+	if(std::find(unmatched.begin(), unmatched.end(), active_scene) != unmatched.end()) {
+		if(started) {
+			s = SwitchScene(kept[0]->Id());
+			if(!s.ok()) {
+				return partial(s);
 			}
+		} else {
+			active_scene = kept[0];
+		}
+	}
 
-			Source* source = scene->AddSource(std::string(strSourceName), type, std::string(strSourceUrl), sourceWidth, sourceHeight);
-			if(!source) {
-				trace_error("Failed to add source", field(sceneIdx), field(sourceIdx));
-				return grpc::Status(grpc::INVALID_ARGUMENT, "Failed to add source sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
-			}
+	for(Scene* scene : unmatched) {
+		std::string scene_id = scene->Id();
+		stats->set_sources_removed(stats->sources_removed() + scene->Sources().size());
+
+		s = UnloadScene(scene_id);
+		if(s.ok()) {
+			s = RemoveScene(scene_id);
 		}
+		if(!s.ok()) {
+			return partial(s);
+		}
+		stats->set_scenes_removed(stats->scenes_removed() + 1);
+	}
+
+	spec_preload.clear();
+	for(const SceneSpec& sceneSpec : spec.scenes) {
+		spec_preload[sceneSpec.name] = sceneSpec.preload;
+	}
+
+	trace_info("Reloaded show", field_s(id),
+		field_n("scenes_reused", stats->scenes_reused()),
+		field_n("scenes_added", stats->scenes_added()),
+		field_n("scenes_removed", stats->scenes_removed()),
+		field_n("sources_reused", stats->sources_reused()),
+		field_n("sources_added", stats->sources_added()),
+		field_n("sources_removed", stats->sources_removed()));
+
+	if(events) {
+		proto::StudioEvent event;
+		proto::ShowReloaded* show_reloaded = event.mutable_show_reloaded();
+		show_reloaded->set_show_id(id);
+		show_reloaded->mutable_stats()->CopyFrom(*stats);
+		events->Publish(std::move(event));
 	}
 
 	return grpc::Status::OK;
@@ -160,6 +196,18 @@ grpc::Status Show::Start() {
 	}
 	obs_transition_set(obs_transition, obs_scene_get_source(active_scene->GetScene()));
 
+	for (auto & it : scenes) {
+		Scene* scene = it.second;
+		if(scene == active_scene || !scene->Preloaded()) {
+			continue;
+		}
+		s = scene->Start();
+		if(!s.ok()) {
+			trace_error("Preloaded scene Start failed", field_ns("scene_id", scene->Id()), error(s.error_message()));
+			return s;
+		}
+	}
+
 	started = true;
 	return grpc::Status::OK;
 }
@@ -178,6 +226,18 @@ grpc::Status Show::Stop() {
 		return s;
 	}
 
+	for (auto & it : scenes) {
+		Scene* scene = it.second;
+		if(scene == active_scene || !scene->Started()) {
+			continue;
+		}
+		s = scene->Stop();
+		if(!s.ok()) {
+			trace_error("Preloaded scene Stop failed", field_ns("scene_id", scene->Id()), error(s.error_message()));
+			return s;
+		}
+	}
+
 	trace_debug("clear and release obs_transition");
 	obs_transition_clear(obs_transition);
 	obs_source_release(obs_transition);
@@ -198,7 +258,7 @@ Scene* Show::AddScene(std::string scene_name) {
 	std::string scene_id = "scene_"+ std::to_string(scene_id_counter);
 	scene_id_counter++;
 
-	Scene* scene = new Scene(scene_id, scene_name, settings);
+	Scene* scene = new Scene(scene_id, scene_name, id, settings, events, registry, watchdog);
 	if(!scene) {
 		trace_error("Failed to create a scene", field_s(scene_id));
 		return NULL;
@@ -209,6 +269,14 @@ Scene* Show::AddScene(std::string scene_name) {
 	if(!active_scene) {
 		active_scene = scene;// TODO need a setActive method
 	}
+
+	if(events) {
+		proto::StudioEvent event;
+		proto::SceneAdded* scene_added = event.mutable_scene_added();
+		scene_added->set_show_id(id);
+		scene->UpdateProto(scene_added->mutable_scene());
+		events->Publish(std::move(event));
+	}
 	return scene;
 }
 
@@ -225,8 +293,10 @@ Scene* Show::DuplicateSceneFromShow(Show* show, std::string scene_id) {
 		return NULL;
 	}
 
+	// Sources() returns a copy, iterate over a single one
+	SourceMap sources = scene->Sources();
 	SourceMap::iterator it;
-	for (it = scene->Sources().begin(); it != scene->Sources().end(); it++) {
+	for (it = sources.begin(); it != sources.end(); it++) {
 		Source* source = it->second;
 		trace_debug("source from original scene",
 			field_ns("id", source->Id()),
@@ -257,17 +327,63 @@ grpc::Status Show::RemoveScene(std::string scene_id) {
 		trace_error("Scene is active", field_s(scene_id));
 		return grpc::Status(grpc::FAILED_PRECONDITION, "Scene is active id="+ scene_id);
 	}
+	if(it->second->Preloaded()) {
+		trace_error("Scene is preloaded", field_s(scene_id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Scene is preloaded id="+ scene_id);
+	}
 
 	trace_debug("Remove scene", field_s(scene_id));
 	// No need to do scene->Stop(); because it is not actve
 	delete it->second;
 	scenes.erase(it);
 
+	if(events) {
+		proto::StudioEvent event;
+		proto::SceneRemoved* scene_removed = event.mutable_scene_removed();
+		scene_removed->set_show_id(id);
+		scene_removed->set_scene_id(scene_id);
+		events->Publish(std::move(event));
+	}
+
+	return grpc::Status::OK;
+}
+
+grpc::Status Show::DiscardScene(std::string scene_id) {
+	SceneMap::iterator it = scenes.find(scene_id);
+	if(it == scenes.end()) {
+		trace_error("Scene not found", field_s(scene_id));
+		return grpc::Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
+	}
+
+	Scene* scene = it->second;
+	trace_debug("Discard scene", field_s(scene_id));
+	if(scene->Started()) {
+		grpc::Status s = scene->Stop();
+		if(!s.ok()) {
+			trace_error("Scene Stop failed", field_s(scene_id), error(s.error_message()));
+		}
+	}
+	// AddScene made it active if the show had no scene
+	if(scene == active_scene) {
+		active_scene = NULL;
+	}
+	delete scene;
+	scenes.erase(it);
+
+	if(events) {
+		proto::StudioEvent event;
+		proto::SceneRemoved* scene_removed = event.mutable_scene_removed();
+		scene_removed->set_show_id(id);
+		scene_removed->set_scene_id(scene_id);
+		events->Publish(std::move(event));
+	}
+
 	return grpc::Status::OK;
 }
 
 grpc::Status Show::SwitchScene(std::string scene_id) {
 	grpc::Status s;
+	std::chrono::steady_clock::time_point switch_start = std::chrono::steady_clock::now();
 	Scene* next = GetScene(scene_id);
 	Scene* curr = active_scene;
 
@@ -280,10 +396,13 @@ grpc::Status Show::SwitchScene(std::string scene_id) {
 		return grpc::Status(grpc::INVALID_ARGUMENT, "scene is already active");
 	}
 
-	s = next->Start();
-	if(!s.ok()) {
-		trace_error("Scene Start failed", error(s.error_message()));
-		return s;
+	// A preloaded scene is already started, only the transition remains
+	if(!next->Started()) {
+		s = next->Start();
+		if(!s.ok()) {
+			trace_error("Scene Start failed", error(s.error_message()));
+			return s;
+		}
 	}
 
 	trace_debug("start transition");
@@ -299,10 +418,29 @@ grpc::Status Show::SwitchScene(std::string scene_id) {
 		return grpc::Status(grpc::INTERNAL, "obs_transition_start failed");
 	}
 
+	last_switch_latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - switch_start).count();
+	trace_info("Scene switched", field_s(id), field_s(scene_id), field(last_switch_latency_us), field_n("preloaded", next->Preloaded()));
+
 	trace_debug("transition finished");
 	Scene* prev = active_scene;
 	active_scene = next;
 
+	if(events) {
+		proto::StudioEvent event;
+		proto::SceneSwitched* scene_switched = event.mutable_scene_switched();
+		scene_switched->set_show_id(id);
+		scene_switched->set_previous_scene_id(prev->Id());
+		scene_switched->set_scene_id(next->Id());
+		scene_switched->set_switch_latency_us(last_switch_latency_us);
+		events->Publish(std::move(event));
+	}
+
+	// Keep a preloaded scene armed for the next switch back to it
+	if(prev->Preloaded()) {
+		return grpc::Status::OK;
+	}
+
 	s = prev->Stop();
 	if(!s.ok()) {
 		trace_error("Scene Stop failed", error(s.error_message()));
@@ -312,6 +450,75 @@ grpc::Status Show::SwitchScene(std::string scene_id) {
 	return grpc::Status::OK;
 }
 
+grpc::Status Show::PreloadScene(std::string scene_id) {
+	grpc::Status s;
+	Scene* scene = GetScene(scene_id);
+
+	if(!scene) {
+		trace_error("Scene not found", field_s(scene_id));
+		return grpc::Status(grpc::NOT_FOUND, "Scene id not found");
+	}
+	if(scene->Preloaded()) {
+		trace_debug("Scene already preloaded", field_s(scene_id));
+		return grpc::Status::OK;
+	}
+
+	// Sources of a stopped show are started along with it
+	if(started && !scene->Started()) {
+		s = scene->Start();
+		if(!s.ok()) {
+			trace_error("Scene Start failed", error(s.error_message()));
+			return s;
+		}
+	}
+
+	trace_debug("Preload scene", field_s(scene_id));
+	scene->SetPreloaded(true);
+	publishPreloadChanged(scene);
+	return grpc::Status::OK;
+}
+
+grpc::Status Show::UnloadScene(std::string scene_id) {
+	grpc::Status s;
+	Scene* scene = GetScene(scene_id);
+
+	if(!scene) {
+		trace_error("Scene not found", field_s(scene_id));
+		return grpc::Status(grpc::NOT_FOUND, "Scene id not found");
+	}
+	if(!scene->Preloaded()) {
+		trace_debug("Scene not preloaded", field_s(scene_id));
+		return grpc::Status::OK;
+	}
+
+	// The active scene keeps running, it is stopped when switched away from
+	if(scene != active_scene && scene->Started()) {
+		s = scene->Stop();
+		if(!s.ok()) {
+			trace_error("Scene Stop failed", error(s.error_message()));
+			return s;
+		}
+	}
+
+	trace_debug("Unload scene", field_s(scene_id));
+	scene->SetPreloaded(false);
+	publishPreloadChanged(scene);
+	return grpc::Status::OK;
+}
+
+void Show::publishPreloadChanged(Scene* scene) {
+	if(!events) {
+		return;
+	}
+
+	proto::StudioEvent event;
+	proto::ScenePreloadChanged* preload_changed = event.mutable_scene_preload_changed();
+	preload_changed->set_show_id(id);
+	preload_changed->set_scene_id(scene->Id());
+	preload_changed->set_preloaded(scene->Preloaded());
+	events->Publish(std::move(event));
+}
+
 grpc::Status Show::UpdateProto(proto::Show* proto_show) {
 	proto_show->Clear();
 	proto_show->set_id(id);
@@ -2,10 +2,11 @@
 
 #include <jansson.h>
 #include "Scene.hpp"
+#include "ShowSpec.hpp"
 
 class Show {
 public:
-	Show(std::string id, std::string name, Settings* settings);
+	Show(std::string id, std::string name, Settings* settings, EventBus* events, SourceRegistry* registry, InputWatchdog* watchdog);
 	~Show();
 
 	// Getters
@@ -14,9 +15,29 @@ public:
 	SceneMap Scenes() { return scenes; }
 	Scene* ActiveScene() { return active_scene; }
 	obs_source_t* Transition() { return obs_transition; }
+	uint64_t LastSwitchLatencyUs() { return last_switch_latency_us; }
+	// File the show was loaded from, empty if created with ShowCreate
+	std::string Path() { return path; }
+
+	// Setters
+	void SetPath(std::string value) { path = value; }
 
 	// Methods
 	grpc::Status Load(json_t* json_show);
+	// Builds the scenes and sources of an already validated show.
+	grpc::Status Load(const ShowSpec& spec);
+	/**
+	 * Updates a loaded show to a new version of its spec. Scenes are matched
+	 * by name and only their changed sources are rebuilt (see Scene::Reload),
+	 * so a running show keeps its unchanged decoders. If the active scene was
+	 * removed, the show switches to the first scene of the spec first. A
+	 * scene is only preloaded or unloaded if its preload flag changed in the
+	 * spec, so ScenePreload and SceneUnload calls are kept.
+	 *
+	 * The steps are not rolled back: if one fails, the previous ones are kept
+	 * and the error message starts with "Show partially reloaded".
+	 */
+	grpc::Status Reload(const ShowSpec& spec, proto::ShowReloadStats* stats);
 	grpc::Status Start();
 	grpc::Status Stop();
 	Scene* GetScene(std::string scene_id);
@@ -24,18 +45,33 @@ public:
 	Scene* DuplicateSceneFromShow(Show* show, std::string scene_id);
 	Scene* DuplicateScene(std::string scene_id);
 	grpc::Status RemoveScene(std::string scene_id);
+	// Removes a scene even if active, stopping it if started. Rolls back an
+	// AddScene.
+	grpc::Status DiscardScene(std::string scene_id);
 	grpc::Status SwitchScene(std::string scene_id);
+	grpc::Status PreloadScene(std::string scene_id);
+	grpc::Status UnloadScene(std::string scene_id);
 	grpc::Status UpdateProto(proto::Show* proto_show);
 
 private:
+	void publishPreloadChanged(Scene* scene);
+
 	std::string id;
 	std::string name;
+	std::string path;
 	bool started;
 	SceneMap scenes;
 	Scene* active_scene;
 	obs_source_t* obs_transition;
 	Settings* settings;
+	EventBus* events;
+	SourceRegistry* registry;
+	InputWatchdog* watchdog;
 	uint64_t scene_id_counter;
+	uint64_t last_switch_latency_us;
+	// Preload flag of each scene in the spec last loaded or reloaded, by
+	// scene name
+	std::map<std::string, bool> spec_preload;
 };
 
 typedef std::map<std::string, Show*> ShowMap;
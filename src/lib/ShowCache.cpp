@@ -0,0 +1,297 @@
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ShowCache.hpp"
+
+#define SHOW_CACHE_MAGIC "OHSC"
+
+struct ShowCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t file_size;
+	int64_t file_mtime_ns;
+	uint64_t file_hash;
+	uint32_t scene_count;
+	uint32_t source_count;
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint64_t strings_size;
+};
+
+struct ShowCacheScene {
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint32_t first_source;
+	uint32_t source_count;
+	uint32_t preload;
+};
+
+struct ShowCacheSource {
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint32_t url_offset;
+	uint32_t url_length;
+	int32_t type;
+	int32_t width;
+	int32_t height;
+	uint32_t rescue_url_offset;
+	uint32_t rescue_url_length;
+	int32_t rescue_type;
+	// Serialized proto::SourceProperties
+	uint32_t properties_offset;
+	uint32_t properties_length;
+};
+
+static uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+	for(size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Appends str to the string table and returns its offset.
+static uint32_t addString(std::string* strings, const std::string& str) {
+	uint32_t offset = strings->size();
+	strings->append(str);
+	return offset;
+}
+
+ShowCache::ShowCache(std::string dir)
+	: dir(dir)
+	, enabled(false) {
+	if(dir.empty()) {
+		return;
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if(ec) {
+		trace_error("Can't create show cache dir, cache disabled", field_s(dir), error(ec.message()));
+		return;
+	}
+	enabled = true;
+	trace_info("Show cache enabled", field_s(dir));
+}
+
+std::string ShowCache::cachePath(const std::string& path) {
+	std::error_code ec;
+	std::string abs = std::filesystem::absolute(path, ec).lexically_normal().string();
+	if(ec) {
+		abs = path;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.showc", (unsigned long long)fnv1a(abs.data(), abs.size()));
+	return dir +"/"+ name;
+}
+
+grpc::Status ShowCache::Load(std::string path, ShowSpec* spec, bool* cached) {
+	*cached = false;
+	if(!enabled) {
+		return LoadShowSpecFile(path, spec);
+	}
+
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0) {
+		trace_error("Can't stat show file", field_s(path), error(strerror(errno)));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read show file "+ path);
+	}
+
+	FileKey key;
+	key.size = st.st_size;
+	key.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	key.hash = 0;
+
+	std::string cache_path = cachePath(path);
+	if(read(cache_path, key, false, spec)) {
+		trace_debug("Show cache hit", field_s(path));
+		*cached = true;
+		return grpc::Status::OK;
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if(!file.good() && !file.eof()) {
+		trace_error("Can't read show file", field_s(path));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read show file "+ path);
+	}
+	key.size = content.size();
+	key.hash = fnv1a(content.data(), content.size());
+
+	// Touched but unchanged: refresh the mtime of the cache entry
+	if(read(cache_path, key, true, spec)) {
+		trace_debug("Show cache hit by hash", field_s(path));
+		write(cache_path, key, *spec);
+		*cached = true;
+		return grpc::Status::OK;
+	}
+
+	json_error_t json_error;
+	json_t* json_show = json_loadb(content.data(), content.size(), 0, &json_error);
+	if(!json_show) {
+		trace_error("Error while loading json config", field_s(path), field_nc("error", json_error.text));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Error while loading json config: "+ std::string(json_error.text));
+	}
+
+	grpc::Status s = ParseShowSpec(json_show, spec);
+	json_decref(json_show);
+	if(!s.ok()) {
+		return s;
+	}
+
+	trace_debug("Show cache miss", field_s(path));
+	write(cache_path, key, *spec);
+	return grpc::Status::OK;
+}
+
+bool ShowCache::read(const std::string& cache_path, const FileKey& key, bool match_hash, ShowSpec* spec) {
+	int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShowCacheHeader)) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+
+	void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		return false;
+	}
+
+	const char* data = (const char*)map;
+	const ShowCacheHeader* header = (const ShowCacheHeader*)data;
+	bool ok = !memcmp(header->magic, SHOW_CACHE_MAGIC, sizeof(header->magic))
+		&& header->version == SHOW_CACHE_VERSION
+		&& header->file_size == key.size
+		&& (match_hash ? header->file_hash == key.hash : header->file_mtime_ns == key.mtime_ns)
+		&& size == sizeof(ShowCacheHeader)
+			+ (uint64_t)header->scene_count * sizeof(ShowCacheScene)
+			+ (uint64_t)header->source_count * sizeof(ShowCacheSource)
+			+ header->strings_size;
+
+	const ShowCacheScene* scenes = (const ShowCacheScene*)(data + sizeof(ShowCacheHeader));
+	const ShowCacheSource* sources = (const ShowCacheSource*)(data + sizeof(ShowCacheHeader) + (ok ? header->scene_count * sizeof(ShowCacheScene) : 0));
+	const char* strings = (const char*)(sources + (ok ? header->source_count : 0));
+
+	// Every offset is checked, a corrupted file is a miss
+	auto str = [&](uint32_t offset, uint32_t length, std::string* out) {
+		if((uint64_t)offset + length > header->strings_size) {
+			return false;
+		}
+		out->assign(strings + offset, length);
+		return true;
+	};
+
+	if(ok) {
+		ok = str(header->name_offset, header->name_length, &spec->name);
+		spec->scenes.clear();
+		spec->scenes.resize(ok ? header->scene_count : 0);
+	}
+	for(uint32_t i = 0; ok && i < header->scene_count; i++) {
+		const ShowCacheScene& cs = scenes[i];
+		SceneSpec& scene = spec->scenes[i];
+		ok = str(cs.name_offset, cs.name_length, &scene.name)
+			&& (uint64_t)cs.first_source + cs.source_count <= header->source_count;
+		if(!ok) {
+			break;
+		}
+		scene.preload = cs.preload;
+		scene.sources.resize(cs.source_count);
+
+		for(uint32_t j = 0; ok && j < cs.source_count; j++) {
+			const ShowCacheSource& cr = sources[cs.first_source + j];
+			SourceSpec& source = scene.sources[j];
+			ok = str(cr.name_offset, cr.name_length, &source.name)
+				&& str(cr.url_offset, cr.url_length, &source.url)
+				&& str(cr.rescue_url_offset, cr.rescue_url_length, &source.rescue_url)
+				&& (cr.type == Image || cr.type == RTMP)
+				&& (cr.rescue_type == InvalidType || cr.rescue_type == Image || cr.rescue_type == RTMP);
+			source.type = (SourceType)cr.type;
+			source.width = cr.width;
+			source.height = cr.height;
+			source.rescue_type = (SourceType)cr.rescue_type;
+			source.properties.Clear();
+			ok = ok && (uint64_t)cr.properties_offset + cr.properties_length <= header->strings_size
+				&& source.properties.ParseFromArray(strings + cr.properties_offset, cr.properties_length);
+		}
+	}
+
+	munmap(map, size);
+	if(!ok) {
+		trace_debug("Stale or invalid show cache file", field_s(cache_path));
+	}
+	return ok;
+}
+
+void ShowCache::write(const std::string& cache_path, const FileKey& key, const ShowSpec& spec) {
+	ShowCacheHeader header = {};
+	std::vector<ShowCacheScene> scenes;
+	std::vector<ShowCacheSource> sources;
+	std::string strings;
+
+	memcpy(header.magic, SHOW_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SHOW_CACHE_VERSION;
+	header.file_size = key.size;
+	header.file_mtime_ns = key.mtime_ns;
+	header.file_hash = key.hash;
+	header.name_offset = addString(&strings, spec.name);
+	header.name_length = spec.name.size();
+
+	scenes.reserve(spec.scenes.size());
+	for(const SceneSpec& scene : spec.scenes) {
+		ShowCacheScene cs;
+		cs.name_offset = addString(&strings, scene.name);
+		cs.name_length = scene.name.size();
+		cs.first_source = sources.size();
+		cs.source_count = scene.sources.size();
+		cs.preload = scene.preload;
+		scenes.push_back(cs);
+
+		for(const SourceSpec& source : scene.sources) {
+			ShowCacheSource cr;
+			cr.name_offset = addString(&strings, source.name);
+			cr.name_length = source.name.size();
+			cr.url_offset = addString(&strings, source.url);
+			cr.url_length = source.url.size();
+			cr.type = source.type;
+			cr.width = source.width;
+			cr.height = source.height;
+			cr.rescue_url_offset = addString(&strings, source.rescue_url);
+			cr.rescue_url_length = source.rescue_url.size();
+			cr.rescue_type = source.rescue_type;
+			cr.properties_offset = addString(&strings, source.properties.SerializeAsString());
+			cr.properties_length = strings.size() - cr.properties_offset;
+			sources.push_back(cr);
+		}
+	}
+	header.scene_count = scenes.size();
+	header.source_count = sources.size();
+	header.strings_size = strings.size();
+
+	// Unique per thread, so that concurrent loads of the same file don't mix
+	static std::atomic<uint64_t> tmp_counter(0);
+	std::string tmp_path = cache_path +".tmp"+ std::to_string(getpid()) +"."+ std::to_string(tmp_counter++);
+	std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)scenes.data(), scenes.size() * sizeof(ShowCacheScene));
+	out.write((const char*)sources.data(), sources.size() * sizeof(ShowCacheSource));
+	out.write(strings.data(), strings.size());
+	out.close();
+
+	if(!out.good() || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+		trace_error("Can't write show cache file", field_s(cache_path));
+		unlink(tmp_path.c_str());
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include "ShowSpec.hpp"
+
+/**
+ * @file
+ * @brief On-disk cache of compiled show specs.
+ *
+ * Each show file has one cache file in the cache directory, named after the
+ * hash of its path. It starts with the size, mtime and FNV-1a hash of the show
+ * file it was compiled from, followed by flat scene and source records and a
+ * string table:
+ *
+ *     ShowCacheHeader | ShowCacheScene[scene_count] | ShowCacheSource[source_count] | strings
+ *
+ * Records only hold offsets into the string table, so the file is read with
+ * one mmap and no parsing. If size and mtime match, the show file is not read
+ * at all; if only the mtime changed, the content hash decides. Cache files are
+ * written to a temporary file then renamed, so concurrent loads and crashes
+ * never leave a partial file. They use the host byte order and are rebuilt
+ * whenever SHOW_CACHE_VERSION changes.
+ *
+ */
+
+#define SHOW_CACHE_VERSION 3
+
+class ShowCache {
+public:
+	/**
+	 * @param  dir  cache directory, created if needed. Empty disables the
+	 *              cache: Load then always parses the json.
+	 */
+	ShowCache(std::string dir);
+
+	/**
+	 * Returns the spec of a show file, from the cache if it is up to date,
+	 * otherwise from the json, then updates the cache. Thread-safe.
+	 *
+	 * @param   path    the show file.
+	 * @param   spec    filled with the show.
+	 * @param   cached  set to true if the json was not parsed.
+	 * @return          grpc::Status::OK if successful
+	 *                  grpc::Status::INVALID_ARGUMENT if the file can't be
+	 *                  read, is not valid json or if ParseShowSpec fails.
+	 */
+	grpc::Status Load(std::string path, ShowSpec* spec, bool* cached);
+
+private:
+	// Identifies the content of a show file.
+	struct FileKey {
+		uint64_t size;
+		int64_t mtime_ns;
+		uint64_t hash;
+	};
+
+	std::string cachePath(const std::string& path);
+	// Decodes a cache file if it matches key: by size and mtime, or by size
+	// and hash if match_hash is set.
+	bool read(const std::string& cache_path, const FileKey& key, bool match_hash, ShowSpec* spec);
+	void write(const std::string& cache_path, const FileKey& key, const ShowSpec& spec);
+
+	std::string dir;
+	bool enabled;
+};
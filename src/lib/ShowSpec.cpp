@@ -0,0 +1,226 @@
+#include <cstring>
+#include "ShowSpec.hpp"
+
+// Reads the "properties" object of a source, see proto::SourceProperties.
+static grpc::Status parseSourceProperties(json_t* jsonProperties, size_t sceneIdx, size_t sourceIdx, proto::SourceProperties* properties) {
+	std::string location = "sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx);
+	if(!json_is_object(jsonProperties)) {
+		trace_error("Source properties is not an object", field(sceneIdx), field(sourceIdx));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Source properties is not an object "+ location);
+	}
+
+	const char* key;
+	json_t* value;
+	json_object_foreach(jsonProperties, key, value) {
+		bool ok;
+		if(!strcmp(key, "buffering_mb")) {
+			ok = json_is_integer(value);
+			properties->set_buffering_mb(json_integer_value(value));
+		} else if(!strcmp(key, "reconnect_delay_sec")) {
+			ok = json_is_integer(value);
+			properties->set_reconnect_delay_sec(json_integer_value(value));
+		} else if(!strcmp(key, "close_when_inactive")) {
+			ok = json_is_boolean(value);
+			properties->set_close_when_inactive(json_is_true(value));
+		} else if(!strcmp(key, "ffmpeg_options")) {
+			ok = json_is_string(value);
+			properties->set_ffmpeg_options(ok ? json_string_value(value) : "");
+		} else if(!strcmp(key, "restart_on_activate")) {
+			ok = json_is_boolean(value);
+			properties->set_restart_on_activate(json_is_true(value));
+		} else {
+			trace_error("Unknown source property", field(sceneIdx), field(sourceIdx), field_c(key));
+			return grpc::Status(grpc::INVALID_ARGUMENT, "Unknown source property "+ std::string(key) +" "+ location);
+		}
+
+		if(!ok) {
+			trace_error("Invalid source property type", field(sceneIdx), field(sourceIdx), field_c(key));
+			return grpc::Status(grpc::INVALID_ARGUMENT, "Invalid type for source property "+ std::string(key) +" "+ location);
+		}
+	}
+
+	return ValidateSourceProperties(*properties);
+}
+
+grpc::Status ParseShowSpec(json_t* jsonShow, ShowSpec* spec) {
+	json_t* jsonShowName = json_object_get(jsonShow, "name");
+	if(!jsonShowName) {
+		trace_error("Show name not found in json");
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Show name not found in config file");
+	}
+
+	const char* strShowName = json_string_value(jsonShowName);
+	if(!strShowName) {
+		trace_error("Can't read show name");
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Show name not found in config file");
+	}
+	spec->name = std::string(strShowName);
+
+	json_t* jsonScenes = json_object_get(jsonShow, "scenes");
+	if(!jsonScenes) {
+		trace_error("Scenes not found in json", field_s(spec->name));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Scenes not found in config file");
+	}
+
+	size_t sceneIdx;
+	json_t *jsonScene;
+
+	spec->scenes.clear();
+	spec->scenes.reserve(json_array_size(jsonScenes));
+	json_array_foreach(jsonScenes, sceneIdx, jsonScene) {
+		const char* strSceneName = nullptr;
+		json_t* jsonScenePreload = nullptr;
+		json_t* jsonSources = nullptr;
+
+		// One pass over the keys instead of one json_object_get per field
+		const char* key;
+		json_t* value;
+		json_object_foreach(jsonScene, key, value) {
+			if(!strcmp(key, "name")) {
+				strSceneName = json_string_value(value);
+				if(!strSceneName) {
+					trace_error("Can't read scene name", field(sceneIdx));
+					return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read scene name sceneIdx="+ std::to_string(sceneIdx));
+				}
+			} else if(!strcmp(key, "preload")) {
+				jsonScenePreload = value;
+			} else if(!strcmp(key, "sources")) {
+				jsonSources = value;
+			}
+		}
+
+		if(!strSceneName) {
+			trace_error("Scene name not found in json", field(sceneIdx));
+			return grpc::Status(grpc::INVALID_ARGUMENT, "Scene name not found in config file sceneIdx="+ std::to_string(sceneIdx));
+		}
+
+		if(!jsonSources) {
+			trace_error("Sources not found in json", field(sceneIdx));
+			return grpc::Status(grpc::INVALID_ARGUMENT, "Sources not found in config file sceneIdx="+ std::to_string(sceneIdx));
+		}
+
+		spec->scenes.emplace_back();
+		SceneSpec& scene = spec->scenes.back();
+		scene.name = std::string(strSceneName);
+		scene.preload = jsonScenePreload && json_is_true(jsonScenePreload);
+		scene.sources.reserve(json_array_size(jsonSources));
+
+		size_t sourceIdx;
+		json_t* jsonSource;
+
+		json_array_foreach(jsonSources, sourceIdx, jsonSource) {
+			json_t* jsonSourceName = nullptr;
+			json_t* jsonSourceUrl = nullptr;
+			json_t* jsonSourceType = nullptr;
+			json_t* jsonSourceWidth = nullptr;
+			json_t* jsonSourceHeight = nullptr;
+			json_t* jsonSourceRescue = nullptr;
+			json_t* jsonSourceProperties = nullptr;
+
+			json_object_foreach(jsonSource, key, value) {
+				if(!strcmp(key, "name")) {
+					jsonSourceName = value;
+				} else if(!strcmp(key, "url")) {
+					jsonSourceUrl = value;
+				} else if(!strcmp(key, "type")) {
+					jsonSourceType = value;
+				} else if(!strcmp(key, "width")) {
+					jsonSourceWidth = value;
+				} else if(!strcmp(key, "height")) {
+					jsonSourceHeight = value;
+				} else if(!strcmp(key, "rescue")) {
+					jsonSourceRescue = value;
+				} else if(!strcmp(key, "properties")) {
+					jsonSourceProperties = value;
+				}
+			}
+
+			if(!jsonSourceName) {
+				trace_error("Source name not found in json", field(sceneIdx), field(sourceIdx));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Source name not found in config file sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+			}
+
+			const char* strSourceName = json_string_value(jsonSourceName);
+			if(!strSourceName) {
+				trace_error("Can't read source name", field(sceneIdx), field(sourceIdx));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read source name sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+			}
+
+			if(!jsonSourceUrl) {
+				trace_error("Source url not found in json", field(sceneIdx), field(sourceIdx));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Source url not found in config file sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+			}
+
+			const char* strSourceUrl = json_string_value(jsonSourceUrl);
+			if(!strSourceUrl) {
+				trace_error("Can't read source url", field(sceneIdx), field(sourceIdx));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read source url sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+			}
+
+			if(!jsonSourceType) {
+				trace_error("Source type not found in json", field(sceneIdx), field(sourceIdx));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Source type not found in config file sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+			}
+
+			const char* strSourceType = json_string_value(jsonSourceType);
+			if(!strSourceType) {
+				trace_error("Can't read source type", field(sceneIdx), field(sourceIdx));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read source type sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+			}
+
+			SourceType type = StringToSourceType(std::string(strSourceType));
+			if(type == InvalidType) {
+				trace_error("Unsupported source type", field_c(strSourceType));
+				return grpc::Status(grpc::INVALID_ARGUMENT, "Unsupported source type="+ std::string(strSourceType));
+			}
+
+			// Optional, {"type": ..., "url": ...} like the source itself
+			SourceType rescueType = InvalidType;
+			const char* strRescueUrl = "";
+			if(jsonSourceRescue) {
+				const char* strRescueType = json_string_value(json_object_get(jsonSourceRescue, "type"));
+				strRescueUrl = json_string_value(json_object_get(jsonSourceRescue, "url"));
+				if(!strRescueType || !strRescueUrl) {
+					trace_error("Can't read source rescue type and url", field(sceneIdx), field(sourceIdx));
+					return grpc::Status(grpc::INVALID_ARGUMENT, "Can't read source rescue type and url sceneIdx="+ std::to_string(sceneIdx) +", sourceIdx="+ std::to_string(sourceIdx));
+				}
+				rescueType = StringToSourceType(std::string(strRescueType));
+				if(rescueType == InvalidType) {
+					trace_error("Unsupported rescue type", field_c(strRescueType));
+					return grpc::Status(grpc::INVALID_ARGUMENT, "Unsupported rescue type="+ std::string(strRescueType));
+				}
+			}
+
+			scene.sources.emplace_back();
+			SourceSpec& source = scene.sources.back();
+			source.name = std::string(strSourceName);
+			source.type = type;
+			source.url = std::string(strSourceUrl);
+			source.width = (jsonSourceWidth && json_is_integer(jsonSourceWidth)) ? json_integer_value(jsonSourceWidth) : -1;
+			source.height = (jsonSourceHeight && json_is_integer(jsonSourceHeight)) ? json_integer_value(jsonSourceHeight) : -1;
+			source.rescue_type = rescueType;
+			source.rescue_url = std::string(strRescueUrl);
+			if(jsonSourceProperties) {
+				grpc::Status s = parseSourceProperties(jsonSourceProperties, sceneIdx, sourceIdx, &source.properties);
+				if(!s.ok()) {
+					return s;
+				}
+			}
+		}
+	}
+
+	return grpc::Status::OK;
+}
+
+grpc::Status LoadShowSpecFile(std::string path, ShowSpec* spec) {
+	json_error_t error;
+	json_t* json_show = json_load_file(path.c_str(), 0, &error);
+	if(!json_show) {
+		trace_error("Error while loading json config", field_s(path), field_nc("error", error.text));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Error while loading json config: "+ std::string(error.text));
+	}
+
+	grpc::Status s = ParseShowSpec(json_show, spec);
+	json_decref(json_show);
+	return s;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <jansson.h>
+#include <grpc++/grpc++.h>
+#include "Source.hpp"
+
+/**
+ * @file
+ * @brief Validated description of a show file, before any Show is built.
+ *
+ * Parsing and validating a show only reads its file, so it runs without the
+ * studio lock and in parallel for ShowLoadMany. Show::Load then builds the
+ * scenes and sources from the spec. Specs are also what the compiled show
+ * cache (ShowCache.hpp) stores, so an unchanged file skips the json parsing.
+ *
+ */
+
+struct SourceSpec {
+	std::string name;
+	SourceType type;
+	std::string url;
+	// -1 if not set
+	int width;
+	int height;
+	// InvalidType if the source has no rescue
+	SourceType rescue_type;
+	std::string rescue_url;
+	proto::SourceProperties properties;
+};
+
+struct SceneSpec {
+	std::string name;
+	bool preload;
+	std::vector<SourceSpec> sources;
+};
+
+struct ShowSpec {
+	std::string name;
+	std::vector<SceneSpec> scenes;
+};
+
+/**
+ * Validates a show in the format of etc/shows/*.json and fills spec.
+ *
+ * @return  grpc::Status::OK if successful
+ *          grpc::Status::INVALID_ARGUMENT if a field is missing or invalid
+ */
+grpc::Status ParseShowSpec(json_t* json_show, ShowSpec* spec);
+
+/**
+ * Reads and validates a show file.
+ *
+ * @return  grpc::Status::OK if successful
+ *          grpc::Status::INVALID_ARGUMENT if the file can't be read, is not
+ *          valid json or if ParseShowSpec fails.
+ */
+grpc::Status LoadShowSpecFile(std::string path, ShowSpec* spec);
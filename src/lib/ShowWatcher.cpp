@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+#include "ShowWatcher.hpp"
+#include "Trace.hpp"
+
+#define SHOW_WATCHER_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+ShowWatcher::ShowWatcher(int debounce_ms, std::function<void(std::string path)> changed)
+	: debounce_ms(debounce_ms)
+	, changed(changed)
+	, inotify_fd(-1)
+	, stop_fd(-1) {
+}
+
+ShowWatcher::~ShowWatcher() {
+	Stop();
+}
+
+bool ShowWatcher::Start() {
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(inotify_fd < 0) {
+		trace_error("inotify_init1 failed", error(strerror(errno)));
+		return false;
+	}
+	stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(stop_fd < 0) {
+		trace_error("eventfd failed", error(strerror(errno)));
+		close(inotify_fd);
+		inotify_fd = -1;
+		return false;
+	}
+
+	thread = std::thread(&ShowWatcher::run, this);
+	trace_info("Show watcher started", field(debounce_ms));
+	return true;
+}
+
+void ShowWatcher::Stop() {
+	if(!thread.joinable()) {
+		return;
+	}
+
+	uint64_t one = 1;
+	if(write(stop_fd, &one, sizeof(one)) != sizeof(one)) {
+		trace_error("Failed to wake the show watcher up", error(strerror(errno)));
+	}
+	thread.join();
+	close(stop_fd);
+	close(inotify_fd);
+	stop_fd = -1;
+	inotify_fd = -1;
+}
+
+std::string ShowWatcher::absolutePath(const std::string& path) {
+	std::error_code ec;
+	std::filesystem::path abs = std::filesystem::absolute(path, ec);
+	if(ec) {
+		return path;
+	}
+	return abs.lexically_normal().string();
+}
+
+void ShowWatcher::Watch(std::string path) {
+	std::string abs = absolutePath(path);
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto it = files.find(abs);
+	if(it != files.end()) {
+		it->second.refs++;
+		return;
+	}
+
+	File file;
+	file.path = path;
+	file.refs = 1;
+	file.wd = -1;
+	file.pending = false;
+
+	if(inotify_fd >= 0) {
+		std::string dir = std::filesystem::path(abs).parent_path().string();
+		// Watching the same directory again returns the same descriptor
+		file.wd = inotify_add_watch(inotify_fd, dir.c_str(), SHOW_WATCHER_EVENTS);
+		if(file.wd < 0) {
+			trace_error("inotify_add_watch failed", field_s(dir), error(strerror(errno)));
+		} else {
+			dirs[file.wd].first = dir;
+			dirs[file.wd].second++;
+		}
+	}
+
+	trace_debug("Watch show file", field_s(abs));
+	files[abs] = file;
+}
+
+void ShowWatcher::Unwatch(std::string path) {
+	std::string abs = absolutePath(path);
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto it = files.find(abs);
+	if(it == files.end() || --it->second.refs > 0) {
+		return;
+	}
+
+	int wd = it->second.wd;
+	if(wd >= 0 && --dirs[wd].second == 0) {
+		inotify_rm_watch(inotify_fd, wd);
+		dirs.erase(wd);
+	}
+
+	trace_debug("Unwatch show file", field_s(abs));
+	files.erase(it);
+}
+
+void ShowWatcher::run() {
+	alignas(struct inotify_event) char buf[4096];
+
+	while(true) {
+		// Sleep until the next debounce deadline, if any
+		int timeout_ms = -1;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			for(auto & it : files) {
+				if(!it.second.pending) {
+					continue;
+				}
+				int64_t wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(it.second.deadline - now).count();
+				wait_ms = std::max<int64_t>(wait_ms, 0);
+				if(timeout_ms < 0 || wait_ms < timeout_ms) {
+					timeout_ms = wait_ms;
+				}
+			}
+		}
+
+		struct pollfd fds[2] = {
+			{ inotify_fd, POLLIN, 0 },
+			{ stop_fd, POLLIN, 0 },
+		};
+		if(poll(fds, 2, timeout_ms) < 0 && errno != EINTR) {
+			trace_error("Show watcher poll failed", error(strerror(errno)));
+			return;
+		}
+		if(fds[1].revents & POLLIN) {
+			return;
+		}
+
+		std::vector<std::string> due;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+			ssize_t len;
+			while((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+				for(char* ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len) {
+					const struct inotify_event* event = (const struct inotify_event*)ptr;
+					auto dir = dirs.find(event->wd);
+					if(!event->len || dir == dirs.end()) {
+						continue;
+					}
+
+					auto file = files.find(dir->second.first +"/"+ event->name);
+					if(file == files.end()) {
+						continue;
+					}
+					file->second.pending = true;
+					file->second.deadline = now + std::chrono::milliseconds(debounce_ms);
+				}
+			}
+
+			for(auto & it : files) {
+				if(it.second.pending && it.second.deadline <= now) {
+					it.second.pending = false;
+					due.push_back(it.second.path);
+				}
+			}
+		}
+
+		// Without the lock, the callback may Watch or Unwatch
+		for(const std::string& path : due) {
+			trace_info("Show file changed", field_s(path));
+			changed(path);
+		}
+	}
+}
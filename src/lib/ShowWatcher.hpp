@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * @file
+ * @brief inotify watcher of the loaded show files.
+ *
+ * The directory of each file is watched rather than the file itself, so that
+ * editors saving to a temporary file and renaming it over the show are seen
+ * too. Several events on a file within the debounce delay (a save often
+ * writes it in several steps) trigger one call of the callback, from the
+ * watcher thread.
+ *
+ */
+
+class ShowWatcher {
+public:
+	/**
+	 * @param  debounce_ms  quiet time after the last event on a file before
+	 *                      changed is called.
+	 * @param  changed      called with the path of a changed file, as passed
+	 *                      to Watch.
+	 */
+	ShowWatcher(int debounce_ms, std::function<void(std::string path)> changed);
+
+	/**
+	 * ShowWatcher destructor, stops the watcher thread.
+	 */
+	~ShowWatcher();
+
+	// Starts the watcher thread. Returns false if inotify is not available.
+	bool Start();
+	void Stop();
+
+	// Watches a file. Calls are counted, each must be matched by an Unwatch.
+	void Watch(std::string path);
+	void Unwatch(std::string path);
+
+private:
+	struct File {
+		std::string path;
+		int refs;
+		int wd;
+		// Set while an event is waiting for the debounce delay
+		bool pending;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	void run();
+	std::string absolutePath(const std::string& path);
+
+	int debounce_ms;
+	std::function<void(std::string path)> changed;
+	int inotify_fd;
+	// Written by Stop to wake the thread up
+	int stop_fd;
+	std::thread thread;
+
+	// Protects files and dirs
+	std::mutex mtx;
+	// By absolute path
+	std::map<std::string, File> files;
+	// Watched directories by watch descriptor, and their number of files
+	std::map<int, std::pair<std::string, int>> dirs;
+};
@@ -1,3 +1,4 @@
+#include <cstring>
 #include "Source.hpp"
 
 std::string SourceTypeToString(SourceType type) {
@@ -19,17 +20,73 @@ SourceType StringToSourceType(std::string type) {
 	return InvalidType;
 }
 
-Source::Source(std::string id, std::string name, SourceType type, std::string url, int width, int height, Settings* settings)
+grpc::Status ValidateSourceProperties(const proto::SourceProperties& properties) {
+	if(properties.has_buffering_mb() && (properties.buffering_mb() < 0 || properties.buffering_mb() > 16)) {
+		trace_error("Invalid buffering_mb", field_n("buffering_mb", properties.buffering_mb()));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Invalid buffering_mb="+ std::to_string(properties.buffering_mb()) +", expected 0 to 16");
+	}
+	if(properties.has_reconnect_delay_sec() && (properties.reconnect_delay_sec() < 1 || properties.reconnect_delay_sec() > 60)) {
+		trace_error("Invalid reconnect_delay_sec", field_n("reconnect_delay_sec", properties.reconnect_delay_sec()));
+		return grpc::Status(grpc::INVALID_ARGUMENT, "Invalid reconnect_delay_sec="+ std::to_string(properties.reconnect_delay_sec()) +", expected 1 to 60");
+	}
+	return grpc::Status::OK;
+}
+
+std::string SourcePropertiesKey(const proto::SourceProperties& properties) {
+	// close_when_inactive and restart_on_activate are always set on the obs
+	// source, the other fields only when set
+	std::string key = "close_when_inactive="+ std::to_string(properties.close_when_inactive());
+	key += "|restart_on_activate="+ std::to_string(properties.restart_on_activate());
+	if(properties.has_buffering_mb()) {
+		key += "|buffering_mb="+ std::to_string(properties.buffering_mb());
+	}
+	if(properties.has_reconnect_delay_sec()) {
+		key += "|reconnect_delay_sec="+ std::to_string(properties.reconnect_delay_sec());
+	}
+	if(properties.has_ffmpeg_options()) {
+		key += "|ffmpeg_options="+ properties.ffmpeg_options();
+	}
+	return key;
+}
+
+bool PollSourceReady(obs_source_t* source, SourceReadyPoll* poll) {
+	// Images are loaded by obs_source_create
+	if(strcmp(obs_source_get_id(source), "ffmpeg_source")) {
+		return true;
+	}
+
+	if(obs_source_media_get_state(source) != OBS_MEDIA_STATE_PLAYING) {
+		return false;
+	}
+	int64_t media_time = obs_source_media_get_time(source);
+	if(poll->first_time < 0) {
+		poll->first_time = media_time;
+		return false;
+	}
+	return media_time > poll->first_time;
+}
+
+Source::Source(std::string id, std::string name, SourceType type, std::string url, int width, int height, Settings* settings, SourceRegistry* registry, InputWatchdog* watchdog)
 	: id(id)
 	, name(name)
 	, type(type)
 	, url(url)
 	, width(width)
 	, height(height)
+	, rescue_type(InvalidType)
 	, started(false)
 	, obs_source(nullptr)
+	, obs_scene_item(nullptr)
+	, rescue_source(nullptr)
+	, rescue_item(nullptr)
+	, pending_source(nullptr)
+	, pending_item(nullptr)
+	, pending_type(InvalidType)
+	, update_counter(0)
 	, obs_scene_ptr(nullptr)
-	, settings(settings) {
+	, settings(settings)
+	, registry(registry)
+	, watchdog(watchdog) {
 	trace_debug("Create Source", field_s(id), field_s(name), field_ns("type", SourceTypeToString(type)), field_s(url));
 }
 
@@ -65,62 +122,67 @@ grpc::Status Source::SetUrl(std::string new_url) {
 	return grpc::Status::OK;
 }
 
-grpc::Status Source::Start(obs_scene_t** obs_scene_in) {	
-	grpc::Status s = grpc::Status::OK;
-	obs_data_t* obs_data;
-	obs_scene_ptr = obs_scene_in;
-
+grpc::Status Source::SetRescue(SourceType new_type, std::string new_url) {
 	if(started) {
 		trace_error("Source already started", field_s(id));
 		return grpc::Status(grpc::FAILED_PRECONDITION, "Source already started");
 	}
+	rescue_type = new_type;
+	rescue_url = new_type == InvalidType ? "" : new_url;
+	trace_info("update source rescue", field_s(id), field_s(name), field_ns("type", SourceTypeToString(rescue_type)), field_s(rescue_url));
+	return grpc::Status::OK;
+}
 
-	// Create the source
-	obs_data = obs_data_create();
-	if (!obs_data) {
-		trace_error("Failed to create obs_data", field_s(id));
-		return grpc::Status(grpc::INTERNAL, "Failed to create obs_data");
+grpc::Status Source::SetProperties(const proto::SourceProperties& new_properties) {
+	if(started) {
+		trace_error("Source already started", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Source already started");
 	}
+	properties.MergeFrom(new_properties);
+	trace_info("update source properties", field_s(id), field_s(name), field_ns("properties", SourcePropertiesKey(properties)));
+	return grpc::Status::OK;
+}
 
-	if(type == Image) {
-		obs_data_set_string(obs_data, "file", url.c_str());
-		obs_data_set_bool(obs_data, "unload", false);
-
-		obs_source = obs_source_create("image_source", "obs_image_source", obs_data, nullptr);
-	} else if(type == RTMP){
-		trace_debug("create ffmpeg src", field_s(id), field_s(name), field_s(url));
+grpc::Status Source::Restore(SourceType old_type, std::string old_url, const proto::SourceProperties& old_properties) {
+	if(started) {
+		trace_error("Source already started", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Source already started");
+	}
+	type = old_type;
+	url = old_url;
+	properties = old_properties;
+	trace_debug("restore source", field_s(id), field_s(name), field_ns("type", SourceTypeToString(type)), field_s(url));
+	return grpc::Status::OK;
+}
 
-		obs_data_set_string(obs_data, "input", url.c_str());
-		obs_data_set_bool(obs_data, "is_local_file", false);
-		obs_data_set_bool(obs_data, "looping", true);
-		obs_data_set_bool(obs_data, "hw_decode", settings->video_hw_decode);
+grpc::Status Source::Start(obs_scene_t** obs_scene_in) {
+	grpc::Status s = grpc::Status::OK;
+	obs_scene_ptr = obs_scene_in;
 
-		std::string source_name = std::string("obs_src_ffmpeg_"+name);
-		obs_source = obs_source_create("ffmpeg_source", source_name.c_str(), obs_data, nullptr);
-	} else {
-		trace_error("Unsupported source type", field(type));
+	if(started) {
+		trace_error("Source already started", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Source already started");
 	}
 
-	obs_data_release(obs_data);
-
+	// Sources with the same input share the obs source, and its decoder
+	obs_source = registry->Acquire(registryKey(type, url, properties), [this]() { return createObsSource(type, url, name, properties); });
 	if (!obs_source) {
 		return grpc::Status(grpc::INTERNAL, "Failed to create obs_source");
 	}
 
 	// Add the source to the scene
-	s = addSourceToScene(obs_source);
+	s = addSourceToScene(obs_source, &obs_scene_item);
 	if(!s.ok()) {
+		registry->Release(obs_source);
+		obs_source = nullptr;
 		return s;
 	}
 
-	// Register signals callbacks on the main source
-	signal_handler_t *handler = obs_source_get_signal_handler(obs_source);
-	signal_handler_connect(handler, "show", SourceShowCb, this);
-	signal_handler_connect(handler, "hide", SourceHideCb, this);
-	signal_handler_connect(handler, "activate", SourceActivateCb, this);
-	signal_handler_connect(handler, "transition_start", SourceTransitionStartCb, this);
-	signal_handler_connect(handler, "transition_video_stop", SourceTransitionVideoStopCb, this);
-	signal_handler_connect(handler, "transition_stop", SourceTransitionStopCb, this);
+	if(rescue_type != InvalidType) {
+		startRescue();
+	}
+
+	connectSignals(obs_source);
 
 	started = true;
 	return grpc::Status::OK;
@@ -132,11 +194,176 @@ grpc::Status Source::Stop() {
 		return grpc::Status(grpc::FAILED_PRECONDITION, "Source already stopped");
 	}
 
-	obs_source_release(obs_source);
+	if(pending_source) {
+		AbortUpdate();
+	}
+
+	// The obs source may outlive this Source when it is shared
+	disconnectSignals(obs_source);
+
+	if(rescue_item) {
+		if(watchdog) {
+			watchdog->RemoveRescue(obs_source, obs_scene_item);
+		}
+		obs_sceneitem_remove(rescue_item);
+		registry->Release(rescue_source);
+		rescue_item = nullptr;
+		rescue_source = nullptr;
+	}
+
+	// Sources of the same input share the obs source, but each one has its
+	// own scene item
+	obs_sceneitem_remove(obs_scene_item);
+	obs_scene_item = nullptr;
+
+	registry->Release(obs_source);
+	obs_source = nullptr;
 	started = false;
 	return grpc::Status::OK;
 }
 
+grpc::Status Source::Update(SourceType new_type, std::string new_url, const proto::SourceProperties& new_properties, obs_source_t** pending, uint64_t* update_id) {
+	*pending = nullptr;
+	*update_id = 0;
+
+	if(!started) {
+		trace_error("Source not started", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Source not started");
+	}
+	if(pending_source) {
+		trace_error("Source update already pending", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "Source update already pending");
+	}
+
+	// Same obs settings, e.g. properties of an image
+	std::string new_key = registryKey(new_type, new_url, new_properties);
+	if(new_key == registryKey(type, url, properties)) {
+		type = new_type;
+		url = new_url;
+		properties = new_properties;
+		return grpc::Status::OK;
+	}
+
+	// Reloading an image is immediate, if no other source shows it
+	if(type == Image && new_type == Image && registry->Rekey(obs_source, new_key)) {
+		obs_data_t* obs_data = obs_data_create();
+		obs_data_set_string(obs_data, "file", new_url.c_str());
+		obs_source_update(obs_source, obs_data);
+		obs_data_release(obs_data);
+
+		url = new_url;
+		properties = new_properties;
+		trace_info("Updated source in place", field_s(id), field_s(name), field_s(url));
+		return grpc::Status::OK;
+	}
+
+	pending_source = registry->Acquire(new_key, [&]() { return createObsSource(new_type, new_url, name, new_properties); });
+	if(!pending_source) {
+		return grpc::Status(grpc::INTERNAL, "Failed to create obs_source");
+	}
+	grpc::Status s = addSourceToScene(pending_source, &pending_item);
+	if(!s.ok()) {
+		registry->Release(pending_source);
+		pending_source = nullptr;
+		return s;
+	}
+
+	bool close_when_inactive = new_type == RTMP && new_properties.close_when_inactive();
+	if(close_when_inactive && obs_source_active(obs_source)) {
+		// Hidden, the new input would stay closed: shown right below the
+		// current item instead, which keeps covering it while it opens
+		obs_sceneitem_set_order_position(pending_item, obs_sceneitem_get_order_position(obs_scene_item));
+	} else {
+		// Hidden right above the current item, so showing it covers it
+		obs_sceneitem_set_visible(pending_item, false);
+		obs_sceneitem_set_order_position(pending_item, obs_sceneitem_get_order_position(obs_scene_item) + 1);
+	}
+
+	pending_type = new_type;
+	pending_url = new_url;
+	pending_properties = new_properties;
+	update_counter++;
+	trace_info("Opening the new input of source", field_s(id), field_s(name), field_ns("type", SourceTypeToString(new_type)), field_s(new_url));
+
+	// Not on the program, the new input only opens once the scene is
+	if(close_when_inactive && !obs_source_active(obs_source)) {
+		return CommitUpdate();
+	}
+
+	*pending = obs_source_get_ref(pending_source);
+	*update_id = update_counter;
+	return grpc::Status::OK;
+}
+
+grpc::Status Source::CommitUpdate() {
+	if(!pending_source) {
+		trace_error("No pending source update", field_s(id));
+		return grpc::Status(grpc::FAILED_PRECONDITION, "No pending source update");
+	}
+
+	if(rescue_item && watchdog) {
+		watchdog->RemoveRescue(obs_source, obs_scene_item);
+	}
+
+	// Shown first: the next frame has the new input, whatever the state of
+	// the current one, which is above it or removed right after
+	obs_sceneitem_set_visible(pending_item, true);
+	if(rescue_item) {
+		obs_sceneitem_set_visible(rescue_item, false);
+	}
+	obs_sceneitem_remove(obs_scene_item);
+	disconnectSignals(obs_source);
+	registry->Release(obs_source);
+
+	obs_source = pending_source;
+	obs_scene_item = pending_item;
+	type = pending_type;
+	url = pending_url;
+	properties = pending_properties;
+	pending_source = nullptr;
+	pending_item = nullptr;
+
+	connectSignals(obs_source);
+	if(rescue_item && watchdog) {
+		watchdog->AddRescue(obs_source, obs_scene_item, rescue_item);
+	}
+
+	trace_info("Swapped the input of source", field_s(id), field_s(name), field_ns("type", SourceTypeToString(type)), field_s(url));
+	return grpc::Status::OK;
+}
+
+void Source::AbortUpdate() {
+	if(!pending_source) {
+		return;
+	}
+
+	trace_warn("Aborted the update of source", field_s(id), field_s(name), field_ns("url", pending_url));
+	obs_sceneitem_remove(pending_item);
+	registry->Release(pending_source);
+	pending_source = nullptr;
+	pending_item = nullptr;
+}
+
+void Source::connectSignals(obs_source_t* source) {
+	signal_handler_t *handler = obs_source_get_signal_handler(source);
+	signal_handler_connect(handler, "show", SourceShowCb, this);
+	signal_handler_connect(handler, "hide", SourceHideCb, this);
+	signal_handler_connect(handler, "activate", SourceActivateCb, this);
+	signal_handler_connect(handler, "transition_start", SourceTransitionStartCb, this);
+	signal_handler_connect(handler, "transition_video_stop", SourceTransitionVideoStopCb, this);
+	signal_handler_connect(handler, "transition_stop", SourceTransitionStopCb, this);
+}
+
+void Source::disconnectSignals(obs_source_t* source) {
+	signal_handler_t *handler = obs_source_get_signal_handler(source);
+	signal_handler_disconnect(handler, "show", SourceShowCb, this);
+	signal_handler_disconnect(handler, "hide", SourceHideCb, this);
+	signal_handler_disconnect(handler, "activate", SourceActivateCb, this);
+	signal_handler_disconnect(handler, "transition_start", SourceTransitionStartCb, this);
+	signal_handler_disconnect(handler, "transition_video_stop", SourceTransitionVideoStopCb, this);
+	signal_handler_disconnect(handler, "transition_stop", SourceTransitionStopCb, this);
+}
+
 void SourceShowCb(void *my_data, calldata_t *cd) {
 	Source* src				= (Source*) my_data;
 	obs_source_t *obs_source	= (obs_source_t*) calldata_ptr(cd, "source");
@@ -215,10 +442,69 @@ grpc::Status Source::UpdateProto(proto::Source* proto_source) {
 	proto_source->set_name(name);
 	proto_source->set_type(SourceTypeToString(type));
 	proto_source->set_url(url);
+	proto_source->mutable_properties()->CopyFrom(properties);
+	if(rescue_type != InvalidType) {
+		proto_source->set_rescue_type(SourceTypeToString(rescue_type));
+		proto_source->set_rescue_url(rescue_url);
+	}
 	return grpc::Status::OK;
 }
 
-grpc::Status Source::addSourceToScene(obs_source_t* source) {
+std::string Source::registryKey(SourceType source_type, const std::string& source_url, const proto::SourceProperties& source_properties) {
+	std::string key = SourceTypeToString(source_type) +"|"+ source_url;
+	if(source_type == RTMP) {
+		key += settings->video_hw_decode ? "|hw_decode|" : "|sw_decode|";
+		key += SourcePropertiesKey(source_properties);
+	}
+	return key;
+}
+
+obs_source_t* Source::createObsSource(SourceType source_type, std::string source_url, std::string obs_name, const proto::SourceProperties& source_properties) {
+	obs_source_t* new_source = nullptr;
+
+	obs_data_t* obs_data = obs_data_create();
+	if (!obs_data) {
+		trace_error("Failed to create obs_data", field_s(id));
+		return nullptr;
+	}
+
+	if(source_type == Image) {
+		obs_data_set_string(obs_data, "file", source_url.c_str());
+		obs_data_set_bool(obs_data, "unload", false);
+
+		new_source = obs_source_create("image_source", "obs_image_source", obs_data, nullptr);
+	} else if(source_type == RTMP){
+		trace_debug("create ffmpeg src", field_s(id), field_s(obs_name), field_s(source_url));
+
+		obs_data_set_string(obs_data, "input", source_url.c_str());
+		obs_data_set_bool(obs_data, "is_local_file", false);
+		obs_data_set_bool(obs_data, "looping", true);
+		obs_data_set_bool(obs_data, "hw_decode", settings->video_hw_decode);
+		// Unless set, keep decoding while the scene is preloaded but not
+		// shown, and do not reconnect when it becomes visible.
+		obs_data_set_bool(obs_data, "close_when_inactive", source_properties.close_when_inactive());
+		obs_data_set_bool(obs_data, "restart_on_activate", source_properties.restart_on_activate());
+		if(source_properties.has_buffering_mb()) {
+			obs_data_set_int(obs_data, "buffering_mb", source_properties.buffering_mb());
+		}
+		if(source_properties.has_reconnect_delay_sec()) {
+			obs_data_set_int(obs_data, "reconnect_delay_sec", source_properties.reconnect_delay_sec());
+		}
+		if(source_properties.has_ffmpeg_options()) {
+			obs_data_set_string(obs_data, "ffmpeg_options", source_properties.ffmpeg_options().c_str());
+		}
+
+		std::string source_name = std::string("obs_src_ffmpeg_"+obs_name);
+		new_source = obs_source_create("ffmpeg_source", source_name.c_str(), obs_data, nullptr);
+	} else {
+		trace_error("Unsupported source type", field(source_type));
+	}
+
+	obs_data_release(obs_data);
+	return new_source;
+}
+
+grpc::Status Source::addSourceToScene(obs_source_t* source, obs_sceneitem_t** item) {
 	obs_sceneitem_t* obs_scene_item = obs_scene_add(*obs_scene_ptr, source);
 	if (!obs_scene_item) {
 		trace_error("Error while adding scene item", field_s(id));
@@ -239,21 +525,45 @@ grpc::Status Source::addSourceToScene(obs_source_t* source) {
 	obs_sceneitem_set_bounds(obs_scene_item, &bounds);
 	obs_sceneitem_set_bounds_alignment(obs_scene_item, align);
 
+	*item = obs_scene_item;
 	return grpc::Status::OK;
 }
 
-grpc::Status Source::setSourceOrder(obs_source_t* source, enum obs_order_movement order) {
-	if(obs_scene_ptr == NULL) {
-		trace_error("obs_scene_ptr is null");
-		return grpc::Status(grpc::INTERNAL, "obs_scene_ptr is null");
-	}
-
-	obs_sceneitem_t* si = obs_scene_find_source(*obs_scene_ptr, obs_source_get_name(source));
-	if(si == NULL) {
-		trace_error("rescue not found in scene");
+grpc::Status Source::setSourceOrder(obs_sceneitem_t* item, enum obs_order_movement order) {
+	if(!item) {
+		trace_error("Scene item not found", field_s(id));
 		return grpc::Status(grpc::INTERNAL, "source not found in scene");
 	}
 
-	obs_sceneitem_set_order(si, order);
+	obs_sceneitem_set_order(item, order);
 	return grpc::Status::OK;
 }
+
+void Source::startRescue() {
+	// A missing rescue must not take the source itself off the program
+	// With the default properties, the rescue must not depend on the tuning
+	// of the input it replaces
+	proto::SourceProperties rescue_properties;
+	rescue_source = registry->Acquire(registryKey(rescue_type, rescue_url, rescue_properties), [this, &rescue_properties]() {
+		return createObsSource(rescue_type, rescue_url, name +"_rescue", rescue_properties);
+	});
+	if(!rescue_source) {
+		trace_error("Failed to create the rescue obs_source", field_s(id), field_s(rescue_url));
+		return;
+	}
+
+	grpc::Status s = addSourceToScene(rescue_source, &rescue_item);
+	if(!s.ok()) {
+		registry->Release(rescue_source);
+		rescue_source = nullptr;
+		return;
+	}
+
+	// Right under the source, hidden until a failover
+	obs_sceneitem_set_visible(rescue_item, false);
+	setSourceOrder(rescue_item, OBS_ORDER_MOVE_DOWN);
+	if(watchdog) {
+		watchdog->AddRescue(obs_source, obs_scene_item, rescue_item);
+	}
+	trace_debug("Started rescue", field_s(id), field_ns("type", SourceTypeToString(rescue_type)), field_s(rescue_url));
+}
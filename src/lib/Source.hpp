@@ -6,6 +6,8 @@
 #include "obs.h"
 #include "Trace.hpp"
 #include "Settings.hpp"
+#include "SourceRegistry.hpp"
+#include "InputWatchdog.hpp"
 
 
 enum SourceType {
@@ -17,10 +19,37 @@ enum SourceType {
 std::string SourceTypeToString(SourceType type);
 SourceType StringToSourceType(std::string type);
 
+/**
+ * Checks the ranges of the fields set in properties.
+ *
+ * @return  grpc::Status::OK if valid
+ *          grpc::Status::INVALID_ARGUMENT otherwise
+ */
+grpc::Status ValidateSourceProperties(const proto::SourceProperties& properties);
+
+// Identifies the obs settings resulting from properties, e.g. to compare them.
+std::string SourcePropertiesKey(const proto::SourceProperties& properties);
+
+// State of PollSourceReady between two checks of the same input.
+struct SourceReadyPoll {
+	// Media time seen by the first check in the playing state, -1 before
+	int64_t first_time = -1;
+};
+
+/**
+ * Checks whether a new input plays, without waiting: its media time advanced
+ * in the playing state since a previous check. Images are ready once created.
+ * Called without the studio lock, with a reference on source.
+ *
+ * @param   poll  kept by the caller between the checks of source.
+ * @return  true once the input plays.
+ */
+bool PollSourceReady(obs_source_t* source, SourceReadyPoll* poll);
+
 
 class Source {
 public:
-	Source(std::string id, std::string name, SourceType type, std::string url, int width, int height, Settings* settings);
+	Source(std::string id, std::string name, SourceType type, std::string url, int width, int height, Settings* settings, SourceRegistry* registry, InputWatchdog* watchdog);
 	~Source();
 
 	// Getters
@@ -28,19 +57,68 @@ public:
 	std::string Name() { return name; }
 	SourceType Type() { return type; }
 	std::string Url() { return url; }
+	int Width() { return width; }
+	int Height() { return height; }
+	// InvalidType if the source has no rescue
+	SourceType RescueType() { return rescue_type; }
+	std::string RescueUrl() { return rescue_url; }
+	const proto::SourceProperties& Properties() { return properties; }
+	// Id of the update waiting for its new input, 0 if none
+	uint64_t PendingUpdate() { return pending_source ? update_counter : 0; }
 	obs_source_t* GetSource() { return obs_source; }
 
 	// Methods
 	grpc::Status SetType(std::string new_type);
 	grpc::Status SetUrl(std::string new_url);
+	/**
+	 * Sets the source shown in place of this one while its input is stalled
+	 * (see InputWatchdog.hpp), e.g. a slate image or a backup input. It is
+	 * added under the source when started, hidden but kept loaded so the
+	 * switch is immediate. InvalidType removes the rescue.
+	 */
+	grpc::Status SetRescue(SourceType new_type, std::string new_url);
+	// Merges the fields set in new_properties, which must be valid.
+	grpc::Status SetProperties(const proto::SourceProperties& new_properties);
+	// Replaces the type, url and properties of a source not started, e.g. to
+	// roll back SetType, SetUrl and SetProperties.
+	grpc::Status Restore(SourceType old_type, std::string old_url, const proto::SourceProperties& old_properties);
+	/**
+	 * Changes the type, url and properties of a started source without
+	 * stopping it. An image that no other source shares is reloaded in place
+	 * with obs_source_update. Otherwise the new input is made before the
+	 * current one is broken: it is added hidden right above the current scene
+	 * item, where it opens and buffers. Once PollSourceReady returns true,
+	 * CommitUpdate shows it and removes the current one, so the program never
+	 * shows a black or frozen frame. With close_when_inactive the new input
+	 * can't open while hidden, so it is added visible right below the current
+	 * item instead, which covers it until CommitUpdate removes it. If the
+	 * source is not active, nothing shows it and it is committed at once.
+	 *
+	 * @param   pending    set to a reference on the new input (to release
+	 *                     with obs_source_release) if it must be waited for,
+	 *                     NULL if the update is done.
+	 * @param   update_id  set to the PendingUpdate of the source.
+	 * @return  grpc::Status::OK if successful
+	 *          grpc::Status::FAILED_PRECONDITION if the source is not
+	 *          started or an update is already pending
+	 *          grpc::Status::INTERNAL if the new input can't be created
+	 */
+	grpc::Status Update(SourceType new_type, std::string new_url, const proto::SourceProperties& new_properties, obs_source_t** pending, uint64_t* update_id);
+	grpc::Status CommitUpdate();
+	void AbortUpdate();
 	grpc::Status Start(obs_scene_t** obs_scene_ptr);
 	grpc::Status Stop();
 	grpc::Status UpdateProto(proto::Source* proto_source);
 
 
 private:
-	grpc::Status addSourceToScene(obs_source_t* source);
-	grpc::Status setSourceOrder(obs_source_t* source, enum obs_order_movement order);
+	std::string registryKey(SourceType source_type, const std::string& source_url, const proto::SourceProperties& source_properties);
+	obs_source_t* createObsSource(SourceType source_type, std::string source_url, std::string obs_name, const proto::SourceProperties& source_properties);
+	grpc::Status addSourceToScene(obs_source_t* source, obs_sceneitem_t** item);
+	grpc::Status setSourceOrder(obs_sceneitem_t* item, enum obs_order_movement order);
+	void startRescue();
+	void connectSignals(obs_source_t* source);
+	void disconnectSignals(obs_source_t* source);
 
 	std::string id;
 	std::string name;
@@ -48,10 +126,25 @@ private:
 	std::string url;
 	int width;
 	int height;
+	SourceType rescue_type;
+	std::string rescue_url;
+	proto::SourceProperties properties;
 	bool started;
 	obs_source_t* obs_source;
+	obs_sceneitem_t* obs_scene_item;
+	obs_source_t* rescue_source;
+	obs_sceneitem_t* rescue_item;
+	// New input of a pending Update
+	obs_source_t* pending_source;
+	obs_sceneitem_t* pending_item;
+	SourceType pending_type;
+	std::string pending_url;
+	proto::SourceProperties pending_properties;
+	uint64_t update_counter;
 	obs_scene_t** obs_scene_ptr;
 	Settings* settings;
+	SourceRegistry* registry;
+	InputWatchdog* watchdog;
 };
 
 void SourceShowCb(void *my_data, calldata_t *cd);
@@ -0,0 +1,131 @@
+#include "SourceRegistry.hpp"
+#include "Trace.hpp"
+
+SourceRegistry::SourceRegistry()
+	: references(0) {
+}
+
+SourceRegistry::~SourceRegistry() {
+	// Sources are released when their scenes stop, which happens before
+	// obs_shutdown. Releasing them here could run after it.
+	for(auto & it : entries) {
+		trace_warn("Source still referenced", field_ns("key", it.first), field_n("references", it.second.references));
+	}
+}
+
+obs_source_t* SourceRegistry::Acquire(std::string key, std::function<obs_source_t*()> create) {
+	std::unique_lock<std::mutex> lock(mtx);
+
+	std::map<std::string, Entry>::iterator it = entries.find(key);
+	if(it != entries.end()) {
+		it->second.references++;
+		references++;
+		trace_debug("Share source", field_s(key), field_n("references", it->second.references));
+		return it->second.source;
+	}
+
+	// Opening an input can take seconds, during which the other sources
+	// must still be released and sampled
+	lock.unlock();
+	obs_source_t* source = create();
+	if(!source) {
+		return NULL;
+	}
+	lock.lock();
+
+	it = entries.find(key);
+	if(it != entries.end()) {
+		// Registered by another Acquire meanwhile
+		it->second.references++;
+		references++;
+		obs_source_t* shared = it->second.source;
+		trace_debug("Share source created concurrently", field_s(key), field_n("references", it->second.references));
+		lock.unlock();
+		obs_source_release(source);
+		return shared;
+	}
+
+	entries[key] = Entry{source, 1};
+	keys[source] = key;
+	references++;
+	trace_debug("Register source", field_s(key));
+	if(created) {
+		created(source);
+	}
+	return source;
+}
+
+void SourceRegistry::Release(obs_source_t* source) {
+	std::unique_lock<std::mutex> lock(mtx);
+
+	std::unordered_map<obs_source_t*, std::string>::iterator key_it = keys.find(source);
+	if(key_it == keys.end()) {
+		trace_error("Released source not found in registry");
+		return;
+	}
+	std::map<std::string, Entry>::iterator it = entries.find(key_it->second);
+
+	references--;
+	it->second.references--;
+	if(it->second.references == 0) {
+		trace_debug("Unregister source", field_ns("key", it->first));
+		if(released) {
+			released(source);
+		}
+		obs_source_release(source);
+		entries.erase(it);
+		keys.erase(key_it);
+	}
+}
+
+bool SourceRegistry::Rekey(obs_source_t* source, std::string key) {
+	std::unique_lock<std::mutex> lock(mtx);
+
+	if(entries.count(key)) {
+		return false;
+	}
+
+	std::unordered_map<obs_source_t*, std::string>::iterator key_it = keys.find(source);
+	if(key_it == keys.end()) {
+		trace_error("Rekeyed source not found in registry");
+		return false;
+	}
+	std::map<std::string, Entry>::iterator it = entries.find(key_it->second);
+	if(it->second.references > 1) {
+		return false;
+	}
+
+	trace_debug("Rekey source", field_ns("from", it->first), field_ns("to", key));
+	entries[key] = it->second;
+	entries.erase(it);
+	key_it->second = key;
+	return true;
+}
+
+uint64_t SourceRegistry::Instances() {
+	std::unique_lock<std::mutex> lock(mtx);
+	return entries.size();
+}
+
+uint64_t SourceRegistry::References() {
+	std::unique_lock<std::mutex> lock(mtx);
+	return references;
+}
+
+uint64_t SourceRegistry::Saved() {
+	std::unique_lock<std::mutex> lock(mtx);
+	return references - entries.size();
+}
+
+void SourceRegistry::ForEach(std::function<void(obs_source_t* source, uint64_t references)> fn) {
+	std::unique_lock<std::mutex> lock(mtx);
+	for(auto & it : entries) {
+		fn(it.second.source, it.second.references);
+	}
+}
+
+void SourceRegistry::SetObserver(std::function<void(obs_source_t* source)> created_fn, std::function<void(obs_source_t* source)> released_fn) {
+	std::unique_lock<std::mutex> lock(mtx);
+	created = created_fn;
+	released = released_fn;
+}
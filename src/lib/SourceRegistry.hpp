@@ -0,0 +1,89 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "obs.h"
+
+/**
+ * @file
+ * @brief Reference-counted registry of started obs sources.
+ *
+ * Sources reading the same input with the same decode options share one
+ * obs_source_t, and therefore one demuxer and decoder. Each Source still adds
+ * its own scene item, so bounds and order stay independent per scene.
+ *
+ */
+
+class SourceRegistry {
+public:
+	SourceRegistry();
+
+	/**
+	 * SourceRegistry destructor. All sources are expected to be released.
+	 */
+	~SourceRegistry();
+
+	/**
+	 * Returns the obs source registered for a key, or creates and registers
+	 * it. Each successful call must be matched by a Release.
+	 *
+	 * @param   key     identifies the input and its decode options.
+	 * @param   create  creates the obs source if none is registered for key.
+	 *                  Called without the registry lock: if another Acquire
+	 *                  registers key meanwhile, the created source is
+	 *                  released and the registered one returned.
+	 * @return          the obs source, NULL if create failed.
+	 */
+	obs_source_t* Acquire(std::string key, std::function<obs_source_t*()> create);
+
+	/**
+	 * Drops a reference acquired with Acquire. The obs source is released
+	 * with the last reference.
+	 */
+	void Release(obs_source_t* source);
+
+	/**
+	 * Registers a source under a new key, before its settings are updated in
+	 * place. Only a source with a single reference can change, and only to a
+	 * key not registered yet.
+	 *
+	 * @return  false if the source is shared or the key taken.
+	 */
+	bool Rekey(obs_source_t* source, std::string key);
+
+	// Number of obs sources currently created.
+	uint64_t Instances();
+	// Number of references currently held on them.
+	uint64_t References();
+	// Number of obs sources that sharing currently avoids creating.
+	uint64_t Saved();
+
+	// Calls fn for each obs source with its number of references, under the
+	// registry lock.
+	void ForEach(std::function<void(obs_source_t* source, uint64_t references)> fn);
+
+	/**
+	 * Sets functions called under the registry lock with each obs source
+	 * created by Acquire, and before the release of its last reference. Used
+	 * by the input watchdog. Must be set before the first Acquire.
+	 */
+	void SetObserver(std::function<void(obs_source_t* source)> created, std::function<void(obs_source_t* source)> released);
+
+private:
+	struct Entry {
+		obs_source_t* source;
+		uint64_t references;
+	};
+
+	std::mutex mtx;
+	std::map<std::string, Entry> entries;
+	// Key of each registered source, so that Release and Rekey don't scan
+	// the entries
+	std::unordered_map<obs_source_t*, std::string> keys;
+	uint64_t references;
+	std::function<void(obs_source_t* source)> created;
+	std::function<void(obs_source_t* source)> released;
+};
@@ -1,17 +1,147 @@
 #include "Studio.hpp"
-#include <QGuiApplication>
-#include <qpa/qplatformnativeinterface.h>
-#include <obs-nix-platform.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/support/proto_buffer_reader.h>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <random>
+#include <sys/resource.h>
+#include <util/platform.h>
+#include "NativeDisplay.hpp"
+
+// Number of events retained for WatchStudio resumes.
+static const size_t EVENT_HISTORY_SIZE = 4096;
+
+// Client metadata carrying the id of a request, added to its trace lines.
+static const char* REQUEST_ID_METADATA = "x-request-id";
+
+static void fillStudioState(const StudioSnapshot& snap, proto::StudioState* proto_studio) {
+	proto_studio->set_active_show_id(snap.active_show_id);
+	proto_studio->set_version(snap.version);
+	for (auto it = snap.shows.begin(); it != snap.shows.end(); it++) {
+		proto_studio->add_shows()->CopyFrom(*it->second);
+	}
+}
+
+// Builds and serializes the StudioGetResponse of a snapshot.
+static grpc::Slice serializeSnapshot(const StudioSnapshot& snap) {
+	proto::StudioGetResponse response;
+	fillStudioState(snap, response.mutable_studio());
+	response.set_version(snap.version);
+
+	string bytes;
+	response.SerializeToString(&bytes);
+	return grpc::Slice(bytes);
+}
+
+// Lookups in a published snapshot, used by the read-only methods.
+static const proto::Show* findProtoShow(const StudioSnapshot& snap, const string& show_id) {
+	auto it = snap.shows.find(show_id);
+	if(it == snap.shows.end()) {
+		return NULL;
+	}
+	return it->second.get();
+}
+
+static const proto::Scene* findProtoScene(const proto::Show& show, const string& scene_id) {
+	for(const proto::Scene& scene : show.scenes()) {
+		if(scene.id() == scene_id) {
+			return &scene;
+		}
+	}
+	return NULL;
+}
+
+static const proto::Source* findProtoSource(const proto::Scene& scene, const string& source_id) {
+	for(const proto::Source& source : scene.sources()) {
+		if(source.id() == source_id) {
+			return &source;
+		}
+	}
+	return NULL;
+}
 
 Studio::Studio(Settings* settings_in)
 	: settings(settings_in)
 	, active_show(nullptr)
 	, init(false)
-	, show_id_counter(0) {
+	, engine_init(false)
+	, obs_started(false)
+	, show_id_counter(0)
+	, output_id_counter(0)
+	, recording(nullptr)
+	, recording_stopping(false)
+	, enc_a(nullptr)
+	, enc_v(nullptr)
+	, events(EVENT_HISTORY_SIZE)
+	, input_watchdog(settings_in->input_stall_ms, settings_in->input_check_ms, settings_in->input_backoff_min_ms, settings_in->input_backoff_max_ms, settings_in->rescue_hold_ms,
+		[this](string name, bool stalled, bool failed_over, uint64_t outage_ms, uint64_t reconnects) {
+			proto::StudioEvent event;
+			proto::InputStateChanged* input_state = event.mutable_input_state_changed();
+			input_state->set_name(name);
+			input_state->set_stalled(stalled);
+			input_state->set_outage_ms(outage_ms);
+			input_state->set_reconnects(reconnects);
+			input_state->set_failed_over(failed_over);
+			events.Publish(std::move(event));
+		})
+	, show_cache(settings_in->show_cache_dir)
+	, show_watcher(settings_in->show_watch_debounce_ms, [this](string show_path) { reloadShowFile(show_path); })
+	, workers(settings_in->grpc_worker_threads, settings_in->grpc_max_queued_requests)
+	// Each running ShowLoadMany queues show_load_threads tasks at most
+	, show_parsers(settings_in->show_load_threads, settings_in->grpc_worker_threads * settings_in->show_load_threads)
+	, request_id_counter(0) {
+	// Versions start at a random epoch in the high word, so that a version
+	// known from a previous server process never matches one of this process.
+	std::random_device random;
+	shared_ptr<StudioSnapshot> initial = make_shared<StudioSnapshot>();
+	initial->version = (uint64_t) (random() | 1) << 32;
+	initial->sequence = 0;
+	initial->serialized = serializeSnapshot(*initial);
+	snapshot = initial;
+
+	if(settings->show_watch) {
+		show_watcher.Start();
+	}
+
+	// Only the network inputs can stall
+	if(settings->input_stall_ms > 0) {
+		source_registry.SetObserver(
+			[this](obs_source_t* source) {
+				if(!strcmp(obs_source_get_id(source), "ffmpeg_source")) {
+					input_watchdog.Watch(source, obs_source_get_name(source));
+				}
+			},
+			[this](obs_source_t* source) {
+				input_watchdog.Unwatch(source);
+			});
+	}
 }
 
 Studio::~Studio() {
 	trace("Studio destructor");
+	// It reloads shows, stop it first
+	show_watcher.Stop();
+	// Let the handlers still queued complete before deleting the shows
+	workers.Stop();
+	show_parsers.Stop();
+	// It samples libobs, stop it before engineRelease
+	metrics_http.Stop();
+	input_watchdog.Stop();
+
+	if(init) {
+		Status s = studioRelease();
+		if(!s.ok()) {
+			trace_error("Error during studioRelease", error(s.error_message()));
+		}
+	}
+	engineRelease();
+
 	ShowMap::iterator it;
 	for (it = shows.begin(); it != shows.end(); it++) {
 		Show* show = it->second;
@@ -24,37 +154,481 @@ Studio::~Studio() {
 	}
 }
 
+///////////////////////////////////////
+// EVENTS                            //
+///////////////////////////////////////
+
+// Maximum number of events a watcher fetches from the bus at once.
+static const size_t WATCH_BATCH_SIZE = 64;
+
+/**
+ * Writes a WatchStudio stream, one event at a time. It is woken up by the
+ * event bus, so no thread waits for new events or for a slow client.
+ *
+ * OnEvent runs on the publishing thread, which may hold the studio lock: it
+ * only arms an immediate alarm, and the events are fetched and written from
+ * the alarm callback, like from OnWriteDone. The watcher owns itself (and the
+ * bus holds a reference) until OnDone.
+ */
+class StudioWatcher : public grpc::ServerWriteReactor<proto::StudioEvent>, public EventListener {
+public:
+	static StudioWatcher* Create(Studio* studio, uint64_t from_sequence) {
+		shared_ptr<StudioWatcher> watcher(new StudioWatcher(studio, from_sequence));
+		watcher->self = watcher;
+		studio->events.AddListener(watcher);
+		watcher->next();
+		return watcher.get();
+	}
+
+	void OnEvent() override {
+		// One wakeup at a time, it fetches every event published until then
+		if(wakeup_pending.exchange(true)) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mtx);
+		if(done) {
+			return;
+		}
+		// The previous alarm already fired, replacing it is safe even while
+		// its callback runs
+		wakeup = make_unique<grpc::Alarm>();
+		wakeup->Set(std::chrono::system_clock::now(), [watcher = self](bool) {
+			watcher->wakeup_pending = false;
+			watcher->next();
+		});
+	}
+
+	void OnWriteDone(bool ok) override {
+		std::unique_lock<std::mutex> lock(mtx);
+		writing = false;
+		if(!ok || cancelled) {
+			finish(lock);
+			return;
+		}
+		lock.unlock();
+		next();
+	}
+
+	void OnCancel() override {
+		std::unique_lock<std::mutex> lock(mtx);
+		cancelled = true;
+		// Otherwise OnWriteDone finishes the call
+		if(!writing) {
+			finish(lock);
+		}
+	}
+
+	void OnDone() override {
+		studio->events.RemoveListener(this);
+		trace_debug("Watcher done", field(last_sequence));
+
+		std::unique_lock<std::mutex> lock(mtx);
+		done = true;
+		unique_ptr<grpc::Alarm> last_wakeup = std::move(wakeup);
+		shared_ptr<StudioWatcher> last_self = std::move(self);
+		lock.unlock();
+
+		// Cancels a pending wakeup, whose callback holds its own reference.
+		// The watcher is deleted with the last one.
+		last_wakeup.reset();
+		last_self.reset();
+	}
+
+private:
+	StudioWatcher(Studio* studio, uint64_t from_sequence)
+		: studio(studio)
+		, last_sequence(from_sequence)
+		, resync(from_sequence == 0)
+		, writing(false)
+		, cancelled(false)
+		, finished(false)
+		, done(false)
+		, wakeup_pending(false) {
+	}
+
+	// Starts writing the next event, unless a write is in progress.
+	void next() {
+		std::unique_lock<std::mutex> lock(mtx);
+		if(writing || cancelled || finished) {
+			return;
+		}
+
+		if(!resync && pending.empty()) {
+			resync = !studio->events.FetchEvents(last_sequence, pending, WATCH_BATCH_SIZE);
+		}
+
+		if(resync) {
+			shared_ptr<const StudioSnapshot> snap = studio->getSnapshot();
+			pending.clear();
+			current.Clear();
+			current.set_sequence(snap->sequence);
+			current.set_timestamp(std::time(nullptr));
+			fillStudioState(*snap, current.mutable_resync());
+			trace_debug("Resync watcher", field_n("sequence", snap->sequence));
+			resync = false;
+		} else if(!pending.empty()) {
+			current = std::move(pending.front());
+			pending.pop_front();
+		} else {
+			// Idle until the next OnEvent
+			return;
+		}
+
+		last_sequence = current.sequence();
+		writing = true;
+		lock.unlock();
+		StartWrite(&current);
+	}
+
+	// Finishes the call once. Releases the lock before.
+	void finish(std::unique_lock<std::mutex>& lock) {
+		if(finished) {
+			return;
+		}
+		finished = true;
+		lock.unlock();
+		Finish(Status::OK);
+	}
+
+	Studio* studio;
+	std::mutex mtx;
+	uint64_t last_sequence;
+	bool resync;
+	bool writing;
+	bool cancelled;
+	bool finished;
+	// Set by OnDone, the call can't be used anymore
+	bool done;
+	// Released by OnDone
+	shared_ptr<StudioWatcher> self;
+	std::atomic<bool> wakeup_pending;
+	unique_ptr<grpc::Alarm> wakeup;
+	// Fetched from the bus, not written yet
+	std::deque<proto::StudioEvent> pending;
+	// Being written, must stay valid until OnWriteDone
+	proto::StudioEvent current;
+};
+
+///////////////////////////////////////
+// SOURCE UPDATES                    //
+///////////////////////////////////////
+
+// Interval between two checks of the new input of a source update.
+static const std::chrono::milliseconds SOURCE_READY_POLL(10);
+
+/**
+ * Finishes a SourceSetProperties call whose new input must play before the
+ * update is committed. The input is checked from alarms, so neither a worker
+ * nor a gRPC thread waits for it to open. Once it plays, or after
+ * source_update_timeout_ms, the update is committed or aborted on the worker
+ * pool, which takes the studio lock. The waiter deletes itself after
+ * finishing the call.
+ */
+class SourceUpdateWaiter {
+public:
+	// Takes over pending, the reference returned by Source::Update.
+	static void Start(Studio* studio, CallbackServerContext* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep, ServerUnaryReactor* reactor, obs_source_t* pending, uint64_t update_id) {
+		SourceUpdateWaiter* waiter = new SourceUpdateWaiter(studio, ctx, req, rep, reactor, pending, update_id);
+		waiter->poll();
+	}
+
+private:
+	SourceUpdateWaiter(Studio* studio, CallbackServerContext* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep, ServerUnaryReactor* reactor, obs_source_t* pending, uint64_t update_id)
+		: studio(studio)
+		, ctx(ctx)
+		, req(req)
+		, rep(rep)
+		, reactor(reactor)
+		, pending(pending)
+		, update_id(update_id)
+		, request_id(TraceRequestScope::Current())
+		, timing(call_timing)
+		, deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(studio->settings->source_update_timeout_ms)) {
+	}
+
+	~SourceUpdateWaiter() {
+		obs_source_release(pending);
+	}
+
+	// Checks the new input, and checks it again SOURCE_READY_POLL later until
+	// it plays, the call is cancelled or the deadline passed.
+	void poll() {
+		bool ready = PollSourceReady(pending, &ready_poll);
+		if(!ready && !ctx->IsCancelled() && std::chrono::steady_clock::now() < deadline) {
+			// Replacing the alarm whose callback runs is safe
+			alarm = make_unique<grpc::Alarm>();
+			alarm->Set(std::chrono::system_clock::now() + SOURCE_READY_POLL, [this](bool) {
+				poll();
+			});
+			return;
+		}
+
+		// Nothing must use the waiter after Submit, done deletes it
+		if(!studio->workers.Submit([this, ready]() { done(ready); })) {
+			// The pool is full or stopping, the update can't be left pending
+			done(ready);
+		}
+	}
+
+	void done(bool ready) {
+		TraceRequestScope scope(request_id);
+		// Adds to the queue and lock waits of the first step
+		call_timing = timing;
+		Status s = studio->handleSourceUpdateDone(req, rep, update_id, ready);
+		reactor->Finish(s);
+		call_timing = CallTiming();
+		delete this;
+	}
+
+	Studio* studio;
+	CallbackServerContext* ctx;
+	const proto::SourceSetPropertiesRequest* req;
+	proto::SourceSetPropertiesResponse* rep;
+	ServerUnaryReactor* reactor;
+	obs_source_t* pending;
+	uint64_t update_id;
+	string request_id;
+	CallTiming timing;
+	std::chrono::steady_clock::time_point deadline;
+	SourceReadyPoll ready_poll;
+	unique_ptr<grpc::Alarm> alarm;
+};
+
+///////////////////////////////////////
+// CALLBACKS                         //
+///////////////////////////////////////
+
+string Studio::requestId(ServerContextBase* ctx) {
+	auto it = ctx->client_metadata().find(REQUEST_ID_METADATA);
+	string id;
+	if(it != ctx->client_metadata().end()) {
+		id = string(it->second.data(), it->second.length());
+	} else {
+		id = "srv-" + to_string(request_id_counter.fetch_add(1) + 1);
+	}
+	// Sent back so that a client which did not set one can correlate too
+	ctx->AddInitialMetadata(REQUEST_ID_METADATA, id);
+	return id;
+}
+
+template<typename Req, typename Rep>
+ServerUnaryReactor* Studio::dispatch(CallbackServerContext* ctx, const Req* req, Rep* rep, Status (Studio::*handler)(ServerContextBase*, const Req*, Rep*)) {
+	return submit(ctx, [this, ctx, req, rep, handler](ServerUnaryReactor* reactor) {
+		reactor->Finish((this->*handler)(ctx, req, rep));
+	});
+}
+
+ServerUnaryReactor* Studio::submit(CallbackServerContext* ctx, std::function<void(ServerUnaryReactor*)> task) {
+	ServerUnaryReactor* reactor = ctx->DefaultReactor();
+	string request_id = requestId(ctx);
+	TraceRequestScope scope(request_id);
+
+	std::chrono::steady_clock::time_point queued_at = std::chrono::steady_clock::now();
+
+	bool queued = workers.Submit([ctx, task, reactor, request_id, queued_at]() {
+		TraceRequestScope scope(request_id);
+		// Read by the MetricsInterceptor in Finish, on this thread
+		call_timing = CallTiming();
+		call_timing.queue_wait_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - queued_at).count();
+		if(ctx->IsCancelled()) {
+			reactor->Finish(Status::CANCELLED);
+		} else {
+			task(reactor);
+		}
+		call_timing = CallTiming();
+	});
+
+	if(!queued) {
+		trace_warn("Worker queue full, rejecting call", field_n("queue_depth", workers.QueueDepth()));
+		reactor->Finish(Status(grpc::RESOURCE_EXHAUSTED, "Too many pending requests"));
+	}
+	return reactor;
+}
+
+template<typename Req, typename Rep>
+ServerUnaryReactor* Studio::runInline(CallbackServerContext* ctx, const Req* req, Rep* rep, Status (Studio::*handler)(ServerContextBase*, const Req*, Rep*)) {
+	ServerUnaryReactor* reactor = ctx->DefaultReactor();
+	TraceRequestScope scope(requestId(ctx));
+	call_timing = CallTiming();
+	reactor->Finish((this->*handler)(ctx, req, rep));
+	call_timing = CallTiming();
+	return reactor;
+}
+
+ServerUnaryReactor* Studio::StudioStart(CallbackServerContext* ctx, const Empty* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleStudioStart);
+}
+
+ServerUnaryReactor* Studio::StudioStop(CallbackServerContext* ctx, const Empty* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleStudioStop);
+}
+
+ServerUnaryReactor* Studio::ShowGet(CallbackServerContext* ctx, const proto::ShowGetRequest* req, proto::ShowGetResponse* rep) {
+	return runInline(ctx, req, rep, &Studio::handleShowGet);
+}
+
+ServerUnaryReactor* Studio::ShowCreate(CallbackServerContext* ctx, const proto::ShowCreateRequest* req, proto::ShowCreateResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleShowCreate);
+}
+
+ServerUnaryReactor* Studio::ShowDuplicate(CallbackServerContext* ctx, const proto::ShowDuplicateRequest* req, proto::ShowDuplicateResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleShowDuplicate);
+}
+
+ServerUnaryReactor* Studio::ShowRemove(CallbackServerContext* ctx, const proto::ShowRemoveRequest* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleShowRemove);
+}
+
+ServerUnaryReactor* Studio::ShowLoad(CallbackServerContext* ctx, const proto::ShowLoadRequest* req, proto::ShowLoadResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleShowLoad);
+}
+
+ServerUnaryReactor* Studio::ShowLoadMany(CallbackServerContext* ctx, const proto::ShowLoadManyRequest* req, proto::ShowLoadManyResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleShowLoadMany);
+}
+
+ServerUnaryReactor* Studio::ShowReload(CallbackServerContext* ctx, const proto::ShowReloadRequest* req, proto::ShowReloadResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleShowReload);
+}
+
+ServerUnaryReactor* Studio::SceneGet(CallbackServerContext* ctx, const proto::SceneGetRequest* req, proto::SceneGetResponse* rep) {
+	return runInline(ctx, req, rep, &Studio::handleSceneGet);
+}
+
+ServerUnaryReactor* Studio::SceneAdd(CallbackServerContext* ctx, const proto::SceneAddRequest* req, proto::SceneAddResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSceneAdd);
+}
+
+ServerUnaryReactor* Studio::SceneDuplicate(CallbackServerContext* ctx, const proto::SceneDuplicateRequest* req, proto::SceneDuplicateResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSceneDuplicate);
+}
+
+ServerUnaryReactor* Studio::SceneRemove(CallbackServerContext* ctx, const proto::SceneRemoveRequest* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSceneRemove);
+}
+
+ServerUnaryReactor* Studio::SceneSetAsCurrent(CallbackServerContext* ctx, const proto::SceneSetAsCurrentRequest* req, proto::SceneSetAsCurrentResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSceneSetAsCurrent);
+}
+
+ServerUnaryReactor* Studio::SceneGetCurrent(CallbackServerContext* ctx, const proto::SceneGetCurrentRequest* req, proto::SceneGetCurrentResponse* rep) {
+	return runInline(ctx, req, rep, &Studio::handleSceneGetCurrent);
+}
+
+ServerUnaryReactor* Studio::ScenePreload(CallbackServerContext* ctx, const proto::ScenePreloadRequest* req, proto::ScenePreloadResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleScenePreload);
+}
+
+ServerUnaryReactor* Studio::SceneUnload(CallbackServerContext* ctx, const proto::SceneUnloadRequest* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSceneUnload);
+}
+
+ServerUnaryReactor* Studio::SourceGet(CallbackServerContext* ctx, const proto::SourceGetRequest* req, proto::SourceGetResponse* rep) {
+	return runInline(ctx, req, rep, &Studio::handleSourceGet);
+}
+
+ServerUnaryReactor* Studio::SourceAdd(CallbackServerContext* ctx, const proto::SourceAddRequest* req, proto::SourceAddResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSourceAdd);
+}
+
+ServerUnaryReactor* Studio::SourceDuplicate(CallbackServerContext* ctx, const proto::SourceDuplicateRequest* req, proto::SourceDuplicateResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSourceDuplicate);
+}
+
+ServerUnaryReactor* Studio::SourceRemove(CallbackServerContext* ctx, const proto::SourceRemoveRequest* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleSourceRemove);
+}
+
+ServerUnaryReactor* Studio::SourceSetProperties(CallbackServerContext* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep) {
+	return submit(ctx, [this, ctx, req, rep](ServerUnaryReactor* reactor) {
+		obs_source_t* pending = nullptr;
+		uint64_t update_id = 0;
+		Status s = handleSourceSetProperties(ctx, req, rep, &pending, &update_id);
+		if(!pending) {
+			reactor->Finish(s);
+			return;
+		}
+		// The new input opens hidden while the current one stays on air. The
+		// call is finished once it plays, without holding this thread.
+		SourceUpdateWaiter::Start(this, ctx, req, rep, reactor, pending, update_id);
+	});
+}
+
+ServerUnaryReactor* Studio::ApplyBatch(CallbackServerContext* ctx, const proto::ApplyBatchRequest* req, proto::ApplyBatchResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleApplyBatch);
+}
+
+ServerUnaryReactor* Studio::OutputAdd(CallbackServerContext* ctx, const proto::OutputAddRequest* req, proto::OutputAddResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleOutputAdd);
+}
+
+ServerUnaryReactor* Studio::OutputRemove(CallbackServerContext* ctx, const proto::OutputRemoveRequest* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleOutputRemove);
+}
+
+ServerUnaryReactor* Studio::OutputList(CallbackServerContext* ctx, const Empty* req, proto::OutputListResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleOutputList);
+}
+
+ServerUnaryReactor* Studio::RenditionList(CallbackServerContext* ctx, const Empty* req, proto::RenditionListResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleRenditionList);
+}
+
+ServerUnaryReactor* Studio::RecordStart(CallbackServerContext* ctx, const proto::RecordStartRequest* req, proto::RecordStartResponse* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleRecordStart);
+}
+
+ServerUnaryReactor* Studio::RecordStop(CallbackServerContext* ctx, const Empty* req, Empty* rep) {
+	return dispatch(ctx, req, rep, &Studio::handleRecordStop);
+}
+
+ServerUnaryReactor* Studio::Health(CallbackServerContext* ctx, const Empty* req, proto::HealthResponse* rep) {
+	return runInline(ctx, req, rep, &Studio::handleHealth);
+}
+
+ServerUnaryReactor* Studio::GetMetrics(CallbackServerContext* ctx, const Empty* req, proto::MetricsResponse* rep) {
+	return runInline(ctx, req, rep, &Studio::handleGetMetrics);
+}
+
+grpc::ServerWriteReactor<proto::StudioEvent>* Studio::WatchStudio(CallbackServerContext* ctx, const proto::WatchStudioRequest* req) {
+	TraceRequestScope scope(requestId(ctx));
+	trace("WatchStudio", field_n("from_sequence", req->from_sequence()));
+	return StudioWatcher::Create(this, req->from_sequence());
+}
+
 ///////////////////////////////////////
 // STUDIO                            //
 ///////////////////////////////////////
 
-Status Studio::StudioGet(ServerContext* ctx, const Empty* req, proto::StudioGetResponse* rep) {
+grpc::ServerUnaryReactor* Studio::StudioGet(grpc::CallbackServerContext* ctx, const grpc::ByteBuffer* req, grpc::ByteBuffer* rep) {
 	Status s = Status::OK;
 
+	TraceRequestScope scope(requestId(ctx));
+	call_timing = CallTiming();
 	trace("Studio (get)");
-	mtx.lock();
 	try {
-		proto::StudioState* proto_studio = rep->mutable_studio();
+		proto::StudioGetRequest request;
+		grpc::ByteBuffer req_buffer(*req);
+		grpc::ProtoBufferReader reader(&req_buffer);
 
-		if(active_show) {
-			proto_studio->set_active_show_id(active_show->Id());
+		if(!request.ParseFromZeroCopyStream(&reader)) {
+			trace_error("Failed to parse StudioGetRequest");
+			s = Status(grpc::INVALID_ARGUMENT, "Failed to parse StudioGetRequest");
 		} else {
-			proto_studio->set_active_show_id("");
-		}
+			shared_ptr<const StudioSnapshot> snap = getSnapshot();
 
-		ShowMap::iterator it;
-		for (it = shows.begin(); it != shows.end(); it++) {
-			Show* show = it->second;
-			proto::Show* proto_show = proto_studio->add_shows();
-			if(show) {
-				s = show->UpdateProto(proto_show);
-				if(!s.ok()) {
-					trace_error("Failed to update show proto", field_ns("id", show->Id()), field_ns("name", show->Name()));
-					break;
-				}
+			if(request.known_version() == snap->version) {
+				proto::StudioGetResponse response;
+				response.set_not_modified(true);
+				response.set_version(snap->version);
+
+				bool own_buffer;
+				s = grpc::SerializationTraits<proto::StudioGetResponse>::Serialize(response, rep, &own_buffer);
 			} else {
-				trace_error("NULL show", field_ns("id", it->first));
-				s = Status(grpc::INTERNAL, "NULL show with id="+ it->first);
+				// Only a reference to the pre-serialized snapshot is taken.
+				grpc::ByteBuffer rep_buffer(&snap->serialized, 1);
+				rep->Swap(&rep_buffer);
 			}
 		}
 	}
@@ -66,15 +640,18 @@ Status Studio::StudioGet(ServerContext* ctx, const Empty* req, proto::StudioGetR
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
-	mtx.unlock();
 
-	return s;
+	grpc::ServerUnaryReactor* reactor = ctx->DefaultReactor();
+	reactor->Finish(s);
+	call_timing = CallTiming();
+	return reactor;
 }
 
-Status Studio::StudioStart(ServerContext* ctx, const Empty* req, Empty* rep) {
+Status Studio::handleStudioStart(ServerContextBase* ctx, const Empty* req, Empty* rep) {
 	Status s = Status::OK;
 
 	trace("StudioStart");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	mtx.lock();
 	try {
 		if(!active_show) {
@@ -85,7 +662,7 @@ Status Studio::StudioStart(ServerContext* ctx, const Empty* req, Empty* rep) {
 			if(!s.ok()) {
 				trace_error("Error during studioInit", error(s.error_message()));
 			} else {
-				trace_info("Started studio");
+				trace_info("Started studio", field_n("start_ms", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
 			}
 		}
 	}
@@ -102,17 +679,18 @@ Status Studio::StudioStart(ServerContext* ctx, const Empty* req, Empty* rep) {
 	return s;
 }
 
-Status Studio::StudioStop(ServerContext* ctx, const Empty* req, Empty* rep) {
+Status Studio::handleStudioStop(ServerContextBase* ctx, const Empty* req, Empty* rep) {
 	Status s = Status::OK;
 
 	trace("StudioStop");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	mtx.lock();
 	try {
 		s = studioRelease();
 		if(!s.ok()) {
 			trace_error("Error during studioRelease", error(s.error_message()));
 		} else {
-			trace_info("Stopped studio");
+			trace_info("Stopped studio", field_n("stop_ms", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
 		}
 	}
 	catch(string e) {
@@ -132,21 +710,25 @@ Status Studio::StudioStop(ServerContext* ctx, const Empty* req, Empty* rep) {
 // SHOW                              //
 ///////////////////////////////////////
 
-Status Studio::ShowGet(ServerContext* ctx, const proto::ShowGetRequest* req, proto::ShowGetResponse* rep) {
+Status Studio::handleShowGet(ServerContextBase* ctx, const proto::ShowGetRequest* req, proto::ShowGetResponse* rep) {
 	Status s = Status::OK;
 
 	trace("Show (get)");
-	mtx.lock();
 	try {
 		string show_id = req->show_id();
+		uint64_t known_version = req->known_version();
+		shared_ptr<const StudioSnapshot> snap = getSnapshot();
 
-		Show* show = getShow(show_id);
-		if(show) {
-			proto::Show* proto_show = rep->mutable_show();
-			s = show->UpdateProto(proto_show);
-		} else {
+		const proto::Show* proto_show = findProtoShow(*snap, show_id);
+		if(!proto_show) {
 			trace_error("Show not found", field_s(show_id));
 			s = Status(grpc::NOT_FOUND, "Show not found: id="+ show_id);
+		} else if(known_version == proto_show->version()) {
+			rep->set_not_modified(true);
+			rep->set_version(proto_show->version());
+		} else {
+			rep->mutable_show()->CopyFrom(*proto_show);
+			rep->set_version(proto_show->version());
 		}
 	}
 	catch(string e) {
@@ -157,12 +739,11 @@ Status Studio::ShowGet(ServerContext* ctx, const proto::ShowGetRequest* req, pro
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
-	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::ShowCreate(ServerContext* ctx, const proto::ShowCreateRequest* req, proto::ShowCreateResponse* rep) {
+Status Studio::handleShowCreate(ServerContextBase* ctx, const proto::ShowCreateRequest* req, proto::ShowCreateResponse* rep) {
 	Status s = Status::OK;
 
 	trace("ShowCreate");
@@ -174,6 +755,7 @@ Status Studio::ShowCreate(ServerContext* ctx, const proto::ShowCreateRequest* re
 			trace_error("Failed to create show");
 			s = Status(grpc::INTERNAL, "Failed to create show");
 		} else {
+			markDirty(show->Id());
 			proto::Show* proto_show = rep->mutable_show();
 			s = show->UpdateProto(proto_show);
 			trace_info("Created show", field_s(show_name));
@@ -187,12 +769,13 @@ Status Studio::ShowCreate(ServerContext* ctx, const proto::ShowCreateRequest* re
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::ShowDuplicate(ServerContext* ctx, const proto::ShowDuplicateRequest* req, proto::ShowDuplicateResponse* rep) {
+Status Studio::handleShowDuplicate(ServerContextBase* ctx, const proto::ShowDuplicateRequest* req, proto::ShowDuplicateResponse* rep) {
 	Status s = Status::OK;
 
 	trace("ShowDuplicate");
@@ -204,6 +787,7 @@ Status Studio::ShowDuplicate(ServerContext* ctx, const proto::ShowDuplicateReque
 			trace_error("Failed to duplicate show");
 			s = Status(grpc::INTERNAL, "Failed to duplicate show");
 		} else {
+			markDirty(show->Id());
 			proto::Show* proto_show = rep->mutable_show();
 			s = show->UpdateProto(proto_show);
 			trace_info("Duplicated show", field_s(show_id));
@@ -217,12 +801,13 @@ Status Studio::ShowDuplicate(ServerContext* ctx, const proto::ShowDuplicateReque
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::ShowRemove(ServerContext* ctx, const proto::ShowRemoveRequest* req, Empty* rep) {
+Status Studio::handleShowRemove(ServerContextBase* ctx, const proto::ShowRemoveRequest* req, Empty* rep) {
 	Status s = Status::OK;
 
 	trace("ShowRemove");
@@ -233,6 +818,7 @@ Status Studio::ShowRemove(ServerContext* ctx, const proto::ShowRemoveRequest* re
 		if(!s.ok()) {
 			trace_error("Error during removeShow", error(s.error_message()));
 		} else {
+			markDirty(show_id);
 			trace_info("Removed show", field_s(show_id));
 		}
 	}
@@ -244,27 +830,39 @@ Status Studio::ShowRemove(ServerContext* ctx, const proto::ShowRemoveRequest* re
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::ShowLoad(ServerContext* ctx, const proto::ShowLoadRequest* req, proto::ShowLoadResponse* rep) {
+Status Studio::handleShowLoad(ServerContextBase* ctx, const proto::ShowLoadRequest* req, proto::ShowLoadResponse* rep) {
 	Status s = Status::OK;
 
 	trace("ShowLoad");
+	// Read the file before taking the lock, only the show creation needs it
+	string show_path = req->show_path();
+	ShowSpec spec;
+	bool cached;
+	Status load_s = show_cache.Load(show_path, &spec, &cached);
+	if(!load_s.ok()) {
+		// Unreadable or invalid file, nothing changed
+		trace_error("Failed to load show", field_s(show_path), error(load_s.error_message()));
+		return load_s;
+	}
+
 	mtx.lock();
 	try {
-		string show_path = req->show_path();
-		Show* show = loadShow(show_path);
+		Show* show = loadShow(show_path, spec);
 
 		if(!show) {
 			trace_error("Failed to load show", field_s(show_path));
 			s = Status(grpc::INTERNAL, "Failed to load show");
 		} else {
+			markDirty(show->Id());
 			proto::Show* proto_show = rep->mutable_show();
 			s = show->UpdateProto(proto_show);
-			trace_info("Loaded show", field_s(show_path));
+			trace_info("Loaded show", field_s(show_path), field(cached));
 		}
 	}
 	catch(string e) {
@@ -275,38 +873,103 @@ Status Studio::ShowLoad(ServerContext* ctx, const proto::ShowLoadRequest* req, p
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
 
 	return s;
 }
 
-///////////////////////////////////////
-// SCENE                             //
-///////////////////////////////////////
+// Files of a ShowLoadMany call, parsed by the calling worker and the show
+// parse threads. Each thread claims the next file until none is left.
+struct ShowLoadBatch {
+	struct Parsed {
+		ShowSpec spec;
+		Status status;
+		bool cached = false;
+	};
+
+	explicit ShowLoadBatch(size_t count)
+		: paths(count)
+		, parsed(count)
+		, next(0)
+		, done(0) {
+	}
+
+	void Parse(ShowCache* cache) {
+		for(size_t i = next++; i < paths.size(); i = next++) {
+			parsed[i].status = cache->Load(paths[i], &parsed[i].spec, &parsed[i].cached);
+			std::unique_lock<std::mutex> lock(mtx);
+			done++;
+			if(done == paths.size()) {
+				cv.notify_all();
+			}
+		}
+	}
 
-Status Studio::SceneGet(ServerContext* ctx, const proto::SceneGetRequest* req, proto::SceneGetResponse* rep) {
+	// Waits for the files claimed by the other threads
+	void Wait() {
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [this] { return done == paths.size(); });
+	}
+
+	vector<string> paths;
+	vector<Parsed> parsed;
+	std::atomic<size_t> next;
+	std::mutex mtx;
+	std::condition_variable cv;
+	size_t done;
+};
+
+Status Studio::handleShowLoadMany(ServerContextBase* ctx, const proto::ShowLoadManyRequest* req, proto::ShowLoadManyResponse* rep) {
 	Status s = Status::OK;
+	size_t count = req->show_paths_size();
+
+	trace("ShowLoadMany", field(count));
+
+	// Parse and validate the files in parallel, without the lock. The parse
+	// threads may start after this call returned, so they only use batch.
+	shared_ptr<ShowLoadBatch> batch = make_shared<ShowLoadBatch>(count);
+	for(size_t i = 0; i < count; i++) {
+		batch->paths[i] = req->show_paths(i);
+	}
+	ShowCache* cache = &show_cache;
+
+	auto parse_start = std::chrono::steady_clock::now();
+	// The calling thread parses too
+	size_t helpers = count > 1 ? std::min<size_t>(settings->show_load_threads, count - 1) : 0;
+	for(size_t i = 0; i < helpers; i++) {
+		// When the queue is full, this thread parses more files itself
+		if(!show_parsers.Submit([batch, cache]() { batch->Parse(cache); })) {
+			break;
+		}
+	}
+	batch->Parse(cache);
+	batch->Wait();
+	vector<ShowLoadBatch::Parsed>& parsed = batch->parsed;
+	auto parse_end = std::chrono::steady_clock::now();
+	rep->set_parse_us(std::chrono::duration_cast<std::chrono::microseconds>(parse_end - parse_start).count());
 
-	trace("Scene (get)");
 	mtx.lock();
 	try {
-		string show_id = req->show_id();
-		string scene_id = req->scene_id();
-		Show* show = getShow(show_id);
-
-		if(show) {
-			Scene* scene = show->GetScene(scene_id);
+		for(size_t i = 0; i < count; i++) {
+			string show_path = req->show_paths(i);
+			proto::ShowLoadResult* result = rep->add_results();
+			result->set_show_path(show_path);
+			result->set_cached(parsed[i].cached);
+
+			if(!parsed[i].status.ok()) {
+				result->set_error(parsed[i].status.error_message());
+				continue;
+			}
 
-			if(!scene) {
-				trace_error("Scene not found", field_s(scene_id));
-				s = Status(grpc::NOT_FOUND, "Scene not found: id="+ scene_id);
-			} else {
-				proto::Scene* proto_scene = rep->mutable_scene();
-				s = scene->UpdateProto(proto_scene);
+			Show* show = loadShow(show_path, parsed[i].spec);
+			if(!show) {
+				trace_error("Failed to load show", field_s(show_path));
+				result->set_error("Failed to load show");
+				continue;
 			}
-		} else {
-			trace_error("Show not found", field_s(show_id));
-			s = Status(grpc::NOT_FOUND,"Show not found: id="+ show_id);
+			markDirty(show->Id());
+			show->UpdateProto(result->mutable_show());
 		}
 	}
 	catch(string e) {
@@ -317,34 +980,60 @@ Status Studio::SceneGet(ServerContext* ctx, const proto::SceneGetRequest* req, p
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
+	rep->set_build_us(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - parse_end).count());
+
+	trace_info("Loaded shows", field(count), field_n("parse_us", rep->parse_us()), field_n("build_us", rep->build_us()));
 
 	return s;
 }
 
-Status Studio::SceneAdd(ServerContext* ctx, const proto::SceneAddRequest* req, proto::SceneAddResponse* rep) {
+Status Studio::handleShowReload(ServerContextBase* ctx, const proto::ShowReloadRequest* req, proto::ShowReloadResponse* rep) {
 	Status s = Status::OK;
+	string show_id = req->show_id();
+	string show_path;
 
-	trace("SceneAdd");
+	trace("ShowReload", field_s(show_id));
 	mtx.lock();
-	try {
-		string show_id = req->show_id();
-		string scene_name = req->scene_name();
-		Show* show = getShow(show_id);
+	Show* show = getShow(show_id);
+	if(show) {
+		show_path = show->Path();
+	}
+	mtx.unlock();
+
+	if(!show) {
+		trace_error("Show not found", field_s(show_id));
+		return Status(grpc::NOT_FOUND, "Show not found: id="+ show_id);
+	}
+	if(show_path.empty()) {
+		trace_error("Show was not loaded from a file", field_s(show_id));
+		return Status(grpc::FAILED_PRECONDITION, "Show was not loaded from a file: id="+ show_id);
+	}
+
+	// Read the file without the lock, like ShowLoad
+	ShowSpec spec;
+	bool cached;
+	s = show_cache.Load(show_path, &spec, &cached);
+	if(!s.ok()) {
+		trace_error("Failed to read show file, show left unchanged", field_s(show_path), error(s.error_message()));
+		return s;
+	}
 
+	mtx.lock();
+	try {
+		// It may have been removed meanwhile
+		show = getShow(show_id);
 		if(show) {
-			Scene* scene = show->AddScene(scene_name);
-			if(!scene) {
-				trace_error("Failed to add scene", field_s(scene_name));
-				s = Status(grpc::INTERNAL, "Failed to add scene");
-			} else {
-				proto::Scene* proto_scene = rep->mutable_scene();
-				s = scene->UpdateProto(proto_scene);
-				trace_info("Added scene", field_s(show_id), field_s(scene_name));
+			s = show->Reload(spec, rep->mutable_stats());
+			// Even a failed reload may have applied its first steps
+			markDirty(show_id);
+			if(s.ok()) {
+				s = show->UpdateProto(rep->mutable_show());
 			}
 		} else {
 			trace_error("Show not found", field_s(show_id));
-			s = Status(grpc::NOT_FOUND,"Show not found: id="+ show_id);
+			s = Status(grpc::NOT_FOUND, "Show not found: id="+ show_id);
 		}
 	}
 	catch(string e) {
@@ -355,30 +1044,34 @@ Status Studio::SceneAdd(ServerContext* ctx, const proto::SceneAddRequest* req, p
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::SceneDuplicate(ServerContext* ctx, const proto::SceneDuplicateRequest* req, proto::SceneDuplicateResponse* rep) {
+///////////////////////////////////////
+// SCENE                             //
+///////////////////////////////////////
+
+Status Studio::handleSceneGet(ServerContextBase* ctx, const proto::SceneGetRequest* req, proto::SceneGetResponse* rep) {
 	Status s = Status::OK;
 
-	trace("SceneDuplicate");
-	mtx.lock();
+	trace("Scene (get)");
 	try {
 		string show_id = req->show_id();
 		string scene_id = req->scene_id();
-		Show* show = getShow(show_id);
+		shared_ptr<const StudioSnapshot> snap = getSnapshot();
+		const proto::Show* proto_show = findProtoShow(*snap, show_id);
 
-		if(show) {
-			Scene* new_scene = show->DuplicateScene(scene_id);
-			if(!new_scene) {
-				trace_error("Failed to duplicate scene", field_s(scene_id));
-				s = Status(grpc::INTERNAL, "Failed to duplicate scene");
+		if(proto_show) {
+			const proto::Scene* proto_scene = findProtoScene(*proto_show, scene_id);
+
+			if(!proto_scene) {
+				trace_error("Scene not found", field_s(scene_id));
+				s = Status(grpc::NOT_FOUND, "Scene not found: id="+ scene_id);
 			} else {
-				proto::Scene* proto_scene = rep->mutable_scene();
-				s = new_scene->UpdateProto(proto_scene);
-				trace_info("Duplicated scene", field_s(show_id), field_s(scene_id));
+				rep->mutable_scene()->CopyFrom(*proto_scene);
 			}
 		} else {
 			trace_error("Show not found", field_s(show_id));
@@ -393,29 +1086,96 @@ Status Studio::SceneDuplicate(ServerContext* ctx, const proto::SceneDuplicateReq
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
-	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::SceneRemove(ServerContext* ctx, const proto::SceneRemoveRequest* req, Empty* rep) {
+Status Studio::handleSceneAdd(ServerContextBase* ctx, const proto::SceneAddRequest* req, proto::SceneAddResponse* rep) {
 	Status s = Status::OK;
 
-	trace("SceneRemove");
+	trace("SceneAdd");
 	mtx.lock();
 	try {
-		string show_id = req->show_id();
-		string scene_id = req->scene_id();
-		Show* show = getShow(show_id);
-
-		if(!show) {
-			trace_error("Show not found", field_s(show_id));
-			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
-		} else {
-			s = show->RemoveScene(scene_id);
-			if(!s.ok()) {
+		Scene* scene;
+		s = addScene(*req, &scene);
+		if(s.ok()) {
+			proto::Scene* proto_scene = rep->mutable_scene();
+			s = scene->UpdateProto(proto_scene);
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleSceneDuplicate(ServerContextBase* ctx, const proto::SceneDuplicateRequest* req, proto::SceneDuplicateResponse* rep) {
+	Status s = Status::OK;
+
+	trace("SceneDuplicate");
+	mtx.lock();
+	try {
+		string show_id = req->show_id();
+		string scene_id = req->scene_id();
+		Show* show = getShow(show_id);
+
+		if(show) {
+			Scene* new_scene = show->DuplicateScene(scene_id);
+			if(!new_scene) {
+				trace_error("Failed to duplicate scene", field_s(scene_id));
+				s = Status(grpc::INTERNAL, "Failed to duplicate scene");
+			} else {
+				markDirty(show_id);
+				proto::Scene* proto_scene = rep->mutable_scene();
+				s = new_scene->UpdateProto(proto_scene);
+				trace_info("Duplicated scene", field_s(show_id), field_s(scene_id));
+			}
+		} else {
+			trace_error("Show not found", field_s(show_id));
+			s = Status(grpc::NOT_FOUND,"Show not found: id="+ show_id);
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleSceneRemove(ServerContextBase* ctx, const proto::SceneRemoveRequest* req, Empty* rep) {
+	Status s = Status::OK;
+
+	trace("SceneRemove");
+	mtx.lock();
+	try {
+		string show_id = req->show_id();
+		string scene_id = req->scene_id();
+		Show* show = getShow(show_id);
+
+		if(!show) {
+			trace_error("Show not found", field_s(show_id));
+			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+		} else {
+			s = show->RemoveScene(scene_id);
+			if(!s.ok()) {
 				trace_error("Error in RemoveScene", field_s(show_id), field_s(scene_id));
 			} else {
+				markDirty(show_id);
 				trace_info("Removed scene", field_s(show_id), field_s(scene_id));
 			}
 		}
@@ -428,12 +1188,13 @@ Status Studio::SceneRemove(ServerContext* ctx, const proto::SceneRemoveRequest*
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::SceneSetAsCurrent(ServerContext* ctx, const proto::SceneSetAsCurrentRequest* req, proto::SceneSetAsCurrentResponse* rep) {
+Status Studio::handleSceneSetAsCurrent(ServerContextBase* ctx, const proto::SceneSetAsCurrentRequest* req, proto::SceneSetAsCurrentResponse* rep) {
 	Status s = Status::OK;
 
 	trace("SceneSetAsCurrent");
@@ -446,8 +1207,10 @@ Status Studio::SceneSetAsCurrent(ServerContext* ctx, const proto::SceneSetAsCurr
 		if(show) {
 			s = show->SwitchScene(scene_id);
 			if(s.ok()) {
+				markDirty(show_id);
 				proto::Show* proto_show = rep->mutable_show();
 				s = show->UpdateProto(proto_show);
+				rep->set_switch_latency_us(show->LastSwitchLatencyUs());
 				trace_info("Scene set as current", field_s(show_id), field_s(scene_id));
 			}
 		} else {
@@ -463,30 +1226,30 @@ Status Studio::SceneSetAsCurrent(ServerContext* ctx, const proto::SceneSetAsCurr
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	publishSnapshot();
 	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::SceneGetCurrent(ServerContext* ctx, const proto::SceneGetCurrentRequest* req, proto::SceneGetCurrentResponse* rep) {
+Status Studio::handleSceneGetCurrent(ServerContextBase* ctx, const proto::SceneGetCurrentRequest* req, proto::SceneGetCurrentResponse* rep) {
 	Status s = Status::OK;
 
 	trace("SceneGetCurrent");
-	mtx.lock();
 	try {
 		string show_id = req->show_id();
-		Show* show = getShow(show_id);
+		shared_ptr<const StudioSnapshot> snap = getSnapshot();
+		const proto::Show* proto_show = findProtoShow(*snap, show_id);
 
-		if(!show) {
+		if(!proto_show) {
 			trace_error("Show not found", field_s(show_id));
 			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
 		} else {
-			Scene* active_scene = show->ActiveScene();
-			if(!active_scene) {
+			if(proto_show->active_scene_id().empty()) {
 				trace_error("null active scene in show", field_s(show_id));
 				s = Status(grpc::INTERNAL, "null active scene in show id=", show_id);
 			} else {
-				rep->set_scene_id(active_scene->Id());
+				rep->set_scene_id(proto_show->active_scene_id());
 			}
 		}
 	}
@@ -498,7 +1261,6 @@ Status Studio::SceneGetCurrent(ServerContext* ctx, const proto::SceneGetCurrentR
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
-	mtx.unlock();
 
 	return s;
 }
@@ -507,31 +1269,105 @@ Status Studio::SceneGetCurrent(ServerContext* ctx, const proto::SceneGetCurrentR
 // SOURCE                            //
 ///////////////////////////////////////
 
-Status Studio::SourceGet(ServerContext* ctx, const proto::SourceGetRequest* req, proto::SourceGetResponse* rep) {
+Status Studio::handleScenePreload(ServerContextBase* ctx, const proto::ScenePreloadRequest* req, proto::ScenePreloadResponse* rep) {
 	Status s = Status::OK;
 
-	trace("Source (get)");
+	trace("ScenePreload");
 	mtx.lock();
 	try {
 		string show_id = req->show_id();
 		string scene_id = req->scene_id();
-		string source_id = req->source_id();
 		Show* show = getShow(show_id);
 
-		if(show) {
-			Scene* scene = show->GetScene(scene_id);
+		if(!show) {
+			trace_error("Show not found", field_s(show_id));
+			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+		} else {
+			s = show->PreloadScene(scene_id);
+			if(!s.ok()) {
+				trace_error("Error in PreloadScene", field_s(show_id), field_s(scene_id));
+			} else {
+				markDirty(show_id);
+				s = show->GetScene(scene_id)->UpdateProto(rep->mutable_scene());
+				trace_info("Preloaded scene", field_s(show_id), field_s(scene_id));
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
 
-			if(!scene) {
+	return s;
+}
+
+Status Studio::handleSceneUnload(ServerContextBase* ctx, const proto::SceneUnloadRequest* req, Empty* rep) {
+	Status s = Status::OK;
+
+	trace("SceneUnload");
+	mtx.lock();
+	try {
+		string show_id = req->show_id();
+		string scene_id = req->scene_id();
+		Show* show = getShow(show_id);
+
+		if(!show) {
+			trace_error("Show not found", field_s(show_id));
+			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+		} else {
+			s = show->UnloadScene(scene_id);
+			if(!s.ok()) {
+				trace_error("Error in UnloadScene", field_s(show_id), field_s(scene_id));
+			} else {
+				markDirty(show_id);
+				trace_info("Unloaded scene", field_s(show_id), field_s(scene_id));
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleSourceGet(ServerContextBase* ctx, const proto::SourceGetRequest* req, proto::SourceGetResponse* rep) {
+	Status s = Status::OK;
+
+	trace("Source (get)");
+	try {
+		string show_id = req->show_id();
+		string scene_id = req->scene_id();
+		string source_id = req->source_id();
+		shared_ptr<const StudioSnapshot> snap = getSnapshot();
+		const proto::Show* proto_show = findProtoShow(*snap, show_id);
+
+		if(proto_show) {
+			const proto::Scene* proto_scene = findProtoScene(*proto_show, scene_id);
+
+			if(!proto_scene) {
 				trace_error("Scene not found", field_s(scene_id));
 				s = Status(grpc::NOT_FOUND, "Scene not found: id="+ scene_id);
 			} else {
-				Source* source = scene->GetSource(source_id);
-				if(!source) {
+				const proto::Source* proto_source = findProtoSource(*proto_scene, source_id);
+				if(!proto_source) {
 					trace_error("Source not found", field_s(source_id));
 					s = Status(grpc::NOT_FOUND, "Source not found: id="+ source_id);
 				} else {
-					proto::Source* proto_source = rep->mutable_source();
-					s = source->UpdateProto(proto_source);
+					rep->mutable_source()->CopyFrom(*proto_source);
 				}
 			}
 		} else {
@@ -547,53 +1383,706 @@ Status Studio::SourceGet(ServerContext* ctx, const proto::SourceGetRequest* req,
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
-	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::SourceAdd(ServerContext* ctx, const proto::SourceAddRequest* req, proto::SourceAddResponse* rep) {
+Status Studio::handleSourceAdd(ServerContextBase* ctx, const proto::SourceAddRequest* req, proto::SourceAddResponse* rep) {
 	Status s = Status::OK;
 
 	trace("SourceAdd");
 	mtx.lock();
+	try {
+		Source* source;
+		s = addSource(*req, &source);
+		if(s.ok()) {
+			proto::Source* proto_source = rep->mutable_source();
+			s = source->UpdateProto(proto_source);
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleSourceDuplicate(ServerContextBase* ctx, const proto::SourceDuplicateRequest* req, proto::SourceDuplicateResponse* rep) {
+	Status s = Status::OK;
+
+	trace("SourceDuplicate");
+	mtx.lock();
 	try {
 		string show_id = req->show_id();
 		string scene_id = req->scene_id();
-		string source_name = req->source_name();
-		string source_type = req->source_type();
-		string source_url = req->source_url();
+		string source_id = req->source_id();
 		Show* show = getShow(show_id);
 
-		SourceType type = StringToSourceType(source_type);
+		if(!show) {
+			trace_error("Show not found id", field_s(show_id));
+			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+		} else {
+			Scene* scene = show->GetScene(scene_id);
+
+			if(!scene) {
+				trace_error("Scene not found id", field_s(scene_id));
+				s = Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
+			} else {
+				Source* source = scene->DuplicateSource(source_id);
+				if(!source) {
+					trace_error("Failed to duplicate source", field_s(source_id));
+					s = Status(grpc::INTERNAL, "Failed to duplicate source id="+ source_id);
+				} else {
+					markDirty(show_id);
+					proto::Source* proto_source = rep->mutable_source();
+					s = source->UpdateProto(proto_source);
+					trace_info("Duplicated source", field_s(show_id), field_s(scene_id), field_s(source_id));
+				}
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleSourceRemove(ServerContextBase* ctx, const proto::SourceRemoveRequest* req, Empty* rep) {
+	Status s = Status::OK;
 
-		if(type == InvalidType) {
-			trace_error("Unsupported type", field_s(source_type));
-			s = grpc::Status(grpc::INVALID_ARGUMENT, "Unsupported type="+ type);
+	trace("SourceRemove");
+	mtx.lock();
+	try {
+		string show_id = req->show_id();
+		string scene_id = req->scene_id();
+		string source_id = req->source_id();
+		Show* show = getShow(show_id);
+
+		if(!show) {
+			trace_error("Show not found", field_s(show_id));
+			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
 		} else {
-			if(!show) {
-				trace_error("Show not found", field_s(show_id));
-				s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+			Scene* scene = show->GetScene(scene_id);
+
+			if(!scene) {
+				trace_error("Scene not found", field_s(scene_id));
+				s = Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
 			} else {
-				Scene* scene = show->GetScene(scene_id);
+				s = scene->RemoveSource(source_id);
+				if(!s.ok()) {
+					trace_error("Error in RemoveSource", field_s(show_id), field_s(scene_id), field_s(source_id));
+				} else {
+					markDirty(show_id);
+					trace_info("Removed source", field_s(show_id), field_s(scene_id), field_s(source_id));
+				}
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleSourceSetProperties(ServerContextBase* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep, obs_source_t** pending, uint64_t* update_id) {
+	Status s = Status::OK;
+	string show_id = req->show_id();
+	string scene_id = req->scene_id();
+	string source_id = req->source_id();
+	string source_type = req->source_type();
+	string source_url = req->source_url();
+
+	trace("SourceSetProperties");
+	mtx.lock();
+	try {
+		Scene* scene;
+		Source* source;
+		s = findSource(show_id, scene_id, source_id, &scene, &source);
+
+		if(!s.ok()) {
+			// Traced by findSource
+		} else if(!(s = validateSourceUpdate(*req)).ok()) {
+			// Traced by validateSourceUpdate
+		} else if(scene->Started()) {
+			// Empty type and url keep the current ones
+			proto::SourceProperties properties = source->Properties();
+			properties.MergeFrom(req->properties());
+			s = source->Update(source_type.empty() ? source->Type() : StringToSourceType(source_type),
+				source_url.empty() ? source->Url() : source_url,
+				properties, pending, update_id);
+			if(!s.ok()) {
+				trace_error("Source Update failed", field_s(source_id), field_s(source_type), field_s(source_url), error(s.error_message()));
+			} else if(!*pending) {
+				markDirty(show_id);
+				s = sourceChanged(show_id, scene_id, source, rep->mutable_source());
+			}
+		} else {
+			// The url may be set even if the type or properties then fail
+			s = setSourceProperties(source, *req);
+			markDirty(show_id);
+			if(s.ok()) {
+				s = sourceChanged(show_id, scene_id, source, rep->mutable_source());
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleSourceUpdateDone(const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep, uint64_t update_id, bool ready) {
+	Status s = Status::OK;
+	string show_id = req->show_id();
+	string scene_id = req->scene_id();
+	string source_id = req->source_id();
+	string source_url = req->source_url();
+
+	mtx.lock();
+	try {
+		// It may have been removed, stopped or updated again meanwhile
+		Scene* scene;
+		Source* source;
+		s = findSource(show_id, scene_id, source_id, &scene, &source);
+
+		if(!s.ok()) {
+			// Traced by findSource
+		} else if(source->PendingUpdate() != update_id) {
+			trace_error("Source update superseded", field_s(source_id));
+			s = Status(grpc::ABORTED, "Source update superseded id="+ source_id);
+		} else if(!ready) {
+			source->AbortUpdate();
+			trace_error("New input not ready in time, source left unchanged", field_s(source_id), field_s(source_url), field_n("timeout_ms", settings->source_update_timeout_ms));
+			s = Status(grpc::DEADLINE_EXCEEDED, "New input not ready in time, source left unchanged id="+ source_id);
+		} else if((s = source->CommitUpdate()).ok()) {
+			markDirty(show_id);
+			s = sourceChanged(show_id, scene_id, source, rep->mutable_source());
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::findSource(string show_id, string scene_id, string source_id, Scene** scene, Source** source) {
+	Show* show = getShow(show_id);
+	*scene = nullptr;
+	*source = nullptr;
+
+	if(!show) {
+		trace_error("Show not found", field_s(show_id));
+		return Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+	}
+	*scene = show->GetScene(scene_id);
+	if(!*scene) {
+		trace_error("Scene not found", field_s(scene_id));
+		return Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
+	}
+	*source = (*scene)->GetSource(source_id);
+	if(!*source) {
+		trace_error("Source not found", field_s(source_id));
+		return Status(grpc::NOT_FOUND, "Source not found id="+ source_id);
+	}
+	return Status::OK;
+}
+
+Status Studio::addScene(const proto::SceneAddRequest& req, Scene** scene) {
+	string show_id = req.show_id();
+	string scene_name = req.scene_name();
+	Show* show = getShow(show_id);
+	*scene = nullptr;
+
+	if(!show) {
+		trace_error("Show not found", field_s(show_id));
+		return Status(grpc::NOT_FOUND,"Show not found: id="+ show_id);
+	}
+	*scene = show->AddScene(scene_name);
+	if(!*scene) {
+		trace_error("Failed to add scene", field_s(scene_name));
+		return Status(grpc::INTERNAL, "Failed to add scene");
+	}
+	markDirty(show_id);
+	trace_info("Added scene", field_s(show_id), field_s(scene_name));
+	return Status::OK;
+}
 
-				if(!scene) {
-					trace_error("Scene not found", field_s(scene_id));
-					s = Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
+Status Studio::addSource(const proto::SourceAddRequest& req, Source** source) {
+	string show_id = req.show_id();
+	string scene_id = req.scene_id();
+	string source_name = req.source_name();
+	string source_type = req.source_type();
+	string source_url = req.source_url();
+	string rescue_type = req.rescue_type();
+	string rescue_url = req.rescue_url();
+	Show* show = getShow(show_id);
+	*source = nullptr;
+
+	SourceType type = StringToSourceType(source_type);
+	SourceType rescue = rescue_type.empty() ? InvalidType : StringToSourceType(rescue_type);
+
+	if(type == InvalidType) {
+		trace_error("Unsupported type", field_s(source_type));
+		return Status(grpc::INVALID_ARGUMENT, "Unsupported type="+ source_type);
+	}
+	if(!rescue_type.empty() && rescue == InvalidType) {
+		trace_error("Unsupported rescue type", field_s(rescue_type));
+		return Status(grpc::INVALID_ARGUMENT, "Unsupported rescue type="+ rescue_type);
+	}
+	if(!show) {
+		trace_error("Show not found", field_s(show_id));
+		return Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+	}
+	Scene* scene = show->GetScene(scene_id);
+	if(!scene) {
+		trace_error("Scene not found", field_s(scene_id));
+		return Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
+	}
+
+	// TODO width and height
+	*source = scene->AddSource(source_name, type, source_url, -1, -1, rescue, rescue_url, proto::SourceProperties());
+	if(!*source) {
+		trace_error("Failed to add source", field_s(source_name));
+		return Status(grpc::INTERNAL, "Failed to add source");
+	}
+	markDirty(show_id);
+	trace_info("Added source", field_s(show_id), field_s(scene_id), field_s(source_name), field_s(source_url));
+	return Status::OK;
+}
+
+Status Studio::validateSourceUpdate(const proto::SourceSetPropertiesRequest& req) {
+	string source_id = req.source_id();
+	string source_type = req.source_type();
+
+	Status s = ValidateSourceProperties(req.properties());
+	if(!s.ok()) {
+		trace_error("Invalid source properties", field_s(source_id), error(s.error_message()));
+		return s;
+	}
+	if(!source_type.empty() && StringToSourceType(source_type) == InvalidType) {
+		trace_error("Unsupported type", field_s(source_type));
+		return Status(grpc::INVALID_ARGUMENT, "Unsupported type="+ source_type);
+	}
+	return Status::OK;
+}
+
+Status Studio::setSourceProperties(Source* source, const proto::SourceSetPropertiesRequest& req) {
+	string source_id = req.source_id();
+	string source_type = req.source_type();
+	string source_url = req.source_url();
+
+	// Empty type and url keep the current ones
+	Status s = source_url.empty() ? Status::OK : source->SetUrl(source_url);
+	if(!s.ok()) {
+		trace_error("Source SetUrl failed", field_s(source_id), field_s(source_url), error(s.error_message()));
+		return s;
+	}
+	s = source_type.empty() ? Status::OK : source->SetType(source_type);
+	if(s.ok() && req.has_properties()) {
+		s = source->SetProperties(req.properties());
+	}
+	if(!s.ok()) {
+		trace_error("Source SetType or SetProperties failed", field_s(source_id), field_s(source_type), error(s.error_message()));
+	}
+	return s;
+}
+
+Status Studio::sourceChanged(string show_id, string scene_id, Source* source, proto::Source* proto_source) {
+	Status s = source->UpdateProto(proto_source);
+
+	proto::StudioEvent event;
+	proto::SourcePropertiesChanged* changed = event.mutable_source_properties_changed();
+	changed->set_show_id(show_id);
+	changed->set_scene_id(scene_id);
+	changed->mutable_source()->CopyFrom(*proto_source);
+	events.Publish(std::move(event));
+
+	trace_info("Set properties for source", field_s(show_id), field_s(scene_id), field_ns("source_id", proto_source->id()), field_ns("source_type", proto_source->type()), field_ns("source_url", proto_source->url()));
+	return s;
+}
+
+///////////////////////////////////////
+// BATCH                             //
+///////////////////////////////////////
+
+// Replaces a "$<n>" reference to an earlier operation of a batch by the id it
+// added. Other ids are kept.
+static Status resolveBatchId(const vector<string>& ids, string* id) {
+	if(id->empty() || (*id)[0] != '$') {
+		return Status::OK;
+	}
+
+	string index = id->substr(1);
+	bool digits = !index.empty() && index.size() < 10 && all_of(index.begin(), index.end(), ::isdigit);
+	if(!digits || stoul(index) >= ids.size() || ids[stoul(index)].empty()) {
+		trace_error("Invalid batch reference", field_ns("reference", *id));
+		return Status(grpc::INVALID_ARGUMENT, "Invalid reference "+ *id +", expected the index of a previous SceneAdd or SourceAdd");
+	}
+	*id = ids[stoul(index)];
+	return Status::OK;
+}
+
+Status Studio::handleApplyBatch(ServerContextBase* ctx, const proto::ApplyBatchRequest* req, proto::ApplyBatchResponse* rep) {
+	Status s = Status::OK;
+	int count = req->operations_size();
+	int i = 0;
+	vector<string> ids;
+	vector<function<void()>> undo;
+
+	trace("ApplyBatch", field_n("operations", count));
+	if(count > settings->batch_max_operations) {
+		trace_error("Too many batch operations", field_n("operations", count), field_n("max", settings->batch_max_operations));
+		return Status(grpc::INVALID_ARGUMENT, "Too many operations: "+ to_string(count) +", max "+ to_string(settings->batch_max_operations));
+	}
+
+	mtx.lock();
+	// Restored on rollback, so that no new version is published
+	set<string> dirty_before = dirty_shows;
+	events.Hold();
+	try {
+		for(; i < count; i++) {
+			string id;
+			s = applyBatchOperation(req->operations(i), ids, &id, &undo);
+			if(!s.ok()) {
+				s = Status(s.error_code(), "operation "+ to_string(i) +": "+ s.error_message());
+				break;
+			}
+			ids.push_back(id);
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+
+	if(!s.ok()) {
+		// In reverse order, the sources before their scene
+		for(auto it = undo.rbegin(); it != undo.rend(); it++) {
+			(*it)();
+		}
+		dirty_shows = dirty_before;
+		trace_warn("Batch rolled back", field_n("operations", count), field_n("failed_operation", i), error(s.error_message()));
+	}
+	events.EndHold(s.ok());
+	publishSnapshot();
+
+	if(s.ok()) {
+		for(const string& id : ids) {
+			rep->add_ids(id);
+		}
+		rep->set_version(getSnapshot()->version);
+		trace_info("Applied batch", field_n("operations", count), field_n("version", rep->version()));
+	}
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::applyBatchOperation(const proto::BatchOperation& op, const vector<string>& ids, string* id, vector<function<void()>>* undo) {
+	Status s;
+
+	switch(op.operation_case()) {
+	case proto::BatchOperation::kSceneAdd: {
+		string show_id = op.scene_add().show_id();
+		Scene* scene;
+		s = addScene(op.scene_add(), &scene);
+		if(s.ok()) {
+			*id = scene->Id();
+			undo->push_back([this, show_id, scene_id = *id]() {
+				Show* show = getShow(show_id);
+				if(show) {
+					show->DiscardScene(scene_id);
+				}
+			});
+		}
+		return s;
+	}
+
+	case proto::BatchOperation::kSourceAdd: {
+		proto::SourceAddRequest req = op.source_add();
+		if(!(s = resolveBatchId(ids, req.mutable_scene_id())).ok()) {
+			return s;
+		}
+		Source* source;
+		s = addSource(req, &source);
+		if(s.ok()) {
+			*id = source->Id();
+			undo->push_back([this, show_id = req.show_id(), scene_id = req.scene_id(), source_id = *id]() {
+				Show* show = getShow(show_id);
+				Scene* scene = show ? show->GetScene(scene_id) : NULL;
+				if(scene) {
+					scene->DiscardSource(source_id);
+				}
+			});
+		}
+		return s;
+	}
+
+	case proto::BatchOperation::kSourceSetProperties: {
+		proto::SourceSetPropertiesRequest req = op.source_set_properties();
+		if(!(s = resolveBatchId(ids, req.mutable_scene_id())).ok() || !(s = resolveBatchId(ids, req.mutable_source_id())).ok()) {
+			return s;
+		}
+		Scene* scene;
+		Source* source;
+		if(!(s = findSource(req.show_id(), req.scene_id(), req.source_id(), &scene, &source)).ok() || !(s = validateSourceUpdate(req)).ok()) {
+			return s;
+		}
+		// Swapping the input of a started source waits for the new one,
+		// which can't be done under the lock
+		if(scene->Started()) {
+			trace_error("Scene is started", field_ns("scene_id", req.scene_id()));
+			return Status(grpc::FAILED_PRECONDITION, "Scene is started, use SourceSetProperties id="+ req.scene_id());
+		}
+
+		markDirty(req.show_id());
+		undo->push_back([this, req, type = source->Type(), url = source->Url(), properties = source->Properties()]() {
+			Scene* scene;
+			Source* source;
+			if(findSource(req.show_id(), req.scene_id(), req.source_id(), &scene, &source).ok()) {
+				source->Restore(type, url, properties);
+			}
+		});
+		if(!(s = setSourceProperties(source, req)).ok()) {
+			return s;
+		}
+		proto::Source proto_source;
+		return sourceChanged(req.show_id(), req.scene_id(), source, &proto_source);
+	}
+
+	default:
+		trace_error("Empty batch operation");
+		return Status(grpc::INVALID_ARGUMENT, "Empty operation");
+	}
+}
+
+///////////////////////////////////////
+// OUTPUT                            //
+///////////////////////////////////////
+
+Status Studio::handleOutputAdd(ServerContextBase* ctx, const proto::OutputAddRequest* req, proto::OutputAddResponse* rep) {
+	Status s = Status::OK;
+
+	trace("OutputAdd");
+	mtx.lock();
+	try {
+		string output_name = req->output_name();
+		string output_url = req->output_url();
+		string output_rendition = req->output_rendition().empty() ? "main" : req->output_rendition();
+		OutputType output_type = StringToOutputType(req->output_type());
+
+		if(output_type == OutputInvalid) {
+			trace_error("Unsupported output type", field_ns("output_type", req->output_type()));
+			s = Status(grpc::INVALID_ARGUMENT, "Unsupported output type="+ req->output_type());
+		} else if(output_url.empty()) {
+			trace_error("Empty output url", field_s(output_name));
+			s = Status(grpc::INVALID_ARGUMENT, "Empty output url");
+		} else if(!engine_init) {
+			trace_error("Engine not initialized");
+			s = Status(grpc::FAILED_PRECONDITION, "Engine not initialized");
+		} else if(!videoEncoder(output_rendition)) {
+			trace_error("Rendition not found", field_s(output_rendition));
+			s = Status(grpc::INVALID_ARGUMENT, "Rendition not found name="+ output_rendition);
+		} else {
+			Output* output = addOutput(output_name, output_type, output_url, req->output_key(), output_rendition);
+			if(!output) {
+				s = Status(grpc::INTERNAL, "Failed to add output");
+			} else {
+				// Joins the running stream, using the same encoders
+				if(init) {
+					s = output->Start(videoEncoder(output_rendition), enc_a);
+				}
+				if(!s.ok()) {
+					// Not kept: the call failed, so the caller has no id to
+					// remove it with
+					trace_error("Output Start failed, output removed", field_ns("output_id", output->Id()), error(s.error_message()));
+					std::unique_lock<std::mutex> lock(outputs_mtx);
+					outputs.erase(output->Id());
+					delete output;
 				} else {
-					// TODO width and height
-					Source* source = scene->AddSource(source_name, type, source_url, -1, -1);
-					if(!source) {
-						trace_error("Failed to add source", field_s(source_name));
-						s = Status(grpc::INTERNAL, "Failed to add source");
-					} else {
-						proto::Source* proto_source = rep->mutable_source();
-						s = source->UpdateProto(proto_source);
-						trace_info("Added source", field_s(show_id), field_s(scene_id), field_s(source_name), field_s(source_url));
-					}
+					output->UpdateProto(rep->mutable_output());
+					trace_info("Added output", field_ns("output_id", output->Id()), field_s(output_name), field_s(output_url));
+				}
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleOutputRemove(ServerContextBase* ctx, const proto::OutputRemoveRequest* req, Empty* rep) {
+	Status s = Status::OK;
+
+	trace("OutputRemove");
+	mtx.lock();
+	try {
+		string output_id = req->output_id();
+		OutputMap::iterator it = outputs.find(output_id);
+
+		if(it == outputs.end()) {
+			trace_error("Output not found", field_s(output_id));
+			s = Status(grpc::NOT_FOUND, "Output not found id="+ output_id);
+		} else {
+			Output* output = it->second;
+			if(output->Started()) {
+				s = output->Stop();
+			}
+			if(s.ok()) {
+				std::unique_lock<std::mutex> lock(outputs_mtx);
+				delete output;
+				outputs.erase(it);
+				lock.unlock();
+				trace_info("Removed output", field_s(output_id));
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleOutputList(ServerContextBase* ctx, const Empty* req, proto::OutputListResponse* rep) {
+	Status s = Status::OK;
+
+	trace("OutputList");
+	mtx.lock();
+	try {
+		for (auto & it : outputs) {
+			s = it.second->UpdateProto(rep->add_outputs());
+			if(!s.ok()) {
+				break;
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+		s = Status(grpc::INTERNAL, e.c_str());
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
+	}
+	mtx.unlock();
+
+	return s;
+}
+
+Status Studio::handleRenditionList(ServerContextBase* ctx, const Empty* req, proto::RenditionListResponse* rep) {
+	Status s = Status::OK;
+
+	trace("RenditionList");
+	mtx.lock();
+	try {
+		vector<Rendition> ladder;
+		ladder.push_back(Rendition{"main", settings->video_width, settings->video_height, settings->video_bitrate_kbps, ""});
+		ladder.insert(ladder.end(), settings->video_renditions.begin(), settings->video_renditions.end());
+
+		for(const Rendition& r : ladder) {
+			proto::Rendition* proto_rendition = rep->add_renditions();
+			proto_rendition->set_name(r.name);
+			proto_rendition->set_width(r.width);
+			proto_rendition->set_height(r.height);
+			proto_rendition->set_bitrate_kbps(r.bitrate_kbps);
+			proto_rendition->set_preset(r.preset);
+
+			obs_encoder_t* enc = videoEncoder(r.name);
+			proto_rendition->set_active(enc && obs_encoder_active(enc));
+
+			uint64_t total_bytes = 0;
+			uint64_t frames_dropped = 0;
+			uint64_t total_frames = 0;
+			for (auto & it : outputs) {
+				if(it.second->Rendition() != r.name) {
+					continue;
 				}
+				proto_rendition->add_output_ids(it.first);
+				total_bytes += it.second->TotalBytes();
+				frames_dropped += it.second->FramesDropped();
+				// Each output of a rendition gets every frame its encoder
+				// produced since the output started
+				total_frames = std::max<uint64_t>(total_frames, it.second->TotalFrames());
+			}
+			proto_rendition->set_total_bytes(total_bytes);
+			proto_rendition->set_frames_dropped(frames_dropped);
+			proto_rendition->set_total_frames(total_frames);
+			if(enc && obs_encoder_video(enc)) {
+				proto_rendition->set_skipped_frames(video_output_get_skipped_frames(obs_encoder_video(enc)));
 			}
 		}
+		if(engine_init) {
+			rep->set_composite_total_frames(video_output_get_total_frames(obs_get_video()));
+		}
+
+		// libobs has no per encoder CPU accounting. Encoders of unused
+		// renditions are idle, so the cost of a rendition is the difference
+		// in process CPU time with and without outputs using it. Its encoder
+		// lag is read from the frame counters above.
+		struct rusage usage;
+		if(getrusage(RUSAGE_SELF, &usage) == 0) {
+			double cpu_seconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+				+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+			rep->set_process_cpu_seconds(cpu_seconds);
+		}
 	}
 	catch(string e) {
 		trace_error("An exception occured", error(e));
@@ -608,36 +2097,66 @@ Status Studio::SourceAdd(ServerContext* ctx, const proto::SourceAddRequest* req,
 	return s;
 }
 
-Status Studio::SourceDuplicate(ServerContext* ctx, const proto::SourceDuplicateRequest* req, proto::SourceDuplicateResponse* rep) {
+///////////////////////////////////////
+// RECORD                            //
+///////////////////////////////////////
+
+Status Studio::handleRecordStart(ServerContextBase* ctx, const proto::RecordStartRequest* req, proto::RecordStartResponse* rep) {
 	Status s = Status::OK;
 
-	trace("SourceDuplicate");
+	trace("RecordStart");
 	mtx.lock();
 	try {
-		string show_id = req->show_id();
-		string scene_id = req->scene_id();
-		string source_id = req->source_id();
-		Show* show = getShow(show_id);
-
-		if(!show) {
-			trace_error("Show not found id", field_s(show_id));
-			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
+		string directory = req->directory();
+		string format = req->format().empty() ? "mp4" : req->format();
+		string rendition = req->rendition().empty() ? "main" : req->rendition();
+
+		if(recording) {
+			trace_error("Already recording");
+			s = Status(grpc::FAILED_PRECONDITION, "Already recording");
+		} else if(recording_stopping) {
+			trace_error("Previous recording still stopping");
+			s = Status(grpc::FAILED_PRECONDITION, "Previous recording still stopping");
+		} else if(!init) {
+			trace_error("Studio not started");
+			s = Status(grpc::FAILED_PRECONDITION, "Studio not started");
+		} else if(directory.empty()) {
+			trace_error("Empty record directory");
+			s = Status(grpc::INVALID_ARGUMENT, "Empty record directory");
+		} else if(format != "mp4" && format != "ts") {
+			trace_error("Unsupported record format", field_s(format));
+			s = Status(grpc::INVALID_ARGUMENT, "Unsupported record format="+ format);
+		} else if(req->segment_duration_sec() > INT_MAX) {
+			// Would be negative for Output::SetSegments, turning segmenting off
+			trace_error("Invalid segment_duration_sec", field_n("segment_duration_sec", req->segment_duration_sec()));
+			s = Status(grpc::INVALID_ARGUMENT, "Invalid segment_duration_sec="+ to_string(req->segment_duration_sec()) +", expected 0 to "+ to_string(INT_MAX));
+		} else if(req->max_segments() > INT_MAX) {
+			// Would be negative for Output::SetSegments, keeping all segments
+			trace_error("Invalid max_segments", field_n("max_segments", req->max_segments()));
+			s = Status(grpc::INVALID_ARGUMENT, "Invalid max_segments="+ to_string(req->max_segments()) +", expected 0 to "+ to_string(INT_MAX));
+		} else if(!videoEncoder(rendition)) {
+			trace_error("Rendition not found", field_s(rendition));
+			s = Status(grpc::INVALID_ARGUMENT, "Rendition not found name="+ rendition);
+		} else if(os_mkdirs(directory.c_str()) == MKDIR_ERROR) {
+			trace_error("Failed to create record directory", field_s(directory));
+			s = Status(grpc::INVALID_ARGUMENT, "Failed to create record directory="+ directory);
 		} else {
-			Scene* scene = show->GetScene(scene_id);
+			// Same name format as the following segments, see Output::SetSegments
+			char* filename = os_generate_formatted_filename(format.c_str(), false, "%CCYY-%MM-%DD_%hh-%mm-%ss");
+			string path = directory +"/"+ filename;
+			bfree(filename);
 
-			if(!scene) {
-				trace_error("Scene not found id", field_s(scene_id));
-				s = Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
+			recording = new Output("record", "record", OutputFile, path, "", rendition, settings, &events);
+			recording->SetSegments(directory, format, req->segment_duration_sec(), req->max_segments());
+
+			// Uses the encoders of the outputs, nothing is encoded twice
+			s = recording->Start(videoEncoder(rendition), enc_a);
+			if(!s.ok()) {
+				delete recording;
+				recording = nullptr;
 			} else {
-				Source* source = scene->DuplicateSource(source_id);
-				if(!source) {
-					trace_error("Failed to duplicate source", field_s(source_id));
-					s = Status(grpc::INTERNAL, "Failed to duplicate source id="+ source_id);
-				} else {
-					proto::Source* proto_source = rep->mutable_source();
-					s = source->UpdateProto(proto_source);
-					trace_info("Duplicated source", field_s(show_id), field_s(scene_id), field_s(source_id));
-				}
+				recording->UpdateProto(rep->mutable_output());
+				trace_info("Started recording", field_s(path), field_n("segment_duration_sec", req->segment_duration_sec()), field_n("max_segments", req->max_segments()));
 			}
 		}
 	}
@@ -654,35 +2173,31 @@ Status Studio::SourceDuplicate(ServerContext* ctx, const proto::SourceDuplicateR
 	return s;
 }
 
-Status Studio::SourceRemove(ServerContext* ctx, const proto::SourceRemoveRequest* req, Empty* rep) {
+Status Studio::handleRecordStop(ServerContextBase* ctx, const Empty* req, Empty* rep) {
 	Status s = Status::OK;
 
-	trace("SourceRemove");
+	trace("RecordStop");
+	Output* stopped = nullptr;
 	mtx.lock();
-	try {
-		string show_id = req->show_id();
-		string scene_id = req->scene_id();
-		string source_id = req->source_id();
-		Show* show = getShow(show_id);
-
-		if(!show) {
-			trace_error("Show not found", field_s(show_id));
-			s = Status(grpc::NOT_FOUND, "Show not found id="+ show_id);
-		} else {
-			Scene* scene = show->GetScene(scene_id);
+	if(!recording) {
+		trace_error("Not recording");
+		s = Status(grpc::FAILED_PRECONDITION, "Not recording");
+	} else {
+		stopped = recording;
+		recording = nullptr;
+		recording_stopping = true;
+	}
+	mtx.unlock();
+	if(!stopped) {
+		return s;
+	}
 
-			if(!scene) {
-				trace_error("Scene not found", field_s(scene_id));
-				s = Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
-			} else {
-				s = scene->RemoveSource(source_id);
-				if(!s.ok()) {
-					trace_error("Error in RemoveSource", field_s(show_id), field_s(scene_id), field_s(source_id))
-				} else {
-					trace_info("Removed source", field_s(show_id), field_s(scene_id), field_s(source_id));
-				}
-			}
-		}
+	// Output::Stop waits up to OUTPUT_STOP_TIMEOUT for the muxer, so it runs
+	// without the studio lock. Nothing else sees the detached output, and
+	// RecordStart is rejected until recording_stopping is cleared.
+	try {
+		s = stopped->Stop();
+		trace_info("Stopped recording");
 	}
 	catch(string e) {
 		trace_error("An exception occured", error(e));
@@ -692,59 +2207,37 @@ Status Studio::SourceRemove(ServerContext* ctx, const proto::SourceRemoveRequest
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
+	delete stopped;
+
+	mtx.lock();
+	recording_stopping = false;
 	mtx.unlock();
 
 	return s;
 }
 
-Status Studio::SourceSetProperties(ServerContext* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep) {
-	Status s = Status::OK;
+///////////////////////////////////////
+// MISC                              //
+///////////////////////////////////////
 
-	trace("SourceSetProperties");
-	mtx.lock();
-	try {
-		string show_id = req->show_id();
-		string scene_id = req->scene_id();
-		string source_id = req->source_id();
-		string source_type = req->source_type();
-		string source_url = req->source_url();
-		Show* show = getShow(show_id);
+Status Studio::handleHealth(ServerContextBase* ctx, const Empty* req, proto::HealthResponse* rep) {
+	trace("Health");
+	rep->set_timestamp(std::time(nullptr));
 
-		if(!show) {
-			trace_error("Show not found", field_s(show_id));
-			s = Status(grpc::NOT_FOUND, "Show not found id=", show_id);
-		} else {
-			Scene* scene = show->GetScene(scene_id);
+	proto::SourceRegistryStats* stats = rep->mutable_source_registry();
+	stats->set_instances(source_registry.Instances());
+	stats->set_references(source_registry.References());
+	stats->set_saved(source_registry.Saved());
+	return Status::OK;
+}
 
-			if(!scene) {
-				trace_error("Scene not found", field_s(scene_id));
-				s = Status(grpc::NOT_FOUND, "Scene not found id="+ scene_id);
-			} else if(scene == show->ActiveScene()) {
-				trace_error("Scene is currently active", field_s(scene_id));
-				s = Status(grpc::INVALID_ARGUMENT, "Invalid scene id");
-			} else {
-				Source* source = scene->GetSource(source_id);
+Status Studio::handleGetMetrics(ServerContextBase* ctx, const Empty* req, proto::MetricsResponse* rep) {
+	Status s = Status::OK;
 
-				if(!source) {
-					trace_error("Source not found", field_s(source_id));
-					s = Status(grpc::NOT_FOUND, "Source not found id="+ source_id);
-				} else {
-					s = source->SetUrl(source_url);
-					if(s.ok()) {
-						s = source->SetType(source_type);
-						if(s.ok()) {
-							proto::Source* proto_source = rep->mutable_source();
-							s = source->UpdateProto(proto_source);
-							trace_info("Set properties for source", field_s(show_id), field_s(scene_id), field_s(source_id), field_s(source_type), field_s(source_url));
-						} else {
-							trace_error("Source SetType failed", field_s(source_id), field_s(source_type), error(s.error_message()));
-						}
-					} else {
-						trace_error("Source SetUrl failed", field_s(source_id), field_s(source_url), error(s.error_message()));
-					}
-				}
-			}
-		}
+	// Does not take mtx: the metrics stay readable during a long mutation
+	trace("GetMetrics");
+	try {
+		collectMetrics(rep);
 	}
 	catch(string e) {
 		trace_error("An exception occured", error(e));
@@ -754,31 +2247,61 @@ Status Studio::SourceSetProperties(ServerContext* ctx, const proto::SourceSetPro
 		trace_error("An uncaught exception occured !");
 		s = Status(grpc::INTERNAL, "An uncaught exception occured !");
 	}
-	mtx.unlock();
-
 	return s;
 }
 
-Status Studio::Health(ServerContext* ctx, const Empty* req, proto::HealthResponse* rep) {
-	trace("Health");
-	rep->set_timestamp(std::time(nullptr));
-	return Status::OK;
-}
-
 //////////////////////
 // Private          //
 //////////////////////
 
-Status Studio::studioInit() {
+Status Studio::EngineInit() {
+	std::chrono::steady_clock::time_point init_start = std::chrono::steady_clock::now();
 
-	if(init) {
-		return Status(grpc::FAILED_PRECONDITION, "Studio already initialized");
+	if(engine_init) {
+		return Status(grpc::FAILED_PRECONDITION, "Engine already initialized");
+	}
+
+	Status s = engineStart();
+	if(!s.ok()) {
+		// Releases what the failed step left, obs included once started
+		engineRelease();
+		return s;
 	}
+	engine_init = true;
+
+	if(settings->input_stall_ms > 0) {
+		input_watchdog.Start();
+	}
+
+	if(settings->metrics_port > 0) {
+		bool started = metrics_http.Start(settings->metrics_port, [this]() {
+			proto::MetricsResponse rep;
+			collectMetrics(&rep);
+			return Metrics::ToPrometheus(rep);
+		});
+		if(!started) {
+			input_watchdog.Stop();
+			engineRelease();
+			return Status(grpc::INTERNAL, "Couldn't listen on metrics port "+ to_string(settings->metrics_port));
+		}
+	}
+
+	// To compare the display backends
+	struct rusage usage;
+	long max_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+	trace_info("Engine initialized",
+		field_n("init_ms", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - init_start).count()),
+		field_ns("display", settings->display_backend),
+		field_n("max_rss_kb", max_rss_kb));
+	return Status::OK;
+}
 
-	// OBS 27+: we need to set the display manually. The OBS app does it using
-	// QT, so we do the same here.
-	QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
-	obs_set_nix_platform_display(native->nativeResourceForIntegration("display"));
+Status Studio::engineStart() {
+	// OBS 27+: we need to set the display manually.
+	string display_error = NativeDisplayOpen(settings->display_backend);
+	if(!display_error.empty()) {
+		return Status(grpc::INTERNAL, "Couldn't open the display: "+ display_error);
+	}
 
 	///////////////
 	// OBS init  //
@@ -786,6 +2309,7 @@ Status Studio::studioInit() {
 	if(!obs_startup("en-US", nullptr, nullptr) || !obs_initialized()) {
 		return Status(grpc::INTERNAL, "obs_startup failed");
 	}
+	obs_started = true;
 
 	memset(&ovi, 0, sizeof(ovi));
 	memset(&oai, 0, sizeof(oai));
@@ -844,28 +2368,6 @@ Status Studio::studioInit() {
 
 	obs_post_load_modules();
 
-	// output and service	
-	service = obs_service_create("rtmp_common", "rtmp service", nullptr, nullptr);
-	if (!service) {
-		return Status(grpc::INTERNAL, "Couldn't create service");
-	}
-
-	rtmp_settings = obs_data_create();
-	if (!rtmp_settings) {
-		return Status(grpc::INTERNAL, "Couldn't create rtmp settings");
-	}
-
-	obs_data_set_string(rtmp_settings, "server", settings->server.c_str());
-	obs_data_set_string(rtmp_settings, "key", settings->key.c_str());
-	obs_service_update(service, rtmp_settings);
-	obs_data_release(rtmp_settings);
-
-	output = obs_output_create("rtmp_output", "RTMP output", NULL, nullptr);
-	if (!output) {
-		return Status(grpc::INTERNAL, "Couldn't create output");
-	}
-
-
 	// Audio encoder
 	enc_a = obs_audio_encoder_create("libfdk_aac", "aac enc", NULL, 0, nullptr);
 	if (!enc_a) {
@@ -883,53 +2385,38 @@ Status Studio::studioInit() {
 	obs_data_release(enc_a_settings);
 
 	// Video encoder
-	string encoder = settings->video_hw_encode ? "ffmpeg_nvenc" : "obs_x264";
-	enc_v = obs_video_encoder_create(encoder.c_str(), "h264 enc", NULL, nullptr);
+	enc_v = createVideoEncoder("h264 enc", settings->video_width, settings->video_height, settings->video_bitrate_kbps, "");
 	if (!enc_v) {
 		return Status(grpc::INTERNAL, "Couldn't create enc_v");
 	}
 
-	enc_v_settings = obs_encoder_get_settings(enc_v);
-	if (!enc_v_settings) {
-		return Status(grpc::INTERNAL, "Failed to create enc_v_settings");
+	// Rendition ladder: scaled encoders fed by the same composite. An
+	// encoder only runs while an output uses it.
+	for(const Rendition& r : settings->video_renditions) {
+		obs_encoder_t* enc = createVideoEncoder("h264 enc "+ r.name, r.width, r.height, r.bitrate_kbps, r.preset);
+		if (!enc) {
+			return Status(grpc::INTERNAL, "Couldn't create encoder for rendition "+ r.name);
+		}
+		obs_encoder_set_scaled_size(enc, r.width, r.height);
+		rendition_encoders[r.name] = enc;
 	}
 
-	obs_data_set_int(	enc_v_settings, "bitrate",		settings->video_bitrate_kbps);
-	obs_data_set_int(	enc_v_settings, "keyint_sec",	settings->video_keyint_sec);
-	obs_data_set_string(enc_v_settings, "rate_control",	settings->video_rate_control.c_str());
-	if(settings->video_hw_encode) {
-		// TODO HW encoder settings
-		// obs_data_set_int(	enc_v_settings, "max_bitrate",	settings->videoBitrateKbps);
-		obs_data_set_string(enc_v_settings, "preset",		"default");
-		obs_data_set_string(enc_v_settings, "profile",		"main");
-		obs_data_set_int(	enc_v_settings, "bf",			2);
-		obs_data_set_bool(	enc_v_settings, "psycho_aq",	false);
-		obs_data_set_bool(	enc_v_settings, "lookahead",	false);
-		// obs_data_set_int(	enc_v_settings, "cqp",			(1, 30, 1));
-		// obs_data_set_int(	enc_v_settings, "gpu",			(0, 8, 1));
-	} else {
-		obs_data_set_int(	enc_v_settings, "width",		settings->video_width);
-		obs_data_set_int(	enc_v_settings, "height",		settings->video_height);
-		obs_data_set_int(	enc_v_settings, "fps_num",		settings->video_fps_num);
-		obs_data_set_int(	enc_v_settings, "fps_den",		settings->video_fps_den);
-		// TODO sw encoder settings
-		// obs_data_set_int(enc_v_settings, "buffer_size",		settings->videoBitrateKbps);
-		obs_data_set_string(enc_v_settings, "preset",		"ultrafast");
-		obs_data_set_string(enc_v_settings, "profile",		"main");
-		obs_data_set_string(enc_v_settings, "tune",			"zerolatency");
-		obs_data_set_string(enc_v_settings, "x264opts",		"");
-		// obs_data_set_bool(enc_v_settings, "use_bufsize",		false);
-		// obs_data_set_int(enc_v_settings, "crf",		0);
-		// #ifdef ENABLE_VFR
-		// obs_data_set_bool(enc_v_settings, "vfr",		true);
-		// #endif
+	// Default output, from the settings
+	if(!addOutput("default", OutputRTMP, settings->server, settings->key, "main")) {
+		return Status(grpc::INTERNAL, "Couldn't create output");
+	}
+
+	return Status::OK;
+}
+
+Status Studio::studioInit() {
+	if(!engine_init) {
+		return Status(grpc::FAILED_PRECONDITION, "Engine not initialized");
+	}
+	if(init) {
+		return Status(grpc::FAILED_PRECONDITION, "Studio already initialized");
 	}
-	obs_encoder_update(enc_v, enc_v_settings);
-	obs_data_release(enc_v_settings);
 
-	///////////////
-	// Show init //
-	///////////////
 	grpc::Status s = active_show->Start();
 	if(!s.ok()) {
 		return s;
@@ -937,13 +2424,18 @@ Status Studio::studioInit() {
 
 	obs_set_output_source(0, active_show->Transition());
 	obs_encoder_set_video(enc_v, obs_get_video());
+	for (auto & it : rendition_encoders) {
+		obs_encoder_set_video(it.second, obs_get_video());
+	}
 	obs_encoder_set_audio(enc_a, obs_get_audio());
-	obs_output_set_video_encoder(output, enc_v);
-	obs_output_set_audio_encoder(output, enc_a, 0);
-	obs_output_set_service(output, service);
 
-	if(obs_output_start(output) != true) {
-		s = Status(grpc::INTERNAL, "obs_output_start failed: "+ std::string(obs_output_get_last_error(output)));
+	// An output failing to start does not prevent the others from streaming,
+	// its state is reported by OutputList and OutputStateChanged.
+	for (auto & it : outputs) {
+		s = it.second->Start(videoEncoder(it.second->Rendition()), enc_a);
+		if(!s.ok()) {
+			trace_error("Output Start failed", field_ns("output_id", it.first), error(s.error_message()));
+		}
 	}
 
 	init = true;
@@ -955,22 +2447,199 @@ Status Studio::studioRelease() {
 		return Status(grpc::FAILED_PRECONDITION, "Studio not started");
 	}
 
-	obs_encoder_release(enc_v);
-	obs_encoder_release(enc_a);
-	obs_service_release(service);
-	obs_output_release(output);
+	Status s;
+	if(recording) {
+		s = recording->Stop();
+		if(!s.ok()) {
+			trace_error("Recording Stop failed", error(s.error_message()));
+		}
+		delete recording;
+		recording = nullptr;
+	}
+	for (auto & it : outputs) {
+		if(!it.second->Started()) {
+			continue;
+		}
+		s = it.second->Stop();
+		if(!s.ok()) {
+			trace_error("Output Stop failed", field_ns("output_id", it.first), error(s.error_message()));
+		}
+	}
+	obs_set_output_source(0, nullptr);
 
-	Status s = active_show->Stop();
+	s = active_show->Stop();
 	if(!s.ok()) {
 		return s;
 	}
 
-	obs_shutdown();
 	init = false;
 	trace("StudioStop Ok !");
 	return Status::OK;
 }
 
+void Studio::engineRelease() {
+	// Held until obs is shut down, collectMetrics samples it
+	std::unique_lock<std::mutex> lock(outputs_mtx);
+	engine_init = false;
+	for (auto & it : outputs) {
+		delete it.second;
+	}
+	outputs.clear();
+
+	for (auto & it : rendition_encoders) {
+		obs_encoder_release(it.second);
+	}
+	rendition_encoders.clear();
+	obs_encoder_release(enc_v);
+	obs_encoder_release(enc_a);
+	enc_v = nullptr;
+	enc_a = nullptr;
+
+	if(obs_started) {
+		obs_shutdown();
+		obs_started = false;
+	}
+	NativeDisplayClose();
+}
+
+static const char* mediaStateToString(enum obs_media_state state) {
+	switch(state) {
+		case OBS_MEDIA_STATE_PLAYING:   return "playing";
+		case OBS_MEDIA_STATE_OPENING:   return "opening";
+		case OBS_MEDIA_STATE_BUFFERING: return "buffering";
+		case OBS_MEDIA_STATE_PAUSED:    return "paused";
+		case OBS_MEDIA_STATE_STOPPED:   return "stopped";
+		case OBS_MEDIA_STATE_ENDED:     return "ended";
+		case OBS_MEDIA_STATE_ERROR:     return "error";
+		default:                        return "none";
+	}
+}
+
+void Studio::collectMetrics(proto::MetricsResponse* rep) {
+	rep->set_timestamp(std::time(nullptr));
+
+	std::unique_lock<std::mutex> lock(outputs_mtx);
+
+	if(engine_init) {
+		proto::VideoMetrics* video = rep->mutable_video();
+		video->set_total_frames(obs_get_total_frames());
+		video->set_lagged_frames(obs_get_lagged_frames());
+		video->set_average_frame_time_ns(obs_get_average_frame_time_ns());
+		video->set_output_total_frames(video_output_get_total_frames(obs_get_video()));
+		video->set_output_skipped_frames(video_output_get_skipped_frames(obs_get_video()));
+	}
+
+	for(auto & it : outputs) {
+		Output* output = it.second;
+		proto::OutputMetrics* proto_output = rep->add_outputs();
+		proto_output->set_id(output->Id());
+		proto_output->set_name(output->Name());
+		proto_output->set_rendition(output->Rendition());
+		proto_output->set_active(output->Active());
+		proto_output->set_total_bytes(output->TotalBytes());
+		proto_output->set_total_frames(output->TotalFrames());
+		proto_output->set_frames_dropped(output->FramesDropped());
+		proto_output->set_congestion(output->Congestion());
+		proto_output->set_connect_time_ms(output->ConnectTimeMs());
+	}
+	lock.unlock();
+
+	source_registry.ForEach([this, rep](obs_source_t* source, uint64_t references) {
+		proto::SourceMetrics* proto_source = rep->add_sources();
+		proto_source->set_name(obs_source_get_name(source));
+		proto_source->set_type(obs_source_get_id(source));
+		proto_source->set_references(references);
+		proto_source->set_active(obs_source_active(source));
+		proto_source->set_showing(obs_source_showing(source));
+		proto_source->set_width(obs_source_get_width(source));
+		proto_source->set_height(obs_source_get_height(source));
+		proto_source->set_media_state(mediaStateToString(obs_source_media_get_state(source)));
+
+		InputHealth health;
+		if(input_watchdog.Health(source, &health)) {
+			proto_source->set_watched(true);
+			proto_source->set_stalled(health.stalled);
+			proto_source->set_idle_ms(health.idle_ms);
+			proto_source->set_stalls(health.stalls);
+			proto_source->set_reconnects(health.reconnects);
+			proto_source->set_outage_ms(health.outage_ms);
+			proto_source->set_total_outage_ms(health.total_outage_ms);
+			proto_source->set_failed_over(health.failed_over);
+			proto_source->set_failovers(health.failovers);
+			proto_source->set_failover_ms(health.failover_ms);
+			proto_source->set_recovery_ms(health.recovery_ms);
+			proto_source->set_open_ms(health.open_ms);
+			proto_source->set_delay_ms(health.delay_ms);
+		}
+	});
+
+	proto::SourceRegistryStats* stats = rep->mutable_source_registry();
+	stats->set_instances(source_registry.Instances());
+	stats->set_references(source_registry.References());
+	stats->set_saved(source_registry.Saved());
+
+	metrics.UpdateProto(rep);
+}
+
+void Studio::markDirty(string show_id) {
+	dirty_shows.insert(show_id);
+}
+
+void Studio::publishSnapshot() {
+	if(dirty_shows.empty()) {
+		return;
+	}
+
+	shared_ptr<const StudioSnapshot> prev = getSnapshot();
+	shared_ptr<StudioSnapshot> next = make_shared<StudioSnapshot>();
+	next->version = prev->version + 1;
+	// Only the events of this mutation, published by this thread: events of
+	// other threads (input watchdog, outputs) may not be reflected yet
+	next->sequence = std::max(prev->sequence, events.LastPublished());
+	next->active_show_id = active_show ? active_show->Id() : "";
+
+	ShowMap::iterator it;
+	for (it = shows.begin(); it != shows.end(); it++) {
+		Show* show = it->second;
+		if(!show) {
+			trace_error("NULL show, snapshot not published", field_ns("id", it->first));
+			return;
+		}
+
+		auto prev_it = prev->shows.find(it->first);
+		if(prev_it != prev->shows.end() && dirty_shows.count(it->first) == 0) {
+			// Unchanged, share it with the previous version
+			next->shows[it->first] = prev_it->second;
+			continue;
+		}
+
+		shared_ptr<proto::Show> proto_show = make_shared<proto::Show>();
+		Status s = show->UpdateProto(proto_show.get());
+		if(!s.ok()) {
+			// dirty_shows is kept so the next mutation retries
+			trace_error("Failed to update show proto, snapshot not published", field_ns("id", show->Id()), error(s.error_message()));
+			return;
+		}
+		proto_show->set_version(next->version);
+		next->shows[it->first] = proto_show;
+	}
+
+	next->serialized = serializeSnapshot(*next);
+	dirty_shows.clear();
+
+	trace_debug("Publish studio snapshot", field_n("version", next->version));
+	snapshot_mtx.lock();
+	snapshot = next;
+	snapshot_mtx.unlock();
+}
+
+shared_ptr<const StudioSnapshot> Studio::getSnapshot() {
+	snapshot_mtx.lock_shared();
+	shared_ptr<const StudioSnapshot> snap = snapshot;
+	snapshot_mtx.unlock_shared();
+	return snap;
+}
+
 Show* Studio::getShow(std::string show_id) {
 	ShowMap::iterator it = shows.find(show_id);
 	if (it == shows.end()) {
@@ -983,7 +2652,7 @@ Show* Studio::addShow(string show_name) {
 	std::string show_id = "show_"+ std::to_string(show_id_counter);
 	show_id_counter++;
 
-	Show* show = new Show(show_id, show_name, settings);
+	Show* show = new Show(show_id, show_name, settings, &events, &source_registry, &input_watchdog);
 	if(!show) {
 		trace_error("Failed to create a show", field_s(show_id));
 		return NULL;
@@ -995,40 +2664,80 @@ Show* Studio::addShow(string show_name) {
 	if(!active_show) {
 		active_show = show;
 	}
+
+	proto::StudioEvent event;
+	show->UpdateProto(event.mutable_show_added()->mutable_show());
+	events.Publish(std::move(event));
 	return show;
 }
 
-Show* Studio::loadShow(string show_id) {
+Show* Studio::loadShow(string show_path, const ShowSpec& spec) {
 	Status s;
 	Show* show;
-	json_t* json_show;
-	json_error_t error;
-
-	json_show = json_load_file(show_id.c_str(), 0, &error);
-	if(!json_show) {
-		trace_error("Error while loading json config", field_s(show_id), field_nc("error", error.text));
-		return NULL;
-	}
 
-	show = addShow(show_id);
+	show = addShow(show_path);
 	if(!show) {
-		json_decref(json_show);
-		trace_error("Error while creating show", field_s(show_id));
+		trace_error("Error while creating show", field_s(show_path));
 		return NULL;
 	}
 
-	s = show->Load(json_show);
-	json_decref(json_show);
-
+	s = show->Load(spec);
 	if(!s.ok()) {
 		trace_error("Error during show Load", error(s.error_message()));
+		shows.erase(show->Id());
+		if(active_show == show) {
+			active_show = NULL;
+		}
+
+		proto::StudioEvent event;
+		event.mutable_show_removed()->set_show_id(show->Id());
+		events.Publish(std::move(event));
+
 		delete show;
 		return NULL;
 	}
 
+	show->SetPath(show_path);
+	show_watcher.Watch(show_path);
 	return show;
 }
 
+void Studio::reloadShowFile(string show_path) {
+	ShowSpec spec;
+	bool cached;
+	Status s = show_cache.Load(show_path, &spec, &cached);
+	if(!s.ok()) {
+		trace_error("Failed to read show file, shows left unchanged", field_s(show_path), error(s.error_message()));
+		return;
+	}
+
+	mtx.lock();
+	try {
+		for(auto & it : shows) {
+			Show* show = it.second;
+			if(show->Path() != show_path) {
+				continue;
+			}
+
+			proto::ShowReloadStats stats;
+			s = show->Reload(spec, &stats);
+			// Even a failed reload may have applied its first steps
+			markDirty(show->Id());
+			if(!s.ok()) {
+				trace_error("Failed to reload show", field_ns("show_id", show->Id()), error(s.error_message()));
+			}
+		}
+	}
+	catch(string e) {
+		trace_error("An exception occured", error(e));
+	}
+	catch(...) {
+		trace_error("An uncaught exception occured !");
+	}
+	publishSnapshot();
+	mtx.unlock();
+}
+
 Show* Studio::duplicateShow(string show_id) {
 	Show* show = getShow(show_id);
 	if(!show) {
@@ -1057,6 +2766,22 @@ Show* Studio::duplicateShow(string show_id) {
 	return new_show;
 }
 
+Output* Studio::addOutput(string output_name, OutputType type, string url, string key, string rendition) {
+	std::string output_id = "output_"+ std::to_string(output_id_counter);
+	output_id_counter++;
+
+	Output* output = new Output(output_id, output_name, type, url, key, rendition, settings, &events);
+	if(!output) {
+		trace_error("Failed to create an output", field_s(output_id));
+		return NULL;
+	}
+
+	trace_debug("Add output", field_s(output_id));
+	std::unique_lock<std::mutex> lock(outputs_mtx);
+	outputs[output_id] = output;
+	return output;
+}
+
 Status Studio::removeShow(string show_id) {
 	ShowMap::iterator it = shows.find(show_id);
 	if(it == shows.end()) {
@@ -1068,12 +2793,82 @@ Status Studio::removeShow(string show_id) {
 
 	trace_debug("Remove show", field_s(show_id));
 	// No need to do show->Stop(); because it is not actve
+	if(!it->second->Path().empty()) {
+		show_watcher.Unwatch(it->second->Path());
+	}
 	delete it->second;
 	shows.erase(it);
 
+	proto::StudioEvent event;
+	event.mutable_show_removed()->set_show_id(show_id);
+	events.Publish(std::move(event));
+
 	return Status::OK;
 }
 
+obs_encoder_t* Studio::createVideoEncoder(string enc_name, int width, int height, int bitrate_kbps, string preset) {
+	string encoder = settings->video_hw_encode ? "ffmpeg_nvenc" : "obs_x264";
+	obs_encoder_t* enc = obs_video_encoder_create(encoder.c_str(), enc_name.c_str(), NULL, nullptr);
+	if (!enc) {
+		trace_error("Couldn't create video encoder", field_s(enc_name));
+		return nullptr;
+	}
+
+	obs_data_t* enc_settings = obs_encoder_get_settings(enc);
+	if (!enc_settings) {
+		trace_error("Failed to get video encoder settings", field_s(enc_name));
+		obs_encoder_release(enc);
+		return nullptr;
+	}
+
+	obs_data_set_int(	enc_settings, "bitrate",		bitrate_kbps);
+	obs_data_set_int(	enc_settings, "keyint_sec",	settings->video_keyint_sec);
+	obs_data_set_string(enc_settings, "rate_control",	settings->video_rate_control.c_str());
+	if(settings->video_hw_encode) {
+		// TODO HW encoder settings
+		// obs_data_set_int(	enc_settings, "max_bitrate",	settings->videoBitrateKbps);
+		obs_data_set_string(enc_settings, "preset",		preset.empty() ? "default" : preset.c_str());
+		obs_data_set_string(enc_settings, "profile",		"main");
+		obs_data_set_int(	enc_settings, "bf",			2);
+		obs_data_set_bool(	enc_settings, "psycho_aq",	false);
+		obs_data_set_bool(	enc_settings, "lookahead",	false);
+		// obs_data_set_int(	enc_settings, "cqp",			(1, 30, 1));
+		// obs_data_set_int(	enc_settings, "gpu",			(0, 8, 1));
+	} else {
+		obs_data_set_int(	enc_settings, "width",		width);
+		obs_data_set_int(	enc_settings, "height",		height);
+		obs_data_set_int(	enc_settings, "fps_num",		settings->video_fps_num);
+		obs_data_set_int(	enc_settings, "fps_den",		settings->video_fps_den);
+		// TODO sw encoder settings
+		// obs_data_set_int(enc_settings, "buffer_size",		settings->videoBitrateKbps);
+		obs_data_set_string(enc_settings, "preset",		preset.empty() ? "ultrafast" : preset.c_str());
+		obs_data_set_string(enc_settings, "profile",		"main");
+		obs_data_set_string(enc_settings, "tune",			"zerolatency");
+		obs_data_set_string(enc_settings, "x264opts",		"");
+		// obs_data_set_bool(enc_settings, "use_bufsize",		false);
+		// obs_data_set_int(enc_settings, "crf",		0);
+		// #ifdef ENABLE_VFR
+		// obs_data_set_bool(enc_settings, "vfr",		true);
+		// #endif
+	}
+	obs_encoder_update(enc, enc_settings);
+	obs_data_release(enc_settings);
+
+	return enc;
+}
+
+obs_encoder_t* Studio::videoEncoder(string rendition) {
+	if(rendition.empty() || rendition == "main") {
+		return enc_v;
+	}
+
+	map<string, obs_encoder_t*>::iterator it = rendition_encoders.find(rendition);
+	if(it == rendition_encoders.end()) {
+		return NULL;
+	}
+	return it->second;
+}
+
 int Studio::loadModule(const char* binPath, const char* dataPath) {
 	obs_module_t *module;
 
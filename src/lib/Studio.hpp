@@ -1,7 +1,20 @@
 #pragma once
 
+#include "InputWatchdog.hpp"
+#include "Metrics.hpp"
+#include "Output.hpp"
 #include "Show.hpp"
+#include "ShowCache.hpp"
+#include "ShowWatcher.hpp"
+#include "SourceRegistry.hpp"
+#include "WorkerPool.hpp"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
 
 /**
  * @file
@@ -10,17 +23,51 @@
  * The server responds to all methods declared in proto/studio.proto.
  * It can contain Show objects in the `ShowMap shows` map.
  *
+ * Mutating methods are serialized by `mtx`. Once a mutation is done, an
+ * immutable StudioSnapshot of the whole tree is published, and read-only
+ * methods (StudioGet, ShowGet, SceneGet, SceneGetCurrent, SourceGet) are
+ * served from it without taking `mtx`. This way a slow scene switch or studio
+ * start never blocks the getters.
+ *
+ * The service uses the gRPC callback API. Read-only methods run directly on
+ * the gRPC callback threads, since they never block. Mutating methods may
+ * block on `mtx` or libobs, so they are handed to a bounded WorkerPool. When
+ * its queue is full they are rejected with grpc::Status::RESOURCE_EXHAUSTED.
+ *
  */
 
 using namespace std;
 
+using grpc::CallbackServerContext;
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
+using grpc::ServerContextBase;
+using grpc::ServerUnaryReactor;
 using grpc::Status;
 using google::protobuf::Empty;
 
-class Studio final : public proto::Studio::Service {
+/**
+ * Immutable state of the studio at a given version.
+ *
+ * Snapshots are copy-on-write: a show that did not change since the previous
+ * version is shared with it instead of being rebuilt from the Show tree.
+ */
+struct StudioSnapshot {
+	// Incremented each time a mutation changes the state, from a random epoch
+	// in the high word.
+	uint64_t version;
+	// Sequence number of the last event reflected in this snapshot.
+	uint64_t sequence;
+	string active_show_id;
+	// Show protos by show id, each stamped with the version it last changed at.
+	map<string, shared_ptr<const proto::Show>> shows;
+	// The whole StudioGetResponse, serialized once per version.
+	grpc::Slice serialized;
+};
+
+// StudioGet is a raw callback method so the pre-serialized snapshot can be
+// sent as is.
+class Studio final : public proto::Studio::WithRawCallbackMethod_StudioGet<proto::Studio::CallbackService> {
 public:
 	/**
 	 * Studio constructor.
@@ -31,277 +78,633 @@ public:
 	Studio(Settings* settings);
 
 	/**
-	 * Studio destructor. Deletes any non-NULL show in `shows`.
+	 * Studio destructor. Stops the studio if started, releases obs, and
+	 * deletes any non-NULL show in `shows`.
 	 */
 	~Studio();
 
+	/**
+	 * Initializes obs once for the lifetime of the server: video and audio
+	 * contexts, modules, RTMP service, output and encoders. StudioStart and
+	 * StudioStop then only attach and detach the active show and the output.
+	 * If a step fails, what was initialized is released, obs_shutdown
+	 * included.
+	 *
+	 * @return  grpc::Status::OK if successful
+	 *          grpc::Status::FAILED_PRECONDITION if already initialized
+	 *          grpc::Status::INTERNAL if an obs call failed
+	 */
+	Status EngineInit();
+
+	// Registry of the RPC latencies, fed by a MetricsInterceptorFactory
+	// registered on the server. Metrics::RequestDump traces them.
+	Metrics* RpcMetrics() { return &metrics; }
+
 	// Studio
 
 	/**
 	 * Returns the current Studio state (each show, scene and source) to the
-	 * gRPC caller.
+	 * gRPC caller, or only not_modified if known_version is its
+	 * current version.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
-	 * @param   req  Empty request gRPC type.
-	 * @param   rep  the studio state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
-	 *               grpc::Status::INTERNAL if an exception occured or a show is NULL
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  serialized StudioGetRequest.
+	 * @param   rep  serialized StudioGetResponse (see proto/studio.proto).
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::INVALID_ARGUMENT if the request can't be parsed
+	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status StudioGet(ServerContext* ctx, const Empty* req, proto::StudioGetResponse* rep) override;
+	ServerUnaryReactor* StudioGet(CallbackServerContext* ctx, const grpc::ByteBuffer* req, grpc::ByteBuffer* rep) override;
 
 	/**
-	 * Calls studioInit to start the studio.
+	 * Calls studioInit to start the studio: starts the active show and the
+	 * output. obs itself stays initialized (see EngineInit).
 	 *
 	 * @note a show must be active (for example with ShowLoad)
 	 * @note cannot be called twice without calling StudioStop in between.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  Empty request gRPC type.
 	 * @param   rep  Empty response gRPC type.
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status StudioStart(ServerContext* ctx, const Empty* req, Empty* rep) override;
+	ServerUnaryReactor* StudioStart(CallbackServerContext* ctx, const Empty* req, Empty* rep) override;
 
 	/**
-	 * Calls studioRelease to stop the studio.
+	 * Calls studioRelease to stop the studio: stops the output and the active
+	 * show, without shutting obs down.
 	 *
 	 * @note cannot be called if StudioStart was not called before.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  Empty request gRPC type.
 	 * @param   rep  Empty response gRPC type.
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status StudioStop(ServerContext* ctx, const Empty* req, Empty* rep) override;
+	ServerUnaryReactor* StudioStop(CallbackServerContext* ctx, const Empty* req, Empty* rep) override;
 
 	// Show
 	/**
-	 * Returns the state of a given show to the gRPC caller.
+	 * Returns the state of a given show to the gRPC caller, or only
+	 * not_modified if known_version is its current version.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
-	 * @param   req  ShowGetRequest containing the show_id.
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  ShowGetRequest containing the show_id and known_version.
 	 * @param   rep  the show state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id is not found in the shows map
-	 *               grpc::Status::INTERNAL if an exception occured or a scene is NULL
+	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status ShowGet(ServerContext* ctx, const proto::ShowGetRequest* req, proto::ShowGetResponse* rep) override;
+	ServerUnaryReactor* ShowGet(CallbackServerContext* ctx, const proto::ShowGetRequest* req, proto::ShowGetResponse* rep) override;
 
 	/**
 	 * Creates a new empty show and adds it to the shows map.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  ShowCreateRequest containing the show_name.
 	 * @param   rep  the show state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status ShowCreate(ServerContext* ctx, const proto::ShowCreateRequest* req, proto::ShowCreateResponse* rep) override;
+	ServerUnaryReactor* ShowCreate(CallbackServerContext* ctx, const proto::ShowCreateRequest* req, proto::ShowCreateResponse* rep) override;
 
 	/**
 	 * Creates a new show from an existing one and adds it to the shows map. It
 	 * will have the same name with a different id. All scenes and sources are
 	 * also duplicated. The new show is not set as active and is not started.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  ShowDuplicateRequest containing the show_id to duplicate.
 	 * @param   rep  the show state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::INTERNAL if an exception occured or the original show is not found
 	 */
-	Status ShowDuplicate(ServerContext* ctx, const proto::ShowDuplicateRequest* req, proto::ShowDuplicateResponse* rep) override;
+	ServerUnaryReactor* ShowDuplicate(CallbackServerContext* ctx, const proto::ShowDuplicateRequest* req, proto::ShowDuplicateResponse* rep) override;
 
 	/**
 	 * Calls removeShow to remove a show.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  ShowRemoveRequest containing the show_id to remove.
 	 * @param   rep  Empty response gRPC type.
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::INTERNAL if an exception occured or the show is not found
 	 */
-	Status ShowRemove(ServerContext* ctx, const proto::ShowRemoveRequest* req, Empty* rep) override;
+	ServerUnaryReactor* ShowRemove(CallbackServerContext* ctx, const proto::ShowRemoveRequest* req, Empty* rep) override;
 
 	/**
 	 * Calls loadShow to load a show.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  ShowLoadRequest containing the path to load the show from
 	 *               (named show_id).
 	 * @param   rep  the show state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::INVALID_ARGUMENT if the file can't be read or the show is invalid
 	 *               grpc::Status::INTERNAL if an exception occured or the show failed to load
 	 */
-	Status ShowLoad(ServerContext* ctx, const proto::ShowLoadRequest* req, proto::ShowLoadResponse* rep) override;
+	ServerUnaryReactor* ShowLoad(CallbackServerContext* ctx, const proto::ShowLoadRequest* req, proto::ShowLoadResponse* rep) override;
+
+	/**
+	 * Loads several shows. The files are read and validated in parallel by
+	 * the calling worker and the show_load_threads parse threads, shared by
+	 * all the calls, without holding the lock, from the compiled
+	 * show cache when they did not change. The shows are then created under
+	 * one lock, in the order of the request.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  ShowLoadManyRequest containing the paths to load.
+	 * @param   rep  one result per path, with the show state or the error.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK even if some files failed to load, see
+	 *               the results.
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* ShowLoadMany(CallbackServerContext* ctx, const proto::ShowLoadManyRequest* req, proto::ShowLoadManyResponse* rep) override;
+
+	/**
+	 * Reloads a show from its file, as done on file changes when show_watch
+	 * is set. Only the changed scenes and sources are rebuilt, see
+	 * Show::Reload. The show may be active and started.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  ShowReloadRequest containing the show_id.
+	 * @param   rep  the show state and the numbers of reused and rebuilt
+	 *               scenes and sources.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::NOT_FOUND if show_id is not found
+	 *               grpc::Status::FAILED_PRECONDITION if the show was not
+	 *               loaded from a file
+	 *               grpc::Status::INVALID_ARGUMENT if the file can't be read
+	 *               or parsed, the show is then left unchanged
+	 *               any other error of Show::Reload, whose message then
+	 *               starts with "Show partially reloaded": the steps
+	 *               applied before the failed one are kept and published
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* ShowReload(CallbackServerContext* ctx, const proto::ShowReloadRequest* req, proto::ShowReloadResponse* rep) override;
 
 	// Scene
 	/**
 	 * Returns the state of a given scene to the gRPC caller.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SceneGetRequest containing the show_id and scene_id.
 	 * @param   rep  the scene state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND show_id is not found in the show
 	 *               map or if scene_id is not found in show_id.
 	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status SceneGet(ServerContext* ctx, const proto::SceneGetRequest* req, proto::SceneGetResponse* rep) override;
+	ServerUnaryReactor* SceneGet(CallbackServerContext* ctx, const proto::SceneGetRequest* req, proto::SceneGetResponse* rep) override;
 
 	/**
 	 * Creates a new empty scene and adds it to the scenes map of a given show.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SceneAddRequest containing the show_id and new scene_name.
 	 * @param   rep  the scene state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND show_id is not found in the show map
 	 *               grpc::Status::INTERNAL if an exception occured or failed to
 	 *               add scene
 	 */
-	Status SceneAdd(ServerContext* ctx, const proto::SceneAddRequest* req, proto::SceneAddResponse* rep) override;
+	ServerUnaryReactor* SceneAdd(CallbackServerContext* ctx, const proto::SceneAddRequest* req, proto::SceneAddResponse* rep) override;
 
 	/**
 	 * Creates a new scene from an existing one and adds it to the scenes map of
 	 * a given show. It will have the same name with a different id. All sources
 	 * are also duplicated. The new scene is not set as active and is not started.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SceneDuplicateRequest containing the show_id where the
 	 *               scene to duplicate is located, and its scene_id.
 	 * @param   rep  the scene state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id is not found
 	 *               grpc::Status::INTERNAL if an exception occured or the
 	 *               original scene is not found
 	 */
-	Status SceneDuplicate(ServerContext* ctx, const proto::SceneDuplicateRequest* req, proto::SceneDuplicateResponse* rep) override;
+	ServerUnaryReactor* SceneDuplicate(CallbackServerContext* ctx, const proto::SceneDuplicateRequest* req, proto::SceneDuplicateResponse* rep) override;
 
 	/**
 	 * Removes a given scene from a given show.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SceneRemoveRequest containing the show_id that contains the
 	 *               scene_id to remove.
 	 * @param   rep  Empty response gRPC type.
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id or scene_id is not found
 	 *               grpc::Status::FAILED_PRECONDITION if the scene is active
 	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status SceneRemove(ServerContext* ctx, const proto::SceneRemoveRequest* req, Empty* rep) override;
+	ServerUnaryReactor* SceneRemove(CallbackServerContext* ctx, const proto::SceneRemoveRequest* req, Empty* rep) override;
 
 	/**
 	 * Sets a given scene as active in a given show : the show switches to this
 	 * scene.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SceneSetAsCurrentRequest containing the show_id that
 	 *               contains the sceene, and scene_id of the scene to switch to.
-	 * @param   rep  the show state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @param   rep  the show state and the switch latency (see proto/studio.proto).
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id or scene_id is not found
 	 *               grpc::Status::INVALID_ARGUMENT if the scene is already active
 	 *               grpc::Status::INTERNAL if an exception occured or the scene transition failed
 	 */
-	Status SceneSetAsCurrent(ServerContext* ctx, const proto::SceneSetAsCurrentRequest* req, proto::SceneSetAsCurrentResponse* rep) override;
+	ServerUnaryReactor* SceneSetAsCurrent(CallbackServerContext* ctx, const proto::SceneSetAsCurrentRequest* req, proto::SceneSetAsCurrentResponse* rep) override;
 
 	/**
 	 * Returns the id of the currently active scene t othe gRPC caller.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SceneGetCurrentRequest containing the show_id
 	 * @param   rep  SceneGetCurrentResponse containing the active scene_id.
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id is not found
 	 *               grpc::Status::INTERNAL if an exception occured or the active scene is NULL
 	 */
-	Status SceneGetCurrent(ServerContext* ctx, const proto::SceneGetCurrentRequest* req, proto::SceneGetCurrentResponse* rep) override;
+	ServerUnaryReactor* SceneGetCurrent(CallbackServerContext* ctx, const proto::SceneGetCurrentRequest* req, proto::SceneGetCurrentResponse* rep) override;
+
+	/**
+	 * Preloads a scene: its sources are started and kept running while it is
+	 * not current, so that switching to it only runs the transition.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  ScenePreloadRequest containing the show_id that contains
+	 *               the scene, and the scene_id to preload.
+	 * @param   rep  the scene state (see proto/studio.proto).
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful or already preloaded
+	 *               grpc::Status::NOT_FOUND if show_id or scene_id is not found
+	 *               grpc::Status::INTERNAL if an exception occured or a source failed to start
+	 */
+	ServerUnaryReactor* ScenePreload(CallbackServerContext* ctx, const proto::ScenePreloadRequest* req, proto::ScenePreloadResponse* rep) override;
+
+	/**
+	 * Unloads a preloaded scene: its sources are stopped, unless it is the
+	 * current scene.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  SceneUnloadRequest containing the show_id that contains
+	 *               the scene, and the scene_id to unload.
+	 * @param   rep  empty.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful or not preloaded
+	 *               grpc::Status::NOT_FOUND if show_id or scene_id is not found
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* SceneUnload(CallbackServerContext* ctx, const proto::SceneUnloadRequest* req, Empty* rep) override;
 
 	// Source
 	/**
 	 * Returns the state of a given source to the gRPC caller.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SourceGetRequest containing the show_id, scene_id and source_id
 	 * @param   rep  the source state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id is not found in the show
 	 *               map or if scene_id is not found in show_id or if source_id
 	 *               is not found in scene_id
 	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status SourceGet(ServerContext* ctx, const proto::SourceGetRequest* req, proto::SourceGetResponse* rep) override;
+	ServerUnaryReactor* SourceGet(CallbackServerContext* ctx, const proto::SourceGetRequest* req, proto::SourceGetResponse* rep) override;
 
 	/**
 	 * Creates a new empty source and adds it to the source map of a given scene
 	 * in a given show.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SourceAddRequest containing the show_id and scene_id, with
 	 *               the new source_name, source_type, and source_url.
 	 * @param   rep  the source state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::INVALID_ARGUMENT if the source_type is not supported
 	 *               grpc::Status::NOT_FOUND if show_id is not found in the show
 	 *               map or if scene_id is not found in show_id
 	 *               grpc::Status::INTERNAL if an exception occured or failed to
 	 *               add source
 	 */
-	Status SourceAdd(ServerContext* ctx, const proto::SourceAddRequest* req, proto::SourceAddResponse* rep) override;
+	ServerUnaryReactor* SourceAdd(CallbackServerContext* ctx, const proto::SourceAddRequest* req, proto::SourceAddResponse* rep) override;
 
 	/**
 	 * Creates a new source from an existing one and adds it to the source map
 	 * of a given scene in a given show. It will have the same name, type and
 	 * url with a different id. The new source is not set as active not started.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SourceDuplicateRequest containing the show_id and scene_id
 	 *               where the source to duplicate is located, and its source_id.
 	 * @param   rep  the source state (see proto/studio.proto).
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id or scene_id is not found
 	 *               grpc::Status::INTERNAL if an exception occured or the
 	 *               original source is not found
 	 */
-	Status SourceDuplicate(ServerContext* ctx, const proto::SourceDuplicateRequest* req, proto::SourceDuplicateResponse* rep) override;
+	ServerUnaryReactor* SourceDuplicate(CallbackServerContext* ctx, const proto::SourceDuplicateRequest* req, proto::SourceDuplicateResponse* rep) override;
 
 	/**
 	 * Removes a given source from a given scene in a given show.
 	 *
-	 * @param   ctx  pointer to the gRPC server context.
+	 * @param   ctx  pointer to the gRPC callback server context.
 	 * @param   req  SourceRemoveRequest containing the show_id and scene_id
 	 *               that contain the source_id to remove.
 	 * @param   rep  Empty response gRPC type.
-	 * @return       grpc::Status::OK if successful
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
 	 *               grpc::Status::NOT_FOUND if show_id, scene_id or source_id is not found
 	 *               grpc::Status::FAILED_PRECONDITION if the source is active
 	 *               grpc::Status::INTERNAL if an exception occured
 	 */
-	Status SourceRemove(ServerContext* ctx, const proto::SourceRemoveRequest* req, Empty* rep) override;
+	ServerUnaryReactor* SourceRemove(CallbackServerContext* ctx, const proto::SourceRemoveRequest* req, Empty* rep) override;
 	
 	// TODO doc
-	Status SourceSetProperties(ServerContext* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep) override;
+	ServerUnaryReactor* SourceSetProperties(CallbackServerContext* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep) override;
+
+	// Batch
+	/**
+	 * Applies SceneAdd, SourceAdd and SourceSetProperties operations in order,
+	 * under one acquisition of mtx, and publishes one snapshot. If an
+	 * operation fails the previous ones are rolled back: the state, its
+	 * version and the event stream are as if the batch was never sent. The
+	 * events of a successful batch are published together.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  ApplyBatchRequest containing the operations, which may
+	 *               refer to the nodes added by the previous ones as "$<n>".
+	 * @param   rep  the ids of the added nodes and the studio version.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::INVALID_ARGUMENT if there are more than
+	 *               batch_max_operations operations or a reference is invalid
+	 *               the status of the failed operation otherwise, its
+	 *               message prefixed with its index
+	 */
+	ServerUnaryReactor* ApplyBatch(CallbackServerContext* ctx, const proto::ApplyBatchRequest* req, proto::ApplyBatchResponse* rep) override;
+
+	// Output
+	/**
+	 * Adds an output. All outputs share the studio encoders. The output is
+	 * started right away if the studio is started.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  OutputAddRequest containing the output name, type
+	 *               ("RTMP" or "File"), url (or file path), key and rendition
+	 *               (empty for the main video).
+	 * @param   rep  the output state (see proto/studio.proto).
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::INVALID_ARGUMENT if the type or rendition is unknown or the url is empty
+	 *               grpc::Status::INTERNAL if an exception occured or the output failed to start,
+	 *               in which case it is not added
+	 */
+	ServerUnaryReactor* OutputAdd(CallbackServerContext* ctx, const proto::OutputAddRequest* req, proto::OutputAddResponse* rep) override;
+
+	/**
+	 * Stops and removes an output.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  OutputRemoveRequest containing the output_id.
+	 * @param   rep  empty.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::NOT_FOUND if output_id is not found
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* OutputRemove(CallbackServerContext* ctx, const proto::OutputRemoveRequest* req, Empty* rep) override;
+
+	/**
+	 * Returns the state of each output, including its reconnect state.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  Empty request gRPC type.
+	 * @param   rep  OutputListResponse containing the outputs.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* OutputList(CallbackServerContext* ctx, const Empty* req, proto::OutputListResponse* rep) override;
+
+	/**
+	 * Returns the rendition ladder: the main video and each scaled rendition,
+	 * with the outputs using it, their byte and frame counters, the frames
+	 * skipped by the video output feeding its encoder, and the CPU time used
+	 * by the whole process.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  Empty request gRPC type.
+	 * @param   rep  RenditionListResponse containing the renditions.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* RenditionList(CallbackServerContext* ctx, const Empty* req, proto::RenditionListResponse* rep) override;
+
+	// Record
+	/**
+	 * Starts recording the program to files, from the packets already
+	 * encoded for the outputs: nothing is encoded again.
+	 *
+	 * @note the studio must be started, and only one recording runs at once.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  RecordStartRequest containing the directory, format,
+	 *               segment duration, number of segments kept and rendition.
+	 * @param   rep  the recording output state (see proto/studio.proto).
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::FAILED_PRECONDITION if the studio is not started, already recording
+	 *               or the previous recording is still stopping
+	 *               grpc::Status::INVALID_ARGUMENT if the directory, format, segment duration,
+	 *               number of segments or rendition is invalid
+	 *               grpc::Status::INTERNAL if an exception occured or the recording failed to start
+	 */
+	ServerUnaryReactor* RecordStart(CallbackServerContext* ctx, const proto::RecordStartRequest* req, proto::RecordStartResponse* rep) override;
+
+	/**
+	 * Stops the recording. The studio lock is not held while waiting for
+	 * the muxer to stop, but a new recording can't start until it did.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  Empty request gRPC type.
+	 * @param   rep  Empty response gRPC type.
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::FAILED_PRECONDITION if not recording
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* RecordStop(CallbackServerContext* ctx, const Empty* req, Empty* rep) override;
+
+	// Events
+	/**
+	 * Streams studio events (see proto/studio.proto) until the caller cancels.
+	 * Starts with a resync event holding the full state if from_sequence is 0
+	 * or too old to be resumed from. No thread is held while the stream waits
+	 * for events.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  WatchStudioRequest containing from_sequence.
+	 * @return       the StudioWatcher reactor writing the stream.
+	 */
+	grpc::ServerWriteReactor<proto::StudioEvent>* WatchStudio(CallbackServerContext* ctx, const proto::WatchStudioRequest* req) override;
 
 	// Misc
-	Status Health(ServerContext* ctx, const Empty* req, proto::HealthResponse* rep) override;
+	ServerUnaryReactor* Health(CallbackServerContext* ctx, const Empty* req, proto::HealthResponse* rep) override;
+
+	/**
+	 * Returns the libobs render and encode counters, the output and source
+	 * counters, and the RPC latency histograms. The same metrics are served
+	 * in the Prometheus text format on the metrics_port setting.
+	 *
+	 * @param   ctx  pointer to the gRPC callback server context.
+	 * @param   req  Empty request gRPC type.
+	 * @param   rep  MetricsResponse (see proto/studio.proto).
+	 * @return       the reactor, finished with:
+	 *               grpc::Status::OK if successful
+	 *               grpc::Status::INTERNAL if an exception occured
+	 */
+	ServerUnaryReactor* GetMetrics(CallbackServerContext* ctx, const Empty* req, proto::MetricsResponse* rep) override;
 
 private:
-	//Initializes obs: reset video and audio context, load modules libs, create RTMP output and encoders. Then starts the currently active show.
+	friend class StudioWatcher;
+	friend class SourceUpdateWaiter;
+
+	// RPC handlers, run inline or on the worker pool by the public methods.
+	Status handleStudioStart(ServerContextBase* ctx, const Empty* req, Empty* rep);
+	Status handleStudioStop(ServerContextBase* ctx, const Empty* req, Empty* rep);
+	Status handleShowGet(ServerContextBase* ctx, const proto::ShowGetRequest* req, proto::ShowGetResponse* rep);
+	Status handleShowCreate(ServerContextBase* ctx, const proto::ShowCreateRequest* req, proto::ShowCreateResponse* rep);
+	Status handleShowDuplicate(ServerContextBase* ctx, const proto::ShowDuplicateRequest* req, proto::ShowDuplicateResponse* rep);
+	Status handleShowRemove(ServerContextBase* ctx, const proto::ShowRemoveRequest* req, Empty* rep);
+	Status handleShowLoad(ServerContextBase* ctx, const proto::ShowLoadRequest* req, proto::ShowLoadResponse* rep);
+	Status handleShowLoadMany(ServerContextBase* ctx, const proto::ShowLoadManyRequest* req, proto::ShowLoadManyResponse* rep);
+	Status handleShowReload(ServerContextBase* ctx, const proto::ShowReloadRequest* req, proto::ShowReloadResponse* rep);
+	Status handleSceneGet(ServerContextBase* ctx, const proto::SceneGetRequest* req, proto::SceneGetResponse* rep);
+	Status handleSceneAdd(ServerContextBase* ctx, const proto::SceneAddRequest* req, proto::SceneAddResponse* rep);
+	Status handleSceneDuplicate(ServerContextBase* ctx, const proto::SceneDuplicateRequest* req, proto::SceneDuplicateResponse* rep);
+	Status handleSceneRemove(ServerContextBase* ctx, const proto::SceneRemoveRequest* req, Empty* rep);
+	Status handleSceneSetAsCurrent(ServerContextBase* ctx, const proto::SceneSetAsCurrentRequest* req, proto::SceneSetAsCurrentResponse* rep);
+	Status handleSceneGetCurrent(ServerContextBase* ctx, const proto::SceneGetCurrentRequest* req, proto::SceneGetCurrentResponse* rep);
+	Status handleScenePreload(ServerContextBase* ctx, const proto::ScenePreloadRequest* req, proto::ScenePreloadResponse* rep);
+	Status handleSceneUnload(ServerContextBase* ctx, const proto::SceneUnloadRequest* req, Empty* rep);
+	Status handleSourceGet(ServerContextBase* ctx, const proto::SourceGetRequest* req, proto::SourceGetResponse* rep);
+	Status handleSourceAdd(ServerContextBase* ctx, const proto::SourceAddRequest* req, proto::SourceAddResponse* rep);
+	Status handleSourceDuplicate(ServerContextBase* ctx, const proto::SourceDuplicateRequest* req, proto::SourceDuplicateResponse* rep);
+	Status handleSourceRemove(ServerContextBase* ctx, const proto::SourceRemoveRequest* req, Empty* rep);
+	// Sets pending and update_id when the new input of a started source must
+	// play before handleSourceUpdateDone commits the update.
+	Status handleSourceSetProperties(ServerContextBase* ctx, const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep, obs_source_t** pending, uint64_t* update_id);
+	Status handleSourceUpdateDone(const proto::SourceSetPropertiesRequest* req, proto::SourceSetPropertiesResponse* rep, uint64_t update_id, bool ready);
+	Status handleApplyBatch(ServerContextBase* ctx, const proto::ApplyBatchRequest* req, proto::ApplyBatchResponse* rep);
+	Status handleOutputAdd(ServerContextBase* ctx, const proto::OutputAddRequest* req, proto::OutputAddResponse* rep);
+	Status handleOutputRemove(ServerContextBase* ctx, const proto::OutputRemoveRequest* req, Empty* rep);
+	Status handleOutputList(ServerContextBase* ctx, const Empty* req, proto::OutputListResponse* rep);
+	Status handleRenditionList(ServerContextBase* ctx, const Empty* req, proto::RenditionListResponse* rep);
+	Status handleRecordStart(ServerContextBase* ctx, const proto::RecordStartRequest* req, proto::RecordStartResponse* rep);
+	Status handleRecordStop(ServerContextBase* ctx, const Empty* req, Empty* rep);
+	Status handleHealth(ServerContextBase* ctx, const Empty* req, proto::HealthResponse* rep);
+	Status handleGetMetrics(ServerContextBase* ctx, const Empty* req, proto::MetricsResponse* rep);
+	// Returns the id correlating the trace lines of a call: the
+	// REQUEST_ID_METADATA client metadata, or a generated one. It is sent
+	// back in the initial metadata.
+	string requestId(ServerContextBase* ctx);
+	// Runs a handler on the worker pool, or rejects the call if the pool queue
+	// is full.
+	template<typename Req, typename Rep>
+	ServerUnaryReactor* dispatch(CallbackServerContext* ctx, const Req* req, Rep* rep, Status (Studio::*handler)(ServerContextBase*, const Req*, Rep*));
+	// Like dispatch, for a task which finishes the reactor itself, possibly
+	// later.
+	ServerUnaryReactor* submit(CallbackServerContext* ctx, std::function<void(ServerUnaryReactor*)> task);
+	// Runs a non-blocking handler on the calling gRPC thread.
+	template<typename Req, typename Rep>
+	ServerUnaryReactor* runInline(CallbackServerContext* ctx, const Req* req, Rep* rep, Status (Studio::*handler)(ServerContextBase*, const Req*, Rep*));
+
+	// Starts the currently active show and attaches it to the encoders, then starts the outputs.
 	Status studioInit();
-	// Releases the obs output and encoders, stop the currently active show, stops obs.
+	// Stops the outputs and the recording, detaches and stops the currently active show.
 	Status studioRelease();
+	// Steps of EngineInit up to the default output. On failure, what it
+	// started is left for engineRelease.
+	Status engineStart();
+	// Deletes the outputs, releases the encoders created by EngineInit, stops
+	// obs. Also releases a partly initialized engine.
+	void engineRelease();
 	Show* getShow(string show_id);
+	// Finds a source of a show, NOT_FOUND if any is missing. Must be called
+	// with mtx held.
+	Status findSource(string show_id, string scene_id, string source_id, Scene** scene, Source** source);
+	// Fills proto_source and publishes SourcePropertiesChanged. Must be
+	// called with mtx held.
+	Status sourceChanged(string show_id, string scene_id, Source* source, proto::Source* proto_source);
+	// Operations of SceneAdd, SourceAdd and SourceSetProperties, shared with
+	// ApplyBatch. Must be called with mtx held.
+	Status addScene(const proto::SceneAddRequest& req, Scene** scene);
+	Status addSource(const proto::SourceAddRequest& req, Source** source);
+	Status validateSourceUpdate(const proto::SourceSetPropertiesRequest& req);
+	// Sets the fields of a source of a scene not started.
+	Status setSourceProperties(Source* source, const proto::SourceSetPropertiesRequest& req);
+	// Applies one operation of a batch, after resolving its "$<n>"
+	// references to the ids added by the previous ones, and appends how to
+	// undo it.
+	Status applyBatchOperation(const proto::BatchOperation& op, const vector<string>& ids, string* id, vector<function<void()>>* undo);
 	Show* addShow(string show_name);
-	Show* loadShow(string show_id);
+	// Creates a show from a spec read with show_cache. Must be called with
+	// mtx held.
+	Show* loadShow(string show_path, const ShowSpec& spec);
+	// Reloads the shows loaded from a changed file. Called by show_watcher,
+	// takes mtx.
+	void reloadShowFile(string show_path);
 	Show* duplicateShow(string show_id);
 	Status removeShow(string show_id);
+	Output* addOutput(string output_name, OutputType type, string url, string key, string rendition);
 	int loadModule(const char* binPath, const char* dataPath);
+	// Creates a video encoder for the current settings. An empty preset selects the default one.
+	obs_encoder_t* createVideoEncoder(string enc_name, int width, int height, int bitrate_kbps, string preset);
+	// Returns the video encoder of a rendition, enc_v for "main" or an empty name, NULL if unknown.
+	obs_encoder_t* videoEncoder(string rendition);
+	// Marks a show as changed, so the next publishSnapshot rebuilds it. Must
+	// be called with mtx held, before mutating the show.
+	void markDirty(string show_id);
+	// Publishes a new snapshot version if any show was marked dirty. Only the
+	// dirty shows are rebuilt. Must be called with mtx held.
+	void publishSnapshot();
+	// Returns the last published snapshot. Never blocks behind mtx.
+	shared_ptr<const StudioSnapshot> getSnapshot();
+	// Samples the libobs counters and fills a GetMetrics response. Does not
+	// need mtx: it only takes outputs_mtx, and the source registry and input
+	// watchdog locks.
+	void collectMetrics(proto::MetricsResponse* rep);
 
 
 	bool init;
+	// Set by EngineInit, obs stays initialized until the Studio is deleted.
+	// Atomic because collectMetrics reads it without mtx.
+	std::atomic<bool> engine_init;
+	// Set once obs_startup succeeded, even if a later EngineInit step failed.
+	bool obs_started;
 	ShowMap shows;
 	Show* active_show;
 
@@ -313,13 +716,58 @@ private:
 	struct obs_video_info ovi;
 	struct obs_audio_info oai;
 
-    obs_service_t*  service;
-	obs_output_t*   output;
+	// Outputs share enc_a and enc_v
+	OutputMap outputs;
+	// Guards outputs against collectMetrics, which runs without mtx. Writers
+	// hold mtx too, and take it only around the map changes: the lock order
+	// is mtx, then outputs_mtx.
+	std::mutex outputs_mtx;
+	// output_id_counter is incremented for each created output.
+	uint64_t output_id_counter;
+	// File output of RecordStart, NULL when not recording
+	Output* recording;
+	// Set while RecordStop stops the recording, without mtx
+	bool recording_stopping;
 	obs_encoder_t*  enc_a;
 	obs_encoder_t*  enc_v;
-	obs_data_t*     rtmp_settings;
 	obs_data_t*     enc_a_settings;
-	obs_data_t*     enc_v_settings;
-
-	std::mutex mtx;
+	// Scaled video encoders of the rendition ladder, by rendition name
+	map<string, obs_encoder_t*> rendition_encoders;
+
+	// Serializes mutating methods. The time waiting for it is reported as
+	// the lock_wait of the RPC metrics.
+	TimedMutex mtx;
+
+	// Deltas for WatchStudio, fed by Studio, Show and Scene mutations.
+	EventBus events;
+	// Reconnects the stalled inputs of source_registry, declared first so
+	// that it outlives it.
+	InputWatchdog input_watchdog;
+	// obs sources shared by the sources of all shows
+	SourceRegistry source_registry;
+	// Compiled show files, read without holding mtx.
+	ShowCache show_cache;
+	// Watches the files of the loaded shows if show_watch is set.
+	ShowWatcher show_watcher;
+
+	// Shows changed since the last published snapshot (protected by mtx).
+	set<string> dirty_shows;
+
+	// Last published snapshot. snapshot_mtx is only held to copy or swap the
+	// pointer, never while building the snapshot.
+	shared_ptr<const StudioSnapshot> snapshot;
+	std::shared_mutex snapshot_mtx;
+
+	// Runs the mutating handlers.
+	WorkerPool workers;
+	// Parses the files of the ShowLoadMany calls, shared by all of them so
+	// that concurrent calls do not add threads.
+	WorkerPool show_parsers;
+
+	// Numbers the request ids generated by requestId.
+	std::atomic<uint64_t> request_id_counter;
+
+	Metrics metrics;
+	// Prometheus endpoint, started by EngineInit if metrics_port is set.
+	MetricsHttpServer metrics_http;
 };
\ No newline at end of file
@@ -1,14 +1,14 @@
 #pragma once
 
-#include <libgen.h> // for basename(), not portable
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <cstring>
-
-#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-#define TRACE_CONTEXT (std::string(__FILENAME__) + ":" + std::to_string(__LINE__) + " " + std::string(__func__) + "()")
-#define ARRAY_LEN(a) ( sizeof(a)/sizeof((a)[0]) )
+#include <cstdio>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+#include "TraceLogger.hpp"
 
 ///////////////////////////////
 // Trace format              //
@@ -81,59 +81,279 @@ enum trace_colors {
 
 
 ///////////////////////////////
-// formatting helpers        //
+// Global variables          //
 ///////////////////////////////
 
-#define text_field(key, val) ("\x1b[37m"+ key + "=" ANSI_COLOR_RESET + val + "\x1b[37m" ANSI_COLOR_RESET)
-#define json_field(key, val) (std::string("\"") + key + std::string("\": \"") + val + std::string("\""))
+extern int gTraceLevel;
+extern int gTraceFormat;
+
 
-#define TO_STRING_STR(val) std::string(val)
-#define TO_STRING_CHAR(val) std::string(val)
-#define TO_STRING(val) std::to_string(val)
+///////////////////////////////
+// fields                    //
+///////////////////////////////
 
-#define format_field(key, val) ( \
-	(gTraceFormat == TRACE_FORMAT_TEXT) ? \
-		text_field(key, val) \
-	: (gTraceFormat == TRACE_FORMAT_JSON) ? \
-		json_field(key, val) \
-	: "" \
-)
+// A key=value pair of a trace line. The value is only viewed, or formatted in
+// place for numbers: building a field never allocates, and fields are only
+// built once the level check passed.
+struct TraceField {
+	std::string_view key;
+	std::string_view str;
+	char num[32];
+	size_t num_len = 0;
+	bool is_num = false;
+
+	TraceField(std::string_view k, std::string_view v) : key(k), str(v) {}
+	TraceField(std::string_view k, const char* v) : key(k), str(v ? v : "(null)") {}
+
+	// Numbers, booleans and enums, formatted like std::to_string()
+	template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> || std::is_enum_v<T>>>
+	TraceField(std::string_view k, T v) : key(k), is_num(true) {
+		if constexpr(std::is_enum_v<T>) {
+			num_len = std::to_chars(num, num + sizeof(num), (long long) v).ptr - num;
+		} else if constexpr(std::is_same_v<T, bool>) {
+			num[0] = v ? '1' : '0';
+			num_len = 1;
+		} else if constexpr(std::is_floating_point_v<T>) {
+			num_len = snprintf(num, sizeof(num), "%f", (double) v);
+			if(num_len >= sizeof(num)) {
+				num_len = sizeof(num) - 1;
+			}
+		} else {
+			num_len = std::to_chars(num, num + sizeof(num), v).ptr - num;
+		}
+	}
+
+	TraceField(const TraceField&) = delete;
+	TraceField& operator=(const TraceField&) = delete;
+
+	std::string_view Value() const {
+		return is_num ? std::string_view(num, num_len) : str;
+	}
+};
+
+///////////////////////////////
+// line buffer               //
+///////////////////////////////
+
+// Basename of a path, evaluated at compile time for __FILE__.
+constexpr const char* trace_basename(const char* path) {
+	const char* base = path;
+	for(const char* p = path; *p; p++) {
+		if(*p == '/') {
+			base = p + 1;
+		}
+	}
+	return base;
+}
+
+// Fixed-size line built on the stack by trace_write, truncated when full.
+struct TraceLine {
+	char buf[TRACE_LINE_MAX];
+	size_t len = 0;
+	// Appends stop at limit, and set truncated.
+	size_t limit = TRACE_LINE_MAX - 1;
+	bool truncated = false;
+
+	void append(const char* s, size_t n) {
+		if(n > limit - len) {
+			n = limit - len;
+			truncated = true;
+		}
+		memcpy(buf + len, s, n);
+		len += n;
+	}
+	void append(std::string_view s) { append(s.data(), s.size()); }
+	void append(int v) {
+		char tmp[16];
+		append(tmp, std::to_chars(tmp, tmp + sizeof(tmp), v).ptr - tmp);
+	}
+	// Appends s as the content of a JSON string. An escape sequence is never
+	// cut by the truncation.
+	void appendEscaped(std::string_view s) {
+		size_t start = 0;
+		for(size_t i = 0; i < s.size(); i++) {
+			unsigned char c = s[i];
+			if(c >= 0x20 && c != '"' && c != '\\') {
+				continue;
+			}
+			append(s.data() + start, i - start);
+			start = i + 1;
+
+			char esc[8];
+			size_t n = 2;
+			esc[0] = '\\';
+			switch(c) {
+				case '"':  esc[1] = '"'; break;
+				case '\\': esc[1] = '\\'; break;
+				case '\n': esc[1] = 'n'; break;
+				case '\r': esc[1] = 'r'; break;
+				case '\t': esc[1] = 't'; break;
+				default:
+					n = snprintf(esc, sizeof(esc), "\\u%04x", c);
+			}
+			if(n > limit - len) {
+				truncated = true;
+				return;
+			}
+			append(esc, n);
+		}
+		append(s.data() + start, s.size() - start);
+	}
+	// file:line func()
+	void appendContext(const char* file, int line, const char* func) {
+		append(file);
+		append(":", 1);
+		append(line);
+		append(" ", 1);
+		append(func);
+		append("()", 2);
+	}
+	void appendTextField(std::string_view key, std::string_view value) {
+		append("\x1b[37m");
+		append(key);
+		append("=" ANSI_COLOR_RESET);
+		append(value);
+		append("\x1b[37m" ANSI_COLOR_RESET " ");
+	}
+	void appendTextField(const TraceField& f) {
+		appendTextField(f.key, f.Value());
+	}
+	// Fields are appended whole: once one does not fit, it and the next ones
+	// are left out.
+	void appendJsonField(std::string_view key, std::string_view value) {
+		if(truncated) {
+			return;
+		}
+		size_t mark = len;
+		append(", \"", 3);
+		appendEscaped(key);
+		append("\": \"", 4);
+		appendEscaped(value);
+		append("\"", 1);
+		if(truncated) {
+			len = mark;
+		}
+	}
+	void appendJsonField(const TraceField& f) {
+		appendJsonField(f.key, f.Value());
+	}
+};
+
+///////////////////////////////
+// request id                //
+///////////////////////////////
+
+#define TRACE_REQUEST_ID_MAX 64
+
+// Id of the request handled by the calling thread, added to its trace lines
+// to correlate them. Empty outside of a TraceRequestScope.
+inline thread_local char trace_request_id[TRACE_REQUEST_ID_MAX] = "";
+inline thread_local size_t trace_request_id_len = 0;
+
+// Sets the request id of the calling thread until the end of the scope. The
+// calls made by the request handler on that thread (Show, Scene, Source)
+// trace it without it being passed around.
+class TraceRequestScope {
+public:
+	explicit TraceRequestScope(std::string_view id) {
+		memcpy(previous, trace_request_id, trace_request_id_len);
+		previous_len = trace_request_id_len;
+		set(id.data(), id.size());
+	}
+	~TraceRequestScope() {
+		set(previous, previous_len);
+	}
+	TraceRequestScope(const TraceRequestScope&) = delete;
+	TraceRequestScope& operator=(const TraceRequestScope&) = delete;
+
+	static std::string_view Current() {
+		return std::string_view(trace_request_id, trace_request_id_len);
+	}
+
+private:
+	static void set(const char* id, size_t len) {
+		if(len > TRACE_REQUEST_ID_MAX - 1) {
+			len = TRACE_REQUEST_ID_MAX - 1;
+		}
+		memcpy(trace_request_id, id, len);
+		trace_request_id[len] = 0;
+		trace_request_id_len = len;
+	}
+
+	char previous[TRACE_REQUEST_ID_MAX];
+	size_t previous_len;
+};
+
+// Added to a JSON line whose fields did not all fit in TRACE_LINE_MAX
+#define TRACE_JSON_TRUNCATED ", \"truncated\": \"1\""
+
+// Formats a line and queues it to the TraceLogger, whose thread writes it:
+// callers never wait for stdout. Only called by trace_print, once the level
+// check passed.
+template<typename... Fields>
+void trace_write(int level, int color, const char* file, int line, const char* func, std::string_view message, const Fields&... fields) {
+	TraceLine line_;
+	if(gTraceFormat == TRACE_FORMAT_TEXT) {
+		line_.append("\x1b[", 2);
+		line_.append(color);
+		line_.append("m", 1);
+		line_.appendContext(file, line, func);
+		line_.append(" ");
+		line_.append(trace_level_name[level]);
+		line_.append(ANSI_COLOR_RESET " ");
+		line_.append(message);
+		line_.append("\t", 1);
+		if(trace_request_id_len > 0) {
+			line_.appendTextField("request_id", TraceRequestScope::Current());
+		}
+		(line_.appendTextField(fields), ...);
+	} else if(gTraceFormat == TRACE_FORMAT_JSON) {
+		// Room for the end of the line, so that it stays valid JSON
+		line_.limit = TRACE_LINE_MAX - 1 - sizeof(TRACE_JSON_TRUNCATED " }");
+		line_.append("{ \"level\": \"");
+		line_.append(trace_level_name[level]);
+		line_.append("\", \"msg\": \"");
+		line_.limit--;
+		line_.appendEscaped(message);
+		line_.limit++;
+		line_.append("\"");
+		if(trace_request_id_len > 0) {
+			line_.appendJsonField("request_id", TraceRequestScope::Current());
+		}
+		if(level >= TRACE_LEVEL_ERROR) {
+			TraceLine context_;
+			context_.appendContext(file, line, func);
+			line_.appendJsonField("context", std::string_view(context_.buf, context_.len));
+		}
+		(line_.appendJsonField(fields), ...);
+		line_.limit = TRACE_LINE_MAX - 1;
+		if(line_.truncated) {
+			line_.append(TRACE_JSON_TRUNCATED);
+		}
+		line_.append(" }", 2);
+	} else {
+		printf("invalid or unset APP_TRACE_FORMAT\n");
+		return;
+	}
+	TraceLogger::Instance().Write(line_.buf, line_.len);
+}
 
 ///////////////////////////////
 // trace print (main macro)  //
 ///////////////////////////////
 
-#define trace_print(level, color, message, ...) {\
-	if(level >= gTraceLevel) {\
-		if(gTraceFormat == TRACE_FORMAT_TEXT) { \
-			std::string ar_[] = { __VA_ARGS__ }; \
-			std::stringstream ss; \
-			ss << "\x1b[" << std::to_string(color) << "m" \
-				<< TRACE_CONTEXT << " " << trace_level_name[level] \
-				<< ANSI_COLOR_RESET " " <<  message << "\t"; \
-			for(int i=0; i<ARRAY_LEN(ar_) ; ++i){ \
-				ss << ar_[i] << " "; \
-			} \
-			std::cout << ss.str() << std::endl; \
-		} else if(gTraceFormat == TRACE_FORMAT_JSON) { \
-			std::string ar_[] = { __VA_ARGS__ }; \
-			std::stringstream ss; \
-			ss << "\"level\": \"" << trace_level_name[level] << "\""; \
-			ss << ", \"msg\": \"" << message << "\""; \
-			if(level >= TRACE_LEVEL_ERROR) { \
-				ss << ", \"context\": \"" << TRACE_CONTEXT << "\""; \
-			} \
-			for(int i=0; i<ARRAY_LEN(ar_) ; ++i){ \
-				ss << ", " << ar_[i]; \
-			} \
-			std::cout << "{ " << ss.str() << " }" << std::endl; \
-		} else if(gTraceFormat == TRACE_FORMAT_NONE) {\
-				/* Disable all traces ! */ \
-		} else { \
-			printf("invalid or unset APP_TRACE_FORMAT\n"); \
+// Levels below APP_TRACE_LEVEL are discarded at compile time. Otherwise the
+// message and fields are only evaluated when the level is enabled at runtime
+// by gTraceLevel, and the format is not TRACE_FORMAT_NONE. The variadic
+// arguments are the message followed by the fields.
+#define trace_print(level, color, ...) do { \
+	if constexpr((level) >= APP_TRACE_LEVEL) { \
+		if((level) >= gTraceLevel && gTraceFormat != TRACE_FORMAT_NONE) { \
+			constexpr const char* trace_file_ = trace_basename(__FILE__); \
+			trace_write(level, color, trace_file_, __LINE__, __func__, __VA_ARGS__); \
 		} \
 	} \
-}
+} while(0)
 
 
 ///////////////////////////////
@@ -143,10 +363,10 @@ enum trace_colors {
 // Use field_(n)s for std::string, field_(n)c for char*,
 // field_(n)l for string litteral, and field(_n) for other types
 
-#define field_n(key, val)	format_field(TO_STRING_CHAR(key), TO_STRING(val))
-#define field_ns(key, val)	format_field(TO_STRING_CHAR(key), val)
-#define field_nc(key, val)	format_field(TO_STRING_CHAR(key), TO_STRING_CHAR(val))
-#define field_nl(key, val)	format_field(TO_STRING_CHAR(key), TO_STRING_STR(val))
+#define field_n(key, val)	TraceField(key, val)
+#define field_ns(key, val)	TraceField(key, std::string_view(val))
+#define field_nc(key, val)	TraceField(key, (const char*) (val))
+#define field_nl(key, val)	TraceField(key, std::string_view(val))
 
 #define field(val)			field_n(#val, val)
 #define field_s(val)		field_ns(#val, val)
@@ -159,16 +379,11 @@ enum trace_colors {
 // per-level macros          //
 ///////////////////////////////
 
-#define trace(msg, ...)			trace_print(TRACE_LEVEL_TRACE, LightYellow, msg, __VA_ARGS__)
-#define trace_debug(msg, ...)	trace_print(TRACE_LEVEL_DEBUG, Blue,        msg, __VA_ARGS__)
-#define trace_info(msg, ...)	trace_print(TRACE_LEVEL_INFO,  Green,       msg, __VA_ARGS__)
-#define trace_warn(msg, ...)	trace_print(TRACE_LEVEL_WARN,  Yellow,      msg, __VA_ARGS__)
-#define trace_error(msg, ...)	trace_print(TRACE_LEVEL_ERROR, Red,         msg, __VA_ARGS__)
+// trace(message, fields...)
+#define trace(...)			trace_print(TRACE_LEVEL_TRACE, LightYellow, __VA_ARGS__)
+#define trace_debug(...)	trace_print(TRACE_LEVEL_DEBUG, Blue,        __VA_ARGS__)
+#define trace_info(...)		trace_print(TRACE_LEVEL_INFO,  Green,       __VA_ARGS__)
+#define trace_warn(...)		trace_print(TRACE_LEVEL_WARN,  Yellow,      __VA_ARGS__)
+#define trace_error(...)	trace_print(TRACE_LEVEL_ERROR, Red,         __VA_ARGS__)
 
 
-///////////////////////////////
-// Global variables          //
-///////////////////////////////
-
-extern int gTraceLevel;
-extern int gTraceFormat;
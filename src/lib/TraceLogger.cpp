@@ -0,0 +1,223 @@
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "TraceLogger.hpp"
+
+// Idle time of the writer thread when the ring buffer is empty, only if it
+// can't be woken up (eventfd failed).
+static const std::chrono::milliseconds TRACE_IDLE_SLEEP(2);
+// Empty drains, each followed by a yield, before the writer sleeps.
+static const int TRACE_IDLE_SPINS = 100;
+// Size of the buffer the writer fills before each fwrite.
+static const size_t TRACE_BATCH_SIZE = 64 * 1024;
+// Set in enqueue_pos by Stop: no position can be claimed anymore.
+static const uint64_t TRACE_CLOSED = 1ULL << 63;
+
+TraceLogger& TraceLogger::Instance() {
+	static TraceLogger logger;
+	return logger;
+}
+
+TraceLogger::TraceLogger()
+	: slots(new Slot[TRACE_RING_SIZE])
+	, enqueue_pos(0)
+	, dequeue_pos(0)
+	, written_pos(0)
+	, reported_dropped(0)
+	, dropped(0)
+	, stopped(false)
+	, sleeping(false)
+	// Blocking: the writer sleeps in read
+	, wakeup_fd(eventfd(0, EFD_CLOEXEC)) {
+	for(uint64_t i = 0; i < TRACE_RING_SIZE; i++) {
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	writer = std::thread(&TraceLogger::run, this);
+}
+
+TraceLogger::~TraceLogger() {
+	Stop();
+	if(wakeup_fd >= 0) {
+		close(wakeup_fd);
+	}
+}
+
+void TraceLogger::Write(const char* line, size_t len) {
+	if(len > TRACE_LINE_MAX - 1) {
+		len = TRACE_LINE_MAX - 1;
+	}
+
+	// Bounded MPSC queue: a producer claims a position, fills its slot, then
+	// publishes it by advancing the slot sequence.
+	uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	Slot* slot;
+	while(true) {
+		if(pos & TRACE_CLOSED) {
+			// Stopped, Stop waits for the positions claimed before. One
+			// fwrite, so that concurrent lines do not interleave.
+			char text[TRACE_LINE_MAX];
+			memcpy(text, line, len);
+			text[len] = '\n';
+			fwrite(text, 1, len + 1, stdout);
+			fflush(stdout);
+			return;
+		}
+		slot = &slots[pos & (TRACE_RING_SIZE - 1)];
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		int64_t diff = (int64_t) sequence - (int64_t) pos;
+		if(diff == 0) {
+			if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if(diff < 0) {
+			// Full
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	memcpy(slot->text, line, len);
+	slot->text[len] = '\n';
+	slot->len = len + 1;
+	slot->sequence.store(pos + 1, std::memory_order_release);
+
+	// Pairs with the fence of run: either the writer sees the slot before
+	// sleeping, or this sees it sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(sleeping.load(std::memory_order_relaxed)) {
+		wakeup();
+	}
+}
+
+void TraceLogger::Flush() {
+	uint64_t end = enqueue_pos.load(std::memory_order_acquire) & ~TRACE_CLOSED;
+	wakeup();
+	while(written_pos.load(std::memory_order_acquire) < end && !stopped.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+}
+
+void TraceLogger::wakeup() {
+	// Only the first caller signals, until the writer sleeps again
+	if(wakeup_fd >= 0 && sleeping.exchange(false)) {
+		signal();
+	}
+}
+
+void TraceLogger::signal() {
+	uint64_t one = 1;
+	if(write(wakeup_fd, &one, sizeof(one)) != sizeof(one)) {
+		// Not traced, that would queue a line
+		fprintf(stderr, "trace: failed to wake the writer up\n");
+	}
+}
+
+void TraceLogger::Stop() {
+	if(stopped.exchange(true)) {
+		return;
+	}
+	if(wakeup_fd >= 0) {
+		signal();
+	}
+	if(writer.joinable()) {
+		writer.join();
+	}
+
+	// Lines queued since the last drain of the writer, including those whose
+	// producer claimed a slot but did not publish it yet
+	uint64_t end = enqueue_pos.fetch_or(TRACE_CLOSED) & ~TRACE_CLOSED;
+	while(true) {
+		drain();
+		if(dequeue_pos == end) {
+			break;
+		}
+		std::this_thread::yield();
+	}
+}
+
+bool TraceLogger::drain() {
+	char batch[TRACE_BATCH_SIZE];
+	size_t batch_len = 0;
+	bool written = false;
+
+	while(true) {
+		Slot* slot = &slots[dequeue_pos & (TRACE_RING_SIZE - 1)];
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		if(sequence != dequeue_pos + 1) {
+			// Empty, or the producer did not finish writing the slot yet
+			break;
+		}
+
+		if(batch_len + slot->len > sizeof(batch)) {
+			fwrite(batch, 1, batch_len, stdout);
+			batch_len = 0;
+		}
+		memcpy(batch + batch_len, slot->text, slot->len);
+		batch_len += slot->len;
+
+		slot->sequence.store(dequeue_pos + TRACE_RING_SIZE, std::memory_order_release);
+		dequeue_pos++;
+		written = true;
+	}
+
+	uint64_t dropped_now = dropped.load(std::memory_order_relaxed);
+	if(dropped_now != reported_dropped) {
+		char notice[64];
+		int len = snprintf(notice, sizeof(notice), "trace: %llu lines dropped\n", (unsigned long long) (dropped_now - reported_dropped));
+		if(batch_len + len > sizeof(batch)) {
+			fwrite(batch, 1, batch_len, stdout);
+			batch_len = 0;
+		}
+		memcpy(batch + batch_len, notice, len);
+		batch_len += len;
+		reported_dropped = dropped_now;
+		written = true;
+	}
+
+	if(batch_len > 0) {
+		fwrite(batch, 1, batch_len, stdout);
+	}
+	if(written) {
+		fflush(stdout);
+	}
+	written_pos.store(dequeue_pos, std::memory_order_release);
+	return written;
+}
+
+void TraceLogger::run() {
+	int idle = 0;
+	while(!stopped.load(std::memory_order_acquire)) {
+		if(drain()) {
+			idle = 0;
+			continue;
+		}
+		// During a burst the next line comes soon, and waking the writer up
+		// would cost its producer a syscall
+		if(idle < TRACE_IDLE_SPINS) {
+			idle++;
+			std::this_thread::yield();
+			continue;
+		}
+		idle = 0;
+		if(wakeup_fd < 0) {
+			std::this_thread::sleep_for(TRACE_IDLE_SLEEP);
+			continue;
+		}
+
+		// Sleeps until a producer publishes a line, checking the ring once
+		// more after telling them
+		sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!stopped.load(std::memory_order_acquire) && !drain()) {
+			uint64_t count;
+			if(read(wakeup_fd, &count, sizeof(count)) != sizeof(count)) {
+				std::this_thread::sleep_for(TRACE_IDLE_SLEEP);
+			}
+		}
+		sleeping.store(false, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/**
+ * @file
+ * @brief Asynchronous writer of the trace lines.
+ *
+ * trace_write formats each line on the stack and copies it into a fixed-size
+ * slot of a lock-free ring buffer; a background thread writes the lines to
+ * stdout in batches, and sleeps on an eventfd while the buffer is empty. A caller (gRPC handler, libobs callback) therefore never
+ * blocks on stdout nor allocates for the line itself. When the buffer is full
+ * the line is dropped and counted, the writer reports the count.
+ *
+ */
+
+// Maximum length of a trace line, longer lines are truncated.
+#define TRACE_LINE_MAX 1024
+// Number of lines the ring buffer holds, must be a power of 2.
+#define TRACE_RING_SIZE 2048
+
+class TraceLogger {
+public:
+	// Returns the process-wide logger, started on first use.
+	static TraceLogger& Instance();
+
+	/**
+	 * Queues a line, without blocking. Once the logger is stopped, the line is
+	 * written synchronously instead.
+	 *
+	 * @param   line  the line, without trailing newline.
+	 * @param   len   its length, truncated to TRACE_LINE_MAX - 1.
+	 */
+	void Write(const char* line, size_t len);
+
+	// Stops the writer thread, then writes the queued lines, waiting for the
+	// producers still filling their slot.
+	void Stop();
+
+	// Waits until the lines queued before the call are written.
+	void Flush();
+
+	// Number of lines dropped because the ring buffer was full.
+	uint64_t Dropped() { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	TraceLogger();
+	~TraceLogger();
+
+	// Writes the queued lines, returns false if there were none.
+	bool drain();
+	void run();
+	// Wakes the writer up if it sleeps.
+	void wakeup();
+	void signal();
+
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		uint32_t len;
+		char text[TRACE_LINE_MAX];
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	// Written by the producers, and closed by Stop with TRACE_CLOSED
+	alignas(64) std::atomic<uint64_t> enqueue_pos;
+	// Only used by the writer thread
+	alignas(64) uint64_t dequeue_pos;
+	// dequeue_pos after the last fwrite, for Flush
+	std::atomic<uint64_t> written_pos;
+	uint64_t reported_dropped;
+	std::atomic<uint64_t> dropped;
+	std::atomic<bool> stopped;
+	// Set by the writer before it sleeps on wakeup_fd, and cleared by the
+	// producer that wakes it up, so that an idle writer costs no wakeup and
+	// a busy one no syscall
+	alignas(64) std::atomic<bool> sleeping;
+	int wakeup_fd;
+	std::thread writer;
+};
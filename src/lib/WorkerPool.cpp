@@ -0,0 +1,63 @@
+#include "WorkerPool.hpp"
+
+WorkerPool::WorkerPool(size_t thread_count, size_t max_queued)
+	: max_queued(max_queued)
+	, stopped(false) {
+	for(size_t i = 0; i < thread_count; i++) {
+		threads.emplace_back(&WorkerPool::run, this);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	Stop();
+}
+
+bool WorkerPool::Submit(std::function<void()> task) {
+	std::unique_lock<std::mutex> lock(mtx);
+	if(stopped || tasks.size() >= max_queued) {
+		return false;
+	}
+	tasks.push_back(std::move(task));
+	lock.unlock();
+
+	cv.notify_one();
+	return true;
+}
+
+void WorkerPool::Stop() {
+	std::unique_lock<std::mutex> lock(mtx);
+	if(stopped) {
+		return;
+	}
+	stopped = true;
+	lock.unlock();
+
+	cv.notify_all();
+	for(std::thread& thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+}
+
+size_t WorkerPool::QueueDepth() {
+	std::unique_lock<std::mutex> lock(mtx);
+	return tasks.size();
+}
+
+void WorkerPool::run() {
+	while(true) {
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [this] { return stopped || !tasks.empty(); });
+
+		// Queued tasks still run after Stop, so that each one completes.
+		if(tasks.empty()) {
+			return;
+		}
+
+		std::function<void()> task = std::move(tasks.front());
+		tasks.pop_front();
+		lock.unlock();
+
+		task();
+	}
+}
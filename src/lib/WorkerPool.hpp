@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @file
+ * @brief Fixed-size thread pool with a bounded task queue.
+ *
+ * Used by the Studio service to run blocking handlers outside of the gRPC
+ * callback threads. Submit never blocks: when the queue is full the task is
+ * rejected, so that the caller can push back on its client.
+ *
+ */
+
+class WorkerPool {
+public:
+	/**
+	 * WorkerPool constructor. Starts the threads.
+	 *
+	 * @param   thread_count  number of worker threads.
+	 * @param   max_queued    maximum number of tasks waiting for a thread.
+	 */
+	WorkerPool(size_t thread_count, size_t max_queued);
+
+	/**
+	 * WorkerPool destructor. Calls Stop.
+	 */
+	~WorkerPool();
+
+	/**
+	 * Queues a task.
+	 *
+	 * @param   task  the task to run on a worker thread.
+	 * @return        false if the queue is full or the pool is stopped.
+	 */
+	bool Submit(std::function<void()> task);
+
+	/**
+	 * Rejects new tasks, runs the queued ones and joins the threads.
+	 */
+	void Stop();
+
+	// Number of tasks waiting for a thread.
+	size_t QueueDepth();
+
+private:
+	void run();
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<std::function<void()>> tasks;
+	std::vector<std::thread> threads;
+	size_t max_queued;
+	bool stopped;
+};
@@ -1,6 +1,8 @@
+#include <chrono>
 #include <csignal>
+#ifdef ENABLE_QT
 #include <QApplication>
-#include <QPushButton>
+#endif
 #include "lib/Studio.hpp"
 #include "lib/Trace.hpp"
 #include "lib/Settings.hpp"
@@ -8,15 +10,25 @@
 using namespace std;
 
 unique_ptr<Server> server = nullptr;
+Metrics* metrics = nullptr;
+std::chrono::steady_clock::time_point process_start;
 
-// TODO Will be overriden by settings
+// Overriden by the trace_level and trace_format settings
 int gTraceLevel = TRACE_LEVEL_TRACE;
 int gTraceFormat = TRACE_FORMAT_TEXT;
 
 void intHandler(int dummy) {
 	if(server != nullptr) {
 		trace_info("Stopping the server");
-		server->Shutdown();
+		// Streaming calls (WatchStudio) are cancelled after the deadline
+		server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+	}
+}
+
+// Traces the RPC metrics, on the Metrics dump thread
+void usr1Handler(int dummy) {
+	if(metrics != nullptr) {
+		metrics->RequestDump();
 	}
 }
 
@@ -24,30 +36,54 @@ void RunServer(Settings* settings) {
 	string server_address("0.0.0.0:50051"); // TODO
 	Studio service(settings);
 
+	// obs is initialized once, StudioStart/StudioStop only attach outputs
+	Status s = service.EngineInit();
+	if(!s.ok()) {
+		throw string("Engine initialization failed: "+ s.error_message());
+	}
+
 	ServerBuilder builder;
 	// Listen on the given address without any authentication mechanism.
 	builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
 	// Register "service" as the instance through which we'll communicate with
-	// clients. In this case it corresponds to an *synchronous* service.
+	// clients. In this case it corresponds to a *callback* service, whose
+	// mutating handlers run on the Studio worker pool.
 	builder.RegisterService(&service);
+	// Time every call into the GetMetrics latency histograms.
+	std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> interceptors;
+	interceptors.push_back(std::make_unique<MetricsInterceptorFactory>(service.RpcMetrics()));
+	builder.experimental().SetInterceptorCreators(std::move(interceptors));
 	// Finally assemble the server.
 	server = builder.BuildAndStart();
-	trace_info("gRPC Server listening", field_s(server_address));
+	metrics = service.RpcMetrics();
+	trace_info("gRPC Server listening", field_s(server_address),
+		field_n("startup_ms", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - process_start).count()));
 
 	// Wait for the server to shutdown. Note that some other thread must be
 	// responsible for shutting down the server for this call to ever return.
 	server->Wait();
+	metrics = nullptr;
 }
 
 int main(int argc, char *argv[]) {
 	bool ret;
 	char* end;
 
-	QApplication app(argc, argv);
+	process_start = std::chrono::steady_clock::now();
 	signal(SIGINT, intHandler);
+	signal(SIGUSR1, usr1Handler);
 
 	try {
         Settings settings = LoadConfig(OBS_HEADLESS_PATH "/etc/config.txt");
+        gTraceLevel = settings.trace_level;
+        gTraceFormat = settings.trace_format;
+#ifdef ENABLE_QT
+		// Only provides the X display to libobs, its event loop never runs
+		unique_ptr<QApplication> app;
+		if(settings.display_backend == "qt") {
+			app = make_unique<QApplication>(argc, argv);
+		}
+#endif
 		RunServer(&settings);
 	}
     catch(const exception& e) {